@@ -4,6 +4,9 @@
 #include <cstring>
 
 #include "esp_log.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "it8951.h"
 
 extern "C" void app_main(void) {
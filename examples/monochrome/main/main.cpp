@@ -4,7 +4,11 @@
 #include <cstring>
 
 #include "esp_log.h"
+#include "esp_system.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "it8951.h"
+#include "it8951_ghost.h"
 
 static const char* TAG = "main";
 
@@ -26,12 +30,15 @@ extern "C" void app_main(void) {
         esp_restart();
     }
 
-    while (true) {
-        // Clear the screen of any residual image. This is done every few updates
-        // and removes the after image on the screen.
+    // Clear the screen of any residual image. After this, the ghosting tracker
+    // removes the after image of the A2 updates by refreshing the parts of the
+    // screen that have been updated too often.
+
+    display.clear_screen();
 
-        display.clear_screen();
+    IT8951GhostTracker tracker(display, display.get_memory_address(), IT8951_PIXEL_FORMAT_1BPP);
 
+    while (true) {
         // Show bars moving across the screen.
 
         const int bars = 16;
@@ -92,6 +99,7 @@ extern "C" void app_main(void) {
             display.load_image_end();
 
             display.display_area(area, display.get_memory_address(), IT8951_PIXEL_FORMAT_1BPP, IT8951_DISPLAY_MODE_A2);
+            tracker.record(area, IT8951_DISPLAY_MODE_A2);
 
             // Wait a bit before showing the next bar.
 
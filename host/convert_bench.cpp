@@ -0,0 +1,201 @@
+// Checks the pixel format conversion kernels against a straightforward
+// implementation and reports their throughput in MB/s of gray scale input.
+// Also reports the throughput of the dithering methods, and how far the
+// average gray value of a dithered gradient is off.
+//
+// Usage: convert_bench [iterations]
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "it8951_convert.h"
+#include "it8951_dither.h"
+
+static const int WIDTH = 1872;
+static const int HEIGHT = 1404;
+
+static size_t convert_reference(int bpp, const uint8_t* curve, const uint8_t* src, uint8_t* dst, size_t pixels) {
+    const size_t pixels_per_byte = 8 / bpp;
+    const size_t bytes = (pixels + pixels_per_byte - 1) / pixels_per_byte;
+
+    memset(dst, 0xff, bytes);
+
+    for (size_t i = 0; i < pixels; i++) {
+        const auto level = (curve ? curve[src[i]] : src[i]) >> (8 - bpp);
+        const auto shift = 8 - bpp * (i % pixels_per_byte + 1);
+        auto& value = dst[i / pixels_per_byte];
+
+        value = (value & ~(((1 << bpp) - 1) << shift)) | level << shift;
+    }
+
+    return bytes;
+}
+
+static bool check(IT8951Converter& converter, int bpp, const uint8_t* curve, std::mt19937& random) {
+    std::vector<uint8_t> src(300);
+    std::vector<uint8_t> expected(src.size());
+    std::vector<uint8_t> actual(src.size());
+
+    for (size_t pixels = 0; pixels < src.size(); pixels++) {
+        for (auto& value : src) {
+            value = random();
+        }
+
+        const auto expected_len = convert_reference(bpp, curve, src.data(), expected.data(), pixels);
+        const auto actual_len = converter.convert(src.data(), actual.data(), pixels);
+
+        if (expected_len != actual_len || memcmp(expected.data(), actual.data(), expected_len)) {
+            fprintf(stderr, "%d bpp conversion of %zu pixels differs\n", bpp, pixels);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char** argv) {
+    const int iterations = argc > 1 ? atoi(argv[1]) : 20;
+
+    const struct {
+        const char* name;
+        it8951_pixel_format_t pixel_format;
+        int bpp;
+    } formats[] = {
+        {"1bpp", IT8951_PIXEL_FORMAT_1BPP, 1},
+        {"2bpp", IT8951_PIXEL_FORMAT_2BPP, 2},
+        {"4bpp", IT8951_PIXEL_FORMAT_4BPP, 4},
+        {"8bpp", IT8951_PIXEL_FORMAT_8BPP, 8},
+    };
+
+    std::mt19937 random(1);
+    std::vector<uint8_t> gray(WIDTH * HEIGHT);
+    std::vector<uint8_t> packed(WIDTH * HEIGHT);
+
+    for (auto& value : gray) {
+        value = random();
+    }
+
+    printf("%-6s %-10s %12s %12s\n", "format", "curve", "MB/s", "reference");
+
+    for (const auto& format : formats) {
+        for (int mode = 0; mode < 3; mode++) {
+            IT8951Converter converter(format.pixel_format);
+            const char* curve_name = "none";
+            uint8_t curve[256];
+
+            if (mode == 1) {
+                converter.set_threshold(0x60);
+                curve_name = "threshold";
+
+                for (int i = 0; i < 256; i++) {
+                    curve[i] = i >= 0x60 ? 0xff : 0x00;
+                }
+            } else if (mode == 2) {
+                converter.set_gamma(0.8f);
+                curve_name = "gamma";
+
+                for (int i = 0; i < 256; i++) {
+                    curve[i] = uint8_t(std::lround(255.0f * std::pow(i / 255.0f, 0.8f)));
+                }
+            }
+
+            if (!check(converter, format.bpp, mode ? curve : nullptr, random)) {
+                return 1;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+
+            for (int i = 0; i < iterations; i++) {
+                for (int y = 0; y < HEIGHT; y++) {
+                    converter.convert(gray.data() + y * WIDTH, packed.data() + y * WIDTH, WIDTH);
+                }
+            }
+
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            start = std::chrono::steady_clock::now();
+
+            for (int i = 0; i < iterations; i++) {
+                for (int y = 0; y < HEIGHT; y++) {
+                    convert_reference(format.bpp, mode ? curve : nullptr, gray.data() + y * WIDTH,
+                                      packed.data() + y * WIDTH, WIDTH);
+                }
+            }
+
+            const std::chrono::duration<double> reference = std::chrono::steady_clock::now() - start;
+            const double megabytes = double(WIDTH) * HEIGHT * iterations / 1e6;
+
+            printf("%-6s %-10s %12.1f %12.1f\n", format.name, curve_name, megabytes / elapsed.count(),
+                   megabytes / reference.count());
+        }
+    }
+
+    // Dithering of a horizontal gradient. The average of the levels in a
+    // column should be close to the gray value of the column.
+
+    for (int x = 0; x < WIDTH; x++) {
+        for (int y = 0; y < HEIGHT; y++) {
+            gray[y * WIDTH + x] = x * 255 / (WIDTH - 1);
+        }
+    }
+
+    const struct {
+        const char* name;
+        it8951_dither_t method;
+    } methods[] = {
+        {"none", IT8951_DITHER_NONE},
+        {"floyd", IT8951_DITHER_FLOYD_STEINBERG},
+        {"atkinson", IT8951_DITHER_ATKINSON},
+        {"bayer", IT8951_DITHER_BAYER},
+    };
+
+    printf("\n%-6s %-10s %12s %12s\n", "format", "dither", "Mpixel/s", "gray error");
+
+    for (const auto& format : formats) {
+        for (const auto& method : methods) {
+            IT8951Ditherer ditherer(format.pixel_format, method.method, WIDTH);
+            std::vector<uint32_t> sums(WIDTH);
+            const int levels = format.bpp == 1 ? 2 : format.bpp == 2 ? 4 : 16;
+
+            auto start = std::chrono::steady_clock::now();
+
+            for (int i = 0; i < iterations; i++) {
+                ditherer.reset();
+
+                for (int y = 0; y < HEIGHT; y++) {
+                    const auto row = packed.data() + y * WIDTH;
+
+                    ditherer.dither_row(gray.data() + y * WIDTH, row);
+
+                    if (i == 0) {
+                        for (int x = 0; x < WIDTH; x++) {
+                            const int pixels_per_byte = 8 / format.bpp;
+                            const auto shift = 8 - format.bpp * (x % pixels_per_byte + 1);
+                            const auto level = row[x / pixels_per_byte] >> shift & ((1 << format.bpp) - 1);
+
+                            sums[x] += (level >> (format.bpp - (format.bpp == 8 ? 4 : format.bpp))) * 255 /
+                                       (levels - 1);
+                        }
+                    }
+                }
+            }
+
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            double error = 0;
+
+            for (int x = 0; x < WIDTH; x++) {
+                error += std::abs(double(sums[x]) / HEIGHT - x * 255 / (WIDTH - 1));
+            }
+
+            printf("%-6s %-10s %12.1f %12.2f\n", format.name, method.name,
+                   double(WIDTH) * HEIGHT * iterations / 1e6 / elapsed.count(), error / WIDTH);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,525 @@
+// Checks the streaming PGM, PBM and PNG decoders against the images they
+// were generated from, and reports their throughput and the heap they use,
+// compared to decoding the image into a buffer as a whole. Each image is
+// also decoded into the emulator, cropped to the panel.
+//
+// Usage: decode_bench [iterations] [image.png|image.pgm|image.pbm ...]
+//
+// Files given on the command line are decoded and their timings reported;
+// there's nothing to check them against.
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "it8951.h"
+#include "it8951_convert.h"
+#include "it8951_decode.h"
+#include "it8951_emulator.h"
+
+// Counts the heap in use, to find the peak use of the decoders.
+
+static size_t heap_used = 0;
+static size_t heap_peak = 0;
+
+void* operator new(size_t size) {
+    auto block = (size_t*)malloc(size + sizeof(max_align_t));
+
+    if (!block) {
+        throw std::bad_alloc();
+    }
+
+    block[0] = size;
+    heap_used += size;
+    heap_peak = std::max(heap_peak, heap_used);
+
+    return (uint8_t*)block + sizeof(max_align_t);
+}
+
+void operator delete(void* data) noexcept {
+    if (data) {
+        auto block = (size_t*)((uint8_t*)data - sizeof(max_align_t));
+
+        heap_used -= block[0];
+        free(block);
+    }
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void* data) noexcept { operator delete(data); }
+void operator delete(void* data, size_t) noexcept { operator delete(data); }
+void operator delete[](void* data, size_t) noexcept { operator delete(data); }
+
+struct MemoryFile {
+    const uint8_t* data;
+    size_t size;
+    size_t pos;
+};
+
+static size_t read_memory(uint8_t* data, size_t len, void* user_data) {
+    auto& file = *(MemoryFile*)user_data;
+    const auto count = std::min(len, file.size - file.pos);
+
+    memcpy(data, file.data + file.pos, count);
+    file.pos += count;
+
+    return count;
+}
+
+enum class Format {
+    PGM,
+    PBM,
+    PNG_GRAY,
+    PNG_GRAY_1,
+    PNG_GRAY_16,
+    PNG_PALETTE_4,
+    PNG_RGB,
+    PNG_RGBA,
+};
+
+struct TestImage {
+    const char* name;
+    Format format;
+};
+
+static const TestImage TEST_IMAGES[] = {
+    {"PGM 8 bit", Format::PGM},
+    {"PBM", Format::PBM},
+    {"PNG gray 8 bit", Format::PNG_GRAY},
+    {"PNG gray 1 bit", Format::PNG_GRAY_1},
+    {"PNG gray 16 bit", Format::PNG_GRAY_16},
+    {"PNG palette 4 bit", Format::PNG_PALETTE_4},
+    {"PNG RGB", Format::PNG_RGB},
+    {"PNG RGBA", Format::PNG_RGBA},
+};
+
+static uint8_t get_test_gray(int x, int y, int w, int h) {
+    // A gradient with blocks of noise, somewhere between a photo and text.
+
+    const auto hash = (uint32_t(x) * 374761393u + uint32_t(y) * 668265263u) * 2246822519u >> 24;
+
+    if ((x / 64 + y / 32) % 3 == 0 && hash < 96) {
+        return hash;
+    }
+
+    return (x + y) * 255 / (w + h);
+}
+
+// The gray values the decoders are expected to return for a pixel.
+static uint8_t get_expected_gray(Format format, uint8_t gray) {
+    switch (format) {
+        case Format::PBM:
+        case Format::PNG_GRAY_1:
+            return gray < 128 ? 0x00 : 0xff;
+        case Format::PNG_PALETTE_4:
+            return (gray >> 4) * 17;
+        default:
+            return gray;
+    }
+}
+
+static void append_be32(std::vector<uint8_t>& file, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        file.push_back(value >> shift);
+    }
+}
+
+static void append_png_chunk(std::vector<uint8_t>& file, const char* type, const std::vector<uint8_t>& data) {
+    append_be32(file, data.size());
+
+    const auto start = file.size();
+
+    file.insert(file.end(), type, type + 4);
+    file.insert(file.end(), data.begin(), data.end());
+    append_be32(file, crc32(0, file.data() + start, file.size() - start));
+}
+
+static uint8_t paeth(int a, int b, int c) {
+    const auto pa = abs(b - c);
+    const auto pb = abs(a - c);
+    const auto pc = abs(a + b - 2 * c);
+
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+static std::vector<uint8_t> encode_png(Format format, int w, int h) {
+    int depth = 8;
+    int color_type = 0;
+    int channels = 1;
+
+    switch (format) {
+        case Format::PNG_GRAY_1:
+            depth = 1;
+            break;
+        case Format::PNG_GRAY_16:
+            depth = 16;
+            break;
+        case Format::PNG_PALETTE_4:
+            depth = 4;
+            color_type = 3;
+            break;
+        case Format::PNG_RGB:
+            color_type = 2;
+            channels = 3;
+            break;
+        case Format::PNG_RGBA:
+            color_type = 6;
+            channels = 4;
+            break;
+        default:
+            break;
+    }
+
+    const size_t row_len = (size_t(w) * depth * channels + 7) / 8;
+    const size_t pixel_len = std::max(1, depth * channels / 8);
+    std::vector<uint8_t> raw;
+    std::vector<uint8_t> row(row_len);
+    std::vector<uint8_t> previous(row_len);
+
+    for (int y = 0; y < h; y++) {
+        std::fill(row.begin(), row.end(), 0);
+
+        for (int x = 0; x < w; x++) {
+            const auto gray = get_test_gray(x, y, w, h);
+
+            switch (format) {
+                case Format::PNG_GRAY_1:
+                    row[x / 8] |= (gray >= 128) << (7 - x % 8);
+                    break;
+                case Format::PNG_PALETTE_4:
+                    row[x / 2] |= (gray >> 4) << (x % 2 ? 0 : 4);
+                    break;
+                case Format::PNG_GRAY_16:
+                    row[x * 2] = gray;
+                    row[x * 2 + 1] = gray;
+                    break;
+                default:
+                    for (int i = 0; i < channels; i++) {
+                        row[x * channels + i] = i == 3 ? 0xff : gray;
+                    }
+                    break;
+            }
+        }
+
+        // Every filter type is used, like encoders that pick one per row.
+
+        const uint8_t filter = y % 5;
+
+        raw.push_back(filter);
+
+        for (size_t i = 0; i < row_len; i++) {
+            const int a = i >= pixel_len ? row[i - pixel_len] : 0;
+            const int b = previous[i];
+            const int c = i >= pixel_len ? previous[i - pixel_len] : 0;
+            const uint8_t predictions[] = {0, uint8_t(a), uint8_t(b), uint8_t((a + b) / 2), paeth(a, b, c)};
+
+            raw.push_back(row[i] - predictions[filter]);
+        }
+
+        std::swap(row, previous);
+    }
+
+    std::vector<uint8_t> file = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    std::vector<uint8_t> header;
+
+    append_be32(header, w);
+    append_be32(header, h);
+    header.insert(header.end(), {uint8_t(depth), uint8_t(color_type), 0, 0, 0});
+    append_png_chunk(file, "IHDR", header);
+
+    if (format == Format::PNG_PALETTE_4) {
+        std::vector<uint8_t> palette;
+
+        for (int i = 0; i < 16; i++) {
+            palette.insert(palette.end(), 3, i * 17);
+        }
+
+        append_png_chunk(file, "PLTE", palette);
+    }
+
+    // The image data is split into chunks of 64 KB, like most encoders do.
+
+    auto compressed_len = compressBound(raw.size());
+    std::vector<uint8_t> compressed(compressed_len);
+
+    compress2(compressed.data(), &compressed_len, raw.data(), raw.size(), 6);
+
+    for (size_t offset = 0; offset < compressed_len; offset += 65536) {
+        const auto end = std::min<size_t>(compressed_len, offset + 65536);
+
+        append_png_chunk(file, "IDAT", std::vector<uint8_t>(compressed.begin() + offset, compressed.begin() + end));
+    }
+
+    append_png_chunk(file, "IEND", {});
+
+    return file;
+}
+
+static std::vector<uint8_t> encode_image(Format format, int w, int h) {
+    if (format != Format::PGM && format != Format::PBM) {
+        return encode_png(format, w, h);
+    }
+
+    const auto header = std::string(format == Format::PGM ? "P5" : "P4") + "\n# decode_bench\n" +
+                        std::to_string(w) + " " + std::to_string(h) + (format == Format::PGM ? "\n255\n" : "\n");
+    std::vector<uint8_t> file(header.begin(), header.end());
+
+    for (int y = 0; y < h; y++) {
+        if (format == Format::PGM) {
+            for (int x = 0; x < w; x++) {
+                file.push_back(get_test_gray(x, y, w, h));
+            }
+        } else {
+            for (int x = 0; x < w; x += 8) {
+                uint8_t bits = 0;
+
+                for (int i = 0; i < 8 && x + i < w; i++) {
+                    bits |= (get_test_gray(x + i, y, w, h) < 128) << (7 - i);
+                }
+
+                file.push_back(bits);
+            }
+        }
+    }
+
+    return file;
+}
+
+static IT8951ImageDecoder* create_decoder(const std::vector<uint8_t>& file, MemoryFile& memory_file) {
+    memory_file = {.data = file.data(), .size = file.size(), .pos = 0};
+
+    if (file.size() >= 8 && file[0] == 0x89 && file[1] == 'P') {
+        return new IT8951PngDecoder(read_memory, &memory_file);
+    }
+
+    return new IT8951PnmDecoder(read_memory, &memory_file);
+}
+
+struct DecodeResult {
+    bool started;
+    double ms;
+    size_t heap;
+    size_t mismatches;
+};
+
+static DecodeResult decode(const std::vector<uint8_t>& file, const TestImage* test_image, int iterations) {
+    DecodeResult result = {};
+
+    for (int i = 0; i < iterations; i++) {
+        MemoryFile memory_file;
+
+        const auto heap_before = heap_used;
+
+        heap_peak = heap_used;
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto decoder = create_decoder(file, memory_file);
+
+        if (!decoder->start()) {
+            delete decoder;
+            return result;
+        }
+
+        const auto w = decoder->get_width();
+        const auto h = decoder->get_height();
+
+        for (int y = 0; y < h; y++) {
+            const auto row = decoder->read_row();
+
+            if (!row) {
+                result.mismatches += w;
+                continue;
+            }
+
+            for (int x = 0; test_image && !i && x < w; x++) {
+                result.mismatches += row[x] != get_expected_gray(test_image->format, get_test_gray(x, y, w, h));
+            }
+        }
+
+        const auto end = std::chrono::steady_clock::now();
+
+        result.started = true;
+        result.ms += std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+        result.heap = heap_peak - heap_before;
+
+        delete decoder;
+    }
+
+    return result;
+}
+
+static void load(IT8951Emulator& emulator, IT8951& display, const std::vector<uint8_t>& file,
+                 const TestImage* test_image) {
+    // Cropped to the panel, converted to 4 bpp while it's being decoded.
+
+    MemoryFile memory_file;
+    IT8951Converter converter(IT8951_PIXEL_FORMAT_4BPP);
+
+    heap_peak = heap_used;
+
+    const auto heap_before = heap_used;
+    const auto decoder = create_decoder(file, memory_file);
+
+    if (!decoder->start()) {
+        delete decoder;
+        return;
+    }
+
+    const auto w = decoder->get_width();
+    const auto h = decoder->get_height();
+
+    IT8951Area area = {
+        .x = 0,
+        .y = 0,
+        .w = std::min(w, display.get_width()),
+        .h = std::min(h, display.get_height()),
+    };
+
+    const auto address = display.get_memory_address();
+    const auto start_us = emulator.get_time_us();
+    const auto intact = decoder->load_image(display, converter, area, address);
+    const auto load_us = emulator.get_time_us() - start_us;
+    const auto heap = heap_peak - heap_before;
+    size_t mismatches = 0;
+
+    for (int y = 0; test_image && y < area.h; y++) {
+        for (int x = 0; x < area.w; x++) {
+            const auto expected = get_expected_gray(test_image->format, get_test_gray(x, y, w, h)) & 0xf0;
+
+            mismatches += emulator.get_memory(address + y * display.get_width() + x) != expected;
+        }
+    }
+
+    printf("  loaded %dx%d at 4 bpp in %.3f ms simulated, %zu bytes of heap, %s, %zu mismatches\n", area.w, area.h,
+           load_us / 1000.0, heap, intact ? "intact" : "corrupt", mismatches);
+
+    delete decoder;
+}
+
+static void report(const char* name, const std::vector<uint8_t>& file, const DecodeResult& result, int w, int h) {
+    const auto pixels = double(w) * h;
+
+    printf("%-20s %5dx%-5d %9zu bytes %9.3f ms %8.1f Mpixel/s %8zu bytes of heap (%zu for the image)", name, w, h,
+           file.size(), result.ms, pixels / result.ms / 1000.0, result.heap, size_t(w) * h);
+
+    if (result.mismatches) {
+        printf(", %zu mismatches", result.mismatches);
+    }
+
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    int iterations = 3;
+    std::vector<const char*> paths;
+
+    for (int i = 1; i < argc; i++) {
+        if (atoi(argv[i]) > 0) {
+            iterations = atoi(argv[i]);
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    IT8951Emulator emulator;
+    IT8951 display(&emulator);
+
+    if (!display.setup(-2.0f)) {
+        fprintf(stderr, "Setup failed\n");
+        return 1;
+    }
+
+    size_t total_mismatches = 0;
+
+    if (paths.empty()) {
+        const struct {
+            int w;
+            int h;
+        } sizes[] = {
+            {1872, 1404},  // The 10.3 inch panel.
+            {6000, 4000},  // A photo of a 24 megapixel camera.
+        };
+
+        for (const auto& size : sizes) {
+            for (const auto& test_image : TEST_IMAGES) {
+                const auto file = encode_image(test_image.format, size.w, size.h);
+                const auto result = decode(file, &test_image, iterations);
+
+                if (!result.started) {
+                    fprintf(stderr, "%s: failed to start decoding\n", test_image.name);
+                    return 1;
+                }
+
+                report(test_image.name, file, result, size.w, size.h);
+                total_mismatches += result.mismatches;
+            }
+
+            printf("\n");
+        }
+
+        // The decoders stream into the transfer buffers; check what ends up
+        // in the controller memory.
+
+        for (const auto& test_image : TEST_IMAGES) {
+            printf("%s:\n", test_image.name);
+            load(emulator, display, encode_image(test_image.format, 6000, 4000), &test_image);
+        }
+
+        // A file that ends early decodes the rows up to there, and loads the
+        // rest as white.
+
+        auto truncated = encode_image(Format::PNG_GRAY, 1872, 1404);
+
+        truncated.resize(truncated.size() / 2);
+
+        printf("truncated PNG:\n");
+        load(emulator, display, truncated, nullptr);
+    }
+
+    for (const auto path : paths) {
+        auto file_handle = fopen(path, "rb");
+
+        if (!file_handle) {
+            fprintf(stderr, "Failed to read %s\n", path);
+            return 1;
+        }
+
+        std::vector<uint8_t> file;
+        uint8_t chunk[65536];
+        size_t len;
+
+        while ((len = fread(chunk, 1, sizeof(chunk), file_handle))) {
+            file.insert(file.end(), chunk, chunk + len);
+        }
+
+        fclose(file_handle);
+
+        MemoryFile memory_file;
+        const auto decoder = create_decoder(file, memory_file);
+        const auto started = decoder->start();
+        const auto w = decoder->get_width();
+        const auto h = decoder->get_height();
+
+        delete decoder;
+
+        if (!started) {
+            fprintf(stderr, "%s: failed to start decoding\n", path);
+            return 1;
+        }
+
+        report(path, file, decode(file, nullptr, iterations), w, h);
+        load(emulator, display, file, nullptr);
+    }
+
+    printf("\nmismatches: %zu, protocol errors: %u, memory hazards: %u\n", total_mismatches,
+           emulator.get_protocol_errors(), emulator.get_memory_hazards());
+
+    return total_mismatches ? 1 : 0;
+}
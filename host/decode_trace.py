@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+"""Decodes a trace written from an IT8951TraceRing into a timeline.
+
+Usage: decode_trace.py [--chrome out.json] [--big-endian] trace.bin
+
+Prints one line per event. Consecutive transfers and HRDY waits are folded
+into one line. With --chrome, the trace is also written in the Chrome trace
+event format, which can be opened in chrome://tracing or Perfetto.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+EVENT_SIZE = 12
+
+CONTROL_TRANSFER = 0
+PAYLOAD_TRANSFER = 1
+HRDY_WAIT = 2
+LUT_WAIT = 3
+LOAD_IMAGE_START = 4
+LOAD_IMAGE_END = 5
+REFRESH_START = 6
+REFRESH_DONE = 7
+
+MODES = ["INIT", "A2", "GC16", "DU", "GL16", "GLR16", "GLD16", "DU4"]
+PIXEL_FORMATS = ["1bpp", "2bpp", "4bpp", "8bpp"]
+
+
+def mode_name(mode):
+    return MODES[mode] if mode < len(MODES) else str(mode)
+
+
+def read_events(path, byte_order):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    if len(data) % EVENT_SIZE:
+        sys.exit(f"{path}: size is not a multiple of {EVENT_SIZE} bytes")
+
+    # Time stamps are the lower 32 bits of the time in microseconds.
+
+    events = []
+    base = 0
+    last = None
+
+    for offset in range(0, len(data), EVENT_SIZE):
+        time_us, kind, arg, arg2, value = struct.unpack_from(byte_order + "IBBHI", data, offset)
+
+        if last is not None and time_us < last:
+            base += 1 << 32
+
+        last = time_us
+        events.append((base + time_us, kind, arg, arg2, value))
+
+    return events
+
+
+def describe(kind, arg, arg2, value):
+    if kind == LOAD_IMAGE_START:
+        pixel_format = PIXEL_FORMATS[arg] if arg < len(PIXEL_FORMATS) else str(arg)
+        return f"load image {value & 0xFFFF}x{value >> 16} {pixel_format}"
+    if kind == LOAD_IMAGE_END:
+        return "load image end"
+    if kind == LUT_WAIT:
+        return f"blocked on refreshes {value / 1000:.3f} ms"
+    if kind == REFRESH_START:
+        return f"refresh {mode_name(arg)} of {value} pixels, LUT engines {arg2:#06x}"
+    if kind == REFRESH_DONE:
+        if not value:
+            return f"refresh {mode_name(arg)} done, not timed, LUT engines {arg2:#06x}"
+        return f"refresh {mode_name(arg)} done after {value / 1000:.3f} ms, LUT engines {arg2:#06x}"
+    return f"unknown event {kind}"
+
+
+def print_timeline(events):
+    start = events[0][0]
+    run = None
+
+    def flush_run():
+        if run:
+            first, last, counts = run
+            parts = []
+            if counts[CONTROL_TRANSFER][0]:
+                parts.append(f"{counts[CONTROL_TRANSFER][0]} control transfers of {counts[CONTROL_TRANSFER][1]} bytes")
+            if counts[PAYLOAD_TRANSFER][0]:
+                parts.append(f"{counts[PAYLOAD_TRANSFER][0]} payload transfers of {counts[PAYLOAD_TRANSFER][1]} bytes")
+            if counts[HRDY_WAIT][0]:
+                parts.append(f"{counts[HRDY_WAIT][1] / 1000:.3f} ms waiting for HRDY")
+            print(f"{(first - start) / 1000:12.3f} {(last - first) / 1000:10.3f}  {', '.join(parts)}")
+
+    for time_us, kind, arg, arg2, value in events:
+        if kind in (CONTROL_TRANSFER, PAYLOAD_TRANSFER, HRDY_WAIT):
+            if not run:
+                run = [time_us, time_us, {CONTROL_TRANSFER: [0, 0], PAYLOAD_TRANSFER: [0, 0], HRDY_WAIT: [0, 0]}]
+            run[1] = time_us
+            run[2][kind][0] += 1
+            run[2][kind][1] += value
+            continue
+
+        flush_run()
+        run = None
+
+        print(f"{(time_us - start) / 1000:12.3f} {'':10}  {describe(kind, arg, arg2, value)}")
+
+    flush_run()
+
+
+def write_chrome(events, path):
+    # Transfers and waits end at their time stamp. Refreshes run on a track
+    # per LUT engine mask, as several run concurrently.
+
+    trace = []
+
+    for time_us, kind, arg, arg2, value in events:
+        if kind == CONTROL_TRANSFER:
+            trace.append({"name": "read" if arg else "write", "ph": "i", "ts": time_us, "pid": 0, "tid": 0,
+                          "s": "t", "args": {"bytes": value}})
+        elif kind == PAYLOAD_TRANSFER:
+            trace.append({"name": "payload", "ph": "i", "ts": time_us, "pid": 0, "tid": 1, "s": "t",
+                          "args": {"bytes": value}})
+        elif kind in (HRDY_WAIT, LUT_WAIT):
+            trace.append({"name": "HRDY" if kind == HRDY_WAIT else "LUT wait", "ph": "X", "ts": time_us - value,
+                          "dur": value, "pid": 0, "tid": 2})
+        elif kind == LOAD_IMAGE_START:
+            trace.append({"name": "load image", "ph": "B", "ts": time_us, "pid": 0, "tid": 3})
+        elif kind == LOAD_IMAGE_END:
+            trace.append({"name": "load image", "ph": "E", "ts": time_us, "pid": 0, "tid": 3})
+        elif kind == REFRESH_DONE and value:
+            trace.append({"name": mode_name(arg), "ph": "X", "ts": time_us - value, "dur": value, "pid": 1,
+                          "tid": arg2, "args": {"lut_engines": arg2}})
+
+    with open(path, "w") as f:
+        json.dump({"traceEvents": trace, "displayTimeUnit": "ms"}, f)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode an IT8951 driver trace.")
+    parser.add_argument("trace")
+    parser.add_argument("--chrome", help="also write the trace in the Chrome trace event format")
+    parser.add_argument("--big-endian", action="store_true", help="the trace was written by a big endian chip")
+    args = parser.parse_args()
+
+    events = read_events(args.trace, ">" if args.big_endian else "<")
+
+    if not events:
+        return
+
+    print(f"{'time ms':>12} {'span ms':>10}  event")
+    print_timeline(events)
+
+    if args.chrome:
+        write_chrome(events, args.chrome)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,1099 @@
+// Runs the driver against the emulator and reports the simulated time
+// spent per frame.
+//
+// Usage: emulator_bench [options] [panel.pgm]
+//
+// --hrdy-poll-ms N   Model a transport that polls HRDY at the given interval
+//                    instead of waiting for the rising edge.
+// --buffers N        Number of SPI transfer buffers.
+// --buffer-size N    Size of the SPI transfer buffers; 0 for the maximum.
+// --produce-us N     Simulated time to produce the data of a transfer buffer.
+//                    Every eighth buffer takes four times as long.
+// --trace FILE       Write the trace events of the driver to FILE, to be
+//                    decoded with decode_trace.py.
+// --packed FILE      Show the images packed into FILE by pack_images.py,
+//                    instead of packed images generated by the benchmark.
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "it8951.h"
+#include "it8951_diff.h"
+#include "it8951_emulator.h"
+#include "it8951_framebuffer.h"
+#include "it8951_ghost.h"
+#include "it8951_memory.h"
+#include "it8951_packed.h"
+#include "it8951_packed_file.h"
+#include "it8951_power.h"
+#include "it8951_scheduler.h"
+#include "it8951_trace.h"
+#include "it8951_waveform.h"
+
+static const char* get_mode_name(uint16_t mode) {
+    static const char* names[] = {"INIT", "DU", "GC16", "GL16", "GLR16", "GLD16", "A2", "DU4"};
+
+    return mode < 8 ? names[mode] : "?";
+}
+
+static const char* get_display_mode_name(int mode) {
+    static const char* names[] = {"INIT", "A2", "GC16", "DU", "GL16", "GLR16", "GLD16", "DU4"};
+
+    return mode < IT8951_DISPLAY_MODE_COUNT ? names[mode] : "?";
+}
+
+static int produce_us = 0;
+
+static void upload(IT8951Emulator& emulator, IT8951& display, IT8951Area& area, uint32_t address,
+                   it8951_pixel_format_t pixel_format, const std::vector<uint8_t>& image) {
+    display.load_image_start(area, address, IT8951_ROTATE_0, pixel_format);
+
+    const size_t buffer_len = display.get_buffer_len();
+
+    for (size_t offset = 0; offset < image.size(); offset += buffer_len) {
+        const auto copy = std::min(buffer_len, image.size() - offset);
+
+        if (produce_us) {
+            emulator.advance_us(offset / buffer_len % 8 == 7 ? produce_us * 4 : produce_us);
+        }
+
+        memcpy(display.get_buffer(), image.data() + offset, copy);
+
+        display.load_image_flush_buffer(copy);
+    }
+
+    display.load_image_end();
+}
+
+static void render_stripes(const IT8951Area& band, uint8_t* buffer, size_t stride, void* user_data) {
+    // Renders 4 bpp horizontal stripes, 16 rows each, straight into the transfer buffer.
+
+    for (uint16_t y = 0; y < band.h; y++) {
+        const uint8_t color = (band.y + y) / 16 % 16;
+
+        memset(buffer + y * stride, color << 4 | color, stride);
+    }
+}
+
+static void append_packed_image(std::vector<uint8_t>& packed, const char* name, const IT8951Area& area,
+                                it8951_pixel_format_t pixel_format, const std::vector<uint8_t>& rows, bool rle) {
+    // Packs an image like pack_images.py; rows are already padded to the stride.
+
+    const auto stride = IT8951::get_stride(area.w, pixel_format);
+    std::vector<uint8_t> data;
+
+    if (!rle) {
+        data = rows;
+    }
+
+    for (size_t y = 0; rle && y < area.h; y++) {
+        const auto row = rows.data() + y * stride;
+
+        for (size_t i = 0; i < stride;) {
+            size_t run = 1;
+
+            while (i + run < stride && run < 128 && row[i + run] == row[i]) {
+                run++;
+            }
+
+            if (run > 1) {
+                data.push_back(257 - run);
+                data.push_back(row[i]);
+                i += run;
+                continue;
+            }
+
+            const auto start = i;
+
+            while (i < stride && i - start < 128 && !(i + 2 < stride && row[i] == row[i + 1] && row[i] == row[i + 2])) {
+                i++;
+            }
+
+            data.push_back(i - start - 1);
+            data.insert(data.end(), row + start, row + i);
+        }
+    }
+
+    IT8951PackedImageHeader header = {
+        .magic = IT8951_PACKED_IMAGE_MAGIC,
+        .version = IT8951_PACKED_IMAGE_VERSION,
+        .flags = uint16_t(rle ? IT8951_PACKED_IMAGE_RLE : 0),
+        .name = {},
+        .x = area.x,
+        .y = area.y,
+        .w = area.w,
+        .h = area.h,
+        .pixel_format = uint8_t(pixel_format),
+        .reserved = {},
+        .stride = uint32_t(stride),
+        .data_size = uint32_t(data.size()),
+    };
+
+    strncpy(header.name, name, sizeof(header.name) - 1);
+
+    packed.insert(packed.end(), (const uint8_t*)&header, (const uint8_t*)(&header + 1));
+    packed.insert(packed.end(), data.begin(), data.end());
+    packed.resize((packed.size() + 3) & ~size_t(3));
+}
+
+static void show_packed_images(IT8951Emulator& emulator, IT8951& display, IT8951PackedImages& images,
+                               const char* label) {
+    uint32_t page = 0;
+
+    for (auto image = images.first(); image; image = images.next(image)) {
+        // Alternating between two image buffers, so loads don't wait for the previous refresh.
+
+        auto area = images.get_area(image);
+        const auto address = display.get_memory_address() + (page++ % 2) * display.get_width() * display.get_height();
+        const auto start_us = emulator.get_time_us();
+        const auto intact = images.load(display, image, address);
+        const auto load_us = emulator.get_time_us() - start_us;
+
+        display.display_area(area, address, images.get_pixel_format(image), IT8951_DISPLAY_MODE_GC16);
+
+        printf("%-8s %-16.16s %8u bytes, %8zu copied, loaded in %8.3f ms%s\n", label, image->name, image->data_size,
+               images.get_copied_bytes(), load_us / 1000.0, intact ? "" : ", corrupt");
+    }
+}
+
+static void print_frames(IT8951Emulator& emulator) {
+    printf("%-6s %-22s %10s %9s %9s %12s %12s %12s %12s\n", "mode", "area", "bytes", "control", "payload",
+           "hrdy ms", "upload ms", "refresh ms", "total ms");
+
+    for (const auto& frame : emulator.get_frames()) {
+        char area[32];
+        snprintf(area, sizeof(area), "%d,%d %dx%d", frame.area.x, frame.area.y, frame.area.w, frame.area.h);
+
+        printf("%-6s %-22s %10llu %9u %9u %12.3f %12.3f %12.3f %12.3f\n", get_mode_name(frame.mode), area,
+               (unsigned long long)frame.bytes, frame.transfers, frame.queued_transfers, frame.hrdy_wait_us / 1000.0,
+               (frame.display_us - frame.start_us) / 1000.0, (frame.done_us - frame.display_us) / 1000.0,
+               (frame.done_us - frame.start_us) / 1000.0);
+    }
+
+    emulator.clear_frames();
+}
+
+static void print_mode_summary(IT8951Emulator& emulator) {
+    printf("%-6s %8s %12s %22s\n", "mode", "frames", "bytes", "refreshed pixels");
+
+    for (uint16_t mode = 0; mode < 8; mode++) {
+        uint32_t frames = 0;
+        uint64_t bytes = 0;
+        uint64_t pixels = 0;
+
+        for (const auto& frame : emulator.get_frames()) {
+            if (frame.mode == mode) {
+                frames++;
+                bytes += frame.bytes;
+                pixels += uint32_t(frame.area.w) * frame.area.h;
+            }
+        }
+
+        if (frames) {
+            printf("%-6s %8u %12llu %22llu\n", get_mode_name(mode), frames, (unsigned long long)bytes,
+                   (unsigned long long)pixels);
+        }
+    }
+
+    emulator.clear_frames();
+}
+
+static void print_perf_counters(IT8951& display) {
+    const auto& counters = display.get_perf_counters();
+
+    printf("control: %llu bytes in %u transfers, %u transactions\n", (unsigned long long)counters.control_bytes,
+           counters.control_transfers, counters.transactions);
+    printf("payload: %llu bytes in %u transfers\n", (unsigned long long)counters.payload_bytes,
+           counters.payload_transfers);
+    printf("blocked: %.3f ms in %u HRDY waits, %.3f ms in %u LUT waits\n", counters.hrdy_wait_us / 1000.0,
+           counters.hrdy_waits, counters.lut_wait_us / 1000.0, counters.lut_waits);
+    printf("%-6s %10s %10s %12s %12s\n", "mode", "refreshes", "timed", "avg ms", "max ms");
+
+    for (int mode = 0; mode < IT8951_DISPLAY_MODE_COUNT; mode++) {
+        const auto& times = counters.modes[mode];
+
+        if (times.timed_refreshes) {
+            printf("%-6s %10u %10u %12.3f %12.3f\n", get_display_mode_name(mode), times.refreshes,
+                   times.timed_refreshes, times.total_us / 1000.0 / times.timed_refreshes, times.max_us / 1000.0);
+        } else if (times.refreshes) {
+            printf("%-6s %10u %10u %12s %12s\n", get_display_mode_name(mode), times.refreshes, 0u, "-", "-");
+        }
+    }
+}
+
+static void run_idle_updates(IT8951Emulator& emulator, IT8951& display, IT8951PowerManager* power,
+                             int64_t duration_ms, const int64_t* gaps_ms, size_t gap_count) {
+    // Small DU updates separated by the gaps, repeated, polling every 100 ms.
+    // Prints the time spent in the update calls and the power states.
+
+    const auto address = display.get_memory_address();
+    const auto start_stats = display.get_power_stats();
+    const auto start_report = power ? power->get_report() : IT8951PowerReport{};
+    const auto end_us = emulator.get_time_us() + duration_ms * 1000;
+    auto next_update_us = emulator.get_time_us();
+    int64_t update_us = 0;
+    int64_t max_update_us = 0;
+    int updates = 0;
+
+    while (emulator.get_time_us() < end_us) {
+        if (emulator.get_time_us() >= next_update_us) {
+            IT8951Area area = {.x = 1504, .y = 48, .w = 256, .h = 64};
+            std::vector<uint8_t> image(area.w / 8 * area.h, updates % 2 ? 0xff : 0x00);
+
+            const auto start_us = emulator.get_time_us();
+
+            display.load_image(area, address, IT8951_ROTATE_0, IT8951_PIXEL_FORMAT_1BPP, image.data(), area.w / 8);
+            display.display_area(area, address, IT8951_PIXEL_FORMAT_1BPP, IT8951_DISPLAY_MODE_DU);
+
+            const auto elapsed_us = emulator.get_time_us() - start_us;
+
+            update_us += elapsed_us;
+            max_update_us = std::max(max_update_us, elapsed_us);
+            next_update_us += gaps_ms[updates++ % gap_count] * 1000;
+        }
+
+        if (power) {
+            power->poll();
+        }
+
+        emulator.advance_us(100 * 1000);
+    }
+
+    const auto stats = display.get_power_stats();
+    IT8951PowerModel model;
+    const float power_mw[] = {model.run_mw, model.standby_mw, model.sleep_mw};
+    const char* names[] = {"run", "standby", "sleep"};
+    float energy_mj = 0;
+
+    printf("%d updates, %.3f ms in update calls, %.3f ms at most\n", updates, update_us / 1000.0,
+           max_update_us / 1000.0);
+
+    for (int i = 0; i < IT8951_POWER_STATE_COUNT; i++) {
+        const auto time_us = stats.time_us[i] - start_stats.time_us[i];
+
+        energy_mj += power_mw[i] * time_us / 1e6f;
+
+        printf("%-8s %12.3f s %6u wakes\n", names[i], time_us / 1e6, stats.wakes[i] - start_stats.wakes[i]);
+    }
+
+    printf("estimated energy: %.1f mJ\n", energy_mj);
+
+    if (power) {
+        const auto report = power->get_report();
+
+        printf("%u early wakes, %u predicted wakes, %u repaints, idle before standby %u ms, before sleep %u ms\n",
+               report.early_wakes - start_report.early_wakes, report.predicted_wakes - start_report.predicted_wakes,
+               report.repaints - start_report.repaints, report.idle_after_ms[IT8951_POWER_STATE_STANDBY],
+               report.idle_after_ms[IT8951_POWER_STATE_SLEEP]);
+    }
+}
+
+static void type_glyphs(IT8951& display, IT8951GhostTracker* tracker, int count) {
+    // Typing in a corner of the screen, alternating black and white glyphs.
+
+    for (int i = 0; i < count; i++) {
+        IT8951Area glyph_area = {
+            .x = uint16_t(1600 + i % 8 * 16),
+            .y = 1300,
+            .w = 16,
+            .h = 32,
+        };
+
+        std::vector<uint8_t> glyph(glyph_area.w / 8 * glyph_area.h, i / 8 % 2 ? 0xff : 0x00);
+
+        display.load_image(glyph_area, display.get_memory_address(), IT8951_ROTATE_0, IT8951_PIXEL_FORMAT_1BPP,
+                           glyph.data(), glyph_area.w / 8);
+        display.display_area(glyph_area, display.get_memory_address(), IT8951_PIXEL_FORMAT_1BPP,
+                             IT8951_DISPLAY_MODE_A2);
+
+        if (tracker) {
+            tracker->record(glyph_area, IT8951_DISPLAY_MODE_A2);
+        } else if (i % 16 == 15) {
+            display.clear_screen();
+        }
+    }
+}
+
+static void run_widgets(IT8951Emulator& emulator, IT8951& display, IT8951UpdateScheduler* scheduler) {
+    // A blinking cursor, a clock and a burst of status bar updates, every
+    // 50 ms for two seconds. Prints the time spent in the update calls.
+
+    const auto address = display.get_memory_address();
+    int64_t blocked_us = 0;
+
+    for (int tick = 0; tick < 40; tick++) {
+        struct {
+            IT8951Area area;
+            it8951_display_mode_t mode;
+            bool due;
+        } widgets[] = {
+            {{.x = 96, .y = 1000, .w = 16, .h = 32}, IT8951_DISPLAY_MODE_A2, true},
+            {{.x = 1504, .y = 48, .w = 256, .h = 64}, IT8951_DISPLAY_MODE_DU, tick % 4 == 0},
+            {{.x = 0, .y = 0, .w = 512, .h = 32}, IT8951_DISPLAY_MODE_DU, tick >= 10 && tick < 14},
+        };
+
+        const auto start_us = emulator.get_time_us();
+
+        for (auto& widget : widgets) {
+            if (!widget.due) {
+                continue;
+            }
+
+            if (scheduler) {
+                scheduler->submit(widget.area, address, IT8951_PIXEL_FORMAT_1BPP, widget.mode);
+            } else {
+                display.display_area(widget.area, address, IT8951_PIXEL_FORMAT_1BPP, widget.mode);
+            }
+        }
+
+        if (scheduler) {
+            scheduler->poll();
+        }
+
+        blocked_us += emulator.get_time_us() - start_us;
+
+        emulator.advance_us(50 * 1000);
+    }
+
+    if (scheduler) {
+        scheduler->flush();
+    }
+
+    printf("(%.3f ms in update calls):\n", blocked_us / 1000.0);
+}
+
+int main(int argc, char** argv) {
+    IT8951EmulatorConfig config;
+    const char* pgm_path = nullptr;
+    const char* trace_path = nullptr;
+    const char* packed_path = nullptr;
+    size_t buffers = 2;
+    size_t buffer_size = 2048;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--hrdy-poll-ms") && i + 1 < argc) {
+            config.hrdy_poll_ns = atoi(argv[++i]) * 1000 * 1000;
+        } else if (!strcmp(argv[i], "--buffers") && i + 1 < argc) {
+            buffers = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--buffer-size") && i + 1 < argc) {
+            buffer_size = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--produce-us") && i + 1 < argc) {
+            produce_us = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (!strcmp(argv[i], "--packed") && i + 1 < argc) {
+            packed_path = argv[++i];
+        } else {
+            pgm_path = argv[i];
+        }
+    }
+
+    IT8951Emulator emulator(config);
+    IT8951 display(&emulator);
+
+    display.configure_buffers(buffers, buffer_size);
+
+    // Large enough to hold the trace of the whole run.
+
+    IT8951TraceRing trace(trace_path ? 1 << 20 : 1);
+
+    if (trace_path) {
+        display.set_trace(&trace);
+    }
+
+    auto start_us = emulator.get_time_us();
+
+    if (!display.setup(-2.0f)) {
+        fprintf(stderr, "Setup failed\n");
+        return 1;
+    }
+
+    printf("setup: %.3f ms\n\n", (emulator.get_time_us() - start_us) / 1000.0);
+
+    display.clear_screen();
+
+    printf("clear_screen:\n");
+    print_frames(emulator);
+
+    // Full screen 16 level gray scale bars.
+
+    IT8951Area area = {
+        .x = 0,
+        .y = 0,
+        .w = display.get_width(),
+        .h = display.get_height(),
+    };
+
+    const size_t scan_line = (display.get_width() + 1) / 2;
+    std::vector<uint8_t> image(scan_line * display.get_height());
+
+    for (size_t y = 0; y < display.get_height(); y++) {
+        for (size_t x = 0; x < scan_line; x++) {
+            const uint8_t color = x * 16 / scan_line;
+            image[y * scan_line + x] = color << 4 | color;
+        }
+    }
+
+    upload(emulator, display, area, display.get_memory_address(), IT8951_PIXEL_FORMAT_4BPP, image);
+    display.display_area(area, display.get_memory_address(), IT8951_PIXEL_FORMAT_4BPP, IT8951_DISPLAY_MODE_GC16);
+
+    printf("\nfull screen GC16:\n");
+    print_frames(emulator);
+
+    // Small monochrome updates, e.g. typing.
+
+    for (int i = 0; i < 8; i++) {
+        IT8951Area small_area = {
+            .x = uint16_t(64 + i * 32),
+            .y = 64,
+            .w = 32,
+            .h = 32,
+        };
+
+        std::vector<uint8_t> glyph(small_area.w / 8 * small_area.h, 0x00);
+
+        upload(emulator, display, small_area, display.get_memory_address(), IT8951_PIXEL_FORMAT_1BPP, glyph);
+        display.display_area(small_area, display.get_memory_address(), IT8951_PIXEL_FORMAT_1BPP,
+                             IT8951_DISPLAY_MODE_A2);
+    }
+
+    printf("\nsmall A2 updates:\n");
+    print_frames(emulator);
+
+    // Wipe the area of the small updates without transferring pixels.
+
+    IT8951Area wipe_area = {
+        .x = 64,
+        .y = 64,
+        .w = 256,
+        .h = 32,
+    };
+
+    display.fill_area(wipe_area, 0xf0, IT8951_DISPLAY_MODE_GC16);
+
+    printf("\nfill GC16:\n");
+    print_frames(emulator);
+
+    // The image buffer is filled once it's shown again, so that doesn't bring
+    // back the text.
+
+    display.display_area(wipe_area, display.get_memory_address(), IT8951_PIXEL_FORMAT_4BPP, IT8951_DISPLAY_MODE_DU);
+
+    printf("\nshow filled memory DU:\n");
+    print_frames(emulator);
+
+    {
+        size_t mismatches = 0;
+
+        for (int y = wipe_area.y; y < wipe_area.y + wipe_area.h; y++) {
+            for (int x = wipe_area.x; x < wipe_area.x + wipe_area.w; x++) {
+                mismatches += emulator.get_memory(display.get_memory_address() + y * display.get_width() + x) != 0xf0;
+            }
+        }
+
+        printf("filled memory: %zu mismatches\n", mismatches);
+    }
+
+    // Page turns alternating between two image buffers, so the next page
+    // uploads while the previous one refreshes.
+
+    const uint32_t pages[] = {
+        display.get_memory_address(),
+        display.get_memory_address() + uint32_t(display.get_width()) * display.get_height(),
+    };
+
+    for (int i = 0; i < 4; i++) {
+        for (auto& value : image) {
+            value = ~value;
+        }
+
+        upload(emulator, display, area, pages[i % 2], IT8951_PIXEL_FORMAT_4BPP, image);
+        display.display_area(area, pages[i % 2], IT8951_PIXEL_FORMAT_4BPP, IT8951_DISPLAY_MODE_GC16);
+    }
+
+    printf("\npage turns GC16:\n");
+    print_frames(emulator);
+
+    // Screens of the user interface cached in the controller memory. Showing
+    // them again doesn't transfer any pixels.
+
+    IT8951MemoryAllocator allocator(display);
+    IT8951FrameCache cache(display, allocator);
+
+    IT8951Area screen_area = {
+        .x = 0,
+        .y = uint16_t(display.get_height() / 2),
+        .w = display.get_width(),
+        .h = uint16_t(display.get_height() / 4),
+    };
+
+    std::vector<uint8_t> screen(scan_line * screen_area.h);
+    const uint32_t screens = 16;
+
+    for (uint32_t id = 0; id < screens; id++) {
+        for (size_t i = 0; i < screen.size(); i++) {
+            screen[i] = uint8_t(i + id * 0x11);
+        }
+
+        if (!cache.load_start(id, screen_area, IT8951_ROTATE_0, IT8951_PIXEL_FORMAT_4BPP)) {
+            break;
+        }
+
+        for (size_t offset = 0; offset < screen.size(); offset += display.get_buffer_len()) {
+            const auto copy = std::min(display.get_buffer_len(), screen.size() - offset);
+
+            memcpy(display.get_buffer(), screen.data() + offset, copy);
+
+            display.load_image_flush_buffer(copy);
+        }
+
+        cache.load_end();
+        cache.show(id, IT8951_DISPLAY_MODE_GC16);
+    }
+
+    uint32_t cached = 0;
+
+    for (uint32_t id = 0; id < screens; id++) {
+        if (cache.contains(id)) {
+            cached++;
+        }
+    }
+
+    printf("\ncached screens GC16 (%u of %u cached, %zu bytes free):\n", cached, screens,
+           allocator.get_free_size());
+    print_frames(emulator);
+
+    for (uint32_t id = 0; id < screens; id++) {
+        cache.show(id, IT8951_DISPLAY_MODE_GC16);
+    }
+
+    printf("\nshow cached screens GC16:\n");
+    print_frames(emulator);
+
+    // Typing into a framebuffer; only the changed glyphs are uploaded.
+
+    {
+        IT8951Framebuffer framebuffer(display, IT8951_PIXEL_FORMAT_1BPP);
+        size_t bytes = 0;
+
+        for (int i = 0; i < 8; i++) {
+            framebuffer.fill_rect({.x = uint16_t(100 + i * 14), .y = 300, .w = 12, .h = 20}, 0x00);
+            bytes += framebuffer.commit(IT8951_DISPLAY_MODE_A2);
+        }
+
+        // A widget update touching two nearby and one distant area.
+
+        framebuffer.fill_rect({.x = 400, .y = 600, .w = 100, .h = 30}, 0x00);
+        framebuffer.fill_rect({.x = 420, .y = 640, .w = 60, .h = 10}, 0x00);
+        framebuffer.fill_rect({.x = 1500, .y = 1200, .w = 40, .h = 40}, 0x00);
+        bytes += framebuffer.commit(IT8951_DISPLAY_MODE_A2);
+
+        printf("\nframebuffer A2 updates (%zu image bytes):\n", bytes);
+        print_frames(emulator);
+    }
+
+    // Rectangles past the edges of the screen are clipped, and ones that are
+    // entirely off the screen are ignored.
+
+    {
+        IT8951Framebuffer framebuffer(display, IT8951_PIXEL_FORMAT_8BPP);
+        const auto width = display.get_width();
+        const auto height = display.get_height();
+
+        framebuffer.fill_rect({.x = uint16_t(width + 8), .y = 100, .w = 40, .h = 40}, 0x00);
+        framebuffer.fill_rect({.x = 100, .y = uint16_t(height + 8), .w = 40, .h = 40}, 0x00);
+        framebuffer.fill_rect({.x = uint16_t(width - 10), .y = uint16_t(height - 6), .w = 40, .h = 40}, 0x00);
+
+        const auto bytes = framebuffer.commit(IT8951_DISPLAY_MODE_DU);
+        size_t mismatches = 0;
+
+        for (int y = height - 6; y < height; y++) {
+            for (int x = width - 10; x < width; x++) {
+                mismatches += emulator.get_memory(display.get_memory_address() + y * width + x) != 0x00;
+            }
+        }
+
+        printf("\nframebuffer rectangles past the edges (%zu image bytes, %zu mismatches):\n", bytes, mismatches);
+        print_frames(emulator);
+    }
+
+    // A widget rendered in bands straight into the transfer buffers, like
+    // the LVGL display driver does.
+
+    IT8951Area widget_area = {
+        .x = 200,
+        .y = 800,
+        .w = 600,
+        .h = 200,
+    };
+
+    display.load_image_render(widget_area, display.get_memory_address(), IT8951_ROTATE_0, IT8951_PIXEL_FORMAT_4BPP,
+                              render_stripes, nullptr);
+    display.display_area(widget_area, display.get_memory_address(), IT8951_PIXEL_FORMAT_4BPP,
+                         IT8951_DISPLAY_MODE_GC16);
+
+    printf("\nband rendered widget GC16:\n");
+    print_frames(emulator);
+
+    // Externally rendered frames, diffed against the last uploaded frame.
+
+    {
+        IT8951FrameDiff diff(display, IT8951_PIXEL_FORMAT_4BPP);
+
+        const auto address = display.get_memory_address();
+
+        // The last frame is compared word by word against a copy of the
+        // previous one, the others by tile hashes.
+        std::vector<uint8_t> previous;
+
+        for (int i = 0; i < 3; i++) {
+            if (i == 1) {
+                // A clock in a corner.
+                for (size_t y = 40; y < 90; y++) {
+                    memset(&image[y * scan_line + 800], 0x00, 60);
+                }
+            } else if (i == 2) {
+                // A list item.
+                for (size_t y = 500; y < 560; y++) {
+                    memset(&image[y * scan_line + 20], 0x55, 400);
+                }
+            }
+
+            const auto ratio = diff.analyze(image.data(), scan_line, address, i == 2 ? previous.data() : nullptr);
+            const auto bytes = diff.upload();
+
+            previous.assign(image.begin(), image.end());
+
+            if (ratio > 0.5f) {
+                display.display_area(area, address, IT8951_PIXEL_FORMAT_4BPP, IT8951_DISPLAY_MODE_GC16);
+            } else {
+                diff.display(IT8951_DISPLAY_MODE_GC16);
+            }
+
+            printf("\ndiffed frame %d GC16 (%.1f%% changed, %zu areas, %zu image bytes):\n", i, ratio * 100,
+                   diff.get_area_count(), bytes);
+            print_frames(emulator);
+        }
+    }
+
+    // Polling a refresh until it completes, like the display task of IT8951Async does.
+
+    {
+        IT8951Area corner_area = {.x = 800, .y = 40, .w = 64, .h = 64};
+
+        display.display_area(corner_area, display.get_memory_address(), IT8951_PIXEL_FORMAT_4BPP,
+                             IT8951_DISPLAY_MODE_DU);
+
+        const auto refresh_id = display.get_last_refresh_id();
+        const auto start_us = emulator.get_time_us();
+        const auto done_at_start = display.is_refresh_done(refresh_id);
+
+        while (!display.is_refresh_done(refresh_id)) {
+            emulator.delay(20);
+            display.is_refreshing();
+        }
+
+        printf("\npolled refresh %u: done at start %s, done after %.3f ms %s\n", refresh_id,
+               done_at_start ? "yes" : "no", (emulator.get_time_us() - start_us) / 1000.0,
+               display.is_refresh_done(refresh_id) ? "yes" : "no");
+        print_frames(emulator);
+    }
+
+    // Updates whose display mode is picked from their content.
+
+    {
+        IT8951WaveformSelector selector(display);
+
+        IT8951Area panel_area = {
+            .x = 0,
+            .y = 1100,
+            .w = 960,
+            .h = 256,
+        };
+
+        display.fill_area(panel_area, 0xf0, IT8951_DISPLAY_MODE_GC16);
+        selector.fill(panel_area, 0xf0);
+
+        const auto artifacts = emulator.get_waveform_artifacts();
+
+        const struct {
+            IT8951Area area;
+            uint8_t levels[4];
+            size_t count;
+        } updates[] = {
+            {{.x = 32, .y = 1120, .w = 64, .h = 32}, {0x0, 0xf}, 2},               // Text on white.
+            {{.x = 32, .y = 200, .w = 64, .h = 32}, {0x0, 0xf}, 2},                // Text on a gray image.
+            {{.x = 160, .y = 1120, .w = 64, .h = 64}, {0x0, 0x5, 0xa, 0xf}, 4},    // Four level icon.
+            {{.x = 320, .y = 1120, .w = 256, .h = 32}, {0xf, 0xf, 0xf, 0x7}, 4},   // Anti-aliased text.
+            {{.x = 640, .y = 1120, .w = 256, .h = 128}, {0x3, 0x8, 0xc, 0x1}, 4},  // Photo.
+            {{.x = 32, .y = 1120, .w = 64, .h = 32}, {0xf, 0x0}, 2},               // Text on white again.
+        };
+
+        for (const auto& update : updates) {
+            auto update_area = update.area;
+            const size_t row_bytes = update_area.w / 2;
+            std::vector<uint8_t> pixels(row_bytes * update_area.h);
+
+            for (size_t i = 0; i < pixels.size(); i++) {
+                const auto first = update.levels[(i * 7 + i / row_bytes) % update.count];
+                const auto second = update.levels[(i * 5 + 1) % update.count];
+
+                pixels[i] = first << 4 | second;
+            }
+
+            const auto mode = selector.analyze(update_area, IT8951_PIXEL_FORMAT_4BPP, pixels.data(), row_bytes);
+
+            display.load_image(update_area, display.get_memory_address(), IT8951_ROTATE_0, IT8951_PIXEL_FORMAT_4BPP,
+                               pixels.data(), row_bytes);
+            display.display_area(update_area, display.get_memory_address(), IT8951_PIXEL_FORMAT_4BPP, mode);
+        }
+
+        printf("\nselected modes (%u waveform artifacts):\n", emulator.get_waveform_artifacts() - artifacts);
+        print_frames(emulator);
+    }
+
+    // Cleaning up after images of fast updates by clearing the whole screen
+    // every 16 updates, and by refreshing only the tiles that need it.
+
+    {
+        auto start_us = emulator.get_time_us();
+
+        type_glyphs(display, nullptr, 64);
+
+        printf("\ntyping with clear_screen() every 16 updates (%.3f ms):\n",
+               (emulator.get_time_us() - start_us) / 1000.0);
+        print_mode_summary(emulator);
+
+        IT8951GhostTracker tracker(display, display.get_memory_address(), IT8951_PIXEL_FORMAT_1BPP);
+
+        tracker.reset();
+        start_us = emulator.get_time_us();
+
+        type_glyphs(display, &tracker, 64);
+
+        printf("\ntyping with the ghosting tracker (%.3f ms):\n", (emulator.get_time_us() - start_us) / 1000.0);
+        print_mode_summary(emulator);
+
+        // Deferred cleanups go with the next GC16 update.
+
+        tracker.set_deferred(true);
+        type_glyphs(display, &tracker, 64);
+
+        IT8951Area page_area = {
+            .x = 1600,
+            .y = 1280,
+            .w = 64,
+            .h = 124,
+        };
+
+        display.display_area(page_area, display.get_memory_address(), IT8951_PIXEL_FORMAT_1BPP,
+                             IT8951_DISPLAY_MODE_GC16);
+        tracker.record(page_area, IT8951_DISPLAY_MODE_GC16);
+
+        const auto& stats = tracker.get_stats();
+
+        printf("\ndeferred cleanups (%u cleanup refreshes of %u tiles, %u tiles saved, %u piggybacked):\n",
+               stats.cleanup_refreshes, stats.cleaned_tiles, stats.saved_tiles, stats.piggybacked);
+        print_mode_summary(emulator);
+    }
+
+    // Independent widgets updated directly and through the scheduler.
+
+    {
+        printf("\nwidgets with display_area() ");
+        run_widgets(emulator, display, nullptr);
+        print_mode_summary(emulator);
+
+        IT8951UpdateScheduler scheduler(display);
+
+        printf("\nwidgets with the scheduler ");
+        run_widgets(emulator, display, &scheduler);
+        print_mode_summary(emulator);
+
+        const auto& stats = scheduler.get_stats();
+
+        printf("%u started, %u queued, %u coalesced, %u dequeued\n", stats.started, stats.queued, stats.coalesced,
+               stats.dequeued);
+    }
+
+    // A clock updated every minute, and bursts of updates with gaps just
+    // longer than the standby time, with and without the power manager.
+
+    {
+        const int64_t clock_gaps_ms[] = {60 * 1000};
+        const int64_t burst_gaps_ms[] = {1200, 1200, 1200, 1200, 1200, 1200, 1200, 20 * 1000};
+
+        printf("\nclock, always running: ");
+        run_idle_updates(emulator, display, nullptr, 10 * 60 * 1000, clock_gaps_ms, 1);
+
+        IT8951PowerManager power(display, display.get_memory_address(), IT8951_PIXEL_FORMAT_1BPP);
+
+        printf("\nclock, power manager: ");
+        run_idle_updates(emulator, display, &power, 10 * 60 * 1000, clock_gaps_ms, 1);
+
+        IT8951PowerManager burst_power(display, display.get_memory_address(), IT8951_PIXEL_FORMAT_1BPP);
+
+        burst_power.set_idle_times(0, 1000);
+        burst_power.set_repaint_after_sleep(true);
+
+        printf("\nbursts, power manager with sleep after 1 s and repaints: ");
+        run_idle_updates(emulator, display, &burst_power, 2 * 60 * 1000, burst_gaps_ms, 8);
+
+        display.set_system_run();
+        emulator.clear_frames();
+    }
+
+    // Calibrating the SPI clock on a board whose reads fail above 45 MHz.
+    // The drivers that wake from deep sleep below use the stored clock.
+
+    {
+        const auto configured_hz = display.get_spi_clock_speed();
+
+        start_us = emulator.get_time_us();
+        upload(emulator, display, area, display.get_memory_address(), IT8951_PIXEL_FORMAT_4BPP, image);
+
+        const auto configured_us = emulator.get_time_us() - start_us;
+
+        emulator.set_max_clock_hz(45 * 1000 * 1000);
+
+        start_us = emulator.get_time_us();
+
+        const auto calibrated_hz = display.calibrate_spi_clock(display.get_memory_address());
+        const auto calibrate_us = emulator.get_time_us() - start_us;
+
+        start_us = emulator.get_time_us();
+        upload(emulator, display, area, display.get_memory_address(), IT8951_PIXEL_FORMAT_4BPP, image);
+
+        const auto calibrated_us = emulator.get_time_us() - start_us;
+
+        printf("\nSPI clock calibration: %.3f ms\n", calibrate_us / 1000.0);
+        printf("full screen upload at %6.3f MHz: %.3f ms\n", configured_hz / 1e6, configured_us / 1000.0);
+        printf("full screen upload at %6.3f MHz: %.3f ms\n", calibrated_hz / 1e6, calibrated_us / 1000.0);
+
+        emulator.clear_frames();
+    }
+
+    // A screenshot of the image in the controller memory, checked against
+    // the memory of the emulator, and copied to free memory as is.
+
+    {
+        const auto address = display.get_memory_address();
+        const size_t len = display.get_width() * display.get_height();
+        std::vector<uint8_t> frame(len);
+
+        start_us = emulator.get_time_us();
+        display.read_memory(address, frame.data(), len);
+
+        const auto read_us = emulator.get_time_us() - start_us;
+        size_t mismatches = 0;
+
+        for (size_t i = 0; i < len; i++) {
+            mismatches += frame[i] != emulator.get_memory(address + i);
+        }
+
+        const auto copy_address = address + len;
+
+        start_us = emulator.get_time_us();
+        display.write_memory(copy_address, frame.data(), len);
+
+        const auto write_us = emulator.get_time_us() - start_us;
+
+        for (size_t i = 0; i < len; i++) {
+            mismatches += frame[i] != emulator.get_memory(copy_address + i);
+        }
+
+        printf("\nscreenshot of %zu bytes: read %.3f ms, written back %.3f ms, %zu mismatches\n", len,
+               read_us / 1000.0, write_us / 1000.0, mismatches);
+    }
+
+    // Packed images mapped from a file, like from a flash partition: loaded
+    // straight from the mapping, copied into the transfer buffers as on
+    // flash that isn't DMA capable, and run length encoded.
+
+    {
+        std::vector<uint8_t> packed;
+
+        if (!packed_path) {
+            const auto stride_1bpp = IT8951::get_stride(area.w, IT8951_PIXEL_FORMAT_1BPP);
+            std::vector<uint8_t> icons(stride_1bpp * area.h, 0xff);
+
+            for (size_t y = 0; y < area.h; y++) {
+                for (size_t x = y / 128 % 2 * 16; x < stride_1bpp; x += 32) {
+                    memset(&icons[y * stride_1bpp + x], 0x00, std::min<size_t>(16, stride_1bpp - x));
+                }
+            }
+
+            append_packed_image(packed, "bars", area, IT8951_PIXEL_FORMAT_4BPP, image, false);
+            append_packed_image(packed, "bars_rle", area, IT8951_PIXEL_FORMAT_4BPP, image, true);
+            append_packed_image(packed, "icons", area, IT8951_PIXEL_FORMAT_1BPP, icons, false);
+            append_packed_image(packed, "icons_rle", area, IT8951_PIXEL_FORMAT_1BPP, icons, true);
+        }
+
+        char temp_path[] = "/tmp/it8951_packed_XXXXXX";
+        const auto fd = packed_path ? -1 : mkstemp(temp_path);
+
+        if (fd >= 0) {
+            const auto written = write(fd, packed.data(), packed.size());
+
+            close(fd);
+
+            if (written == ssize_t(packed.size())) {
+                packed_path = temp_path;
+            }
+        }
+
+        IT8951PackedFile file;
+
+        if (!packed_path || !file.open(packed_path)) {
+            fprintf(stderr, "Failed to map packed images\n");
+            return 1;
+        }
+
+        auto images = file.get_images();
+
+        printf("\npacked images (%zu images):\n", images.get_count());
+        show_packed_images(emulator, display, images, "direct");
+
+        if (!packed.empty()) {
+            IT8951PackedImages copied_images(packed.data(), packed.size(), false);
+
+            show_packed_images(emulator, display, copied_images, "copied");
+        }
+
+        // The encoded images decode to the same memory as the raw ones.
+
+        size_t mismatches = 0;
+
+        for (const auto& [raw_name, rle_name] : {std::pair{"bars", "bars_rle"}, std::pair{"icons", "icons_rle"}}) {
+            const auto raw = images.find(raw_name);
+            const auto rle = images.find(rle_name);
+
+            if (!raw || !rle) {
+                continue;
+            }
+
+            const auto address = display.get_memory_address();
+            const auto rle_address = address + uint32_t(display.get_width()) * display.get_height();
+            const size_t bytes_per_row = raw->pixel_format == IT8951_PIXEL_FORMAT_1BPP ? raw->w / 8 : raw->w;
+
+            images.load(display, raw, address);
+            images.load(display, rle, rle_address);
+
+            for (size_t y = 0; y < raw->h; y++) {
+                for (size_t x = 0; x < bytes_per_row; x++) {
+                    const auto offset = (raw->y + y) * display.get_width() + raw->x + x;
+
+                    mismatches += emulator.get_memory(address + offset) != emulator.get_memory(rle_address + offset);
+                }
+            }
+        }
+
+        printf("run length encoded images: %zu mismatches\n", mismatches);
+
+        if (packed_path == temp_path) {
+            unlink(temp_path);
+        }
+
+        emulator.clear_frames();
+    }
+
+    // Waking from deep sleep: a new driver talks to the controller that was
+    // put to sleep, once with the controller keeping its state and once
+    // after it lost power.
+
+    {
+        display.set_sleep();
+
+        for (auto power_lost : {false, true}) {
+            if (power_lost) {
+                emulator.power_cycle();
+            }
+
+            IT8951 woken_display(&emulator);
+
+            woken_display.configure_buffers(buffers, buffer_size);
+
+            start_us = emulator.get_time_us();
+
+            if (!woken_display.setup(-2.0f, true)) {
+                fprintf(stderr, "Setup failed\n");
+                return 1;
+            }
+
+            printf("\nsetup after deep sleep%s: %.3f ms (%s start, %.3f MHz)\n",
+                   power_lost ? ", controller lost power" : "", (emulator.get_time_us() - start_us) / 1000.0,
+                   woken_display.is_warm_started() ? "warm" : "cold", woken_display.get_spi_clock_speed() / 1e6);
+
+            IT8951Area glyph_area = {.x = 1600, .y = 64, .w = 16, .h = 32};
+            std::vector<uint8_t> glyph(glyph_area.w / 8 * glyph_area.h, 0x00);
+
+            woken_display.load_image(glyph_area, woken_display.get_memory_address(), IT8951_ROTATE_0,
+                                     IT8951_PIXEL_FORMAT_1BPP, glyph.data(), glyph_area.w / 8);
+            woken_display.display_area(glyph_area, woken_display.get_memory_address(), IT8951_PIXEL_FORMAT_1BPP,
+                                       IT8951_DISPLAY_MODE_A2);
+        }
+
+        // A longer cable, on which the stored clock speed doesn't work anymore.
+
+        emulator.set_max_clock_hz(24 * 1000 * 1000);
+        emulator.power_cycle();
+
+        IT8951 rewired_display(&emulator);
+
+        rewired_display.configure_buffers(buffers, buffer_size);
+
+        start_us = emulator.get_time_us();
+
+        if (!rewired_display.setup(-2.0f)) {
+            fprintf(stderr, "Setup failed\n");
+            return 1;
+        }
+
+        printf("\nsetup with a longer cable: %.3f ms (%.3f MHz)\n", (emulator.get_time_us() - start_us) / 1000.0,
+               rewired_display.get_spi_clock_speed() / 1e6);
+
+        emulator.clear_frames();
+    }
+
+    printf("\ntotal: %.3f ms simulated, %llu bytes in %u transfers, %.3f ms waiting for HRDY\n",
+           emulator.get_time_us() / 1000.0, (unsigned long long)emulator.get_bytes(), emulator.get_transfers(),
+           emulator.get_hrdy_wait_us() / 1000.0);
+    printf("protocol errors: %u, memory hazards: %u\n", emulator.get_protocol_errors(),
+           emulator.get_memory_hazards());
+
+    printf("\ndriver counters:\n");
+    print_perf_counters(display);
+
+    if (trace_path) {
+        auto file = fopen(trace_path, "wb");
+
+        if (!file) {
+            fprintf(stderr, "Failed to write %s\n", trace_path);
+            return 1;
+        }
+
+        IT8951TraceEvent events[256];
+        size_t count;
+
+        if (trace.get_dropped()) {
+            fprintf(stderr, "%u trace events dropped\n", trace.get_dropped());
+        }
+
+        while ((count = trace.read(events, sizeof(events) / sizeof(events[0])))) {
+            fwrite(events, sizeof(IT8951TraceEvent), count, file);
+        }
+
+        fclose(file);
+    }
+
+    if (pgm_path && !emulator.write_pgm(pgm_path)) {
+        fprintf(stderr, "Failed to write %s\n", pgm_path);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "it8951.h"
+#include "it8951_transport.h"
+
+/**
+ * @brief Configuration of the emulated controller and its timing model.
+ *
+ * The defaults emulate the 7.8 inch 1872x1404 panel. Timings are rough
+ * approximations of the real hardware and are intended to compare driver
+ * changes with each other, not to predict absolute numbers.
+ */
+struct IT8951EmulatorConfig {
+    uint16_t width{1872};
+    uint16_t height{1404};
+    uint32_t memory_address{0x001236E0};  ///< Image buffer address reported by the device info.
+    uint32_t memory_size{8 * 1024 * 1024};  ///< Size of the controller SDRAM.
+    std::string firmware_version{"SWv_0.1.1"};
+    std::string lut_version{"M841_TFA2812"};
+    uint16_t vcom{2000};
+    int lut_engines{16};                   ///< Number of LUT engines that can refresh concurrently.
+    uint32_t command_busy_ns{2'000};       ///< HRDY low time after receiving a command code.
+    uint32_t execute_busy_ns{10'000};      ///< HRDY low time after receiving the last argument of a command.
+    uint32_t device_info_busy_ns{100'000};  ///< HRDY low time to collect the device info.
+    uint32_t transfer_overhead_ns{20'000};  ///< CPU and interrupt cost of a blocking transfer.
+    uint32_t queue_overhead_ns{5'000};     ///< CPU cost of queueing a transfer.
+    uint32_t polling_overhead_ns{3'000};   ///< CPU cost of a short blocking transfer while the bus is acquired.
+    uint32_t polling_max_len{32};          ///< Maximum length of a transfer that is sent using polling.
+    uint32_t wake_ns{1'000'000};           ///< HRDY low time after waking from sleep.
+    uint32_t standby_wake_ns{100'000};     ///< HRDY low time after waking from standby.
+    uint32_t hrdy_poll_ns{0};  ///< When set, HRDY waits are rounded up to this interval to model polling.
+    uint32_t max_clock_hz{0};  ///< When set, data read at a faster SPI clock arrives a bit late.
+    uint32_t mode_duration_ms[8]{
+        1600,  // INIT
+        260,   // DU
+        450,   // GC16
+        450,   // GL16
+        450,   // GLR16
+        450,   // GLD16
+        120,   // A2
+        290,   // DU4
+    };
+};
+
+/**
+ * @brief Statistics of a single frame, i.e. all traffic up to and including a display command.
+ */
+struct IT8951EmulatorFrame {
+    IT8951Area area;
+    uint16_t mode;
+    uint32_t address;
+    int64_t start_us;    ///< Time of the first transfer of the frame.
+    int64_t display_us;  ///< Time the display command was received.
+    int64_t done_us;     ///< Time the refresh of the panel completes.
+    uint64_t bytes;      ///< Number of bytes transferred for the frame.
+    uint32_t transfers;  ///< Number of blocking transfers for the frame.
+    uint32_t queued_transfers;  ///< Number of queued transfers for the frame.
+    int64_t hrdy_wait_us;  ///< Time spent waiting for HRDY during the frame.
+};
+
+/**
+ * @brief Emulator of the IT8951 controller.
+ *
+ * The emulator implements the transport interface of the driver and decodes
+ * the I80-over-SPI protocol the driver speaks. It keeps the image memory of the
+ * controller and the pixels shown on the panel, and keeps a simulated clock
+ * that advances with the SPI clock, HRDY busy time, LUT busy time and delays.
+ * This allows the unmodified driver to run on a host.
+ *
+ * Protocol violations, like words sent while HRDY is low or image loads into
+ * memory that is being shown by an active refresh, are counted.
+ */
+class IT8951Emulator : public IT8951Transport {
+public:
+    IT8951Emulator(const IT8951EmulatorConfig& config = IT8951EmulatorConfig());
+
+    void setup(int clock_speed_hz, int queue_size) override;
+    size_t get_max_transfer_len() override { return 4092; }
+    uint8_t* allocate_buffer(size_t len) override;
+    void set_reset(bool level) override;
+    void set_cs(bool level) override;
+    bool wait_ready(uint32_t timeout_ms) override;
+    void acquire_bus() override { _bus_acquired = true; }
+    void release_bus() override { _bus_acquired = false; }
+    void transfer(const uint8_t* tx, uint8_t* rx, size_t len) override;
+    void queue_transfer(const uint8_t* tx, uint8_t* rx, size_t len) override;
+    void wait_transfer() override;
+    bool poll_transfer() override;
+    void delay(int ms) override;
+    int64_t get_time_us() override { return _now_ns / 1000; }
+    void store_retained_state(const void* data, size_t len) override;
+    bool load_retained_state(void* data, size_t len) override;
+    bool store_setting(const char* key, int32_t value) override;
+    bool load_setting(const char* key, int32_t& value) override;
+
+    /**
+     * @brief Reset the controller, e.g. to model a controller that lost power while the chip was in deep sleep.
+     */
+    void power_cycle() { power_on(); }
+
+    /**
+     * @brief Set the fastest SPI clock reads work at, e.g. to model a longer cable. 0 means any.
+     */
+    void set_max_clock_hz(uint32_t max_clock_hz) { _config.max_clock_hz = max_clock_hz; }
+
+    /**
+     * @brief Gets the SPI clock speed the bus is setup with.
+     */
+    int get_clock_speed_hz() const { return _clock_speed_hz; }
+
+    /**
+     * @brief Advance the simulated clock, e.g. to model work done by the application.
+     */
+    void advance_us(int64_t us) { _now_ns += us * 1000; }
+
+    /**
+     * @brief Gets the gray value (0x00 to 0xf0) of a pixel shown on the panel.
+     */
+    uint8_t get_pixel(uint16_t x, uint16_t y) const { return _panel[y * _config.width + x]; }
+
+    /**
+     * @brief Gets a byte of the controller memory.
+     */
+    uint8_t get_memory(uint32_t address) const { return _memory[address]; }
+
+    /**
+     * @brief Gets the value of a register.
+     */
+    uint16_t get_register(uint16_t reg);
+
+    /**
+     * @brief Gets the frames that have been displayed.
+     */
+    const std::vector<IT8951EmulatorFrame>& get_frames() const { return _frames; }
+
+    /**
+     * @brief Clears the frame statistics.
+     */
+    void clear_frames() { _frames.clear(); }
+
+    /**
+     * @brief Gets the total time spent waiting for HRDY.
+     */
+    int64_t get_hrdy_wait_us() const { return _hrdy_wait_ns / 1000; }
+
+    /**
+     * @brief Gets the total number of bytes transferred.
+     */
+    uint64_t get_bytes() const { return _bytes; }
+
+    /**
+     * @brief Gets the total number of transfers.
+     */
+    uint32_t get_transfers() const { return _transfers; }
+
+    /**
+     * @brief Gets the number of protocol violations, e.g. words sent while HRDY was low.
+     */
+    uint32_t get_protocol_errors() const { return _protocol_errors; }
+
+    /**
+     * @brief Gets the number of bytes written into memory that was being shown by an active refresh.
+     */
+    uint32_t get_memory_hazards() const { return _memory_hazards; }
+
+    /**
+     * @brief Gets the number of refreshes that used a display mode that can't show the image correctly.
+     *
+     * These are DU and A2 refreshes of gray levels, DU4 refreshes of levels
+     * other than its four, and A2 refreshes of pixels that showed gray levels.
+     */
+    uint32_t get_waveform_artifacts() const { return _waveform_artifacts; }
+
+    /**
+     * @brief Writes the panel as a binary PGM image.
+     */
+    bool write_pgm(const char* path) const;
+
+private:
+    enum class WindowState {
+        PREAMBLE,
+        COMMAND,
+        WRITE,
+        READ,
+    };
+
+    enum class PowerState {
+        RUN,
+        STANDBY,
+        SLEEP,
+    };
+
+    enum class Payload {
+        NONE,
+        IMAGE,
+        MEMORY,
+    };
+
+    struct LutEngine {
+        int64_t busy_until_ns;
+        IT8951Area area;
+        uint32_t memory_address;
+        IT8951Area memory_area;
+    };
+
+    void power_on();
+    int64_t get_byte_ns();
+    int64_t begin_transfer(size_t len, bool queued);
+    void process_byte(uint8_t tx, uint8_t* rx, int64_t time_ns);
+    void process_word(uint16_t word, int64_t time_ns);
+    void process_command(uint16_t command, int64_t time_ns);
+    void process_payload(uint16_t word);
+    int get_argument_count();
+    void execute(int64_t time_ns);
+    void load_image_byte(uint8_t value);
+    void display(const IT8951Area& area, uint16_t mode, uint32_t address, int64_t time_ns);
+    uint16_t read_register(uint16_t reg);
+    uint16_t get_lut_status();
+    void write_memory(uint32_t address, uint8_t value);
+    void set_busy(int64_t until_ns);
+
+    IT8951EmulatorConfig _config;
+    std::vector<uint8_t> _memory;
+    std::vector<uint8_t> _panel;
+    std::map<uint16_t, uint16_t> _registers;
+    std::vector<uint8_t> _retained_state;
+    std::map<std::string, int32_t> _settings;
+    std::vector<LutEngine> _lut_engines;
+    std::vector<std::unique_ptr<uint8_t[]>> _buffers;
+    std::deque<int64_t> _queued_transfers;
+    std::deque<uint16_t> _read_queue;
+    PowerState _power_state{PowerState::RUN};
+    bool _reset{true};
+    bool _cs{true};
+    bool _bus_acquired{false};
+    int _clock_speed_hz{0};
+    int _queue_size{0};
+    int64_t _now_ns{0};
+    int64_t _busy_until_ns{0};
+    int64_t _bus_free_ns{0};
+    int64_t _hrdy_wait_ns{0};
+    WindowState _window_state{WindowState::PREAMBLE};
+    uint8_t _word_high{0};
+    bool _word_pending{false};
+    size_t _read_offset{0};
+    uint16_t _read_word{0};
+    uint8_t _read_previous{0};
+    uint16_t _command{0};
+    bool _command_active{false};
+    std::vector<uint16_t> _arguments;
+    Payload _payload{Payload::NONE};
+    uint32_t _burst_address{0};
+    uint32_t _burst_words{0};
+    int _image_bpp{8};
+    IT8951Area _image_area{};
+    uint32_t _image_address{0};
+    uint32_t _image_row{0};
+    uint32_t _image_offset{0};
+    IT8951EmulatorFrame _frame{};
+    bool _frame_active{false};
+    std::vector<IT8951EmulatorFrame> _frames;
+    uint64_t _bytes{0};
+    uint32_t _transfers{0};
+    uint32_t _protocol_errors{0};
+    uint32_t _memory_hazards{0};
+    uint32_t _waveform_artifacts{0};
+};
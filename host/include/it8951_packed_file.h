@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "it8951_packed.h"
+
+/**
+ * @brief Packed images in a file that's mapped into memory, the host equivalent of a flash partition.
+ */
+class IT8951PackedFile {
+public:
+    IT8951PackedFile() = default;
+    IT8951PackedFile(const IT8951PackedFile&) = delete;
+    IT8951PackedFile& operator=(const IT8951PackedFile&) = delete;
+
+    ~IT8951PackedFile() { close(); }
+
+    /**
+     * @brief Map a file of packed images.
+     * @param path The file, e.g. written by `pack_images.py`.
+     * @return Whether the file was mapped.
+     */
+    bool open(const char* path);
+
+    /**
+     * @brief Unmap the file.
+     */
+    void close();
+
+    /**
+     * @brief Gets the images of the file. The memory of a host is always DMA capable.
+     */
+    IT8951PackedImages get_images() { return IT8951PackedImages(_data, _size, true); }
+
+private:
+    const uint8_t* _data{nullptr};
+    size_t _size{0};
+};
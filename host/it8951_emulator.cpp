@@ -0,0 +1,826 @@
+#include "it8951_emulator.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "esp_log.h"
+
+static const char* TAG = "IT8951Emulator";
+
+// Preambles.
+#define PREAMBLE_COMMAND 0x6000
+#define PREAMBLE_WRITE 0x0000
+#define PREAMBLE_READ 0x1000
+
+// Built in I80 Command Code
+#define IT8951_TCON_SYS_RUN 0x0001
+#define IT8951_TCON_STANDBY 0x0002
+#define IT8951_TCON_SLEEP 0x0003
+#define IT8951_TCON_REG_RD 0x0010
+#define IT8951_TCON_REG_WR 0x0011
+
+#define IT8951_TCON_MEM_BST_RD_T 0x0012
+#define IT8951_TCON_MEM_BST_RD_S 0x0013
+#define IT8951_TCON_MEM_BST_WR 0x0014
+#define IT8951_TCON_MEM_BST_END 0x0015
+
+#define IT8951_TCON_LD_IMG 0x0020
+#define IT8951_TCON_LD_IMG_AREA 0x0021
+#define IT8951_TCON_LD_IMG_END 0x0022
+
+// I80 User defined command code
+#define USDEF_I80_CMD_DPY_AREA 0x0034
+#define USDEF_I80_CMD_GET_DEV_INFO 0x0302
+#define USDEF_I80_CMD_DPY_BUF_AREA 0x0037
+#define USDEF_I80_CMD_VCOM 0x0039
+
+// Registers
+#define I80CPCR 0x0004
+#define DISPLAY_REG_BASE 0x1000
+#define UP1SR (DISPLAY_REG_BASE + 0x138)
+#define LUTAFSR (DISPLAY_REG_BASE + 0x224)
+#define BGVR (DISPLAY_REG_BASE + 0x250)
+#define MCSR_BASE_ADDR 0x0200
+#define LISAR (MCSR_BASE_ADDR + 0x0008)
+
+// Time the controller needs to boot after a reset.
+#define RESET_BUSY_NS (50 * 1000 * 1000)
+
+IT8951Emulator::IT8951Emulator(const IT8951EmulatorConfig& config)
+    : _config(config),
+      _memory(config.memory_size, 0),
+      _panel(config.width * config.height, 0xf0),
+      _lut_engines(config.lut_engines, LutEngine{}) {}
+
+void IT8951Emulator::setup(int clock_speed_hz, int queue_size) {
+    _clock_speed_hz = clock_speed_hz;
+    _queue_size = queue_size;
+}
+
+uint8_t* IT8951Emulator::allocate_buffer(size_t len) {
+    _buffers.push_back(std::make_unique<uint8_t[]>(len));
+
+    return _buffers.back().get();
+}
+
+void IT8951Emulator::set_reset(bool level) {
+    if (level && !_reset) {
+        power_on();
+    }
+
+    _reset = level;
+}
+
+void IT8951Emulator::set_cs(bool level) {
+    if (!level && _cs) {
+        _window_state = WindowState::PREAMBLE;
+        _word_pending = false;
+    }
+
+    _cs = level;
+}
+
+bool IT8951Emulator::wait_ready(uint32_t timeout_ms) {
+    if (_busy_until_ns <= _now_ns) {
+        return true;
+    }
+
+    const auto timeout_ns = int64_t(timeout_ms) * 1000 * 1000;
+    auto wait_ns = _busy_until_ns - _now_ns;
+
+    if (_config.hrdy_poll_ns) {
+        wait_ns = (wait_ns + _config.hrdy_poll_ns - 1) / _config.hrdy_poll_ns * _config.hrdy_poll_ns;
+    }
+
+    const auto ready = wait_ns <= timeout_ns;
+    if (!ready) {
+        wait_ns = timeout_ns;
+    }
+
+    _hrdy_wait_ns += wait_ns;
+    _frame.hrdy_wait_us += wait_ns / 1000;
+    _now_ns += wait_ns;
+
+    return ready;
+}
+
+void IT8951Emulator::transfer(const uint8_t* tx, uint8_t* rx, size_t len) {
+    if (_bus_acquired && len <= _config.polling_max_len) {
+        _now_ns += _config.polling_overhead_ns;
+    } else {
+        _now_ns += _config.transfer_overhead_ns;
+    }
+
+    const auto start_ns = begin_transfer(len, false);
+
+    for (size_t i = 0; i < len; i++) {
+        process_byte(tx ? tx[i] : 0, rx ? &rx[i] : nullptr, start_ns + i * get_byte_ns());
+    }
+
+    _now_ns = _bus_free_ns;
+}
+
+void IT8951Emulator::queue_transfer(const uint8_t* tx, uint8_t* rx, size_t len) {
+    if ((int)_queued_transfers.size() >= _queue_size) {
+        ESP_LOGE(TAG, "Transfer queue is full");
+        abort();
+    }
+
+    _now_ns += _config.queue_overhead_ns;
+
+    const auto start_ns = begin_transfer(len, true);
+
+    for (size_t i = 0; i < len; i++) {
+        process_byte(tx ? tx[i] : 0, rx ? &rx[i] : nullptr, start_ns + i * get_byte_ns());
+    }
+
+    _queued_transfers.push_back(_bus_free_ns);
+}
+
+void IT8951Emulator::wait_transfer() {
+    if (_queued_transfers.empty()) {
+        ESP_LOGE(TAG, "Waiting for a transfer while none are queued");
+        abort();
+    }
+
+    _now_ns = std::max(_now_ns, _queued_transfers.front());
+    _queued_transfers.pop_front();
+}
+
+bool IT8951Emulator::poll_transfer() {
+    if (_queued_transfers.empty() || _queued_transfers.front() > _now_ns) {
+        return false;
+    }
+
+    _queued_transfers.pop_front();
+
+    return true;
+}
+
+void IT8951Emulator::store_retained_state(const void* data, size_t len) {
+    // Models RTC memory, which is kept when the controller is reset.
+
+    _retained_state.assign((const uint8_t*)data, (const uint8_t*)data + len);
+}
+
+bool IT8951Emulator::load_retained_state(void* data, size_t len) {
+    if (_retained_state.size() != len) {
+        return false;
+    }
+
+    memcpy(data, _retained_state.data(), len);
+
+    return true;
+}
+
+bool IT8951Emulator::store_setting(const char* key, int32_t value) {
+    // Models NVS, which is kept when the controller is reset.
+
+    _settings[key] = value;
+
+    return true;
+}
+
+bool IT8951Emulator::load_setting(const char* key, int32_t& value) {
+    const auto it = _settings.find(key);
+
+    if (it == _settings.end()) {
+        return false;
+    }
+
+    value = it->second;
+
+    return true;
+}
+
+void IT8951Emulator::delay(int ms) { _now_ns += int64_t(ms) * 1000 * 1000; }
+
+uint16_t IT8951Emulator::get_register(uint16_t reg) { return read_register(reg); }
+
+bool IT8951Emulator::write_pgm(const char* path) const {
+    auto f = fopen(path, "wb");
+    if (!f) {
+        return false;
+    }
+
+    fprintf(f, "P5\n%d %d\n255\n", _config.width, _config.height);
+    fwrite(_panel.data(), 1, _panel.size(), f);
+    fclose(f);
+
+    return true;
+}
+
+void IT8951Emulator::power_on() {
+    _registers.clear();
+    _read_queue.clear();
+    for (auto& engine : _lut_engines) {
+        engine = LutEngine{};
+    }
+    _power_state = PowerState::RUN;
+    _command_active = false;
+    _payload = Payload::NONE;
+    _busy_until_ns = _now_ns + RESET_BUSY_NS;
+}
+
+int64_t IT8951Emulator::get_byte_ns() {
+    if (!_clock_speed_hz) {
+        ESP_LOGE(TAG, "Transfer before the bus was setup");
+        abort();
+    }
+
+    return 8ll * 1000 * 1000 * 1000 / _clock_speed_hz;
+}
+
+int64_t IT8951Emulator::begin_transfer(size_t len, bool queued) {
+    const auto start_ns = std::max(_now_ns, _bus_free_ns);
+
+    _bus_free_ns = start_ns + len * get_byte_ns();
+
+    if (!_frame_active) {
+        _frame = IT8951EmulatorFrame{};
+        _frame.start_us = start_ns / 1000;
+        _frame_active = true;
+    }
+
+    _frame.bytes += len;
+    if (queued) {
+        _frame.queued_transfers++;
+    } else {
+        _frame.transfers++;
+    }
+    _bytes += len;
+    _transfers++;
+
+    return start_ns;
+}
+
+void IT8951Emulator::process_byte(uint8_t tx, uint8_t* rx, int64_t time_ns) {
+    if (_cs) {
+        // Not selected.
+        return;
+    }
+
+    if (_window_state == WindowState::READ) {
+        uint8_t value = 0;
+
+        if (_read_offset % 2 == 0) {
+            if (time_ns < _busy_until_ns) {
+                _protocol_errors++;
+            }
+
+            // The first word read is a dummy word.
+
+            if (_read_offset == 0) {
+                _read_word = 0;
+            } else if (_read_queue.empty()) {
+                ESP_LOGW(TAG, "Read without data available");
+                _protocol_errors++;
+                _read_word = 0;
+            } else {
+                _read_word = _read_queue.front();
+                _read_queue.pop_front();
+            }
+
+            value = _read_word >> 8;
+        } else {
+            value = _read_word & 0xff;
+        }
+
+        _read_offset++;
+
+        // Above the maximum clock speed, the data arrives too late to be
+        // sampled in time, so the host sees it shifted by a bit.
+
+        if (_config.max_clock_hz && _clock_speed_hz > (int)_config.max_clock_hz) {
+            const auto late_value = (uint8_t)(value >> 1 | _read_previous << 7);
+
+            _read_previous = value;
+            value = late_value;
+        }
+
+        if (rx) {
+            *rx = value;
+        }
+        return;
+    }
+
+    if (rx) {
+        *rx = 0;
+    }
+
+    if (!_word_pending) {
+        _word_high = tx;
+        _word_pending = true;
+        return;
+    }
+
+    _word_pending = false;
+
+    process_word((uint16_t)_word_high << 8 | tx, time_ns);
+}
+
+void IT8951Emulator::process_word(uint16_t word, int64_t time_ns) {
+    // Image data is written in pack mode and doesn't require HRDY to be checked.
+
+    if (_window_state == WindowState::WRITE && _payload != Payload::NONE) {
+        process_payload(word);
+        return;
+    }
+
+    if (time_ns < _busy_until_ns) {
+        _protocol_errors++;
+    }
+
+    switch (_window_state) {
+        case WindowState::PREAMBLE:
+            switch (word) {
+                case PREAMBLE_COMMAND:
+                    _window_state = WindowState::COMMAND;
+                    break;
+                case PREAMBLE_WRITE:
+                    _window_state = WindowState::WRITE;
+                    break;
+                case PREAMBLE_READ:
+                    _window_state = WindowState::READ;
+                    _read_offset = 0;
+                    break;
+                default:
+                    ESP_LOGW(TAG, "Invalid preamble %04x", word);
+                    _protocol_errors++;
+                    break;
+            }
+            break;
+
+        case WindowState::COMMAND:
+            process_command(word, time_ns);
+            break;
+
+        case WindowState::WRITE:
+            if (!_command_active) {
+                ESP_LOGW(TAG, "Data %04x written without an active command", word);
+                _protocol_errors++;
+                break;
+            }
+
+            _arguments.push_back(word);
+
+            // With pack write enabled, arguments are accepted without the
+            // host having to wait for HRDY.
+
+            if ((int)_arguments.size() == get_argument_count()) {
+                execute(time_ns);
+            } else if (!(read_register(I80CPCR) & 1)) {
+                set_busy(time_ns + _config.command_busy_ns);
+            }
+            break;
+    }
+}
+
+void IT8951Emulator::process_command(uint16_t command, int64_t time_ns) {
+    if (_power_state == PowerState::SLEEP && command != IT8951_TCON_SYS_RUN) {
+        ESP_LOGW(TAG, "Command %04x sent while sleeping", command);
+        _protocol_errors++;
+    }
+
+    _command = command;
+    _command_active = true;
+    _arguments.clear();
+    _payload = Payload::NONE;
+
+    switch (command) {
+        case IT8951_TCON_SYS_RUN:
+        case IT8951_TCON_STANDBY:
+        case IT8951_TCON_SLEEP:
+        case IT8951_TCON_REG_RD:
+        case IT8951_TCON_REG_WR:
+        case IT8951_TCON_MEM_BST_RD_T:
+        case IT8951_TCON_MEM_BST_RD_S:
+        case IT8951_TCON_MEM_BST_WR:
+        case IT8951_TCON_MEM_BST_END:
+        case IT8951_TCON_LD_IMG:
+        case IT8951_TCON_LD_IMG_AREA:
+        case IT8951_TCON_LD_IMG_END:
+        case USDEF_I80_CMD_DPY_AREA:
+        case USDEF_I80_CMD_GET_DEV_INFO:
+        case USDEF_I80_CMD_DPY_BUF_AREA:
+        case USDEF_I80_CMD_VCOM:
+            break;
+        default:
+            ESP_LOGW(TAG, "Unknown command %04x", command);
+            _protocol_errors++;
+            _command_active = false;
+            return;
+    }
+
+    if (get_argument_count() == 0) {
+        execute(time_ns);
+    } else {
+        set_busy(time_ns + _config.command_busy_ns);
+    }
+}
+
+int IT8951Emulator::get_argument_count() {
+    switch (_command) {
+        case IT8951_TCON_REG_RD:
+        case IT8951_TCON_LD_IMG:
+            return 1;
+        case IT8951_TCON_REG_WR:
+            return 2;
+        case IT8951_TCON_MEM_BST_RD_T:
+        case IT8951_TCON_MEM_BST_WR:
+            return 4;
+        case IT8951_TCON_LD_IMG_AREA:
+        case USDEF_I80_CMD_DPY_AREA:
+            return 5;
+        case USDEF_I80_CMD_DPY_BUF_AREA:
+            return 7;
+        case USDEF_I80_CMD_VCOM:
+            // Reading the VCOM takes a single argument; setting it takes the value as well.
+            return !_arguments.empty() && _arguments[0] == 1 ? 2 : 1;
+        default:
+            return 0;
+    }
+}
+
+void IT8951Emulator::execute(int64_t time_ns) {
+    auto busy_ns = _config.execute_busy_ns;
+
+    switch (_command) {
+        case IT8951_TCON_SYS_RUN:
+            if (_power_state == PowerState::SLEEP) {
+                busy_ns = _config.wake_ns;
+            } else if (_power_state == PowerState::STANDBY) {
+                busy_ns = _config.standby_wake_ns;
+            }
+            _power_state = PowerState::RUN;
+            break;
+
+        case IT8951_TCON_STANDBY:
+            _power_state = PowerState::STANDBY;
+            break;
+
+        case IT8951_TCON_SLEEP:
+            _power_state = PowerState::SLEEP;
+            break;
+
+        case IT8951_TCON_REG_RD:
+            _read_queue.push_back(read_register(_arguments[0]));
+            break;
+
+        case IT8951_TCON_REG_WR:
+            _registers[_arguments[0]] = _arguments[1];
+            break;
+
+        case IT8951_TCON_MEM_BST_RD_T:
+            _burst_address = _arguments[0] | (uint32_t)_arguments[1] << 16;
+            _burst_words = _arguments[2] | (uint32_t)_arguments[3] << 16;
+            break;
+
+        case IT8951_TCON_MEM_BST_RD_S:
+            for (uint32_t i = 0; i < _burst_words; i++) {
+                const auto address = (_burst_address + i * 2) % _memory.size();
+                _read_queue.push_back(_memory[address] | _memory[(address + 1) % _memory.size()] << 8);
+            }
+            break;
+
+        case IT8951_TCON_MEM_BST_WR:
+            _burst_address = _arguments[0] | (uint32_t)_arguments[1] << 16;
+            _burst_words = _arguments[2] | (uint32_t)_arguments[3] << 16;
+            _payload = Payload::MEMORY;
+            break;
+
+        case IT8951_TCON_LD_IMG:
+        case IT8951_TCON_LD_IMG_AREA: {
+            const auto settings = _arguments[0];
+
+            if ((settings >> 8 & 1) != 1) {
+                ESP_LOGW(TAG, "Only big endian image loads are emulated");
+            }
+            if ((settings & 3) != 0) {
+                ESP_LOGW(TAG, "Hardware rotation is not emulated");
+            }
+
+            switch (settings >> 4 & 3) {
+                case 0:
+                    _image_bpp = 2;
+                    break;
+                case 2:
+                    _image_bpp = 4;
+                    break;
+                case 3:
+                    _image_bpp = 8;
+                    break;
+                default:
+                    ESP_LOGW(TAG, "3 bits per pixel is not emulated");
+                    _protocol_errors++;
+                    _image_bpp = 8;
+                    break;
+            }
+
+            if (_command == IT8951_TCON_LD_IMG) {
+                _image_area = {.x = 0, .y = 0, .w = _config.width, .h = _config.height};
+            } else {
+                _image_area = {.x = _arguments[1], .y = _arguments[2], .w = _arguments[3], .h = _arguments[4]};
+            }
+
+            _image_address = read_register(LISAR) | (uint32_t)read_register(LISAR + 2) << 16;
+            _image_row = 0;
+            _image_offset = 0;
+            _payload = Payload::IMAGE;
+            break;
+        }
+
+        case IT8951_TCON_MEM_BST_END:
+        case IT8951_TCON_LD_IMG_END:
+            break;
+
+        case USDEF_I80_CMD_DPY_AREA:
+            display({.x = _arguments[0], .y = _arguments[1], .w = _arguments[2], .h = _arguments[3]}, _arguments[4],
+                    _config.memory_address, time_ns);
+            break;
+
+        case USDEF_I80_CMD_DPY_BUF_AREA:
+            display({.x = _arguments[0], .y = _arguments[1], .w = _arguments[2], .h = _arguments[3]}, _arguments[4],
+                    _arguments[5] | (uint32_t)_arguments[6] << 16, time_ns);
+            break;
+
+        case USDEF_I80_CMD_GET_DEV_INFO: {
+            _read_queue.push_back(_config.width);
+            _read_queue.push_back(_config.height);
+            _read_queue.push_back(_config.memory_address & 0xffff);
+            _read_queue.push_back(_config.memory_address >> 16);
+
+            // The version strings are sent as little endian words.
+
+            for (const auto& version : {_config.firmware_version, _config.lut_version}) {
+                char buffer[16] = {};
+                strncpy(buffer, version.c_str(), sizeof(buffer) - 1);
+
+                for (size_t i = 0; i < sizeof(buffer); i += 2) {
+                    _read_queue.push_back((uint8_t)buffer[i] | (uint8_t)buffer[i + 1] << 8);
+                }
+            }
+
+            busy_ns = _config.device_info_busy_ns;
+            break;
+        }
+
+        case USDEF_I80_CMD_VCOM:
+            if (_arguments[0] == 1) {
+                _config.vcom = _arguments[1];
+            } else {
+                _read_queue.push_back(_config.vcom);
+            }
+            break;
+    }
+
+    set_busy(time_ns + busy_ns);
+
+    // Commands with a payload stay active until the next command.
+
+    if (_payload == Payload::NONE) {
+        _command_active = false;
+    }
+}
+
+void IT8951Emulator::process_payload(uint16_t word) {
+    switch (_payload) {
+        case Payload::IMAGE:
+            // Image loads are big endian so bytes are in wire order.
+            load_image_byte(word >> 8);
+            load_image_byte(word & 0xff);
+            break;
+
+        case Payload::MEMORY:
+            if (!_burst_words) {
+                _protocol_errors++;
+                break;
+            }
+
+            write_memory(_burst_address, word & 0xff);
+            write_memory(_burst_address + 1, word >> 8);
+            _burst_address += 2;
+            _burst_words--;
+            break;
+    }
+}
+
+void IT8951Emulator::load_image_byte(uint8_t value) {
+    if (_image_row >= _image_area.h) {
+        _protocol_errors++;
+        return;
+    }
+
+    // Rows are padded to whole words.
+
+    const uint32_t pixels_per_byte = 8 / _image_bpp;
+    const uint32_t row_bytes = (_image_area.w * _image_bpp + 7) / 8;
+    const uint32_t padded_row_bytes = (row_bytes + 1) & ~1;
+
+    if (_image_offset < row_bytes) {
+        // The first pixel is in the most significant bits of a byte.
+
+        for (uint32_t i = 0; i < pixels_per_byte; i++) {
+            const auto x = _image_offset * pixels_per_byte + i;
+            if (x >= _image_area.w) {
+                break;
+            }
+
+            const auto level = value >> (8 - _image_bpp * (i + 1)) & ((1 << _image_bpp) - 1);
+            uint8_t gray;
+
+            switch (_image_bpp) {
+                case 2:
+                    gray = level * 5 << 4;
+                    break;
+                case 4:
+                    gray = level << 4;
+                    break;
+                default:
+                    gray = level;
+                    break;
+            }
+
+            write_memory(_image_address + (_image_area.y + _image_row) * _config.width + _image_area.x + x, gray);
+        }
+    }
+
+    if (++_image_offset == padded_row_bytes) {
+        _image_offset = 0;
+        _image_row++;
+    }
+}
+
+void IT8951Emulator::display(const IT8951Area& area, uint16_t mode, uint32_t address, int64_t time_ns) {
+    if (area.x + area.w > _config.width || area.y + area.h > _config.height || !area.w || !area.h) {
+        ESP_LOGW(TAG, "Invalid display area %d,%d %dx%d", area.x, area.y, area.w, area.h);
+        _protocol_errors++;
+        return;
+    }
+
+    const auto one_bpp = read_register(UP1SR + 2) & (1 << 2);
+    const auto colors = read_register(BGVR);
+
+    // A refresh of an area that overlaps an active refresh starts after the
+    // active refresh completes. Without a free LUT engine, the controller
+    // stays busy until one becomes available.
+
+    auto start_ns = time_ns;
+    LutEngine* free_engine = nullptr;
+
+    for (auto& engine : _lut_engines) {
+        if (engine.busy_until_ns <= time_ns) {
+            if (!free_engine) {
+                free_engine = &engine;
+            }
+        } else if (area.x < engine.area.x + engine.area.w && engine.area.x < area.x + area.w &&
+                   area.y < engine.area.y + engine.area.h && engine.area.y < area.y + area.h) {
+            start_ns = std::max(start_ns, engine.busy_until_ns);
+        }
+    }
+
+    if (!free_engine) {
+        free_engine = &*std::min_element(_lut_engines.begin(), _lut_engines.end(),
+                                         [](auto& a, auto& b) { return a.busy_until_ns < b.busy_until_ns; });
+        start_ns = std::max(start_ns, free_engine->busy_until_ns);
+        set_busy(free_engine->busy_until_ns);
+    }
+
+    // The memory read by the refresh. 1 bpp images hold 8 pixels per byte.
+
+    IT8951Area memory_area = area;
+
+    if (one_bpp) {
+        memory_area.x = area.x / 8;
+        memory_area.w = (area.x + area.w + 7) / 8 - memory_area.x;
+
+        // With both colors of the color table the same, the memory isn't used.
+
+        if ((colors >> 8) == (colors & 0xff)) {
+            memory_area = {};
+        }
+    }
+
+    const auto done_ns = start_ns + int64_t(_config.mode_duration_ms[mode & 7]) * 1000 * 1000;
+
+    *free_engine = {
+        .busy_until_ns = done_ns,
+        .area = area,
+        .memory_address = address,
+        .memory_area = memory_area,
+    };
+
+    // Update the panel. Pixels that a mode can't drive to their gray level,
+    // or A2 refreshes of pixels that don't show black or white, are artifacts.
+
+    auto artifacts = false;
+
+    for (int y = area.y; y < area.y + area.h; y++) {
+        for (int x = area.x; x < area.x + area.w; x++) {
+            uint8_t gray;
+
+            if (one_bpp) {
+                const auto value = _memory[(address + y * _config.width + x / 8) % _memory.size()];
+                gray = value & (0x80 >> (x % 8)) ? colors & 0xff : colors >> 8;
+            } else {
+                gray = _memory[(address + y * _config.width + x) % _memory.size()];
+            }
+
+            gray &= 0xf0;
+
+            auto& pixel = _panel[y * _config.width + x];
+
+            switch (mode) {
+                case 0:
+                    // INIT
+                    gray = 0xf0;
+                    break;
+                case 6:
+                    // A2
+                    artifacts |= pixel != 0x00 && pixel != 0xf0;
+                    // fall through
+                case 1:
+                    // DU
+                    artifacts |= gray != 0x00 && gray != 0xf0;
+                    gray = gray >= 0x80 ? 0xf0 : 0x00;
+                    break;
+                case 7:
+                    // DU4
+                    artifacts |= (gray >> 4) % 5 != 0;
+                    gray = ((gray >> 4) + 2) / 5 * 0x50;
+                    break;
+            }
+
+            pixel = gray;
+        }
+    }
+
+    if (artifacts) {
+        _waveform_artifacts++;
+    }
+
+    // Record the frame.
+
+    if (!_frame_active) {
+        _frame = IT8951EmulatorFrame{};
+        _frame.start_us = time_ns / 1000;
+    }
+
+    _frame.area = area;
+    _frame.mode = mode;
+    _frame.address = address;
+    _frame.display_us = time_ns / 1000;
+    _frame.done_us = done_ns / 1000;
+    _frames.push_back(_frame);
+    _frame_active = false;
+}
+
+uint16_t IT8951Emulator::read_register(uint16_t reg) {
+    if (reg == LUTAFSR) {
+        return get_lut_status();
+    }
+
+    auto it = _registers.find(reg);
+
+    return it == _registers.end() ? 0 : it->second;
+}
+
+uint16_t IT8951Emulator::get_lut_status() {
+    uint16_t status = 0;
+
+    for (size_t i = 0; i < _lut_engines.size(); i++) {
+        if (_lut_engines[i].busy_until_ns > _now_ns) {
+            status |= 1 << i;
+        }
+    }
+
+    return status;
+}
+
+void IT8951Emulator::write_memory(uint32_t address, uint8_t value) {
+    if (address >= _memory.size()) {
+        _protocol_errors++;
+        return;
+    }
+
+    for (const auto& engine : _lut_engines) {
+        if (engine.busy_until_ns <= _now_ns || address < engine.memory_address) {
+            continue;
+        }
+
+        const auto row = (address - engine.memory_address) / _config.width;
+        const auto column = (address - engine.memory_address) % _config.width;
+        const auto& area = engine.memory_area;
+
+        if (row >= area.y && row < uint32_t(area.y + area.h) && column >= area.x && column < uint32_t(area.x + area.w)) {
+            _memory_hazards++;
+            break;
+        }
+    }
+
+    _memory[address] = value;
+}
+
+void IT8951Emulator::set_busy(int64_t until_ns) { _busy_until_ns = std::max(_busy_until_ns, until_ns); }
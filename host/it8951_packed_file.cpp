@@ -0,0 +1,43 @@
+#include "it8951_packed_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool IT8951PackedFile::open(const char* path) {
+    close();
+
+    const auto fd = ::open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    void* data = MAP_FAILED;
+
+    if (!fstat(fd, &st) && st.st_size > 0) {
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    ::close(fd);
+
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    _data = (const uint8_t*)data;
+    _size = st.st_size;
+
+    return true;
+}
+
+void IT8951PackedFile::close() {
+    if (_data) {
+        munmap((void*)_data, _size);
+    }
+
+    _data = nullptr;
+    _size = 0;
+}
@@ -0,0 +1,302 @@
+#!/usr/bin/env python3
+"""Packs images in the format the IT8951 loads, to be shown with IT8951PackedImages.
+
+Usage: pack_images.py -o images.bin [--bpp N] [--rle] [--at X,Y] [--name NAME] image.pgm ...
+
+Reads PGM (P2 and P5) and PNG files, converts them to gray and quantizes
+them to the pixel format. The options apply to the images that follow
+them, so images can be packed with different formats and positions:
+
+    pack_images.py -o images.bin --bpp 4 splash.png --bpp 1 --rle --at 0,1300 footer.pgm
+
+Images are named after their file name without the extension, unless
+--name is given. The output is written to a flash partition with
+parttool.py, or mapped from a file on the host.
+"""
+
+import argparse
+import os
+import struct
+import sys
+import zlib
+
+MAGIC = 0x4B503849
+VERSION = 1
+FLAG_RLE = 0x0001
+NAME_LEN = 16
+ALIGN = 4
+
+PIXEL_FORMATS = {1: 0, 2: 1, 4: 2, 8: 3}
+
+# magic, version, flags, name, x, y, w, h, pixel_format, reserved, stride, data_size
+HEADER = struct.Struct("<IHH16sHHHHB3xII")
+
+
+def read_pgm(path, data):
+    # Header fields are separated by whitespace and may be followed by comments.
+
+    fields = []
+    pos = 0
+
+    while len(fields) < 4:
+        while pos < len(data) and data[pos : pos + 1].isspace():
+            pos += 1
+
+        if data[pos : pos + 1] == b"#":
+            pos = data.index(b"\n", pos)
+            continue
+
+        start = pos
+
+        while pos < len(data) and not data[pos : pos + 1].isspace():
+            pos += 1
+
+        if start == pos:
+            sys.exit(f"{path}: truncated header")
+
+        fields.append(data[start:pos])
+
+    magic, w, h, max_value = fields[0], int(fields[1]), int(fields[2]), int(fields[3])
+
+    if magic == b"P5":
+        pixels = data[pos + 1 :]
+
+        if max_value > 255:
+            pixels = pixels[::2]
+    elif magic == b"P2":
+        pixels = [int(value) for value in data[pos:].split()]
+    else:
+        sys.exit(f"{path}: not a gray scale PGM")
+
+    if len(pixels) < w * h:
+        sys.exit(f"{path}: truncated image")
+
+    max_value = min(max_value, 255)
+
+    return w, h, bytes(pixels[i] * 255 // max_value for i in range(w * h))
+
+
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+
+    if pa <= pb and pa <= pc:
+        return a
+
+    return b if pb <= pc else c
+
+
+def unfilter(path, data, h, row_len, bpp):
+    rows = []
+    previous = bytearray(row_len)
+    pos = 0
+
+    for _ in range(h):
+        filter_type = data[pos]
+        row = bytearray(data[pos + 1 : pos + 1 + row_len])
+        pos += 1 + row_len
+
+        for i in range(row_len):
+            a = row[i - bpp] if i >= bpp else 0
+            b = previous[i]
+            c = previous[i - bpp] if i >= bpp else 0
+
+            if filter_type == 1:
+                row[i] = (row[i] + a) & 0xFF
+            elif filter_type == 2:
+                row[i] = (row[i] + b) & 0xFF
+            elif filter_type == 3:
+                row[i] = (row[i] + (a + b) // 2) & 0xFF
+            elif filter_type == 4:
+                row[i] = (row[i] + paeth(a, b, c)) & 0xFF
+            elif filter_type:
+                sys.exit(f"{path}: unknown filter {filter_type}")
+
+        rows.append(row)
+        previous = row
+
+    return rows
+
+
+def read_png(path, data):
+    pos = 8
+    compressed = b""
+    palette = None
+
+    while pos < len(data):
+        length, chunk_type = struct.unpack(">I4s", data[pos : pos + 8])
+        chunk = data[pos + 8 : pos + 8 + length]
+        pos += 12 + length
+
+        if chunk_type == b"IHDR":
+            w, h, depth, color_type, _, _, interlace = struct.unpack(">IIBBBBB", chunk)
+        elif chunk_type == b"PLTE":
+            palette = chunk
+        elif chunk_type == b"IDAT":
+            compressed += chunk
+        elif chunk_type == b"IEND":
+            break
+
+    if interlace:
+        sys.exit(f"{path}: interlaced PNG files aren't supported")
+
+    channels = {0: 1, 2: 3, 3: 1, 4: 2, 6: 4}[color_type]
+    bits = depth * channels
+    rows = unfilter(path, zlib.decompress(compressed), h, (w * bits + 7) // 8, max(1, bits // 8))
+    pixels = bytearray()
+
+    for row in rows:
+        for x in range(w):
+            if depth < 8:
+                shift = 8 - depth - x * depth % 8
+                values = [row[x * depth // 8] >> shift & ((1 << depth) - 1)]
+            else:
+                step = depth // 8
+                values = [row[(x * channels + i) * step] for i in range(channels)]
+
+            if color_type == 3:
+                r, g, b = palette[values[0] * 3 : values[0] * 3 + 3]
+                gray = (r * 299 + g * 587 + b * 114) // 1000
+            elif color_type in (2, 6):
+                r, g, b = values[:3]
+                gray = (r * 299 + g * 587 + b * 114) // 1000
+            elif depth < 8:
+                gray = values[0] * 255 // ((1 << depth) - 1)
+            else:
+                gray = values[0]
+
+            # Transparent pixels are shown on white.
+
+            if color_type in (4, 6):
+                alpha = values[-1]
+                gray = (gray * alpha + 255 * (255 - alpha)) // 255
+
+            pixels.append(gray)
+
+    return w, h, bytes(pixels)
+
+
+def read_image(path):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    if data.startswith(b"\x89PNG\r\n\x1a\n"):
+        return read_png(path, data)
+
+    return read_pgm(path, data)
+
+
+def pack_rows(w, h, pixels, bpp):
+    # The first pixel is in the most significant bits of a byte. 1 bpp
+    # pixels are white when their bit is set.
+
+    row_bytes = (w * bpp + 7) // 8
+    stride = (row_bytes + 1) & ~1
+    levels = (1 << bpp) - 1
+    rows = []
+
+    for y in range(h):
+        row = bytearray(stride)
+
+        for x in range(w):
+            gray = pixels[y * w + x]
+            level = (gray * levels + 127) // 255
+            row[x * bpp // 8] |= level << (8 - bpp - x * bpp % 8)
+
+        rows.append(bytes(row))
+
+    return stride, rows
+
+
+def packbits(row):
+    out = bytearray()
+    i = 0
+
+    while i < len(row):
+        run = 1
+
+        while i + run < len(row) and run < 128 and row[i + run] == row[i]:
+            run += 1
+
+        if run > 1:
+            out += bytes([257 - run, row[i]])
+            i += run
+            continue
+
+        start = i
+
+        while i < len(row) and i - start < 128:
+            if i + 2 < len(row) and row[i] == row[i + 1] == row[i + 2]:
+                break
+
+            i += 1
+
+        out += bytes([i - start - 1]) + row[start:i]
+
+    return bytes(out)
+
+
+def pack_image(name, x, y, w, h, bpp, rle, pixels):
+    stride, rows = pack_rows(w, h, pixels, bpp)
+
+    if rle:
+        data = b"".join(packbits(row) for row in rows)
+    else:
+        data = b"".join(rows)
+
+    header = HEADER.pack(MAGIC, VERSION, FLAG_RLE if rle else 0, name.encode()[: NAME_LEN - 1], x, y, w, h,
+                         PIXEL_FORMATS[bpp], stride, len(data))
+    image = header + data
+
+    return image + bytes(-len(image) % ALIGN), stride * h, len(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Pack images for IT8951PackedImages.")
+    parser.add_argument("-o", "--output", required=True, help="file to write the packed images to")
+    parser.epilog = "images: [--bpp 1|2|4|8] [--rle | --no-rle] [--at X,Y] [--name NAME] image ..."
+
+    # The image options apply in order, so they're parsed by hand.
+
+    args, items = parser.parse_known_args()
+
+    bpp = 4
+    rle = False
+    x = y = 0
+    name = None
+    output = bytearray()
+    items = iter(items)
+
+    for item in items:
+        if item == "--bpp":
+            bpp = int(next(items))
+
+            if bpp not in PIXEL_FORMATS:
+                sys.exit(f"unsupported pixel format {bpp} bpp")
+        elif item == "--rle":
+            rle = True
+        elif item == "--no-rle":
+            rle = False
+        elif item == "--at":
+            x, y = (int(value) for value in next(items).split(","))
+        elif item == "--name":
+            name = next(items)
+        else:
+            w, h, pixels = read_image(item)
+            image_name = name or os.path.splitext(os.path.basename(item))[0]
+
+            if bpp == 1 and (x % 8 or w % 8):
+                sys.exit(f"{item}: 1 bpp images must start and end at multiples of 8 pixels")
+
+            image, raw_size, data_size = pack_image(image_name, x, y, w, h, bpp, rle, pixels)
+            output += image
+            name = None
+
+            print(f"{image_name}: {w}x{h} at {x},{y}, {bpp} bpp, {data_size} of {raw_size} bytes")
+
+    with open(args.output, "wb") as f:
+        f.write(output)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,15 @@
+#pragma once
+
+// Host replacements for the compiler helpers ESP-IDF provides.
+
+#ifndef likely
+#define likely(x) __builtin_expect(!!(x), 1)
+#endif
+
+#ifndef unlikely
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#endif
+
+#ifndef __ASSERT_FUNC
+#define __ASSERT_FUNC __func__
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+
+// Host replacement for the ESP-IDF logging macros. Debug and verbose
+// messages are compiled out.
+
+#include <cstdio>
+
+#include "esp_compiler.h"
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) fprintf(stderr, "I (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...)                                        \
+    do {                                                                  \
+        if (0) fprintf(stderr, "D (%s) " format "\n", tag, ##__VA_ARGS__); \
+    } while (0)
+#define ESP_LOGV(tag, format, ...)                                        \
+    do {                                                                  \
+        if (0) fprintf(stderr, "V (%s) " format "\n", tag, ##__VA_ARGS__); \
+    } while (0)
@@ -0,0 +1,11 @@
+#pragma once
+
+// Host replacement for the ESP-IDF system functions.
+
+#include <cstdio>
+#include <cstdlib>
+
+[[noreturn]] inline void esp_restart() {
+    fprintf(stderr, "esp_restart() called\n");
+    abort();
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// Host replacement for the configuration ESP-IDF generates from Kconfig.projbuild.
+// Values are the defaults of the configuration parameters.
+
+#define CONFIG_IT8951_SPI_BUS_SPEED_DIVIDER 4
+#define CONFIG_IT8951_BUFFER_COUNT 2
+#define CONFIG_IT8951_BUFFER_SIZE 2048
+#define CONFIG_IT8951_MEMORY_SIZE 8388608
@@ -1,6 +1,22 @@
 #pragma once
 
-#include "driver/spi_master.h"
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+
+#include "it8951_trace.h"
+#include "it8951_transport.h"
+
+/**
+ * @brief Maximum number of refreshes the driver tracks concurrently.
+ */
+#define IT8951_MAX_REFRESHES 16
+
+/**
+ * @brief Maximum number of filled areas whose memory the driver writes when it's next used.
+ */
+#define IT8951_MAX_PENDING_FILLS 8
 
 /**
  * @brief Area identifying the size of images and display areas.
@@ -36,11 +52,101 @@ enum it8951_pixel_format_t : uint8_t {
  * @brief Display mode to show images on the screen.
  */
 enum it8951_display_mode_t {
-    IT8951_DISPLAY_MODE_INIT,  ///< Init mode to refresh the screen. Use `clear_screen()` instead.
-    IT8951_DISPLAY_MODE_A2,    ///< Fast display mode. Requires 1 bit per pixel images.
-    IT8951_DISPLAY_MODE_GC16,  ///< 16 color gray scale mode.
+    IT8951_DISPLAY_MODE_INIT,   ///< Init mode to refresh the screen. Use `clear_screen()` instead.
+    IT8951_DISPLAY_MODE_A2,     ///< Fast display mode. Requires 1 bit per pixel images.
+    IT8951_DISPLAY_MODE_GC16,   ///< 16 color gray scale mode.
+    IT8951_DISPLAY_MODE_DU,     ///< Non-flashing update from any gray level to black or white.
+    IT8951_DISPLAY_MODE_GL16,   ///< 16 color gray scale mode that doesn't flash white areas, for text on white.
+    IT8951_DISPLAY_MODE_GLR16,  ///< GL16 with ghost reduction. GL16 if the panel doesn't support it.
+    IT8951_DISPLAY_MODE_GLD16,  ///< GL16 with ghost reduction and dithering. GL16 if the panel doesn't support it.
+    IT8951_DISPLAY_MODE_DU4,    ///< Non-flashing update to 4 gray levels. GC16 if the panel doesn't support it.
+};
+
+/**
+ * @brief Statistics of a frame, i.e. all driver activity up to and including `display_area()`.
+ */
+struct IT8951FrameStats {
+    int64_t hrdy_wait_us;        ///< Time spent waiting for the controller to signal HRDY.
+    uint32_t control_transfers;  ///< Number of blocking transfers of commands, arguments and reads.
+    uint32_t payload_transfers;  ///< Number of queued transfers of image data.
+};
+
+/**
+ * @brief Power state of the controller.
+ */
+enum it8951_power_state_t : uint8_t {
+    IT8951_POWER_STATE_RUN,      ///< Running.
+    IT8951_POWER_STATE_STANDBY,  ///< Standby mode. Wakes up quickly.
+    IT8951_POWER_STATE_SLEEP,    ///< Sleep mode. Uses the least power, but takes longest to wake up.
+};
+
+/**
+ * @brief Number of power states.
+ */
+#define IT8951_POWER_STATE_COUNT 3
+
+/**
+ * @brief Time spent in and waking from the power states, since setup.
+ */
+struct IT8951PowerStats {
+    int64_t time_us[IT8951_POWER_STATE_COUNT];  ///< Time spent in each state.
+    uint32_t entries[IT8951_POWER_STATE_COUNT];  ///< Number of times each state was entered.
+    uint32_t wakes[IT8951_POWER_STATE_COUNT];    ///< Number of wakes from each state.
+    int64_t wake_us[IT8951_POWER_STATE_COUNT];   ///< Total time from waking from each state until the controller was ready.
+    uint32_t timed_wakes[IT8951_POWER_STATE_COUNT];  ///< Number of wakes included in `wake_us`.
+    uint32_t full_refreshes;                         ///< Number of GC16 and INIT refreshes of the whole screen.
+};
+
+/**
+ * @brief Number of display modes.
+ */
+#define IT8951_DISPLAY_MODE_COUNT 8
+
+/**
+ * @brief Refreshes are timed when the driver saw them busy at most this long before it saw them complete.
+ */
+#define IT8951_REFRESH_TIMING_RESOLUTION_US 25000
+
+/**
+ * @brief Timings of the completed refreshes of a display mode.
+ *
+ * A refresh is known to be complete the next time the driver reads the
+ * status of the LUT engines. Only refreshes that completed while the driver
+ * was polling them, e.g. while waiting for them, are timed, so the times are
+ * at most `IT8951_REFRESH_TIMING_RESOLUTION_US` too long.
+ */
+struct IT8951ModeTimes {
+    uint32_t refreshes;        ///< Number of completed refreshes.
+    uint32_t timed_refreshes;  ///< Number of refreshes included in `total_us` and `max_us`.
+    int64_t total_us;          ///< Total time from starting the timed refreshes until they completed.
+    int64_t max_us;            ///< Longest time from starting a timed refresh until it completed.
 };
 
+/**
+ * @brief Cumulative performance counters of the driver, since setup or `reset_perf_counters()`.
+ */
+struct IT8951PerfCounters {
+    uint64_t control_bytes;                            ///< Bytes of commands, arguments and reads.
+    uint64_t payload_bytes;                            ///< Bytes of image data.
+    uint32_t control_transfers;                        ///< Number of blocking transfers.
+    uint32_t payload_transfers;                        ///< Number of queued transfers of image data.
+    uint32_t transactions;                             ///< Number of times CS was asserted.
+    uint32_t hrdy_waits;                               ///< Number of waits for HRDY.
+    int64_t hrdy_wait_us;                              ///< Time blocked waiting for HRDY.
+    uint32_t lut_waits;                                ///< Number of times the driver blocked on refreshes.
+    int64_t lut_wait_us;                               ///< Time blocked waiting for refreshes.
+    IT8951ModeTimes modes[IT8951_DISPLAY_MODE_COUNT];  ///< Refresh timings, indexed by display mode.
+};
+
+/**
+ * @brief Callback that renders rows of an image straight into an SPI transfer buffer.
+ * @param band The rows to render, in screen coordinates.
+ * @param buffer The SPI transfer buffer to write the pixels to, in the pixel format of the image.
+ * @param stride The number of bytes between the rows in the buffer. Rows are padded to whole words.
+ * @param user_data The pointer passed to `load_image_render()`.
+ */
+typedef void (*it8951_render_cb_t)(const IT8951Area& band, uint8_t* buffer, size_t stride, void* user_data);
+
 /**
  * @brief Driver for the IT8951 controller.
  */
@@ -55,24 +161,121 @@ class IT8951 {
     };
 
 public:
+    /**
+     * @brief Create a driver for the controller connected to the pins configured in `sdkconfig`.
+     */
+    IT8951();
+
+    /**
+     * @brief Create a driver that talks to the controller through a custom transport.
+     * @param transport The transport used to talk to the controller. It must outlive the driver.
+     */
+    explicit IT8951(IT8951Transport* transport);
+
     /**
      * @brief Setup the controller.
+     *
+     * A warm start skips the reset of the controller and the queries of its
+     * settings when the chip wakes from deep sleep. The settings are kept by
+     * the transport, in RTC memory on the ESP32, and a single register read
+     * checks whether the controller kept its state. If it didn't, e.g.
+     * because it lost power, the controller is reset as usual.
+     *
      * @param vcom The VCOM value. This has to be set correctly and is the number printed on the cable.
+     * @param warm_start Whether to try a warm start.
      * @return Whether the controller was setup correctly.
      */
-    bool setup(float vcom);
+    bool setup(float vcom, bool warm_start = false);
+
+    /**
+     * @brief Gets whether `setup()` did a warm start, i.e. the screen still shows what it showed before.
+     */
+    bool is_warm_started() { return _warm_started; }
+
+    /**
+     * @brief Find the fastest SPI clock speed that works reliably on this board.
+     *
+     * Starting at the clock speed set by `IT8951_SPI_BUS_SPEED_DIVIDER`, the
+     * clock is stepped up until test patterns written to the controller
+     * memory don't read back the same. The clock one step below the fastest
+     * one that passed is used, and stored by the transport, in NVS on the
+     * ESP32, so `setup()` uses it from then on. `setup()` falls back to the
+     * configured clock speed when the stored one stops working.
+     *
+     * Call after `setup()`, while no images are being loaded.
+     *
+     * @param scratch_address Controller memory the test patterns are written
+     * to. Its contents are restored.
+     * @return The selected clock speed.
+     */
+    int calibrate_spi_clock(uint32_t scratch_address);
+
+    /**
+     * @brief Gets the SPI clock speed used once the controller has been initialized.
+     */
+    int get_spi_clock_speed() { return _spi_clock_hz; }
+
+    /**
+     * @brief Configure the ring of SPI transfer buffers. Must be called before `setup()`.
+     *
+     * The defaults are taken from the `IT8951_BUFFER_COUNT` and `IT8951_BUFFER_SIZE`
+     * configuration parameters.
+     *
+     * @param count The number of transfer buffers. At least 2.
+     * @param len The size of a transfer buffer, or 0 to use the maximum transfer size
+     * supported by the bus.
+     */
+    void configure_buffers(size_t count, size_t len);
+
+    /**
+     * @brief Get the current SPI transfer buffer. Called after `load_image_start()` or `write_memory_start()`.
+     * @param offset The number of buffers after the current one in the ring.
+     * @return The current SPI transfer buffer, or the one that becomes current
+     * after `offset` calls to `load_image_flush_buffer()`.
+     */
+    uint8_t* get_buffer(size_t offset = 0) { return _buffers[(_current_buffer + offset) % _buffer_count]; }
+
+    /**
+     * @brief Get the current SPI transfer buffer if it's not being transferred anymore.
+     *
+     * Use this together with `load_image_flush_buffer(len, false)` to keep
+     * producing image data while the SPI transfers complete.
+     *
+     * @return The current SPI transfer buffer, or `nullptr` if it's still being transferred.
+     */
+    uint8_t* try_get_buffer();
+
+    /**
+     * @brief Release the oldest SPI transfer buffer that's being transferred.
+     *
+     * Use this together with `load_image_flush_buffer(len, false)` to reuse
+     * the buffers in the order they were queued.
+     *
+     * @param wait Whether to wait for the transfer to complete.
+     * @return Whether a buffer was released.
+     */
+    bool load_image_release_buffer(bool wait);
+
+    /**
+     * @brief Gets the number of SPI transfer buffers that are being transferred.
+     */
+    size_t get_buffers_pending() { return _buffers_pending; }
 
     /**
-     * @brief Get the current SPI transfer buffer. Called after `load_image_start()`.
-     * @return The current SPI transfer buffer.
+     * @brief Gets the number of bytes of a row of an image, including the padding to whole words.
      */
-    uint8_t* get_buffer() { return _current_buffer == 0 ? _buffer0 : _buffer1; }
+    static size_t get_stride(uint16_t width, it8951_pixel_format_t pixel_format);
 
     /**
      * @brief Gets the size of the SPI transfer buffers.
      */
     size_t get_buffer_len() { return _buffer_len; }
 
+    /**
+     * @brief Gets the number of SPI transfer buffers.
+     */
+    size_t get_buffer_count() { return _buffer_count; }
+
     /**
      * @brief Gets the width of the screen.
      *
@@ -104,7 +307,11 @@ public:
     void enable_enhance_driving_capability();
 
     /**
-     * @brief Wake the controller from sleep mode.
+     * @brief Wake the controller from standby or sleep mode.
+     *
+     * The controller is woken up when it's used anyway. Waking it ahead of
+     * time hides the wake up time behind other work, as the driver only
+     * waits for it with the next command.
      *
      * The screen needs to be cleared after the system is woken up from
      * sleep mode. Otherwise you get strange artifacts on the screen. If you
@@ -114,12 +321,57 @@ public:
     void set_system_run();
 
     /**
-     * @brief Put the controller in sleep mode.
+     * @brief Put the controller in standby mode once all refreshes have completed.
+     */
+    void set_standby();
+
+    /**
+     * @brief Put the controller in sleep mode once all refreshes have completed.
      */
     void set_sleep();
 
     /**
-     * @brief Clear the screen.
+     * @brief Gets the power state of the controller.
+     */
+    it8951_power_state_t get_power_state() { return _power_state; }
+
+    /**
+     * @brief Gets the time spent in and waking from the power states.
+     */
+    IT8951PowerStats get_power_stats();
+
+    /**
+     * @brief Gets the time the driver last loaded an image or started a refresh.
+     */
+    int64_t get_last_activity_us() { return _last_activity_us; }
+
+    /**
+     * @brief Gets a monotonic time stamp in microseconds from the transport.
+     */
+    int64_t get_time_us() { return _transport->get_time_us(); }
+
+    /**
+     * @brief Gets whether refreshes are in progress. Reads the controller status if needed.
+     */
+    bool is_refreshing();
+
+    /**
+     * @brief Gets the ID of the last refresh started by the driver, or 0 if none has been started.
+     */
+    uint32_t get_last_refresh_id() { return _last_refresh_id; }
+
+    /**
+     * @brief Gets whether a refresh has completed.
+     *
+     * This doesn't read the controller status; the driver reads it while it
+     * waits for refreshes and in `is_refreshing()`.
+     *
+     * @param refresh_id The ID of a refresh, from `get_last_refresh_id()`.
+     */
+    bool is_refresh_done(uint32_t refresh_id);
+
+    /**
+     * @brief Clear the screen and the default image buffer to white. See `fill_area()`.
      *
      * This must be done when the controller is started, when the controller
      * wakes from sleep mode and every once in a while when using A2 fast update
@@ -127,6 +379,33 @@ public:
      */
     void clear_screen();
 
+    /**
+     * @brief Fill an area of the screen with a solid color without transferring pixels.
+     *
+     * The area is shown using the 1 bit per pixel color table with both colors
+     * set to the fill color, so no image data is sent. The fill color is only
+     * written to the area of the memory when that memory is used again without
+     * overwriting the whole area first, e.g. when it's shown by a refresh, so
+     * it never brings back what was there before the fill. Like changing
+     * between 1 bit per pixel and other pixel formats, this waits until all
+     * refreshes have completed.
+     *
+     * @param area The area to fill.
+     * @param gray The gray value, from 0x00 (black) to 0xf0 (white).
+     * @param mode The mode used to show the area.
+     * @param target_memory_address The memory of the screen image, or 0 for the default image buffer.
+     */
+    void fill_area(IT8951Area& area, uint8_t gray, it8951_display_mode_t mode, uint32_t target_memory_address = 0);
+
+    /**
+     * @brief Write the fill color of areas filled with `fill_area()` to the memory that hasn't been written yet.
+     *
+     * The driver does this when needed. Call it before the driver is
+     * discarded while the controller keeps its memory, e.g. before a deep
+     * sleep of the chip.
+     */
+    void write_pending_fills();
+
     /**
      * @brief Start copying an image to the controller.
      * @param area The dimensions of the image.
@@ -139,15 +418,148 @@ public:
 
     /**
      * @brief Transfer an SPI buffer to the controller.
+     *
+     * The buffer is queued for transfer and the next buffer in the ring becomes
+     * the current buffer.
+     *
      * @param len The number of bytes in the SPI buffer to transfer.
+     * @param wait Whether to wait until the next buffer is available. If this is
+     * false, use `try_get_buffer()` to get the next buffer.
+     */
+    void load_image_flush_buffer(size_t len, bool wait = true);
+
+    /**
+     * @brief Append data to the current SPI buffer, transferring buffers as they fill up.
+     *
+     * This is an alternative to filling the buffers returned by `get_buffer()`
+     * for data that is produced in pieces that don't line up with the buffers,
+     * like rows of an image. Don't mix the two between calls to
+     * `load_image_flush_buffer()`. Data that's still in the current buffer is
+     * transferred by `load_image_end()`.
+     *
+     * @param data The data to append.
+     * @param len The number of bytes to append.
+     */
+    void load_image_write(const uint8_t* data, size_t len);
+
+    /**
+     * @brief Transfer data straight from where it is, without copying it into the SPI buffers.
+     *
+     * Data that's still in the current buffer is transferred first. The data
+     * is queued in pieces of at most the size of an SPI buffer, and must stay
+     * valid until `load_image_end()`. On the ESP32 it must be DMA capable.
+     *
+     * @param data The data to transfer.
+     * @param len The number of bytes to transfer.
      */
-    void load_image_flush_buffer(size_t len);
+    void load_image_write_direct(const uint8_t* data, size_t len);
 
     /**
      * @brief Signal that the whole image has been copied.
      */
     void load_image_end();
 
+    /**
+     * @brief Copy an image from memory to the controller.
+     *
+     * This combines `load_image_start()`, `load_image_flush_buffer()` and
+     * `load_image_end()` for images that are available in memory.
+     *
+     * @param area The dimensions of the image.
+     * @param target_memory_address The target memory address to store the image at.
+     * @param rotate The hardware rotation associated with the image.
+     * @param pixel_format The pixel format of the data.
+     * @param data The first row of the image.
+     * @param stride The number of bytes between the rows of the image.
+     */
+    void load_image(IT8951Area& area, uint32_t target_memory_address, it8951_rotate_t rotate,
+                    it8951_pixel_format_t pixel_format, const uint8_t* data, size_t stride);
+
+    /**
+     * @brief Copy an image to the controller that's rendered in bands.
+     *
+     * The callback is called with as many rows as fit in an SPI transfer
+     * buffer and renders them straight into that buffer. While it renders a
+     * band, the previous band is being transferred. A row must fit in an SPI
+     * transfer buffer.
+     *
+     * @param area The dimensions of the image.
+     * @param target_memory_address The target memory address to store the image at.
+     * @param rotate The hardware rotation associated with the image.
+     * @param pixel_format The pixel format the callback renders in.
+     * @param render The callback that renders the bands.
+     * @param user_data Passed to the callback.
+     */
+    void load_image_render(IT8951Area& area, uint32_t target_memory_address, it8951_rotate_t rotate,
+                           it8951_pixel_format_t pixel_format, it8951_render_cb_t render, void* user_data);
+
+    /**
+     * @brief Start copying raw data to the controller memory.
+     *
+     * Unlike an image, the data is copied as is, e.g. a frame that was read
+     * with `read_memory_start()`. Fill the SPI buffers with `get_buffer()` and
+     * `load_image_flush_buffer()`, or with `load_image_write()`, like when
+     * loading an image, and finish with `write_memory_end()`. Waits for the
+     * refreshes that show this part of the memory.
+     *
+     * The data is in the byte order of the controller memory. Memory words
+     * are little endian and the bus sends the high byte first, so the bytes
+     * of the SPI buffers are swapped before they're transferred.
+     *
+     * @param address The memory address to copy the data to. Must be even.
+     * @param len The number of bytes that will be copied. Must be even.
+     */
+    void write_memory_start(uint32_t address, size_t len);
+
+    /**
+     * @brief Signal that all data has been copied.
+     */
+    void write_memory_end();
+
+    /**
+     * @brief Copy raw data from memory to the controller memory. See `write_memory_start()`.
+     */
+    void write_memory(uint32_t address, const uint8_t* data, size_t len);
+
+    /**
+     * @brief Start reading raw data from the controller memory.
+     *
+     * The data is read into the SPI transfer buffers, which are queued ahead
+     * while the application processes the data of the previous one:
+     *
+     * ```cpp
+     * display.read_memory_start(display.get_memory_address(), display.get_width() * display.get_height());
+     *
+     * size_t len;
+     * while (auto data = display.read_memory_next(len)) {
+     *     fwrite(data, 1, len, file);
+     * }
+     *
+     * display.read_memory_end();
+     * ```
+     *
+     * @param address The memory address to read from. Must be even.
+     * @param len The number of bytes to read. Must be even.
+     */
+    void read_memory_start(uint32_t address, size_t len);
+
+    /**
+     * @brief Get the next part of the data, in the byte order of the controller memory.
+     * @param len Receives the number of bytes, at most the size of an SPI transfer buffer.
+     * @return The data, valid until the next call, or `nullptr` once all data has been read.
+     */
+    const uint8_t* read_memory_next(size_t& len);
+
+    /**
+     * @brief Signal that the data has been read. Data that wasn't read yet is discarded.
+     */
+    void read_memory_end();
+
+    /**
+     * @brief Read raw data from the controller memory into memory. See `read_memory_start()`.
+     */
+    void read_memory(uint32_t address, uint8_t* data, size_t len);
+
     /**
      * @brief Display an image on the screen.
      * @param area The area to show the image.
@@ -158,25 +570,105 @@ public:
     void display_area(IT8951Area& area, uint32_t target_memory_address, it8951_pixel_format_t pixel_format,
                       it8951_display_mode_t mode);
 
+    /**
+     * @brief Gets whether `display_area()` would have to wait for refreshes in progress.
+     *
+     * This is the case when a refresh of an overlapping area is in progress,
+     * or when any refresh is in progress and the update switches between 1 bit
+     * per pixel and the other pixel formats.
+     *
+     * @param area The area to show.
+     * @param pixel_format The pixel format of the image.
+     */
+    bool is_display_blocked(const IT8951Area& area, it8951_pixel_format_t pixel_format);
+
+    /**
+     * @brief Gets whether the waveforms of the panel include a display mode.
+     *
+     * Display modes that aren't supported fall back to a slower mode that
+     * shows the same gray levels.
+     */
+    bool is_mode_supported(it8951_display_mode_t mode);
+
+    /**
+     * @brief Gets the statistics of the last frame shown with `display_area()`.
+     */
+    const IT8951FrameStats& get_frame_stats() { return _last_frame_stats; }
+
+    /**
+     * @brief Gets the cumulative performance counters.
+     */
+    const IT8951PerfCounters& get_perf_counters() { return _perf_counters; }
+
+    /**
+     * @brief Reset the performance counters.
+     */
+    void reset_perf_counters() { _perf_counters = {}; }
+
+    /**
+     * @brief Record the activity of the driver in a trace ring.
+     * @param trace The ring receiving the events, or `nullptr` to stop tracing. It must outlive the driver.
+     */
+    void set_trace(IT8951TraceRing* trace) { _trace = trace; }
+
 private:
+    class BusLock;
+
+    struct Refresh {
+        uint32_t id;
+        IT8951Area area;
+        uint32_t memory_address;
+        IT8951Area memory_area;
+        uint16_t lut_mask;
+        it8951_display_mode_t mode;
+        int64_t start_us;
+        int64_t seen_busy_us;
+    };
+
+    struct PendingFill {
+        uint32_t memory_address;
+        IT8951Area area;
+        uint8_t gray;
+    };
+
+    struct RetainedState {
+        uint32_t magic;
+        uint32_t memory_address;
+        uint16_t width;
+        uint16_t height;
+        uint16_t vcom;
+        uint16_t one_bpp_colors;
+        uint8_t a2_mode;
+        bool one_bpp;
+    };
+
     void reset();
+    bool warm_setup(uint16_t vcom);
+    void store_retained_state();
+    void set_power_state(it8951_power_state_t power_state);
+    void wake();
+    void acquire_bus();
+    void release_bus();
+    void transfer(const uint8_t* tx, uint8_t* rx, size_t len);
     void spi_setup(int clock_speed_hz);
+    int load_spi_clock_speed();
+    bool verify_spi_clock(uint32_t scratch_address, uint8_t* buffer, size_t len);
     void transaction_start();
     void transaction_end();
-    uint8_t read_byte();
     uint16_t read_word();
     void read_array(uint8_t* data, size_t len, bool swap);
-    void write_byte(uint8_t value);
     void write_word(uint16_t value);
     void write_array(uint8_t* data, size_t len, bool swap);
     void delay(int ms);
     uint32_t millis();
     void wait_until_idle();
     uint16_t read_data();
+    void read_data_start();
     void read_data(uint8_t* data, size_t len);
     void write_command(uint16_t command);
+    void write_command(uint16_t command, std::initializer_list<uint16_t> args);
     void write_data(uint16_t data);
-    void write_data(uint8_t* data, size_t len);
+    void write_data(const uint16_t* data, size_t count, bool keep_open);
     uint16_t read_reg(uint16_t reg);
     void write_reg(uint16_t reg, uint16_t value);
     uint32_t idle_timeout() { return 30'000; }
@@ -186,17 +678,64 @@ private:
     void set_vcom(uint16_t vcom);
     void set_target_memory_address(uint32_t target_memory_address);
     void wait_display_ready();
+    void set_one_bpp(bool one_bpp, uint16_t colors);
+    void start_refresh(IT8951Area& area, uint32_t target_memory_address, it8951_display_mode_t mode,
+                       const IT8951Area& memory_area);
+    void update_refreshes(uint16_t lut_status);
+    void complete_refresh(const Refresh& refresh, int64_t now_us);
+    void add_lut_wait(int64_t start_us);
+    void flush_payload();
+    void queue_reads();
+    void trace(it8951_trace_event_t type, uint8_t arg, uint16_t arg2, uint32_t value) {
+        if (_trace) {
+            _trace->record(_transport->get_time_us(), type, arg, arg2, value);
+        }
+    }
+    bool memory_overlaps(uint32_t a_address, const IT8951Area& a, uint32_t b_address, const IT8951Area& b);
+    void write_fills(uint32_t memory_address, const IT8951Area& memory_area, bool overwritten);
+    void write_fill(const PendingFill& fill);
+    void wait_refreshes(const IT8951Area* area, uint32_t memory_address, const IT8951Area* memory_area);
     uint16_t get_mode_value(it8951_display_mode_t mode);
+    static size_t get_row_bytes(uint16_t width, it8951_pixel_format_t pixel_format);
 
+    std::unique_ptr<IT8951Transport> _default_transport;
+    IT8951Transport* _transport{nullptr};
+    size_t _buffer_count{0};
     size_t _buffer_len{0};
-    uint8_t _current_buffer{0};
-    uint8_t* _buffer0{nullptr};
-    uint8_t* _buffer1{nullptr};
-    spi_transaction_t _buffer_transaction{};
-    bool _buffer_transaction_pending{false};
-    spi_device_handle_t _spi{nullptr};
+    std::unique_ptr<uint8_t*[]> _buffers;
+    size_t _current_buffer{0};
+    size_t _buffer_used{0};
+    size_t _buffers_pending{0};
+    bool _swap_payload{false};
+    size_t _read_len{0};
+    size_t _read_queued{0};
+    size_t _read_done{0};
+    bool _read_held{false};
     uint32_t _memory_address{0};
     uint16_t _width{0};
     uint16_t _height{0};
     int _a2_mode{0};
+    uint16_t _vcom{0};
+    bool _warm_started{false};
+    int _spi_clock_hz{0};
+    it8951_power_state_t _power_state{IT8951_POWER_STATE_RUN};
+    int64_t _power_state_since_us{0};
+    it8951_power_state_t _wake_from{IT8951_POWER_STATE_RUN};
+    int64_t _wake_start_us{0};
+    bool _wake_pending{false};
+    int64_t _last_activity_us{0};
+    IT8951PowerStats _power_stats{};
+    bool _pack_write{false};
+    int _bus_acquired{0};
+    bool _one_bpp{false};
+    uint16_t _one_bpp_colors{0};
+    Refresh _refreshes[IT8951_MAX_REFRESHES];
+    size_t _refresh_count{0};
+    uint32_t _last_refresh_id{0};
+    PendingFill _pending_fills[IT8951_MAX_PENDING_FILLS];
+    size_t _pending_fill_count{0};
+    IT8951FrameStats _frame_stats{};
+    IT8951FrameStats _last_frame_stats{};
+    IT8951PerfCounters _perf_counters{};
+    IT8951TraceRing* _trace{nullptr};
 };
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "it8951.h"
+#include "sdkconfig.h"
+
+/**
+ * @brief Number of completed jobs whose timestamps are kept.
+ */
+#define IT8951_JOB_HISTORY 32
+
+/**
+ * @brief Handle of a job submitted to the display task. Handles are never 0.
+ */
+typedef uint32_t it8951_job_t;
+
+/**
+ * @brief Callback that's called by the display task when a job completes.
+ * @param job The job that completed.
+ * @param user_data The pointer passed when the job was submitted.
+ */
+typedef void (*it8951_job_cb_t)(it8951_job_t job, void* user_data);
+
+/**
+ * @brief Timestamps of a job, in microseconds since boot.
+ */
+struct IT8951JobTimes {
+    int64_t submitted_us;  ///< Time the job was submitted.
+    int64_t started_us;    ///< Time the display task started the job, or 0.
+    int64_t done_us;       ///< Time the job completed, or 0.
+    int64_t refreshed_us;  ///< Time the display task saw the refresh started by the job complete, or 0.
+};
+
+/**
+ * @brief Runs the driver in a task of its own, so other tasks don't wait for the controller.
+ *
+ * Once started, the display task owns the driver: uploads, refreshes, fills
+ * and sleep requests are submitted as jobs, which the task runs in the order
+ * they were submitted. Submitting a job returns a handle right away, unless
+ * the job queue is full. The handle can be polled, awaited, or a callback can
+ * be passed that the display task calls when the job completes.
+ *
+ * A job completes when its driver call returns. For display, fill and clear
+ * jobs that is when the refresh has started, not when it is visible; the
+ * display task then polls the controller and records when the refresh
+ * completed in `IT8951JobTimes::refreshed_us`.
+ *
+ * ```cpp
+ * IT8951Async async(display);
+ * async.start();
+ *
+ * async.upload(area, display.get_memory_address(), IT8951_ROTATE_0, IT8951_PIXEL_FORMAT_4BPP, image, area.w / 2);
+ * const auto job = async.display(area, display.get_memory_address(), IT8951_PIXEL_FORMAT_4BPP,
+ *                                IT8951_DISPLAY_MODE_GC16);
+ *
+ * // Keep rendering; reuse the image once the upload is done.
+ *
+ * async.wait(job);
+ * ```
+ *
+ * Image data passed to `upload()` and the render callback passed to
+ * `upload_render()` must stay valid until the upload completes. Don't call
+ * the driver directly while the display task is running.
+ */
+class IT8951Async {
+public:
+    /**
+     * @brief Create an asynchronous front end. Call `start()` to start the display task.
+     * @param display The driver, set up. It must outlive the front end.
+     */
+    explicit IT8951Async(IT8951& display);
+
+    ~IT8951Async();
+
+    /**
+     * @brief Start the display task.
+     *
+     * The defaults are taken from the `IT8951_TASK_PRIORITY`, `IT8951_TASK_CORE`
+     * and `IT8951_TASK_STACK_SIZE` configuration parameters.
+     *
+     * @param priority The priority of the task.
+     * @param core The core to pin the task to, or -1 to let it run on any core.
+     * @param stack_size The stack size of the task in bytes.
+     */
+    void start(UBaseType_t priority = CONFIG_IT8951_TASK_PRIORITY, int core = CONFIG_IT8951_TASK_CORE,
+               uint32_t stack_size = CONFIG_IT8951_TASK_STACK_SIZE);
+
+    /**
+     * @brief Complete the submitted jobs and stop the display task.
+     */
+    void stop();
+
+    /**
+     * @brief Copy an image from memory to the controller. See `IT8951::load_image()`.
+     */
+    it8951_job_t upload(const IT8951Area& area, uint32_t target_memory_address, it8951_rotate_t rotate,
+                        it8951_pixel_format_t pixel_format, const uint8_t* data, size_t stride,
+                        it8951_job_cb_t callback = nullptr, void* user_data = nullptr);
+
+    /**
+     * @brief Copy an image to the controller that's rendered in bands. See `IT8951::load_image_render()`.
+     *
+     * The render callback is called by the display task.
+     */
+    it8951_job_t upload_render(const IT8951Area& area, uint32_t target_memory_address, it8951_rotate_t rotate,
+                               it8951_pixel_format_t pixel_format, it8951_render_cb_t render, void* render_data,
+                               it8951_job_cb_t callback = nullptr, void* user_data = nullptr);
+
+    /**
+     * @brief Display an image on the screen. See `IT8951::display_area()`.
+     *
+     * The job completes when the refresh has started. The time the refresh
+     * completed is recorded in `IT8951JobTimes::refreshed_us`.
+     */
+    it8951_job_t display(const IT8951Area& area, uint32_t target_memory_address, it8951_pixel_format_t pixel_format,
+                         it8951_display_mode_t mode, it8951_job_cb_t callback = nullptr, void* user_data = nullptr);
+
+    /**
+     * @brief Fill an area of the screen with a solid color. See `IT8951::fill_area()`.
+     *
+     * Like `display()`, the job completes when the refresh has started.
+     */
+    it8951_job_t fill(const IT8951Area& area, uint8_t gray, it8951_display_mode_t mode,
+                      it8951_job_cb_t callback = nullptr, void* user_data = nullptr);
+
+    /**
+     * @brief Clear the screen. See `IT8951::clear_screen()`.
+     *
+     * Like `display()`, the job completes when the refresh has started.
+     */
+    it8951_job_t clear(it8951_job_cb_t callback = nullptr, void* user_data = nullptr);
+
+    /**
+     * @brief Put the controller in sleep mode once all refreshes have completed. See `IT8951::set_sleep()`.
+     */
+    it8951_job_t sleep(it8951_job_cb_t callback = nullptr, void* user_data = nullptr);
+
+    /**
+     * @brief Wake the controller from sleep mode. See `IT8951::set_system_run()`.
+     */
+    it8951_job_t wake(it8951_job_cb_t callback = nullptr, void* user_data = nullptr);
+
+    /**
+     * @brief Gets whether a job has completed.
+     */
+    bool is_done(it8951_job_t job) { return int32_t(_completed.load() - job) >= 0; }
+
+    /**
+     * @brief Wait until a job has completed. Several tasks may wait at the same time.
+     * @param job The job.
+     * @param timeout The maximum time to wait.
+     * @return Whether the job completed.
+     */
+    bool wait(it8951_job_t job, TickType_t timeout = portMAX_DELAY);
+
+    /**
+     * @brief Gets the timestamps of a job.
+     *
+     * Timestamps are kept for the last `IT8951_JOB_HISTORY` jobs. Refreshes
+     * still in progress when the display task stops are never recorded as
+     * completed.
+     *
+     * @return Whether the timestamps are still known.
+     */
+    bool get_times(it8951_job_t job, IT8951JobTimes& times);
+
+private:
+    enum class JobType : uint8_t {
+        UPLOAD,
+        UPLOAD_RENDER,
+        DISPLAY,
+        FILL,
+        CLEAR,
+        SLEEP,
+        WAKE,
+        STOP,
+    };
+
+    struct Job {
+        it8951_job_t id;
+        JobType type;
+        IT8951Area area;
+        uint32_t memory_address;
+        it8951_rotate_t rotate;
+        it8951_pixel_format_t pixel_format;
+        it8951_display_mode_t mode;
+        uint8_t gray;
+        const uint8_t* data;
+        size_t stride;
+        it8951_render_cb_t render;
+        void* render_data;
+        it8951_job_cb_t callback;
+        void* user_data;
+    };
+
+    // A refresh started by a job, which the display task polls until it completes.
+    struct PendingRefresh {
+        it8951_job_t job;
+        uint32_t refresh_id;
+    };
+
+    // A task blocked in wait(), signalled once its job has completed.
+    struct Waiter {
+        it8951_job_t job;
+        SemaphoreHandle_t done;
+        Waiter* next;
+    };
+
+    static void task(void* arg);
+    void run();
+    void execute(Job& job);
+    it8951_job_t submit(Job& job);
+    void complete(it8951_job_t job);
+    void update_refreshed();
+    void remove_waiter(Waiter* waiter);
+
+    IT8951& _display;
+    QueueHandle_t _queue{nullptr};
+    SemaphoreHandle_t _submit_lock{nullptr};
+    SemaphoreHandle_t _state_lock{nullptr};  // Guards _submitted, _times and _waiters.
+    EventGroupHandle_t _events{nullptr};
+    TaskHandle_t _task{nullptr};
+    it8951_job_t _submitted{0};
+    std::atomic<it8951_job_t> _completed{0};
+    IT8951JobTimes _times[IT8951_JOB_HISTORY]{};
+    Waiter* _waiters{nullptr};
+    PendingRefresh _pending_refreshes[IT8951_MAX_REFRESHES];
+    size_t _pending_refresh_count{0};
+};
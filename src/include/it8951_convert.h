@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "it8951.h"
+
+/**
+ * @brief Converts 8 bit gray scale pixels into the packed pixel formats of the controller.
+ *
+ * Gray values range from 0x00 (black) to 0xff (white). Before packing, they
+ * go through a tone curve, which by default leaves them unchanged. The curve
+ * can be replaced by a threshold, a gamma curve or a custom lookup table.
+ * Packing is done 32 bits at a time. Without a tone curve, no table lookups
+ * are done at all.
+ *
+ * ```cpp
+ * IT8951Converter converter(IT8951_PIXEL_FORMAT_4BPP);
+ *
+ * converter.set_gamma(0.8f);
+ * converter.load_image(display, area, display.get_memory_address(), gray, area.w);
+ * ```
+ */
+class IT8951Converter {
+public:
+    /**
+     * @brief Create a converter.
+     * @param pixel_format The pixel format to convert to.
+     */
+    explicit IT8951Converter(it8951_pixel_format_t pixel_format);
+
+    /**
+     * @brief Gets the pixel format the converter converts to.
+     */
+    it8951_pixel_format_t get_pixel_format() { return _pixel_format; }
+
+    /**
+     * @brief Map gray values below the threshold to black and the others to white.
+     */
+    void set_threshold(uint8_t threshold);
+
+    /**
+     * @brief Apply a gamma curve. Values below 1 make the image lighter.
+     */
+    void set_gamma(float gamma);
+
+    /**
+     * @brief Apply a custom tone curve.
+     * @param curve 256 gray values indexed by the input gray value.
+     */
+    void set_curve(const uint8_t* curve);
+
+    /**
+     * @brief Remove the tone curve.
+     */
+    void reset_curve() { _has_curve = false; }
+
+    /**
+     * @brief Gets the number of bytes a row of pixels takes, excluding the padding to whole words.
+     */
+    size_t get_row_bytes(size_t pixels);
+
+    /**
+     * @brief Convert pixels.
+     *
+     * Unused bits of the last byte are set to white.
+     *
+     * @param src The gray values.
+     * @param dst The packed pixels.
+     * @param pixels The number of pixels to convert.
+     * @return The number of bytes written.
+     */
+    size_t convert(const uint8_t* src, uint8_t* dst, size_t pixels);
+
+    /**
+     * @brief Convert an image and copy it to the controller.
+     *
+     * Rows are converted straight into the SPI transfer buffers.
+     *
+     * @param display The driver.
+     * @param area The dimensions of the image.
+     * @param target_memory_address The target memory address to store the image at.
+     * @param src The gray values of the first row of the image.
+     * @param stride The number of bytes between the rows of the image.
+     */
+    void load_image(IT8951& display, IT8951Area& area, uint32_t target_memory_address, const uint8_t* src,
+                    size_t stride);
+
+private:
+    it8951_pixel_format_t _pixel_format;
+    int _bpp;
+    bool _has_curve{false};
+    uint8_t _curve[256];
+};
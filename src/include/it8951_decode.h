@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "it8951.h"
+#include "it8951_convert.h"
+#include "it8951_dither.h"
+#include "it8951_inflate.h"
+
+/**
+ * @brief Number of bytes of an image file read at a time.
+ */
+#define IT8951_DECODE_INPUT_LEN 512
+
+/**
+ * @brief Decodes an image file a row at a time, into 8 bit gray scale pixels.
+ *
+ * The file is pulled from a callback as it's decoded, and only the rows
+ * the decoder works on are kept in memory, so images much larger than the
+ * free RAM can be shown. `load_image()` converts the rows straight into the
+ * SPI transfer buffers while the previous rows are being transferred:
+ *
+ * ```cpp
+ * static size_t read_file(uint8_t* data, size_t len, void* user_data) {
+ *     return fread(data, 1, len, (FILE*)user_data);
+ * }
+ *
+ * IT8951PngDecoder decoder(read_file, file);
+ * IT8951Converter converter(IT8951_PIXEL_FORMAT_4BPP);
+ *
+ * if (decoder.start()) {
+ *     IT8951Area area = {
+ *         .x = 0,
+ *         .y = 0,
+ *         .w = std::min(decoder.get_width(), display.get_width()),
+ *         .h = std::min(decoder.get_height(), display.get_height()),
+ *     };
+ *
+ *     decoder.load_image(display, converter, area, display.get_memory_address());
+ *     display.display_area(area, display.get_memory_address(), IT8951_PIXEL_FORMAT_4BPP, IT8951_DISPLAY_MODE_GC16);
+ * }
+ * ```
+ */
+class IT8951ImageDecoder {
+public:
+    /**
+     * @brief Create a decoder.
+     * @param read The callback that reads the file.
+     * @param user_data Passed to the callback.
+     */
+    IT8951ImageDecoder(it8951_read_cb_t read, void* user_data) : _read(read), _user_data(user_data) {}
+
+    virtual ~IT8951ImageDecoder() = default;
+
+    /**
+     * @brief Read the header of the file.
+     * @return Whether the file is an image the decoder supports.
+     */
+    virtual bool start() = 0;
+
+    /**
+     * @brief Gets the width of the image, once started.
+     */
+    uint16_t get_width() { return _width; }
+
+    /**
+     * @brief Gets the height of the image, once started.
+     */
+    uint16_t get_height() { return _height; }
+
+    /**
+     * @brief Decode the next row.
+     * @return The gray values of the row, valid until the next call, or `nullptr` after the last row or on errors.
+     */
+    virtual const uint8_t* read_row() = 0;
+
+    /**
+     * @brief Gets whether the file is corrupt or ended early.
+     */
+    bool has_error() { return _error; }
+
+    /**
+     * @brief Decode the rest of the image, convert it and copy it to the controller.
+     *
+     * Rows are converted straight into the SPI transfer buffers; a row must
+     * fit in a buffer. Rows that don't decode are loaded as white.
+     *
+     * @param display The driver.
+     * @param converter The converter to the pixel format of the image in the controller memory.
+     * @param area Where to store the image. Larger images are cropped to its size.
+     * @param target_memory_address The target memory address to store the image at.
+     * @return Whether the rows decoded.
+     */
+    bool load_image(IT8951& display, IT8951Converter& converter, IT8951Area& area, uint32_t target_memory_address);
+
+    /**
+     * @brief Decode the rest of the image, dither it and copy it to the controller.
+     *
+     * Rows that don't decode are loaded as white.
+     *
+     * @param display The driver.
+     * @param ditherer The ditherer. Its width must be the width of the area.
+     * @param area Where to store the image. Larger images are cropped to its size.
+     * @param target_memory_address The target memory address to store the image at.
+     * @return Whether the rows decoded.
+     */
+    bool load_image(IT8951& display, IT8951Ditherer& ditherer, IT8951Area& area, uint32_t target_memory_address);
+
+protected:
+    bool set_size(uint32_t width, uint32_t height);
+    void fail(const char* reason);
+    int read_byte();
+    size_t read(uint8_t* data, size_t len);
+    bool skip(size_t len);
+
+    uint16_t _width{0};
+    uint16_t _height{0};
+    uint16_t _row{0};
+    bool _error{false};
+    std::unique_ptr<uint8_t[]> _gray;
+
+private:
+    static void render_rows(const IT8951Area& band, uint8_t* buffer, size_t stride, void* user_data);
+
+    it8951_read_cb_t _read;
+    void* _user_data;
+    uint8_t _input[IT8951_DECODE_INPUT_LEN];
+    size_t _input_pos{0};
+    size_t _input_len{0};
+};
+
+/**
+ * @brief Decodes PGM and PBM files, both the binary and the plain text variants.
+ *
+ * 16 bit gray values are reduced to 8 bits. Set bits of PBM files are black.
+ */
+class IT8951PnmDecoder : public IT8951ImageDecoder {
+public:
+    using IT8951ImageDecoder::IT8951ImageDecoder;
+
+    bool start() override;
+    const uint8_t* read_row() override;
+
+private:
+    bool read_number(uint32_t& value, bool single_digit = false);
+    bool read_plain_row();
+    bool read_binary_row();
+
+    char _format{0};
+    uint32_t _max_value{0};
+    uint8_t _scale[256];
+};
+
+/**
+ * @brief Decodes PNG files of any color type and bit depth, except interlaced ones.
+ *
+ * The image data is inflated as the rows are read, so only two rows of the
+ * image and the 32 KB inflate window are kept. Colors are converted to gray
+ * with the weights of ITU-R BT.601, and transparent pixels are blended onto
+ * white. Checksums aren't verified.
+ */
+class IT8951PngDecoder : public IT8951ImageDecoder {
+public:
+    using IT8951ImageDecoder::IT8951ImageDecoder;
+
+    bool start() override;
+    const uint8_t* read_row() override;
+
+private:
+    static size_t read_image_data(uint8_t* data, size_t len, void* user_data);
+    bool read_header(const uint8_t* header);
+    void unfilter(uint8_t* row, const uint8_t* previous);
+    void convert_row(const uint8_t* row);
+
+    IT8951Inflater _inflater;
+    uint8_t _color_type{0};
+    uint8_t _depth{0};
+    size_t _row_len{0};
+    size_t _pixel_len{0};
+    std::unique_ptr<uint8_t[]> _rows;
+    uint8_t* _current{nullptr};
+    uint8_t* _previous{nullptr};
+    bool _has_palette{false};
+    uint8_t _palette[256];
+    uint32_t _data_left{0};
+    bool _data_end{false};
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "it8951.h"
+
+/**
+ * @brief Maximum number of memory addresses the diff engine keeps tile hashes for.
+ */
+#define IT8951_MAX_DIFF_TARGETS 4
+
+/**
+ * @brief Default size of the tiles compared by the diff engine, in pixels.
+ */
+#define IT8951_DEFAULT_DIFF_TILE_SIZE 32
+
+/**
+ * @brief Uploads only the parts of full screen frames that changed.
+ *
+ * This is meant for frames that come from code that doesn't report what it
+ * changed, like decoded images. The diff engine keeps a hash of every tile
+ * of the last frame uploaded to a memory address. A new frame is compared
+ * tile by tile, and only spans of changed tiles are uploaded.
+ *
+ * ```cpp
+ * if (diff.analyze(frame, stride) > 0.5f) {
+ *     diff.upload();
+ *     display.display_area(area, display.get_memory_address(), pixel_format, IT8951_DISPLAY_MODE_GC16);
+ * } else {
+ *     diff.upload();
+ *     diff.display(IT8951_DISPLAY_MODE_GC16);
+ * }
+ * ```
+ *
+ * When the caller still has the previous frame, like the other half of a
+ * double buffer, passing it to `analyze()` compares the tiles word by word
+ * and no change can go unnoticed. Otherwise tiles are compared by a 64 bit
+ * hash. A change then has a chance of about one in 2^64 to go unnoticed and
+ * leave a stale tile on the panel. The hashes take 8 bytes per tile for the
+ * frame being analyzed and for every memory address, e.g. 20 kB each for a
+ * 1872x1404 panel with 32 pixel tiles, which is far less than a copy of the
+ * frame. On the ESP32 a 64 bit multiply costs a few 32 bit ones, which is
+ * small next to loading the frame words from PSRAM.
+ */
+class IT8951FrameDiff {
+public:
+    /**
+     * @brief Create a diff engine. Must be created after `setup()`.
+     * @param display The driver. It must outlive the diff engine.
+     * @param pixel_format The pixel format of the frames.
+     * @param tile_size The width and height of a tile. Must be a multiple of 16.
+     */
+    IT8951FrameDiff(IT8951& display, it8951_pixel_format_t pixel_format,
+                    uint16_t tile_size = IT8951_DEFAULT_DIFF_TILE_SIZE);
+
+    /**
+     * @brief Compare a frame with the last frame uploaded to a memory address.
+     *
+     * The frame must stay valid until `upload()` has been called.
+     *
+     * @param frame The first row of the full screen frame, packed like the image data
+     * passed to `load_image_flush_buffer()`.
+     * @param stride The number of bytes between the rows of the frame.
+     * @param target_memory_address The memory address, or 0 for `get_memory_address()`.
+     * @param previous_frame The frame last uploaded to the memory address by `upload()`,
+     * with the same stride, or nullptr to compare tile hashes instead.
+     * @return The ratio of pixels in changed tiles, from 0 to 1.
+     */
+    float analyze(const uint8_t* frame, size_t stride, uint32_t target_memory_address = 0,
+                  const uint8_t* previous_frame = nullptr);
+
+    /**
+     * @brief Upload the changed parts of the frame passed to `analyze()`.
+     * @return The number of image bytes uploaded.
+     */
+    size_t upload();
+
+    /**
+     * @brief Display the changed parts of the last uploaded frame.
+     * @param mode The mode used to show the areas.
+     */
+    void display(it8951_display_mode_t mode);
+
+    /**
+     * @brief Gets the ratio of pixels in changed tiles of the last analyzed frame.
+     */
+    float get_changed_ratio() { return _changed_ratio; }
+
+    /**
+     * @brief Gets the number of changed areas of the last analyzed frame.
+     */
+    size_t get_area_count() { return _area_count; }
+
+    /**
+     * @brief Gets a changed area of the last analyzed frame.
+     */
+    const IT8951Area& get_area(size_t index) { return _areas[index]; }
+
+    /**
+     * @brief Forget the frame at a memory address, e.g. because it has been overwritten.
+     */
+    void invalidate(uint32_t target_memory_address);
+
+private:
+    struct Target {
+        uint32_t address;
+        bool valid;
+        std::unique_ptr<uint64_t[]> hashes;
+    };
+
+    Target& get_target(uint32_t address);
+    uint64_t hash_tile(const uint8_t* frame, size_t stride, int column, int row);
+    bool same_tile(const uint8_t* frame, const uint8_t* previous_frame, size_t stride, int column, int row);
+
+    IT8951& _display;
+    it8951_pixel_format_t _pixel_format;
+    int _bpp;
+    uint16_t _tile_size;
+    uint16_t _width;
+    uint16_t _height;
+    int _columns;
+    int _rows;
+    Target _targets[IT8951_MAX_DIFF_TARGETS];
+    size_t _next_target{0};
+    std::unique_ptr<uint64_t[]> _hashes;
+    std::unique_ptr<IT8951Area[]> _areas;
+    std::unique_ptr<size_t[]> _open;
+    size_t _area_count{0};
+    float _changed_ratio{0};
+    Target* _target{nullptr};
+    const uint8_t* _frame{nullptr};
+    size_t _stride{0};
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "it8951.h"
+#include "it8951_convert.h"
+
+/**
+ * @brief Dithering method.
+ */
+enum it8951_dither_t : uint8_t {
+    IT8951_DITHER_NONE,             ///< Round to the nearest gray level.
+    IT8951_DITHER_FLOYD_STEINBERG,  ///< Error diffusion with smooth gradients.
+    IT8951_DITHER_ATKINSON,         ///< Error diffusion with more contrast; diffuses only part of the error.
+    IT8951_DITHER_BAYER,            ///< Ordered dithering with an 8x8 matrix. Fastest; has no state.
+};
+
+/**
+ * @brief Dithers 8 bit gray scale images to the gray levels of a pixel format, a row at a time.
+ *
+ * The ditherer keeps at most two rows of error terms, so images can be
+ * dithered while they're being uploaded without having them in memory as a
+ * whole, e.g. while they're being decoded:
+ *
+ * ```cpp
+ * IT8951Ditherer ditherer(IT8951_PIXEL_FORMAT_4BPP, IT8951_DITHER_FLOYD_STEINBERG, area.w);
+ *
+ * display.load_image_start(area, display.get_memory_address(), IT8951_ROTATE_0, IT8951_PIXEL_FORMAT_4BPP);
+ * for (int y = 0; y < area.h; y++) {
+ *     ditherer.load_image_row(display, decode_row(y));
+ * }
+ * display.load_image_end();
+ * ```
+ *
+ * 8 bit per pixel images are dithered to 16 gray levels, the most the
+ * controller shows.
+ */
+class IT8951Ditherer {
+public:
+    /**
+     * @brief Create a ditherer.
+     * @param pixel_format The pixel format to dither to.
+     * @param method The dithering method.
+     * @param width The number of pixels in a row.
+     */
+    IT8951Ditherer(it8951_pixel_format_t pixel_format, it8951_dither_t method, uint16_t width);
+
+    /**
+     * @brief Gets the pixel format the ditherer dithers to.
+     */
+    it8951_pixel_format_t get_pixel_format() { return _pixel_format; }
+
+    /**
+     * @brief Start a new image.
+     */
+    void reset();
+
+    /**
+     * @brief Dither a row.
+     * @param src The gray values of the row.
+     * @param dst The packed pixels.
+     * @return The number of bytes written.
+     */
+    size_t dither_row(const uint8_t* src, uint8_t* dst);
+
+    /**
+     * @brief Dither a row and append it to the image being copied to the controller.
+     *
+     * Call this between `load_image_start()` and `load_image_end()`, once for
+     * every row of the image.
+     */
+    void load_image_row(IT8951& display, const uint8_t* src);
+
+    /**
+     * @brief Dither an image and copy it to the controller.
+     * @param display The driver.
+     * @param area The dimensions of the image. The width must match the width of the ditherer.
+     * @param target_memory_address The target memory address to store the image at.
+     * @param src The gray values of the first row of the image.
+     * @param stride The number of bytes between the rows of the image.
+     */
+    void load_image(IT8951& display, IT8951Area& area, uint32_t target_memory_address, const uint8_t* src,
+                    size_t stride);
+
+private:
+    template <it8951_dither_t Method>
+    void diffuse_row(const uint8_t* src);
+    void bayer_row(const uint8_t* src);
+    void round_row(const uint8_t* src);
+
+    it8951_pixel_format_t _pixel_format;
+    it8951_dither_t _method;
+    uint16_t _width;
+    int _levels;
+    IT8951Converter _converter;
+    uint16_t _row{0};
+    uint8_t _round[256];
+    std::unique_ptr<uint8_t[]> _quantized;
+    std::unique_ptr<uint8_t[]> _packed;
+    std::unique_ptr<int16_t[]> _errors;
+    int16_t* _current_errors{nullptr};
+    int16_t* _next_errors{nullptr};
+};
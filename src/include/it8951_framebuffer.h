@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "it8951.h"
+#include "it8951_convert.h"
+
+/**
+ * @brief Maximum number of dirty areas the framebuffer tracks before merging them.
+ */
+#define IT8951_MAX_DIRTY_AREAS 16
+
+/**
+ * @brief Default cost of an additional upload and refresh, in bytes.
+ */
+#define IT8951_DEFAULT_MERGE_OVERHEAD 1024
+
+/**
+ * @brief Framebuffer that keeps a copy of the screen and uploads only what changed.
+ *
+ * Drawing is done into a shadow buffer in the memory of the ESP32. The
+ * framebuffer keeps track of the areas that have been drawn to. `commit()`
+ * merges these into a few areas and uploads and displays only those.
+ *
+ * Gray values range from 0x00 (black) to 0xff (white) and are reduced to the
+ * pixel format of the framebuffer. The shadow buffer starts out white, like
+ * the screen after `clear_screen()`.
+ */
+class IT8951Framebuffer {
+public:
+    /**
+     * @brief Create a framebuffer for the whole screen. Must be created after `setup()`.
+     * @param display The driver. It must outlive the framebuffer.
+     * @param pixel_format The pixel format of the shadow buffer and the uploads.
+     */
+    IT8951Framebuffer(IT8951& display, it8951_pixel_format_t pixel_format);
+
+    /**
+     * @brief Gets the shadow buffer. Call `mark_dirty()` after changing it directly.
+     *
+     * Pixels are packed with the first pixel in the most significant bits of a byte.
+     */
+    uint8_t* get_buffer() { return _buffer.get(); }
+
+    /**
+     * @brief Gets the number of bytes in a row of the shadow buffer.
+     */
+    size_t get_scan_line() { return _scan_line; }
+
+    /**
+     * @brief Gets the pixel format of the shadow buffer.
+     */
+    it8951_pixel_format_t get_pixel_format() { return _pixel_format; }
+
+    /**
+     * @brief Set a pixel.
+     */
+    void set_pixel(uint16_t x, uint16_t y, uint8_t gray);
+
+    /**
+     * @brief Fill an area with a gray value.
+     */
+    void fill_rect(const IT8951Area& area, uint8_t gray);
+
+    /**
+     * @brief Draw an image with one byte per pixel.
+     * @param area The area to draw the image in.
+     * @param data The gray values of the image.
+     * @param stride The number of bytes between the rows of the image.
+     */
+    void draw_gray8(const IT8951Area& area, const uint8_t* data, size_t stride);
+
+    /**
+     * @brief Mark an area as changed.
+     */
+    void mark_dirty(const IT8951Area& area);
+
+    /**
+     * @brief Gets the number of dirty areas that haven't been committed.
+     */
+    size_t get_dirty_count() { return _dirty_count; }
+
+    /**
+     * @brief Set the cost of an additional upload and refresh, in bytes.
+     *
+     * Two dirty areas are merged when uploading the bytes of the merged area
+     * costs less than uploading both areas plus this overhead. Larger values
+     * give fewer, larger uploads.
+     */
+    void set_merge_overhead(size_t bytes) { _merge_overhead = bytes; }
+
+    /**
+     * @brief Upload and display the dirty areas.
+     * @param mode The mode used to show the areas.
+     * @param target_memory_address The memory address to upload to, or 0 for `get_memory_address()`.
+     * @return The number of image bytes uploaded.
+     */
+    size_t commit(it8951_display_mode_t mode, uint32_t target_memory_address = 0);
+
+private:
+    void fill_row(uint16_t y, uint16_t x0, uint16_t x1, uint8_t level);
+    uint8_t get_level(uint8_t gray);
+    IT8951Area align(const IT8951Area& area);
+    size_t get_row_bytes(uint16_t w);
+    size_t get_cost(const IT8951Area& area);
+    void merge(size_t a, size_t b);
+    bool find_merge(size_t& a, size_t& b, bool force);
+
+    IT8951& _display;
+    it8951_pixel_format_t _pixel_format;
+    IT8951Converter _converter;
+    int _bpp;
+    uint16_t _pixels_per_word;
+    uint16_t _width;
+    uint16_t _height;
+    size_t _scan_line;
+    std::unique_ptr<uint8_t[]> _buffer;
+    IT8951Area _dirty[IT8951_MAX_DIRTY_AREAS + 1];
+    size_t _dirty_count{0};
+    size_t _merge_overhead{IT8951_DEFAULT_MERGE_OVERHEAD};
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "it8951.h"
+
+/**
+ * @brief Default size of the tiles ghosting is tracked in, in pixels.
+ */
+#define IT8951_DEFAULT_GHOST_TILE_SIZE 32
+
+/**
+ * @brief Default number of fast updates a tile takes before it's cleaned up.
+ */
+#define IT8951_DEFAULT_GHOST_BUDGET 16
+
+/**
+ * @brief Maximum number of areas a cleanup refreshes before they're merged.
+ */
+#define IT8951_MAX_CLEANUP_AREAS 16
+
+/**
+ * @brief Statistics of the ghosting tracker.
+ */
+struct IT8951GhostStats {
+    uint32_t cleanup_refreshes;  ///< Number of cleanup refreshes started.
+    uint32_t cleaned_tiles;      ///< Number of tiles refreshed by cleanups.
+    uint32_t saved_tiles;        ///< Number of tiles over budget that were cleaned by a GC16 or INIT update instead.
+    uint32_t piggybacked;        ///< Number of deferred cleanups started together with a GC16 or INIT update.
+};
+
+/**
+ * @brief Keeps track of the ghosting left by fast updates and cleans up only where needed.
+ *
+ * A2, DU and DU4 updates leave an after image. Instead of clearing the whole
+ * screen every so many updates, the tracker counts the fast updates of every
+ * tile of the screen and refreshes only the tiles that went over their
+ * budget. GC16, GLR16, GLD16 and INIT updates reset the count of the tiles
+ * they cover.
+ *
+ * Cleanups refresh the image in the controller memory again, so the screen
+ * image must be kept at one memory address, like uploads at the coordinates
+ * of the area do:
+ *
+ * ```cpp
+ * IT8951GhostTracker tracker(display, display.get_memory_address(), IT8951_PIXEL_FORMAT_1BPP);
+ *
+ * display.display_area(area, display.get_memory_address(), IT8951_PIXEL_FORMAT_1BPP, IT8951_DISPLAY_MODE_A2);
+ * tracker.record(area, IT8951_DISPLAY_MODE_A2);
+ * ```
+ *
+ * Cleanups start as soon as a tile goes over budget. When they're deferred,
+ * they start when `cleanup()` is called, e.g. when the application is idle,
+ * or together with the next GC16 or INIT update, which flashes the screen
+ * anyway.
+ */
+class IT8951GhostTracker {
+public:
+    /**
+     * @brief Create a tracker. Must be created after `setup()`.
+     * @param display The driver. It must outlive the tracker.
+     * @param target_memory_address The memory address of the screen image.
+     * @param pixel_format The pixel format of the screen image.
+     * @param tile_size The width and height of a tile. Must be a multiple of 16.
+     */
+    IT8951GhostTracker(IT8951& display, uint32_t target_memory_address, it8951_pixel_format_t pixel_format,
+                       uint16_t tile_size = IT8951_DEFAULT_GHOST_TILE_SIZE);
+
+    /**
+     * @brief Set the number of fast updates a tile takes before it's cleaned up.
+     */
+    void set_budget(uint16_t budget) { _budget = budget; }
+
+    /**
+     * @brief Set the mode of cleanups.
+     *
+     * With INIT, the area is cleared before it's refreshed with GC16. This
+     * removes more of the after image, but takes much longer and waits for
+     * the INIT refresh to complete.
+     *
+     * @param mode GC16 or INIT.
+     */
+    void set_cleanup_mode(it8951_display_mode_t mode) { _cleanup_mode = mode; }
+
+    /**
+     * @brief Set whether cleanups wait for `cleanup()` or the next GC16 or INIT update.
+     */
+    void set_deferred(bool deferred) { _deferred = deferred; }
+
+    /**
+     * @brief Record an update of the screen. Call after `display_area()`.
+     *
+     * Starts the cleanups that are due unless they're deferred.
+     */
+    void record(const IT8951Area& area, it8951_display_mode_t mode);
+
+    /**
+     * @brief Mark the whole screen as clean, e.g. after `clear_screen()`.
+     */
+    void reset();
+
+    /**
+     * @brief Gets whether tiles are over budget and waiting for a cleanup.
+     */
+    bool has_pending_cleanup() { return _pending; }
+
+    /**
+     * @brief Refresh the tiles that are over budget.
+     * @return The number of refreshes started.
+     */
+    size_t cleanup();
+
+    /**
+     * @brief Gets the statistics of the tracker.
+     */
+    const IT8951GhostStats& get_stats() { return _stats; }
+
+private:
+    bool covers(const IT8951Area& area, int column, int row);
+    IT8951Area get_tiles_area(int first_column, int last_column, int first_row, int last_row);
+
+    IT8951& _display;
+    uint32_t _memory_address;
+    it8951_pixel_format_t _pixel_format;
+    uint16_t _tile_size;
+    uint16_t _columns;
+    uint16_t _rows;
+    uint16_t _budget{IT8951_DEFAULT_GHOST_BUDGET};
+    it8951_display_mode_t _cleanup_mode{IT8951_DISPLAY_MODE_GC16};
+    bool _deferred{false};
+    bool _pending{false};
+    std::unique_ptr<uint16_t[]> _counts;
+    IT8951GhostStats _stats{};
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief Size of the window of previous output that compressed data refers back to.
+ */
+#define IT8951_INFLATE_WINDOW 32768
+
+/**
+ * @brief Number of bytes of compressed data read at a time.
+ */
+#define IT8951_INFLATE_INPUT_LEN 512
+
+/**
+ * @brief Callback that reads the next bytes of a stream.
+ * @param data Where to store the bytes.
+ * @param len The maximum number of bytes to read.
+ * @param user_data The pointer passed along with the callback.
+ * @return The number of bytes read, or 0 at the end of the stream.
+ */
+typedef size_t (*it8951_read_cb_t)(uint8_t* data, size_t len, void* user_data);
+
+/**
+ * @brief Decompresses zlib and raw deflate streams, as much output as is asked for at a time.
+ *
+ * Compressed data is pulled from a callback as it's needed, so neither the
+ * compressed nor the decompressed data have to be in memory as a whole. The
+ * inflater keeps the 32 KB window of previous output, an input buffer and
+ * the Huffman tables of the current block. Checksums aren't verified.
+ *
+ * ```cpp
+ * IT8951Inflater inflater;
+ *
+ * inflater.start(read_file, file, true);
+ * while (size_t len = inflater.read(row, sizeof(row))) {
+ *     // ...
+ * }
+ * ```
+ */
+class IT8951Inflater {
+public:
+    IT8951Inflater();
+
+    /**
+     * @brief Start decompressing a stream.
+     * @param read The callback that reads the compressed data.
+     * @param user_data Passed to the callback.
+     * @param zlib Whether the stream has a zlib header, like the image data of a PNG file.
+     */
+    void start(it8951_read_cb_t read, void* user_data, bool zlib);
+
+    /**
+     * @brief Decompress the next bytes.
+     * @param data Where to store the bytes.
+     * @param len The number of bytes to decompress.
+     * @return The number of bytes decompressed, less than `len` only at the end of the stream or on errors.
+     */
+    size_t read(uint8_t* data, size_t len);
+
+    /**
+     * @brief Gets whether the end of the stream was reached.
+     */
+    bool is_done() { return _state == State::DONE; }
+
+    /**
+     * @brief Gets whether the stream is corrupt or ended early.
+     */
+    bool has_error() { return _state == State::ERROR; }
+
+private:
+    // Codes up to this length are decoded with a single table lookup.
+    static const int FAST_BITS = 10;
+    static const int MAX_BITS = 15;
+
+    enum class State : uint8_t {
+        ZLIB_HEADER,
+        HEADER,
+        STORED,
+        CODES,
+        DONE,
+        ERROR,
+    };
+
+    struct Huffman {
+        uint16_t fast[1 << FAST_BITS];  // Symbol << 4 | length, or 0 for longer codes.
+        uint16_t count[MAX_BITS + 1];   // Number of codes of each length.
+        uint16_t symbol[288];           // Symbols ordered by their codes.
+    };
+
+    bool build(Huffman& huffman, const uint8_t* lengths, int count);
+    bool read_header();
+    bool read_dynamic_tables();
+    int decode(const Huffman& huffman);
+    void refill();
+    uint32_t get_bits(int count);
+    void fail();
+
+    it8951_read_cb_t _read{nullptr};
+    void* _user_data{nullptr};
+    State _state{State::DONE};
+    bool _last_block{false};
+    std::unique_ptr<uint8_t[]> _window;
+    size_t _window_pos{0};
+    size_t _total{0};
+    uint32_t _copy_len{0};
+    uint32_t _copy_distance{0};
+    uint32_t _stored_len{0};
+
+    uint8_t _input[IT8951_INFLATE_INPUT_LEN];
+    size_t _input_pos{0};
+    size_t _input_len{0};
+    bool _input_end{false};
+    uint64_t _bits{0};
+    int _bit_count{0};
+    int _padding_bits{0};
+
+    std::unique_ptr<Huffman> _lengths;
+    std::unique_ptr<Huffman> _distances;
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "it8951.h"
+#include "it8951_convert.h"
+#include "lvgl.h"
+
+/**
+ * @brief Maximum number of areas an LVGL refresh shows before they're merged.
+ */
+#define IT8951_LVGL_MAX_AREAS 16
+
+/**
+ * @brief Default number of rows in the LVGL draw buffer.
+ */
+#define IT8951_LVGL_DEFAULT_BUFFER_ROWS 32
+
+/**
+ * @brief LVGL 9 display driver using partial rendering.
+ *
+ * LVGL renders the invalidated areas of the screen in bands into a draw
+ * buffer. Every band is converted to the pixel format of the driver straight
+ * into the SPI transfer buffers, so there's no copy of the band in between.
+ * Once LVGL has rendered all areas, they're shown on the screen.
+ *
+ * The draw buffer can be `LV_COLOR_FORMAT_L8`, which is the default, or one
+ * of the 16, 24 and 32 bit RGB formats, which are converted to gray values
+ * first. The converter applies its tone curve to the gray values, e.g. a
+ * threshold for 1 bit per pixel.
+ *
+ * This driver is only built when LVGL is part of the project.
+ *
+ * ```cpp
+ * lv_init();
+ *
+ * IT8951Lvgl lvgl(display, IT8951_PIXEL_FORMAT_4BPP, IT8951_DISPLAY_MODE_GC16);
+ * lvgl.create();
+ * ```
+ */
+class IT8951Lvgl {
+public:
+    /**
+     * @brief Create a display driver. Must be created after `setup()`.
+     * @param display The driver. It must outlive the display driver.
+     * @param pixel_format The pixel format images are uploaded in.
+     * @param mode The mode used to show the rendered areas.
+     */
+    IT8951Lvgl(IT8951& display, it8951_pixel_format_t pixel_format, it8951_display_mode_t mode);
+
+    ~IT8951Lvgl();
+
+    /**
+     * @brief Create the LVGL display. Call after `lv_init()`.
+     * @param buffer_rows The number of rows in the draw buffer.
+     * @param color_format The color format LVGL renders in.
+     * @return The LVGL display.
+     */
+    lv_display_t* create(uint16_t buffer_rows = IT8951_LVGL_DEFAULT_BUFFER_ROWS,
+                         lv_color_format_t color_format = LV_COLOR_FORMAT_L8);
+
+    /**
+     * @brief Gets the LVGL display, or `nullptr` before `create()`.
+     */
+    lv_display_t* get_lv_display() { return _lv_display; }
+
+    /**
+     * @brief Gets the converter, e.g. to set a threshold or gamma curve.
+     */
+    IT8951Converter& get_converter() { return _converter; }
+
+    /**
+     * @brief Set the mode used to show the rendered areas.
+     */
+    void set_display_mode(it8951_display_mode_t mode) { _mode = mode; }
+
+private:
+    static void flush_cb(lv_display_t* disp, const lv_area_t* area, uint8_t* px_map);
+    static void invalidate_area_cb(lv_event_t* e);
+    static void render_band(const IT8951Area& band, uint8_t* buffer, size_t stride, void* user_data);
+    void flush(const lv_area_t* area, uint8_t* px_map);
+    void add_area(const IT8951Area& area);
+    void show_areas();
+    const uint8_t* get_gray_row(const uint8_t* src, uint16_t width);
+
+    IT8951& _display;
+    it8951_pixel_format_t _pixel_format;
+    it8951_display_mode_t _mode;
+    IT8951Converter _converter;
+    uint16_t _pixels_per_word;
+    uint16_t _width;
+    lv_display_t* _lv_display{nullptr};
+    lv_color_format_t _color_format{LV_COLOR_FORMAT_L8};
+    uint8_t _bytes_per_pixel{1};
+    std::unique_ptr<uint8_t[]> _draw_buffer;
+    std::unique_ptr<uint8_t[]> _gray;
+    const uint8_t* _px_map{nullptr};
+    size_t _px_stride{0};
+    uint16_t _px_y{0};
+    IT8951Area _areas[IT8951_LVGL_MAX_AREAS];
+    size_t _area_count{0};
+};
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "it8951.h"
+
+/**
+ * @brief Maximum number of image slots the memory allocator hands out.
+ */
+#define IT8951_MAX_SLOTS 32
+
+/**
+ * @brief Handle of an image slot that couldn't be allocated.
+ */
+#define IT8951_INVALID_SLOT -1
+
+/**
+ * @brief Allocator for image slots in the memory of the controller.
+ *
+ * Images are stored in the memory of the controller with a pitch of the
+ * panel width, regardless of the pixel format. A slot therefore holds whole
+ * rows: an image of `area` takes `area.h * get_width()` bytes. The address
+ * of a slot is offset so that the image can be loaded and displayed with the
+ * coordinates of its area, e.g.:
+ *
+ * ```cpp
+ * display.load_image_start(area, allocator.get_address(slot), IT8951_ROTATE_0, pixel_format);
+ * display.display_area(area, allocator.get_address(slot), pixel_format, mode);
+ * ```
+ */
+class IT8951MemoryAllocator {
+public:
+    /**
+     * @brief Create an allocator for the memory after the default image buffer.
+     *
+     * The first full screen image at `get_memory_address()` is left for normal
+     * use. Must be created after `setup()`.
+     */
+    explicit IT8951MemoryAllocator(IT8951& display);
+
+    /**
+     * @brief Create an allocator for a range of the controller memory.
+     * @param start The first address of the range.
+     * @param end The end of the range.
+     * @param pitch The number of bytes in a row of an image, i.e. the panel width.
+     */
+    IT8951MemoryAllocator(uint32_t start, uint32_t end, uint16_t pitch);
+
+    /**
+     * @brief Allocate a slot for an image.
+     * @param area The area of the image.
+     * @param pixel_format The pixel format of the image.
+     * @return The slot, or `IT8951_INVALID_SLOT` if there isn't enough memory.
+     */
+    int allocate(const IT8951Area& area, it8951_pixel_format_t pixel_format);
+
+    /**
+     * @brief Free a slot.
+     */
+    void free(int slot);
+
+    /**
+     * @brief Gets the memory address to load and display the image of a slot.
+     */
+    uint32_t get_address(int slot);
+
+    /**
+     * @brief Gets the area of the image of a slot.
+     */
+    const IT8951Area& get_area(int slot);
+
+    /**
+     * @brief Gets the pixel format of the image of a slot.
+     */
+    it8951_pixel_format_t get_pixel_format(int slot);
+
+    /**
+     * @brief Gets the number of bytes that aren't allocated.
+     *
+     * The memory may be fragmented, so an allocation of this size can still fail.
+     */
+    size_t get_free_size();
+
+private:
+    struct Slot {
+        bool used;
+        uint32_t start;
+        uint32_t size;
+        IT8951Area area;
+        it8951_pixel_format_t pixel_format;
+    };
+
+    bool is_free(uint32_t start, uint32_t size);
+
+    uint32_t _start;
+    uint32_t _end;
+    uint16_t _pitch;
+    Slot _slots[IT8951_MAX_SLOTS]{};
+};
+
+/**
+ * @brief Cache of images that have been uploaded to the controller.
+ *
+ * Images are identified by an id chosen by the application, e.g. a page
+ * number or a screen of the user interface. Showing a cached image doesn't
+ * transfer any pixels. When memory runs out, the least recently used images
+ * are evicted.
+ */
+class IT8951FrameCache {
+public:
+    /**
+     * @brief Create a cache.
+     * @param display The driver. It must outlive the cache.
+     * @param allocator The allocator to store images in. It must outlive the cache.
+     */
+    IT8951FrameCache(IT8951& display, IT8951MemoryAllocator& allocator);
+
+    /**
+     * @brief Check whether an image is cached.
+     */
+    bool contains(uint32_t id);
+
+    /**
+     * @brief Start uploading an image into the cache.
+     *
+     * Replaces the cached image with the same id. Continue the upload the
+     * same way as after `IT8951::load_image_start()` and finish it with
+     * `load_end()`.
+     *
+     * @param id The id of the image.
+     * @param area The area of the image.
+     * @param rotate The hardware rotation associated with the image.
+     * @param pixel_format The pixel format of the image.
+     * @return Whether memory could be allocated for the image. If not, nothing is uploaded.
+     */
+    bool load_start(uint32_t id, IT8951Area& area, it8951_rotate_t rotate, it8951_pixel_format_t pixel_format);
+
+    /**
+     * @brief Finish uploading the image started with `load_start()`.
+     */
+    void load_end();
+
+    /**
+     * @brief Show a cached image.
+     * @param id The id of the image.
+     * @param mode The mode used to show the image.
+     * @return Whether the image was cached. If not, nothing is shown.
+     */
+    bool show(uint32_t id, it8951_display_mode_t mode);
+
+    /**
+     * @brief Remove an image from the cache.
+     */
+    void remove(uint32_t id);
+
+    /**
+     * @brief Remove all images from the cache.
+     */
+    void clear();
+
+private:
+    struct Entry {
+        uint32_t id;
+        int slot;
+        uint32_t last_used;
+    };
+
+    Entry* find(uint32_t id);
+    bool evict();
+
+    IT8951& _display;
+    IT8951MemoryAllocator& _allocator;
+    Entry _entries[IT8951_MAX_SLOTS]{};
+    size_t _entry_count{0};
+    Entry* _loading{nullptr};
+    uint32_t _clock{0};
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "it8951.h"
+
+/**
+ * @brief Identifies a packed image, "I8PK" in file order.
+ */
+#define IT8951_PACKED_IMAGE_MAGIC 0x4b503849
+
+/**
+ * @brief Version of the packed image layout.
+ */
+#define IT8951_PACKED_IMAGE_VERSION 1
+
+/**
+ * @brief Flag of packed images whose rows are run length encoded.
+ */
+#define IT8951_PACKED_IMAGE_RLE 0x0001
+
+/**
+ * @brief Maximum length of the name of a packed image, including the terminating zero.
+ */
+#define IT8951_PACKED_IMAGE_NAME_LEN 16
+
+/**
+ * @brief Header of an image packed in the format the controller loads.
+ *
+ * The rows of the image follow the header as `load_image()` transfers them,
+ * `stride` bytes each, padded to whole words. With `IT8951_PACKED_IMAGE_RLE`,
+ * every row is encoded on its own with PackBits: a control byte `n` below
+ * 128 is followed by `n + 1` bytes that are copied as is, and a control byte
+ * above 128 by a byte that's repeated `257 - n` times. Images are stored
+ * back to back, each padded to a multiple of 4 bytes. All fields are little
+ * endian.
+ */
+struct IT8951PackedImageHeader {
+    uint32_t magic;                           ///< `IT8951_PACKED_IMAGE_MAGIC`.
+    uint16_t version;                         ///< `IT8951_PACKED_IMAGE_VERSION`.
+    uint16_t flags;                           ///< `IT8951_PACKED_IMAGE_RLE` or 0.
+    char name[IT8951_PACKED_IMAGE_NAME_LEN];  ///< Name of the image, zero terminated.
+    uint16_t x;                               ///< Where the image is meant to be shown.
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+    uint8_t pixel_format;  ///< An `it8951_pixel_format_t`.
+    uint8_t reserved[3];
+    uint32_t stride;     ///< Number of bytes of a row, including the padding.
+    uint32_t data_size;  ///< Number of bytes of image data after the header.
+};
+
+/**
+ * @brief Images packed back to back in memory, e.g. a mapped flash partition or file.
+ *
+ * Packed images are stored as the controller loads them, so showing one
+ * doesn't convert pixels. Images that aren't run length encoded are
+ * transferred straight from where they are when that memory is DMA capable,
+ * and copied into the SPI buffers once otherwise:
+ *
+ * ```cpp
+ * IT8951PackedImages images(data, size, false);
+ *
+ * if (auto image = images.find("splash")) {
+ *     auto area = images.get_area(image);
+ *
+ *     images.load(display, image, display.get_memory_address());
+ *     display.display_area(area, display.get_memory_address(), images.get_pixel_format(image),
+ *                          IT8951_DISPLAY_MODE_GC16);
+ * }
+ * ```
+ *
+ * The `host/pack_images.py` script packs PGM and PNG files.
+ */
+class IT8951PackedImages {
+public:
+    /**
+     * @brief Create a view of packed images.
+     *
+     * The images end at the first one that isn't complete, so the memory
+     * may be larger than the images, like a flash partition.
+     *
+     * @param data The first image. It must stay valid while the images are used.
+     * @param size The number of bytes of the images.
+     * @param dma_capable Whether SPI transfers can read the memory directly.
+     */
+    IT8951PackedImages(const uint8_t* data, size_t size, bool dma_capable)
+        : _data(data), _size(size), _dma_capable(dma_capable) {}
+
+    /**
+     * @brief Gets the number of images.
+     */
+    size_t get_count();
+
+    /**
+     * @brief Gets the first image, or `nullptr` if there is none.
+     */
+    const IT8951PackedImageHeader* first() { return get(_data); }
+
+    /**
+     * @brief Gets the image after an image, or `nullptr` after the last one.
+     */
+    const IT8951PackedImageHeader* next(const IT8951PackedImageHeader* image);
+
+    /**
+     * @brief Gets an image by its name, or `nullptr` if there is no such image.
+     */
+    const IT8951PackedImageHeader* find(const char* name);
+
+    /**
+     * @brief Gets the area an image is meant to be shown at.
+     */
+    static IT8951Area get_area(const IT8951PackedImageHeader* image);
+
+    /**
+     * @brief Gets the pixel format of an image.
+     */
+    static it8951_pixel_format_t get_pixel_format(const IT8951PackedImageHeader* image) {
+        return (it8951_pixel_format_t)image->pixel_format;
+    }
+
+    /**
+     * @brief Copy an image to the controller.
+     * @param display The driver.
+     * @param image The image.
+     * @param target_memory_address The target memory address to store the image at.
+     * @return Whether the image was intact. Rows that don't decode are loaded as black.
+     */
+    bool load(IT8951& display, const IT8951PackedImageHeader* image, uint32_t target_memory_address);
+
+    /**
+     * @brief Gets the number of image bytes the last `load()` copied into the SPI buffers.
+     */
+    size_t get_copied_bytes() { return _copied_bytes; }
+
+private:
+    const IT8951PackedImageHeader* get(const uint8_t* data);
+    bool load_rle(IT8951& display, const IT8951PackedImageHeader* image);
+
+    const uint8_t* _data;
+    size_t _size;
+    bool _dma_capable;
+    size_t _copied_bytes{0};
+};
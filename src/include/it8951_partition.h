@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "esp_partition.h"
+#include "it8951_packed.h"
+
+/**
+ * @brief Packed images in a data partition that's mapped into the address space.
+ *
+ * The partition is flashed with the output of `host/pack_images.py`:
+ *
+ * ```
+ * images,   data, 0x40,    ,        1M,
+ * ```
+ *
+ * ```sh
+ * parttool.py write_partition --partition-name images --input images.bin
+ * ```
+ *
+ * Mapping the partition costs no RAM; the images are read from flash while
+ * they're transferred to the controller.
+ */
+class IT8951PartitionImages {
+public:
+    IT8951PartitionImages() = default;
+    IT8951PartitionImages(const IT8951PartitionImages&) = delete;
+    IT8951PartitionImages& operator=(const IT8951PartitionImages&) = delete;
+
+    ~IT8951PartitionImages() { close(); }
+
+    /**
+     * @brief Map a data partition of packed images.
+     * @param label The label of the partition in the partition table.
+     * @return Whether the partition was found and mapped.
+     */
+    bool open(const char* label);
+
+    /**
+     * @brief Unmap the partition.
+     */
+    void close();
+
+    /**
+     * @brief Gets the images of the partition.
+     */
+    IT8951PackedImages get_images() { return IT8951PackedImages(_data, _size, _dma_capable); }
+
+private:
+    const uint8_t* _data{nullptr};
+    size_t _size{0};
+    bool _dma_capable{false};
+    esp_partition_mmap_handle_t _handle{0};
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "it8951.h"
+#include "sdkconfig.h"
+
+/**
+ * @brief Maximum number of SPI transfer buffers the pipeline passes around.
+ */
+#define IT8951_MAX_PIPELINE_BUFFERS 16
+
+/**
+ * @brief Timings of the last pipelined upload, in microseconds.
+ */
+struct IT8951PipelineStats {
+    uint32_t bands;             ///< Number of bands rendered and transferred.
+    int64_t render_us;          ///< Time spent in the render callback.
+    int64_t producer_stall_us;  ///< Time the producer waited for a free buffer, because the bus was busy.
+    int64_t consumer_stall_us;  ///< Time the bus was idle, waiting for the producer. Includes the first band.
+    int64_t total_us;           ///< Time from the start to the end of the upload.
+};
+
+/**
+ * @brief Uploads images that are rendered on one core while the other core drives the SPI bus.
+ *
+ * `IT8951::load_image_render()` renders a band and queues its transfer from
+ * the same task, so rendering and queueing transfers take turns. The
+ * pipeline moves rendering to a producer task pinned to another core. The
+ * producer renders bands into the SPI transfer buffers, and the task calling
+ * `upload()` queues their transfers as soon as they're ready and hands the
+ * buffers back once they've been transferred. The buffers are passed between
+ * the two through a lock-free single producer, single consumer ring, in the
+ * order of the driver's own ring of transfer buffers.
+ *
+ * ```cpp
+ * IT8951Pipeline pipeline(display);
+ * pipeline.start();
+ *
+ * pipeline.upload(area, display.get_memory_address(), IT8951_ROTATE_0, IT8951_PIXEL_FORMAT_4BPP, render, nullptr);
+ *
+ * const auto& stats = pipeline.get_stats();
+ * ```
+ *
+ * The render callback runs on the producer task and only the task calling
+ * `upload()` talks to the controller. The two tasks wake each other with
+ * task notifications, so don't use the notification of the task calling
+ * `upload()` for anything else. The stall times of the last upload
+ * show which side is the bottleneck: when the bus stays busy, the consumer
+ * only stalls on the first band.
+ */
+class IT8951Pipeline {
+public:
+    /**
+     * @brief Create a pipeline. Call `start()` to start the producer task.
+     * @param display The driver, set up. It must outlive the pipeline.
+     */
+    explicit IT8951Pipeline(IT8951& display) : _display(display) {}
+
+    ~IT8951Pipeline();
+
+    /**
+     * @brief Start the producer task.
+     *
+     * The defaults are taken from the `IT8951_PRODUCER_CORE`, `IT8951_TASK_PRIORITY`
+     * and `IT8951_TASK_STACK_SIZE` configuration parameters.
+     *
+     * @param core The core to pin the producer task to. Should be another core than the one calling `upload()`.
+     * @param priority The priority of the task.
+     * @param stack_size The stack size of the task in bytes.
+     */
+    void start(int core = CONFIG_IT8951_PRODUCER_CORE, UBaseType_t priority = CONFIG_IT8951_TASK_PRIORITY,
+               uint32_t stack_size = CONFIG_IT8951_TASK_STACK_SIZE);
+
+    /**
+     * @brief Stop the producer task.
+     */
+    void stop();
+
+    /**
+     * @brief Copy an image to the controller that's rendered in bands on the producer task.
+     *
+     * Bands are rendered like `IT8951::load_image_render()` does. Returns when the
+     * image has been transferred.
+     *
+     * @param area The dimensions of the image.
+     * @param target_memory_address The target memory address to store the image at.
+     * @param rotate The hardware rotation associated with the image.
+     * @param pixel_format The pixel format the callback renders in.
+     * @param render The callback that renders the bands.
+     * @param user_data Passed to the callback.
+     */
+    void upload(IT8951Area& area, uint32_t target_memory_address, it8951_rotate_t rotate,
+                it8951_pixel_format_t pixel_format, it8951_render_cb_t render, void* user_data);
+
+    /**
+     * @brief Gets the timings of the last upload.
+     */
+    const IT8951PipelineStats& get_stats() { return _stats; }
+
+private:
+    static void task(void* arg);
+    void run();
+    void produce();
+    void consume();
+
+    IT8951& _display;
+    TaskHandle_t _producer{nullptr};
+    TaskHandle_t _consumer{nullptr};
+    IT8951Area _area{};
+    size_t _stride{0};
+    uint16_t _rows{0};
+    uint32_t _bands{0};
+    it8951_render_cb_t _render{nullptr};
+    void* _user_data{nullptr};
+    uint8_t* _slots[IT8951_MAX_PIPELINE_BUFFERS]{};
+    size_t _lengths[IT8951_MAX_PIPELINE_BUFFERS]{};
+    std::atomic<uint32_t> _produced{0};
+    std::atomic<uint32_t> _released{0};
+    std::atomic<bool> _producing{false};
+    std::atomic<bool> _stopping{false};
+    IT8951PipelineStats _stats{};
+};
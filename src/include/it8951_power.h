@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "it8951.h"
+
+/**
+ * @brief Default idle time after which the controller is put in standby mode.
+ */
+#define IT8951_DEFAULT_STANDBY_AFTER_MS 1000
+
+/**
+ * @brief Default idle time after which the controller is put in sleep mode.
+ */
+#define IT8951_DEFAULT_SLEEP_AFTER_MS 30000
+
+/**
+ * @brief Power the controller and panel draw in each power state, used to estimate the energy spent.
+ *
+ * The defaults are rough figures. Measure the board for accurate estimates.
+ */
+struct IT8951PowerModel {
+    float run_mw{150};     ///< Power drawn while running.
+    float standby_mw{20};  ///< Power drawn in standby mode.
+    float sleep_mw{1};     ///< Power drawn in sleep mode.
+};
+
+/**
+ * @brief Report of the power manager.
+ */
+struct IT8951PowerReport {
+    int64_t time_us[IT8951_POWER_STATE_COUNT];      ///< Time spent in each power state.
+    float energy_mj[IT8951_POWER_STATE_COUNT];      ///< Estimated energy spent in each power state.
+    int64_t wake_cost_us[IT8951_POWER_STATE_COUNT];  ///< Learned time to wake from each power state.
+    uint32_t idle_after_ms[IT8951_POWER_STATE_COUNT];  ///< Current idle time before entering each power state.
+    uint32_t wakes[IT8951_POWER_STATE_COUNT];       ///< Number of wakes from each power state.
+    uint32_t early_wakes;                           ///< Number of wakes before entering the state paid off.
+    uint32_t predicted_wakes;                       ///< Number of wakes ahead of a predicted update.
+    uint32_t repaints;                              ///< Number of repaints after waking from sleep mode.
+};
+
+/**
+ * @brief Puts the controller in standby or sleep mode when it's idle.
+ *
+ * Call `poll()` regularly. Once the driver hasn't loaded an image or started
+ * a refresh for the standby or sleep time, the controller is put in that
+ * mode. It's woken up by the driver when it's used again, so the
+ * application doesn't have to.
+ *
+ * ```cpp
+ * IT8951PowerManager power(display, display.get_memory_address(), IT8951_PIXEL_FORMAT_4BPP);
+ *
+ * while (true) {
+ *     power.poll();
+ *     // ...
+ * }
+ * ```
+ *
+ * The manager learns the time it takes to wake from each mode. When the
+ * controller is woken up before the energy saved makes up for the wake up,
+ * the idle time before entering that mode doubles, so bursty updates don't
+ * make the controller flap between modes. The idle time returns to the
+ * configured time once the controller stays in the mode long enough again.
+ *
+ * Waking up adds latency to the first update after an idle period. When
+ * updates come at a regular interval, like a clock, the controller is woken
+ * up ahead of the next update. Otherwise, `wake_ahead()` wakes it up while
+ * the application renders the update.
+ *
+ * Optionally, the screen is refreshed from the controller memory with GC16
+ * after waking from sleep mode to remove artifacts, see
+ * `set_repaint_after_sleep()`. This requires the screen image to be kept at
+ * one memory address.
+ */
+class IT8951PowerManager {
+public:
+    /**
+     * @brief Create a power manager. Must be created after `setup()`.
+     * @param display The driver. It must outlive the power manager.
+     * @param target_memory_address The memory address of the screen image.
+     * @param pixel_format The pixel format of the screen image.
+     */
+    IT8951PowerManager(IT8951& display, uint32_t target_memory_address, it8951_pixel_format_t pixel_format);
+
+    /**
+     * @brief Set the idle times after which the controller is put in standby and sleep mode.
+     * @param standby_after_ms The idle time before standby mode, or 0 to skip standby mode.
+     * @param sleep_after_ms The idle time before sleep mode, or 0 to never use sleep mode.
+     */
+    void set_idle_times(uint32_t standby_after_ms, uint32_t sleep_after_ms);
+
+    /**
+     * @brief Set the power drawn in each state, used to estimate the energy spent.
+     */
+    void set_power_model(const IT8951PowerModel& model) { _model = model; }
+
+    /**
+     * @brief Set whether the screen is refreshed after waking from sleep mode. Off by default.
+     *
+     * The repaint is a full screen GC16 refresh from the screen image,
+     * started by the next `poll()` after the update that woke the controller.
+     * It's skipped when that update was a GC16 or INIT refresh of the whole
+     * screen. Leave this off when the application refreshes the whole screen
+     * after long idle periods itself, as every wake would flash twice.
+     */
+    void set_repaint_after_sleep(bool repaint) { _repaint_after_sleep = repaint; }
+
+    /**
+     * @brief Enter standby or sleep mode when the controller has been idle long enough. Call regularly.
+     */
+    void poll();
+
+    /**
+     * @brief Start waking the controller, e.g. when starting to render an update.
+     */
+    void wake_ahead();
+
+    /**
+     * @brief Gets the time and estimated energy spent in each power state.
+     */
+    IT8951PowerReport get_report();
+
+private:
+    void observe();
+    void observe_activity();
+    void enter(it8951_power_state_t power_state);
+    bool is_update_expected(int64_t now, int64_t within_us);
+    int64_t get_wake_cost_us(it8951_power_state_t power_state);
+    int64_t get_break_even_us(it8951_power_state_t power_state);
+    float get_power_mw(it8951_power_state_t power_state);
+
+    IT8951& _display;
+    uint32_t _memory_address;
+    it8951_pixel_format_t _pixel_format;
+    IT8951PowerModel _model{};
+    bool _repaint_after_sleep{false};
+    bool _repaint_pending{false};
+    bool _repainted{false};
+    uint32_t _base_idle_ms[IT8951_POWER_STATE_COUNT]{0, IT8951_DEFAULT_STANDBY_AFTER_MS, IT8951_DEFAULT_SLEEP_AFTER_MS};
+    uint32_t _idle_ms[IT8951_POWER_STATE_COUNT]{0, IT8951_DEFAULT_STANDBY_AFTER_MS, IT8951_DEFAULT_SLEEP_AFTER_MS};
+    int64_t _wake_cost_us[IT8951_POWER_STATE_COUNT]{};
+    IT8951PowerStats _last_stats{};
+    it8951_power_state_t _entered{IT8951_POWER_STATE_RUN};
+    int64_t _entered_time_us{0};
+    int64_t _last_activity_us{0};
+    int64_t _last_update_us{0};
+    int64_t _period_us{0};
+    uint32_t _stable_periods{0};
+    int64_t _last_poll_us{0};
+    int64_t _poll_interval_us{0};
+    int64_t _hold_until_us{0};
+    int64_t _predicted_for_us{-1};
+    uint32_t _early_wakes{0};
+    uint32_t _predicted_wakes{0};
+    uint32_t _repaints{0};
+};
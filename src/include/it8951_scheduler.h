@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "it8951.h"
+
+/**
+ * @brief Maximum number of updates the scheduler queues.
+ */
+#define IT8951_MAX_QUEUED_UPDATES 16
+
+/**
+ * @brief Statistics of the update scheduler.
+ */
+struct IT8951SchedulerStats {
+    uint32_t started;    ///< Number of updates started as soon as they were submitted.
+    uint32_t queued;     ///< Number of updates queued because their area was being refreshed.
+    uint32_t coalesced;  ///< Number of queued updates merged into an update that was already queued.
+    uint32_t dequeued;   ///< Number of queued updates started.
+};
+
+/**
+ * @brief Shows updates of independent parts of the screen without waiting for each other.
+ *
+ * The controller has several LUT engines that refresh parts of the screen
+ * concurrently. Updates of a part of the screen that isn't being refreshed
+ * start right away. Updates of a part that is being refreshed are queued
+ * instead of waiting, and updates that arrive for the same part while it's
+ * busy are merged into one refresh, which shows the latest image in the
+ * controller memory. Call `poll()` regularly to start queued updates once
+ * their part of the screen is free:
+ *
+ * ```cpp
+ * IT8951UpdateScheduler scheduler(display);
+ *
+ * scheduler.submit(clock_area, display.get_memory_address(), IT8951_PIXEL_FORMAT_1BPP, IT8951_DISPLAY_MODE_DU);
+ * scheduler.submit(cursor_area, display.get_memory_address(), IT8951_PIXEL_FORMAT_1BPP, IT8951_DISPLAY_MODE_A2);
+ *
+ * while (true) {
+ *     scheduler.poll();
+ *     // ...
+ * }
+ * ```
+ *
+ * Updates aren't merged into a queued update when an update queued after it
+ * overlaps the merged area, so overlapping updates show in the order they were
+ * submitted. Merged updates use the mode that shows the most gray levels of
+ * the merged updates. Images loaded into memory that's being shown by a refresh still
+ * wait in `load_image_start()`.
+ */
+class IT8951UpdateScheduler {
+public:
+    /**
+     * @brief Create a scheduler.
+     * @param display The driver. It must outlive the scheduler.
+     */
+    explicit IT8951UpdateScheduler(IT8951& display) : _display(display) {}
+
+    /**
+     * @brief Show an image on the screen as soon as its area isn't being refreshed.
+     * @param area The area to show the image.
+     * @param target_memory_address The location where the image is stored.
+     * @param pixel_format The pixel format of the image.
+     * @param mode The mode used to show the image.
+     */
+    void submit(const IT8951Area& area, uint32_t target_memory_address, it8951_pixel_format_t pixel_format,
+                it8951_display_mode_t mode);
+
+    /**
+     * @brief Start the queued updates whose area isn't being refreshed anymore.
+     * @return The number of updates started.
+     */
+    size_t poll();
+
+    /**
+     * @brief Start all queued updates, waiting for refreshes as needed.
+     */
+    void flush();
+
+    /**
+     * @brief Gets the number of queued updates.
+     */
+    size_t get_queued_count() { return _count; }
+
+    /**
+     * @brief Gets the statistics of the scheduler.
+     */
+    const IT8951SchedulerStats& get_stats() { return _stats; }
+
+private:
+    struct Update {
+        IT8951Area area;
+        uint32_t memory_address;
+        it8951_pixel_format_t pixel_format;
+        it8951_display_mode_t mode;
+    };
+
+    bool is_queued_before(size_t index, const IT8951Area& area);
+    bool is_queued_after(size_t index, const IT8951Area& area);
+    void start(size_t index);
+
+    IT8951& _display;
+    Update _updates[IT8951_MAX_QUEUED_UPDATES];
+    size_t _count{0};
+    IT8951SchedulerStats _stats{};
+};
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * @brief Type of a trace event.
+ */
+enum it8951_trace_event_t : uint8_t {
+    IT8951_TRACE_CONTROL_TRANSFER,  ///< Blocking transfer. `arg` is 1 for reads, `value` the number of bytes.
+    IT8951_TRACE_PAYLOAD_TRANSFER,  ///< Queued transfer of image data. `value` is the number of bytes.
+    IT8951_TRACE_HRDY_WAIT,         ///< Wait for HRDY. `value` is the time blocked in microseconds.
+    IT8951_TRACE_LUT_WAIT,          ///< Wait for refreshes. `value` is the time blocked in microseconds.
+    IT8951_TRACE_LOAD_IMAGE_START,  ///< Start of an upload. `arg` is the pixel format, `value` the height << 16 | width.
+    IT8951_TRACE_LOAD_IMAGE_END,    ///< End of an upload.
+    IT8951_TRACE_REFRESH_START,     ///< Refresh started. `arg` is the mode, `arg2` the LUT engines, `value` the pixels.
+    IT8951_TRACE_REFRESH_DONE,      ///< Refresh completed. `arg` is the mode, `arg2` the LUT engines, `value` the
+                                    ///< time since it started in microseconds, or 0 if it wasn't timed.
+};
+
+/**
+ * @brief Event in the trace ring. Events are 12 bytes, stored in the byte order of the chip.
+ */
+struct IT8951TraceEvent {
+    uint32_t time_us;  ///< Lower 32 bits of the time stamp of the transport at the end of the event.
+    uint8_t type;      ///< Type of the event, see `it8951_trace_event_t`.
+    uint8_t arg;       ///< Argument of the event.
+    uint16_t arg2;     ///< Second argument of the event.
+    uint32_t value;    ///< Value of the event.
+};
+
+/**
+ * @brief Ring of the most recent trace events of the driver.
+ *
+ * Set with `IT8951::set_trace()`. When the ring is full, the oldest events
+ * are overwritten. The events can be written to a file or sent to a host
+ * as is and turned into a timeline by `host/decode_trace.py`:
+ *
+ * ```cpp
+ * IT8951TraceRing trace(4096);
+ * display.set_trace(&trace);
+ *
+ * // ...
+ *
+ * IT8951TraceEvent events[64];
+ * size_t count;
+ *
+ * while ((count = trace.read(events, 64))) {
+ *     fwrite(events, sizeof(IT8951TraceEvent), count, file);
+ * }
+ * ```
+ *
+ * The ring isn't synchronized; read it from the task that uses the driver.
+ */
+class IT8951TraceRing {
+public:
+    /**
+     * @brief Create a trace ring.
+     * @param capacity The number of events the ring holds.
+     */
+    explicit IT8951TraceRing(size_t capacity);
+
+    /**
+     * @brief Add an event, overwriting the oldest event if the ring is full.
+     */
+    void record(int64_t time_us, it8951_trace_event_t type, uint8_t arg, uint16_t arg2, uint32_t value) {
+        _events[(_first + _count) % _capacity] = {
+            .time_us = uint32_t(time_us),
+            .type = type,
+            .arg = arg,
+            .arg2 = arg2,
+            .value = value,
+        };
+
+        if (_count < _capacity) {
+            _count++;
+        } else {
+            _first = (_first + 1) % _capacity;
+            _dropped++;
+        }
+    }
+
+    /**
+     * @brief Remove the oldest events from the ring.
+     * @param events Receives the events, oldest first.
+     * @param max_count The maximum number of events to read.
+     * @return The number of events read.
+     */
+    size_t read(IT8951TraceEvent* events, size_t max_count);
+
+    /**
+     * @brief Remove all events.
+     */
+    void clear();
+
+    /**
+     * @brief Gets the number of events in the ring.
+     */
+    size_t get_count() { return _count; }
+
+    /**
+     * @brief Gets the number of events that were overwritten before they were read.
+     */
+    uint32_t get_dropped() { return _dropped; }
+
+private:
+    std::unique_ptr<IT8951TraceEvent[]> _events;
+    size_t _capacity;
+    size_t _first{0};
+    size_t _count{0};
+    uint32_t _dropped{0};
+};
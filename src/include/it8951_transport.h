@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Access to the bus and pins the IT8951 controller is connected to.
+ *
+ * The driver talks to the controller exclusively through this interface. On
+ * the ESP32 the default implementation drives the SPI master and the GPIO pins
+ * configured in `sdkconfig`. Other implementations, like the emulator in the
+ * `host` folder, allow the driver to run without a panel attached.
+ */
+class IT8951Transport {
+public:
+    virtual ~IT8951Transport() = default;
+
+    /**
+     * @brief Configure the bus. Called again when the clock speed changes.
+     * @param clock_speed_hz The SPI clock speed.
+     * @param queue_size The maximum number of queued transfers.
+     */
+    virtual void setup(int clock_speed_hz, int queue_size) = 0;
+
+    /**
+     * @brief Gets the maximum number of bytes a single transfer can hold.
+     */
+    virtual size_t get_max_transfer_len() = 0;
+
+    /**
+     * @brief Allocate a buffer that can be used for queued transfers.
+     * @param len The size of the buffer.
+     * @return The buffer, or `nullptr` if it could not be allocated.
+     */
+    virtual uint8_t* allocate_buffer(size_t len) = 0;
+
+    /**
+     * @brief Set the level of the reset pin.
+     */
+    virtual void set_reset(bool level) = 0;
+
+    /**
+     * @brief Set the level of the CS pin.
+     */
+    virtual void set_cs(bool level) = 0;
+
+    /**
+     * @brief Wait until the controller signals it's ready using the HRDY pin.
+     * @param timeout_ms The maximum time to wait.
+     * @return Whether the controller became ready before the timeout expired.
+     */
+    virtual bool wait_ready(uint32_t timeout_ms) = 0;
+
+    /**
+     * @brief Acquire the bus for a sequence of transfers.
+     *
+     * While the bus is acquired, short blocking transfers can skip the
+     * overhead of arbitrating the bus between devices.
+     */
+    virtual void acquire_bus() {}
+
+    /**
+     * @brief Release the bus acquired with `acquire_bus()`.
+     */
+    virtual void release_bus() {}
+
+    /**
+     * @brief Perform a blocking full duplex transfer.
+     * @param tx The data to send, or `nullptr` to send zeros.
+     * @param rx The buffer receiving data, or `nullptr` to discard it.
+     * @param len The number of bytes to transfer.
+     */
+    virtual void transfer(const uint8_t* tx, uint8_t* rx, size_t len) = 0;
+
+    /**
+     * @brief Queue a transfer and return without waiting for it to complete.
+     *
+     * The buffers must stay valid until the transfer has been completed
+     * with `wait_transfer()`.
+     */
+    virtual void queue_transfer(const uint8_t* tx, uint8_t* rx, size_t len) = 0;
+
+    /**
+     * @brief Wait for the oldest queued transfer to complete.
+     */
+    virtual void wait_transfer() = 0;
+
+    /**
+     * @brief Check whether the oldest queued transfer has completed without blocking.
+     * @return Whether the transfer has completed. If so, it's no longer queued.
+     */
+    virtual bool poll_transfer() = 0;
+
+    /**
+     * @brief Store state of the driver that must survive a deep sleep of the chip.
+     *
+     * Called when the state changes. The default implementation doesn't
+     * retain anything, which disables warm starts.
+     *
+     * @param data The state.
+     * @param len The size of the state.
+     */
+    virtual void store_retained_state(const void* data, size_t len) {}
+
+    /**
+     * @brief Load the state stored with `store_retained_state()`.
+     * @param data Receives the state.
+     * @param len The size of the state.
+     * @return Whether state of this size was stored.
+     */
+    virtual bool load_retained_state(void* data, size_t len) { return false; }
+
+    /**
+     * @brief Store a setting that must survive a reboot, like the calibrated SPI clock speed.
+     *
+     * The default implementation doesn't store anything.
+     *
+     * @param key The name of the setting, at most 15 characters.
+     * @param value The value.
+     * @return Whether the setting was stored.
+     */
+    virtual bool store_setting(const char* key, int32_t value) { return false; }
+
+    /**
+     * @brief Load a setting stored with `store_setting()`.
+     * @param key The name of the setting.
+     * @param value Receives the value.
+     * @return Whether the setting was stored.
+     */
+    virtual bool load_setting(const char* key, int32_t& value) { return false; }
+
+    /**
+     * @brief Block the calling task.
+     */
+    virtual void delay(int ms) = 0;
+
+    /**
+     * @brief Gets a monotonic time stamp in microseconds.
+     */
+    virtual int64_t get_time_us() = 0;
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "it8951.h"
+
+/**
+ * @brief Picks the fastest display mode that shows the pixels of an update correctly.
+ *
+ * The selector builds a histogram of the gray levels of the pixels that are
+ * uploaded and keeps track of which parts of the screen show only black and
+ * white, in tiles. From these it picks:
+ *
+ * * A2 for black and white content where the screen showed only black and white.
+ * * DU for black and white content where the screen showed gray levels.
+ * * DU4 for content with only the gray levels 0x00, 0x50, 0xa0 and 0xf0.
+ * * GL16 for content that's mostly white, like anti-aliased text.
+ * * GC16 for everything else.
+ *
+ * Pixels can be scanned in pieces, e.g. in the render callback of
+ * `load_image_render()`, before the display mode is picked for the whole area:
+ *
+ * ```cpp
+ * selector.scan(band, IT8951_PIXEL_FORMAT_4BPP, buffer, stride);
+ * // ...
+ * display.display_area(area, display.get_memory_address(), IT8951_PIXEL_FORMAT_4BPP, selector.select(area));
+ * ```
+ *
+ * The state of the screen isn't known until `reset()` is called, e.g. after
+ * `clear_screen()`. Until then, areas that haven't been updated are treated
+ * as showing gray levels.
+ */
+class IT8951WaveformSelector {
+public:
+    /**
+     * @brief Create a selector. Must be created after `setup()`.
+     * @param display The driver. It must outlive the selector.
+     * @param tile_size The size of the tiles the state of the screen is tracked in.
+     */
+    explicit IT8951WaveformSelector(IT8951& display, uint16_t tile_size = 32);
+
+    /**
+     * @brief Mark the whole screen as white, e.g. after `clear_screen()`.
+     */
+    void reset();
+
+    /**
+     * @brief Mark an area as filled with a gray value, e.g. after `fill_area()`.
+     */
+    void fill(const IT8951Area& area, uint8_t gray);
+
+    /**
+     * @brief Mark an area as showing gray levels, e.g. after it's been updated without the selector.
+     */
+    void invalidate(const IT8951Area& area);
+
+    /**
+     * @brief Add pixels of the next update to the histogram.
+     * @param area The area of the pixels.
+     * @param pixel_format The pixel format of the pixels.
+     * @param data The first row of the pixels, starting at `area.x`.
+     * @param stride The number of bytes between the rows.
+     */
+    void scan(const IT8951Area& area, it8951_pixel_format_t pixel_format, const uint8_t* data, size_t stride);
+
+    /**
+     * @brief Pick the display mode for the pixels scanned since the last call.
+     *
+     * Records the content of the area as shown on the screen.
+     *
+     * @param area The area that will be shown.
+     * @return The display mode.
+     */
+    it8951_display_mode_t select(const IT8951Area& area);
+
+    /**
+     * @brief Scan the pixels of an update and pick its display mode.
+     */
+    it8951_display_mode_t analyze(const IT8951Area& area, it8951_pixel_format_t pixel_format, const uint8_t* data,
+                                  size_t stride);
+
+private:
+    template <int Bpp>
+    void scan_rows(const IT8951Area& area, const uint8_t* data, size_t stride);
+    void set_tiles(const IT8951Area& area, bool black_and_white);
+    bool covers(const IT8951Area& area, int column, int row);
+
+    IT8951& _display;
+    uint16_t _tile_size;
+    uint16_t _columns;
+    uint16_t _rows;
+    uint32_t _histogram[16]{};
+    std::unique_ptr<uint16_t[]> _tile_levels;
+    std::unique_ptr<bool[]> _black_and_white;
+};
@@ -1,24 +1,58 @@
 #include "it8951.h"
 
+#include <algorithm>
+#include <cassert>
 #include <cmath>
 #include <cstring>
 
-#include "driver/gpio.h"
 #include "esp_log.h"
-#include "esp_timer.h"
+#include "esp_system.h"
+#include "sdkconfig.h"
 #include "support.h"
 
-static const char* TAG = "IT8951";
+#ifdef ESP_PLATFORM
+#include "it8951_esp_transport.h"
+#endif
 
-#define _WS_CONCAT3(x, y, z) x##y##z
-#define WS_CONCAT3(x, y, z) _WS_CONCAT3(x, y, z)
+static const char* TAG = "IT8951";
 
-#define IT8951_SPI_HOST WS_CONCAT3(SPI, CONFIG_IT8951_SPI_HOST, _HOST)
+// SPI clock speed used to initialize the controller.
+#define IT8951_SPI_INIT_CLOCK_HZ (10 * 1000 * 1000)
+// Clock the SPI clock speed is divided from.
+#define IT8951_SPI_BASE_CLOCK_HZ (80 * 1000 * 1000)
+// SPI clock speed used once the controller has been initialized, unless a faster one was calibrated.
+#define IT8951_SPI_CLOCK_HZ (IT8951_SPI_BASE_CLOCK_HZ / CONFIG_IT8951_SPI_BUS_SPEED_DIVIDER)
+// Smallest divider of the base clock calibration tries.
+#define IT8951_SPI_MIN_DIVIDER 2
+// Number of bytes written and read back to test a clock speed.
+#define IT8951_SPI_CALIBRATION_LEN 1024
+// Number of test patterns a clock speed has to pass.
+#define IT8951_SPI_CALIBRATION_ROUNDS 4
+// Name of the setting the calibrated clock speed is stored in.
+#define IT8951_SPI_CLOCK_SETTING "spi_clock_hz"
+// Identifies the layout of the state kept through a deep sleep.
+#define IT8951_RETAINED_STATE_MAGIC 0x49543101
+// Time a controller that kept its state takes at most to become ready.
+#define IT8951_WARM_START_READY_TIMEOUT_MS 10
+
+// Maximum number of arguments of a command.
+#define IT8951_MAX_ARGS 8
 
 // INIT mode, for every init or some time after A2 mode refresh
 #define IT8951_MODE_INIT 0
+// DU mode, fast non-flashing update to black and white
+#define IT8951_MODE_DU 1
 // GC16 mode, for every time to display 16 grayscale image
 #define IT8951_MODE_GC16 2
+// GL16 mode, 16 grayscale image without flashing white areas
+#define IT8951_MODE_GL16 3
+// GLR16 and GLD16 modes, GL16 with ghost reduction. Not available on M641 panels.
+#define IT8951_MODE_GLR16 4
+#define IT8951_MODE_GLD16 5
+// DU4 mode, fast non-flashing update to 4 gray levels. Not available on M641 panels.
+#define IT8951_MODE_DU4 7
+// A2 mode of M641 panels; the others use 6
+#define IT8951_MODE_A2_M641 4
 
 // Built in I80 Command Code
 #define IT8951_TCON_SYS_RUN 0x0001
@@ -91,41 +125,64 @@ IT8951 Registers defines
 #define MCSR (MCSR_BASE_ADDR + 0x0000)
 #define LISAR (MCSR_BASE_ADDR + 0x0008)
 
-bool IT8951::setup(float vcom) {
-    ESP_LOGI(TAG, "Initializing SPI");
+IT8951::IT8951() : _buffer_count(CONFIG_IT8951_BUFFER_COUNT), _buffer_len(CONFIG_IT8951_BUFFER_SIZE) {
+#ifdef ESP_PLATFORM
+    _default_transport = std::make_unique<IT8951EspTransport>();
+    _transport = _default_transport.get();
+#endif
+}
 
-    gpio_config_t i_conf = {
-        .pin_bit_mask = 1ull << CONFIG_IT8951_DISPLAY_READY_PIN,
-        .mode = GPIO_MODE_INPUT,
-        .pull_up_en = GPIO_PULLUP_DISABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE,
-    };
+IT8951::IT8951(IT8951Transport* transport)
+    : _transport(transport), _buffer_count(CONFIG_IT8951_BUFFER_COUNT), _buffer_len(CONFIG_IT8951_BUFFER_SIZE) {}
 
-    ESP_ERROR_CHECK(gpio_config(&i_conf));
+void IT8951::configure_buffers(size_t count, size_t len) {
+    ESP_ERROR_ASSERT(!_buffers);
+    ESP_ERROR_ASSERT(count >= 2);
 
-    i_conf = {
-        .pin_bit_mask = 1ull << CONFIG_IT8951_RESET_PIN | 1ull << CONFIG_IT8951_CS_PIN,
-        .mode = GPIO_MODE_OUTPUT,
-        .pull_up_en = GPIO_PULLUP_DISABLE,
-        .pull_down_en = GPIO_PULLDOWN_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE,
-    };
+    _buffer_count = count;
+    _buffer_len = len;
+}
+
+bool IT8951::setup(float vcom, bool warm_start) {
+    ESP_ERROR_ASSERT(_transport);
 
-    ESP_ERROR_CHECK(gpio_config(&i_conf));
+    _vcom = (uint16_t)(fabs(vcom) * 1000);
+    _warm_started = warm_start && warm_setup(_vcom);
 
-    spi_setup(SPI_MASTER_FREQ_10M);
+    if (_warm_started) {
+        return true;
+    }
+
+    ESP_LOGI(TAG, "Initializing SPI");
+
+    spi_setup(IT8951_SPI_INIT_CLOCK_HZ);
 
     ESP_LOGI(TAG, "Initializing controller");
 
     DeviceInfo device_info;
-    controller_setup(device_info, (uint16_t)(fabs(vcom) * 1000));
+    controller_setup(device_info, _vcom);
 
     // Per documentation. We need to initialize the controller at a low clock
     // speed. We get errors if we initialize the controller with the below
     // clock speed.
 
-    spi_setup(SPI_MASTER_FREQ_20M);
+    _spi_clock_hz = load_spi_clock_speed();
+    spi_setup(_spi_clock_hz);
+
+    // A calibrated clock speed may stop working, e.g. when the cable is
+    // replaced by a longer one. Reads are the first to fail.
+
+    if (_spi_clock_hz != IT8951_SPI_CLOCK_HZ) {
+        DeviceInfo check_device_info;
+        get_system_info(check_device_info);
+
+        if (memcmp(&check_device_info, &device_info, sizeof(DeviceInfo)) != 0) {
+            ESP_LOGW(TAG, "SPI clock of %d Hz doesn't work anymore; using %d Hz", _spi_clock_hz, IT8951_SPI_CLOCK_HZ);
+
+            _spi_clock_hz = IT8951_SPI_CLOCK_HZ;
+            spi_setup(_spi_clock_hz);
+        }
+    }
 
     _width = device_info.width;
     _height = device_info.height;
@@ -136,7 +193,7 @@ bool IT8951::setup(float vcom) {
 
     if (strcmp(lut_version, "M641") == 0) {
         // 6inch e-Paper HAT(800,600), 6inch HD e-Paper HAT(1448,1072), 6inch HD touch e-Paper HAT(1448,1072)
-        _a2_mode = 4;
+        _a2_mode = IT8951_MODE_A2_M641;
         four_byte_align = true;
     } else if (strcmp(lut_version, "M841_TFAB512") == 0) {
         // Another firmware version for 6inch HD e-Paper HAT(1448,1072), 6inch HD touch e-Paper HAT(1448,1072)
@@ -161,87 +218,105 @@ bool IT8951::setup(float vcom) {
         return false;
     }
 
+    store_retained_state();
+
+    _power_state_since_us = _transport->get_time_us();
+    _power_stats = {};
+    _pending_fill_count = 0;
+
     return true;
 }
 
 void IT8951::spi_setup(int clock_speed_hz) {
-    if (!_spi) {
-        spi_bus_config_t bus_config = {
-            .mosi_io_num = CONFIG_IT8951_MOSI_PIN,
-            .miso_io_num = CONFIG_IT8951_MISO_PIN,
-            .sclk_io_num = CONFIG_IT8951_SCLK_PIN,
-            .quadwp_io_num = -1,
-            .quadhd_io_num = -1,
-        };
+    _transport->setup(clock_speed_hz, _buffer_count);
 
-        ESP_ERROR_CHECK(spi_bus_initialize(IT8951_SPI_HOST, &bus_config, SPI_DMA_CH_AUTO));
-    } else {
-        spi_bus_remove_device(_spi);
+    if (_buffers) {
+        return;
     }
 
-    spi_device_interface_config_t device_interface_config = {
-        .clock_speed_hz = clock_speed_hz,
-        .spics_io_num = -1,
-        .queue_size = 1,
-    };
+    size_t bus_max_transfer_sz = _transport->get_max_transfer_len();
 
-    ESP_ERROR_CHECK(spi_bus_add_device(IT8951_SPI_HOST, &device_interface_config, &_spi));
+    _buffer_len = _buffer_len ? std::min(bus_max_transfer_sz, _buffer_len) : bus_max_transfer_sz;
 
-    int freq_khz;
-    ESP_ERROR_CHECK(spi_device_get_actual_freq(_spi, &freq_khz));
-    ESP_LOGI(TAG, "SPI device frequency %d KHz", freq_khz);
-    ESP_ERROR_ASSERT(freq_khz * 1000 <= device_interface_config.clock_speed_hz);
+    ESP_LOGI(TAG, "Allocating %d buffers of %d bytes for xfer buffers (max %d)", (int)_buffer_count, (int)_buffer_len,
+             (int)bus_max_transfer_sz);
 
-    if (_buffer0) {
-        return;
+    _buffers = std::make_unique<uint8_t*[]>(_buffer_count);
+
+    for (size_t i = 0; i < _buffer_count; i++) {
+        _buffers[i] = _transport->allocate_buffer(_buffer_len);
+        ESP_ERROR_ASSERT(_buffers[i]);
+    }
+}
+
+int IT8951::load_spi_clock_speed() {
+    int32_t clock_speed_hz;
+
+    if (_transport->load_setting(IT8951_SPI_CLOCK_SETTING, clock_speed_hz) && clock_speed_hz > 0) {
+        return clock_speed_hz;
     }
 
-    size_t bus_max_transfer_sz;
-    ESP_ERROR_CHECK(spi_bus_get_max_transaction_len(IT8951_SPI_HOST, &bus_max_transfer_sz));
+    return IT8951_SPI_CLOCK_HZ;
+}
+
+/**
+ * @brief Holds the bus for the duration of a command sequence.
+ */
+class IT8951::BusLock {
+public:
+    BusLock(IT8951* display) : _display(display) { _display->acquire_bus(); }
+    ~BusLock() { _display->release_bus(); }
 
-    _buffer_len = std::min(bus_max_transfer_sz, size_t(2048));
+private:
+    IT8951* _display;
+};
 
-    ESP_LOGI(TAG, "Allocating %d bytes for xfer buffers (max %d)", _buffer_len, bus_max_transfer_sz);
+void IT8951::acquire_bus() {
+    if (_bus_acquired++ == 0) {
+        _transport->acquire_bus();
 
-    _buffer0 = (uint8_t*)heap_caps_malloc(_buffer_len, MALLOC_CAP_DMA);
-    ESP_ERROR_ASSERT(_buffer0);
-    _buffer1 = (uint8_t*)heap_caps_malloc(_buffer_len, MALLOC_CAP_DMA);
-    ESP_ERROR_ASSERT(_buffer1);
+        // The controller is woken up by the first command sequence that needs it.
+
+        if (_power_state != IT8951_POWER_STATE_RUN) {
+            wake();
+        }
+    }
 }
 
-void IT8951::transaction_start() { gpio_set_level((gpio_num_t)CONFIG_IT8951_CS_PIN, 0); }
+void IT8951::release_bus() {
+    ESP_ERROR_ASSERT(_bus_acquired > 0);
 
-void IT8951::transaction_end() { gpio_set_level((gpio_num_t)CONFIG_IT8951_CS_PIN, 1); }
+    if (--_bus_acquired == 0) {
+        _transport->release_bus();
+    }
+}
 
-uint8_t IT8951::read_byte() {
-    spi_transaction_t t = {
-        .flags = SPI_TRANS_USE_RXDATA,
-        .length = 8,
-    };
+void IT8951::transfer(const uint8_t* tx, uint8_t* rx, size_t len) {
+    _transport->transfer(tx, rx, len);
+    _frame_stats.control_transfers++;
+    _perf_counters.control_transfers++;
+    _perf_counters.control_bytes += len;
 
-    ESP_ERROR_CHECK(spi_device_transmit(_spi, &t));
+    trace(IT8951_TRACE_CONTROL_TRANSFER, rx != nullptr, 0, len);
+}
 
-    return t.rx_data[0];
+void IT8951::transaction_start() {
+    _transport->set_cs(false);
+    _perf_counters.transactions++;
 }
 
+void IT8951::transaction_end() { _transport->set_cs(true); }
+
 uint16_t IT8951::read_word() {
-    spi_transaction_t t = {
-        .flags = SPI_TRANS_USE_RXDATA,
-        .length = 16,
-    };
+    uint8_t rx_data[2];
 
-    ESP_ERROR_CHECK(spi_device_transmit(_spi, &t));
+    transfer(nullptr, rx_data, sizeof(rx_data));
 
-    return (uint16_t)t.rx_data[0] << 8 | t.rx_data[1];
+    return (uint16_t)rx_data[0] << 8 | rx_data[1];
 }
 
 void IT8951::read_array(uint8_t* data, size_t len, bool swap) {
-    spi_transaction_t t = {
-        .length = 8 * len,
-        .rx_buffer = data,
-    };
-
-    ESP_ERROR_CHECK(spi_device_transmit(_spi, &t));
+    transfer(nullptr, data, len);
 
     if (swap) {
         for (size_t i = 0; i < len; i += 2) {
@@ -252,32 +327,13 @@ void IT8951::read_array(uint8_t* data, size_t len, bool swap) {
     }
 }
 
-void IT8951::write_byte(uint8_t value) {
-    spi_transaction_t t = {
-        .flags = SPI_TRANS_USE_TXDATA,
-        .length = 8,
-        .tx_data = {value},
-    };
-
-    ESP_ERROR_CHECK(spi_device_transmit(_spi, &t));
-}
-
 void IT8951::write_word(uint16_t value) {
-    spi_transaction_t t = {
-        .flags = SPI_TRANS_USE_TXDATA,
-        .length = 16,
-        .tx_data = {(uint8_t)(value >> 8), (uint8_t)(value)},
-    };
+    uint8_t tx_data[] = {(uint8_t)(value >> 8), (uint8_t)(value)};
 
-    ESP_ERROR_CHECK(spi_device_transmit(_spi, &t));
+    transfer(tx_data, nullptr, sizeof(tx_data));
 }
 
 void IT8951::write_array(uint8_t* data, size_t len, bool swap) {
-    spi_transaction_t t = {
-        .length = 8 * len,
-        .tx_buffer = data,
-    };
-
     if (swap) {
         for (size_t i = 0; i < len; i += 2) {
             auto tmp = data[i];
@@ -286,49 +342,88 @@ void IT8951::write_array(uint8_t* data, size_t len, bool swap) {
         }
     }
 
-    ESP_ERROR_CHECK(spi_device_transmit(_spi, &t));
+    transfer(data, nullptr, len);
 }
 
-void IT8951::delay(int ms) { vTaskDelay(pdMS_TO_TICKS(ms)); }
+void IT8951::delay(int ms) { _transport->delay(ms); }
 
-uint32_t IT8951::millis() { return esp_timer_get_time() / 1000; }
+uint32_t IT8951::millis() { return _transport->get_time_us() / 1000; }
 
 void IT8951::wait_until_idle() {
-    if (gpio_get_level((gpio_num_t)CONFIG_IT8951_DISPLAY_READY_PIN)) {
-        return;
-    }
+    const auto start = _transport->get_time_us();
+    const auto ready = _transport->wait_ready(this->idle_timeout());
+    const auto wait_us = _transport->get_time_us() - start;
 
-    const uint32_t start = millis();
-    while (!gpio_get_level((gpio_num_t)CONFIG_IT8951_DISPLAY_READY_PIN)) {
-        ESP_ERROR_ASSERT(millis() - start < this->idle_timeout());
+    _frame_stats.hrdy_wait_us += wait_us;
+    _perf_counters.hrdy_waits++;
+    _perf_counters.hrdy_wait_us += wait_us;
 
-        delay(20);
+    // The controller signals HRDY once it has woken up.
+
+    if (_wake_pending) {
+        _wake_pending = false;
+        _power_stats.wake_us[_wake_from] += _transport->get_time_us() - _wake_start_us;
+        _power_stats.timed_wakes[_wake_from]++;
+    }
+
+    if (wait_us) {
+        trace(IT8951_TRACE_HRDY_WAIT, 0, 0, wait_us);
     }
+
+    ESP_ERROR_ASSERT(ready);
 }
 
 uint16_t IT8951::read_data() {
     transaction_start();
 
-    wait_until_idle();
-    write_word(0x1000);
-    wait_until_idle();
-    read_word();  // Skip a word.
-    wait_until_idle();
-    auto result = read_word();
+    uint16_t result;
+
+    if (_pack_write) {
+        // Send the preamble and read the dummy word and the data in one go.
+
+        uint8_t tx_data[6] = {0x10, 0x00};
+        uint8_t rx_data[6];
+
+        wait_until_idle();
+        transfer(tx_data, rx_data, sizeof(tx_data));
+
+        result = (uint16_t)rx_data[4] << 8 | rx_data[5];
+    } else {
+        wait_until_idle();
+        write_word(0x1000);
+        wait_until_idle();
+        read_word();  // Skip a word.
+        wait_until_idle();
+        result = read_word();
+    }
 
     transaction_end();
 
     return result;
 }
 
-void IT8951::read_data(uint8_t* data, size_t len) {
+void IT8951::read_data_start() {
+    // Sends the read preamble and skips the dummy word.
+
     transaction_start();
 
-    wait_until_idle();
-    write_word(0x1000);
-    wait_until_idle();
-    read_word();  // Skip a word.
-    wait_until_idle();
+    if (_pack_write) {
+        uint8_t tx_data[4] = {0x10, 0x00};
+
+        wait_until_idle();
+        transfer(tx_data, nullptr, sizeof(tx_data));
+    } else {
+        wait_until_idle();
+        write_word(0x1000);
+        wait_until_idle();
+        read_word();  // Skip a word.
+        wait_until_idle();
+    }
+}
+
+void IT8951::read_data(uint8_t* data, size_t len) {
+    read_data_start();
+
     read_array(data, len, true);
 
     transaction_end();
@@ -337,14 +432,31 @@ void IT8951::read_data(uint8_t* data, size_t len) {
 void IT8951::write_command(uint16_t command) {
     transaction_start();
 
-    wait_until_idle();
-    write_word(0x6000);
-    wait_until_idle();
-    write_word(command);
+    if (_pack_write) {
+        uint8_t tx_data[] = {0x60, 0x00, (uint8_t)(command >> 8), (uint8_t)command};
+
+        wait_until_idle();
+        transfer(tx_data, nullptr, sizeof(tx_data));
+    } else {
+        wait_until_idle();
+        write_word(0x6000);
+        wait_until_idle();
+        write_word(command);
+    }
 
     transaction_end();
 }
 
+void IT8951::write_command(uint16_t command, std::initializer_list<uint16_t> args) {
+    BusLock lock(this);
+
+    write_command(command);
+
+    if (args.size()) {
+        write_data(args.begin(), args.size(), false);
+    }
+}
+
 void IT8951::write_data(uint16_t data) {
     transaction_start();
 
@@ -356,39 +468,53 @@ void IT8951::write_data(uint16_t data) {
     transaction_end();
 }
 
-void IT8951::write_data(uint8_t* data, size_t len) {
-    transaction_start();
+void IT8951::write_data(const uint16_t* data, size_t count, bool keep_open) {
+    if (!_pack_write) {
+        for (size_t i = 0; i < count; i++) {
+            write_data(data[i]);
+        }
 
-    wait_until_idle();
-    write_word(0x0000);
-    wait_until_idle();
-    write_array(data, len, true);
+        if (keep_open) {
+            transaction_start();
 
-    transaction_end();
-}
+            wait_until_idle();
+            write_word(0x0000);
+            wait_until_idle();
+        }
+        return;
+    }
 
-uint16_t IT8951::read_reg(uint16_t reg) {
-    transaction_start();
+    // With pack write enabled, the controller accepts all arguments after a
+    // single preamble without checking HRDY in between.
 
-    write_command(IT8951_TCON_REG_RD);
-    write_data(reg);
-    auto result = read_data();
+    uint8_t tx_data[2 + 2 * IT8951_MAX_ARGS] = {0x00, 0x00};
+    ESP_ERROR_ASSERT(count <= IT8951_MAX_ARGS);
 
-    transaction_end();
+    for (size_t i = 0; i < count; i++) {
+        tx_data[2 + i * 2] = data[i] >> 8;
+        tx_data[2 + i * 2 + 1] = data[i];
+    }
 
-    return result;
+    transaction_start();
+
+    wait_until_idle();
+    transfer(tx_data, nullptr, 2 + count * 2);
+
+    if (!keep_open) {
+        transaction_end();
+    }
 }
 
-void IT8951::write_reg(uint16_t reg, uint16_t value) {
-    transaction_start();
+uint16_t IT8951::read_reg(uint16_t reg) {
+    BusLock lock(this);
 
-    write_command(IT8951_TCON_REG_WR);
-    write_data(reg);
-    write_data(value);
+    write_command(IT8951_TCON_REG_RD, {reg});
 
-    transaction_end();
+    return read_data();
 }
 
+void IT8951::write_reg(uint16_t reg, uint16_t value) { write_command(IT8951_TCON_REG_WR, {reg, value}); }
+
 void IT8951::enable_enhance_driving_capability() {
     auto value = read_reg(0x0038);
 
@@ -401,53 +527,144 @@ void IT8951::enable_enhance_driving_capability() {
     ESP_LOGD(TAG, "The reg value after writing is %x", value);
 }
 
-void IT8951::set_system_run() { write_command(IT8951_TCON_SYS_RUN); }
+void IT8951::set_system_run() {
+    // Acquiring the bus wakes the controller if the driver put it in standby
+    // or sleep. Otherwise, the state of the controller isn't known, e.g. when
+    // it was put to sleep before a deep sleep of the chip.
+
+    const auto power_state = _power_state;
+
+    BusLock lock(this);
+
+    if (power_state == IT8951_POWER_STATE_RUN) {
+        write_command(IT8951_TCON_SYS_RUN);
+    }
+}
+
+void IT8951::set_standby() {
+    wait_display_ready();
+
+    BusLock lock(this);
+
+    write_command(IT8951_TCON_STANDBY);
+
+    set_power_state(IT8951_POWER_STATE_STANDBY);
+}
+
+void IT8951::set_sleep() {
+    wait_display_ready();
+
+    BusLock lock(this);
+
+    write_command(IT8951_TCON_SLEEP);
+
+    set_power_state(IT8951_POWER_STATE_SLEEP);
+}
+
+IT8951PowerStats IT8951::get_power_stats() {
+    auto stats = _power_stats;
+
+    stats.time_us[_power_state] += _transport->get_time_us() - _power_state_since_us;
+
+    return stats;
+}
+
+bool IT8951::is_refreshing() {
+    if (_refresh_count) {
+        BusLock lock(this);
+
+        update_refreshes(read_reg(LUTAFSR));
+    }
+
+    return _refresh_count;
+}
+
+bool IT8951::is_refresh_done(uint32_t refresh_id) {
+    for (size_t i = 0; i < _refresh_count; i++) {
+        if (_refreshes[i].id == refresh_id) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void IT8951::set_power_state(it8951_power_state_t power_state) {
+    const auto now = _transport->get_time_us();
+
+    _power_stats.time_us[_power_state] += now - _power_state_since_us;
+    _power_stats.entries[power_state]++;
+    _power_state = power_state;
+    _power_state_since_us = now;
+}
+
+void IT8951::wake() {
+    // The wake up time is measured up to the next wait for HRDY, which is
+    // the first command after this one.
+
+    const auto from = _power_state;
+    const auto start = _transport->get_time_us();
+
+    set_power_state(IT8951_POWER_STATE_RUN);
 
-void IT8951::set_sleep() { write_command(IT8951_TCON_SLEEP); }
+    write_command(IT8951_TCON_SYS_RUN);
+
+    _power_stats.wakes[from]++;
+    _wake_from = from;
+    _wake_start_us = start;
+    _wake_pending = true;
+}
 
 void IT8951::reset() {
-    gpio_set_level((gpio_num_t)CONFIG_IT8951_RESET_PIN, 1);
+    _transport->set_reset(true);
     delay(200);
-    gpio_set_level((gpio_num_t)CONFIG_IT8951_RESET_PIN, 0);
+    _transport->set_reset(false);
     delay(10);
-    gpio_set_level((gpio_num_t)CONFIG_IT8951_RESET_PIN, 1);
+    _transport->set_reset(true);
     delay(200);
 }
 
 void IT8951::get_system_info(DeviceInfo& device_info) {
+    BusLock lock(this);
+
     write_command(USDEF_I80_CMD_GET_DEV_INFO);
 
     read_data((uint8_t*)&device_info, sizeof(DeviceInfo));
-
-    ESP_LOGI(TAG, "Panel(W,H) = (%d,%d)", device_info.width, device_info.height);
-    ESP_LOGI(TAG, "Memory Address = %X", device_info.memory_address_low | (device_info.memory_address_heigh << 16));
-    ESP_LOGI(TAG, "FW Version = %s", (uint8_t*)device_info.firmware_version);
-    ESP_LOGI(TAG, "LUT Version = %s", (uint8_t*)device_info.lut_version);
 }
 
 uint16_t IT8951::get_vcom() {
-    write_command(USDEF_I80_CMD_VCOM);
-    write_data(0x0000);
+    BusLock lock(this);
+
+    write_command(USDEF_I80_CMD_VCOM, {0x0000});
     return read_data();
 }
 
-void IT8951::set_vcom(uint16_t vcom) {
-    write_command(USDEF_I80_CMD_VCOM);
-    write_data(0x0001);
-    write_data(vcom);
-}
+void IT8951::set_vcom(uint16_t vcom) { write_command(USDEF_I80_CMD_VCOM, {0x0001, vcom}); }
 
 void IT8951::controller_setup(DeviceInfo& device_info, uint16_t vcom) {
+    BusLock lock(this);
+
     transaction_end();
 
+    _pack_write = false;
+    _one_bpp = false;
+    _one_bpp_colors = 0;
+    _refresh_count = 0;
+
     reset();
 
     set_system_run();
 
     get_system_info(device_info);
 
+    ESP_LOGI(TAG, "Panel(W,H) = (%d,%d)", device_info.width, device_info.height);
+    ESP_LOGI(TAG, "Memory Address = %X", device_info.memory_address_low | (device_info.memory_address_heigh << 16));
+    ESP_LOGI(TAG, "FW Version = %s", (uint8_t*)device_info.firmware_version);
+    ESP_LOGI(TAG, "LUT Version = %s", (uint8_t*)device_info.lut_version);
+
     // Enable Pack write
     write_reg(I80CPCR, 0x0001);
+    _pack_write = true;
 
     // Set VCOM by handle
     if (vcom != get_vcom()) {
@@ -456,168 +673,971 @@ void IT8951::controller_setup(DeviceInfo& device_info, uint16_t vcom) {
     }
 }
 
-void IT8951::clear_screen() {
-    IT8951Area area = {
-        .x = 0,
-        .y = 0,
-        .w = _width,
-        .h = _height,
-    };
+bool IT8951::warm_setup(uint16_t vcom) {
+    RetainedState state;
 
-    load_image_start(area, _memory_address, IT8951_ROTATE_0, IT8951_PIXEL_FORMAT_1BPP);
+    if (!_transport->load_retained_state(&state, sizeof(state)) || state.magic != IT8951_RETAINED_STATE_MAGIC ||
+        state.vcom != vcom) {
+        return false;
+    }
 
-    auto write_len = area.w / 8 * area.h;
+    ESP_LOGI(TAG, "Checking whether the controller kept its state");
 
-    for (uint32_t offset = 0; offset < write_len; offset += _buffer_len) {
-        auto buffer = get_buffer();
+    // The controller was setup before, so it accepts the fast clock right away.
 
-        memset(buffer, 0xff, _buffer_len);
+    _spi_clock_hz = load_spi_clock_speed();
+    spi_setup(_spi_clock_hz);
 
-        load_image_flush_buffer(std::min(size_t(write_len - offset), size_t(_buffer_len)));
+    if (!_transport->wait_ready(IT8951_WARM_START_READY_TIMEOUT_MS)) {
+        ESP_LOGI(TAG, "Controller isn't ready; resetting");
+        return false;
     }
 
-    load_image_end();
+    {
+        BusLock lock(this);
 
-    display_area(area, _memory_address, IT8951_PIXEL_FORMAT_1BPP, IT8951_DISPLAY_MODE_INIT);
-}
+        transaction_end();
 
-void IT8951::load_image_start(IT8951Area& area, uint32_t target_memory_address, it8951_rotate_t rotate,
-                              it8951_pixel_format_t pixel_format) {
-    wait_display_ready();
+        // A controller that was reset has pack write disabled, so check
+        // using the protocol that works either way. The controller may have
+        // been put to sleep before the deep sleep.
 
-    uint16_t pixel_format_value;
+        _pack_write = false;
 
-    switch (pixel_format) {
-        case IT8951_PIXEL_FORMAT_1BPP:
-        case IT8951_PIXEL_FORMAT_8BPP:
-            pixel_format_value = IT8951_8BPP;
-            break;
-        case IT8951_PIXEL_FORMAT_2BPP:
-            pixel_format_value = IT8951_2BPP;
-            break;
-        case IT8951_PIXEL_FORMAT_4BPP:
-            pixel_format_value = IT8951_4BPP;
-            break;
-        default:
-            assert(false);
-            break;
-    }
+        set_system_run();
 
-    set_target_memory_address(target_memory_address);
+        if (read_reg(I80CPCR) != 0x0001) {
+            ESP_LOGI(TAG, "Controller lost its state; resetting");
+            return false;
+        }
+    }
 
-    auto x = area.x;
-    auto w = area.w;
+    _pack_write = true;
+    _refresh_count = 0;
+    _width = state.width;
+    _height = state.height;
+    _memory_address = state.memory_address;
+    _a2_mode = state.a2_mode;
+    _one_bpp = state.one_bpp;
+    _one_bpp_colors = state.one_bpp_colors;
+    _power_state_since_us = _transport->get_time_us();
+    _power_stats = {};
 
-    if (pixel_format == IT8951_PIXEL_FORMAT_1BPP) {
-        x /= 8;
-        w /= 8;
-    }
+    ESP_LOGI(TAG, "Warm start; Panel(W,H) = (%d,%d)", _width, _height);
 
-    // Send image load area start command.
+    return true;
+}
 
-    write_command(IT8951_TCON_LD_IMG_AREA);
-    write_data((IT8951_LDIMG_B_ENDIAN << 8 | pixel_format_value << 4 | (uint16_t)rotate));
-    write_data(x);
-    write_data(area.y);
-    write_data(w);
-    write_data(area.h);
+void IT8951::store_retained_state() {
+    const RetainedState state = {
+        .magic = IT8951_RETAINED_STATE_MAGIC,
+        .memory_address = _memory_address,
+        .width = _width,
+        .height = _height,
+        .vcom = _vcom,
+        .one_bpp_colors = _one_bpp_colors,
+        .a2_mode = (uint8_t)_a2_mode,
+        .one_bpp = _one_bpp,
+    };
 
-    // This is the start of the write_data method. The data itself
-    // will be written in chunks.
+    _transport->store_retained_state(&state, sizeof(state));
+}
 
-    transaction_start();
+// Memory words are little endian, while the bus sends the high byte of a
+// word first.
+static void swap_bytes(uint8_t* data, size_t len) {
+    for (size_t i = 0; i + 1 < len; i += 2) {
+        std::swap(data[i], data[i + 1]);
+    }
+}
 
-    wait_until_idle();
-    write_word(0x0000);
-    wait_until_idle();
+// Alternating bits, all bits flipping at once, a walking one and pseudo
+// random data. Bits that are shifted or dropped show up in all of them.
+static uint8_t get_test_pattern(int round, size_t i) {
+    switch (round % 4) {
+        case 0:
+            return i % 2 ? 0xaa : 0x55;
+        case 1:
+            return i / 2 % 2 ? 0xff : 0x00;
+        case 2:
+            return 1 << i % 8;
+        default: {
+            uint32_t value = (i + round) * 2654435761u;
+            value ^= value >> 15;
+            return value >> 8;
+        }
+    }
 }
 
-void IT8951::load_image_flush_buffer(size_t len) {
-    ESP_ERROR_ASSERT(len <= _buffer_len);
+int IT8951::calibrate_spi_clock(uint32_t scratch_address) {
+    ESP_ERROR_ASSERT(_buffers && !_buffers_pending);
+    ESP_ERROR_ASSERT(scratch_address % 2 == 0);
 
-    if (_buffer_transaction_pending) {
-        spi_transaction_t* result_transaction;
-        ESP_ERROR_CHECK(spi_device_get_trans_result(_spi, &result_transaction, portMAX_DELAY));
+    const auto len = IT8951_SPI_CALIBRATION_LEN;
+    const auto saved = std::make_unique<uint8_t[]>(len);
+    const auto buffer = std::make_unique<uint8_t[]>(len);
 
-        ESP_ERROR_ASSERT(result_transaction == &_buffer_transaction);
+    // Keep what's in the scratch area, reading it at the configured clock speed.
 
-        _buffer_transaction_pending = false;
-    }
+    spi_setup(IT8951_SPI_CLOCK_HZ);
+    read_memory(scratch_address, saved.get(), len);
 
-    if (!len) {
-        return;
+    if (!verify_spi_clock(scratch_address, buffer.get(), len)) {
+        ESP_LOGE(TAG, "Memory doesn't read back at the configured SPI clock of %d Hz", IT8951_SPI_CLOCK_HZ);
+
+        write_memory(scratch_address, saved.get(), len);
+        spi_setup(_spi_clock_hz);
+
+        return _spi_clock_hz;
     }
 
-    _buffer_transaction = {
-        .length = 8 * len,
-        .tx_buffer = _current_buffer == 0 ? _buffer0 : _buffer1,
-    };
+    // Keep one step below the fastest clock that passed.
 
-    ESP_ERROR_CHECK(spi_device_queue_trans(_spi, &_buffer_transaction, portMAX_DELAY));
+    int passed_hz = IT8951_SPI_CLOCK_HZ;
+    int selected_hz = IT8951_SPI_CLOCK_HZ;
 
-    _buffer_transaction_pending = true;
-    _current_buffer = (_current_buffer + 1) % 2;
-}
+    for (int divider = CONFIG_IT8951_SPI_BUS_SPEED_DIVIDER - 1; divider >= IT8951_SPI_MIN_DIVIDER; divider--) {
+        const auto clock_speed_hz = IT8951_SPI_BASE_CLOCK_HZ / divider;
 
-void IT8951::load_image_end() {
-    load_image_flush_buffer(0);
+        spi_setup(clock_speed_hz);
 
-    _current_buffer = 0;
+        if (!verify_spi_clock(scratch_address, buffer.get(), len)) {
+            break;
+        }
 
-    transaction_end();
+        selected_hz = passed_hz;
+        passed_hz = clock_speed_hz;
+    }
 
-    write_command(IT8951_TCON_LD_IMG_END);
-}
+    spi_setup(selected_hz);
 
-void IT8951::display_area(IT8951Area& area, uint32_t target_memory_address, it8951_pixel_format_t pixel_format,
-                          it8951_display_mode_t mode) {
-    wait_display_ready();
+    // Writes at a clock that failed may have been garbled into other
+    // commands, so check the controller still works as expected.
 
-    if (pixel_format == IT8951_PIXEL_FORMAT_1BPP) {
-        // Set Display mode to 1 bpp mode - Set 0x18001138 Bit[18](0x1800113A Bit[2])to 1
+    if (!verify_spi_clock(scratch_address, buffer.get(), len)) {
+        ESP_LOGW(TAG, "Controller got confused by the calibration; resetting");
 
-        write_reg(UP1SR + 2, read_reg(UP1SR + 2) | (1 << 2));
-        write_reg(BGVR, (FRONT_GRAY_VALUE << 8) | BACK_GRAY_VALUE);
-    }
+        DeviceInfo device_info;
 
-    if (!target_memory_address) {
-        write_command(USDEF_I80_CMD_DPY_AREA);
-        write_data(area.x);
-        write_data(area.y);
-        write_data(area.w);
-        write_data(area.h);
-        write_data(get_mode_value(mode));
-    } else {
-        write_command(USDEF_I80_CMD_DPY_BUF_AREA);
-        write_data(area.x);
-        write_data(area.y);
-        write_data(area.w);
-        write_data(area.h);
-        write_data(get_mode_value(mode));
-        write_data(target_memory_address);
-        write_data(target_memory_address >> 16);
+        spi_setup(IT8951_SPI_INIT_CLOCK_HZ);
+        controller_setup(device_info, _vcom);
+        spi_setup(selected_hz);
     }
 
-    if (pixel_format == IT8951_PIXEL_FORMAT_1BPP) {
-        wait_display_ready();
+    write_memory(scratch_address, saved.get(), len);
 
-        write_reg(UP1SR + 2, read_reg(UP1SR + 2) & ~(1 << 2));
-    }
-}
+    ESP_LOGI(TAG, "SPI clock of %d Hz selected; %d Hz passed", selected_hz, passed_hz);
 
-void IT8951::set_target_memory_address(uint32_t target_memory_address) {
-    uint16_t WordH = (uint16_t)((target_memory_address >> 16) & 0x0000FFFF);
-    uint16_t WordL = (uint16_t)(target_memory_address & 0x0000FFFF);
+    _spi_clock_hz = selected_hz;
 
-    write_reg(LISAR + 2, WordH);
-    write_reg(LISAR, WordL);
+    if (!_transport->store_setting(IT8951_SPI_CLOCK_SETTING, selected_hz)) {
+        ESP_LOGW(TAG, "The SPI clock speed couldn't be stored");
+    }
+
+    return selected_hz;
 }
 
-void IT8951::wait_display_ready() {
-    const uint32_t start = millis();
+bool IT8951::verify_spi_clock(uint32_t scratch_address, uint8_t* buffer, size_t len) {
+    for (int round = 0; round < IT8951_SPI_CALIBRATION_ROUNDS; round++) {
+        for (size_t i = 0; i < len; i++) {
+            buffer[i] = get_test_pattern(round, i);
+        }
 
-    while (true) {
-        if (!read_reg(LUTAFSR)) {
+        write_memory(scratch_address, buffer, len);
+        read_memory(scratch_address, buffer, len);
+
+        for (size_t i = 0; i < len; i++) {
+            if (buffer[i] != get_test_pattern(round, i)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void IT8951::clear_screen() {
+    IT8951Area area = {
+        .x = 0,
+        .y = 0,
+        .w = _width,
+        .h = _height,
+    };
+
+    fill_area(area, BACK_GRAY_VALUE, IT8951_DISPLAY_MODE_INIT);
+}
+
+void IT8951::load_image_start(IT8951Area& area, uint32_t target_memory_address, it8951_rotate_t rotate,
+                              it8951_pixel_format_t pixel_format) {
+    uint16_t pixel_format_value;
+
+    switch (pixel_format) {
+        case IT8951_PIXEL_FORMAT_1BPP:
+        case IT8951_PIXEL_FORMAT_8BPP:
+            pixel_format_value = IT8951_8BPP;
+            break;
+        case IT8951_PIXEL_FORMAT_2BPP:
+            pixel_format_value = IT8951_2BPP;
+            break;
+        case IT8951_PIXEL_FORMAT_4BPP:
+            pixel_format_value = IT8951_4BPP;
+            break;
+        default:
+            // Not a format the controller can load.
+            abort();
+    }
+
+    auto x = area.x;
+    auto w = area.w;
+
+    if (pixel_format == IT8951_PIXEL_FORMAT_1BPP) {
+        x /= 8;
+        w /= 8;
+    }
+
+    // Only wait for refreshes that show this part of the memory.
+
+    const IT8951Area memory_area = {.x = x, .y = area.y, .w = w, .h = area.h};
+
+    write_fills(target_memory_address, memory_area, true);
+    wait_refreshes(nullptr, target_memory_address, &memory_area);
+
+    // The bus is held until the image has been loaded.
+
+    acquire_bus();
+
+    set_target_memory_address(target_memory_address);
+
+    // Send image load area start command. The arguments are the start of
+    // the data transaction. The image data itself will be written in chunks.
+
+    write_command(IT8951_TCON_LD_IMG_AREA);
+
+    const uint16_t args[] = {
+        (uint16_t)(IT8951_LDIMG_B_ENDIAN << 8 | pixel_format_value << 4 | (uint16_t)rotate),
+        x,
+        area.y,
+        w,
+        area.h,
+    };
+
+    write_data(args, sizeof(args) / sizeof(args[0]), true);
+
+    trace(IT8951_TRACE_LOAD_IMAGE_START, pixel_format, 0, uint32_t(area.h) << 16 | area.w);
+
+    _last_activity_us = _transport->get_time_us();
+}
+
+uint8_t* IT8951::try_get_buffer() {
+    // The current buffer is in flight only if all buffers are.
+
+    if (_buffers_pending == _buffer_count) {
+        if (!_transport->poll_transfer()) {
+            return nullptr;
+        }
+
+        _buffers_pending--;
+    }
+
+    return get_buffer();
+}
+
+bool IT8951::load_image_release_buffer(bool wait) {
+    if (!_buffers_pending) {
+        return false;
+    }
+
+    if (wait) {
+        _transport->wait_transfer();
+    } else if (!_transport->poll_transfer()) {
+        return false;
+    }
+
+    _buffers_pending--;
+
+    return true;
+}
+
+void IT8951::load_image_flush_buffer(size_t len, bool wait) {
+    ESP_ERROR_ASSERT(len <= _buffer_len);
+    ESP_ERROR_ASSERT(_buffers_pending < _buffer_count);
+
+    _buffer_used = 0;
+
+    if (len) {
+        if (_swap_payload) {
+            swap_bytes(_buffers[_current_buffer], len);
+        }
+
+        _transport->queue_transfer(_buffers[_current_buffer], nullptr, len);
+        _frame_stats.payload_transfers++;
+        _perf_counters.payload_transfers++;
+        _perf_counters.payload_bytes += len;
+
+        trace(IT8951_TRACE_PAYLOAD_TRANSFER, 0, 0, len);
+
+        _buffers_pending++;
+        _current_buffer = (_current_buffer + 1) % _buffer_count;
+    }
+
+    // Buffers are queued in order, so the next buffer is the oldest
+    // one in flight.
+
+    if (wait && _buffers_pending == _buffer_count) {
+        _transport->wait_transfer();
+        _buffers_pending--;
+    }
+}
+
+void IT8951::load_image_end() {
+    flush_payload();
+
+    write_command(IT8951_TCON_LD_IMG_END);
+
+    release_bus();
+
+    trace(IT8951_TRACE_LOAD_IMAGE_END, 0, 0, 0);
+}
+
+void IT8951::flush_payload() {
+    if (_buffer_used) {
+        load_image_flush_buffer(_buffer_used);
+    }
+
+    while (_buffers_pending) {
+        _transport->wait_transfer();
+        _buffers_pending--;
+    }
+
+    transaction_end();
+}
+
+void IT8951::load_image(IT8951Area& area, uint32_t target_memory_address, it8951_rotate_t rotate,
+                        it8951_pixel_format_t pixel_format, const uint8_t* data, size_t stride) {
+    const auto row_bytes = get_row_bytes(area.w, pixel_format);
+
+    load_image_start(area, target_memory_address, rotate, pixel_format);
+
+    const uint8_t padding = 0;
+
+    for (uint16_t y = 0; y < area.h; y++) {
+        load_image_write(data + y * stride, row_bytes);
+
+        if (row_bytes % 2) {
+            load_image_write(&padding, 1);
+        }
+    }
+
+    load_image_end();
+}
+
+void IT8951::load_image_render(IT8951Area& area, uint32_t target_memory_address, it8951_rotate_t rotate,
+                               it8951_pixel_format_t pixel_format, it8951_render_cb_t render, void* user_data) {
+    const auto stride = get_stride(area.w, pixel_format);
+
+    ESP_ERROR_ASSERT(stride <= _buffer_len);
+
+    const auto rows = uint16_t(std::min<size_t>(_buffer_len / stride, area.h));
+
+    load_image_start(area, target_memory_address, rotate, pixel_format);
+
+    for (uint16_t y = 0; y < area.h; y += rows) {
+        const IT8951Area band = {
+            .x = area.x,
+            .y = uint16_t(area.y + y),
+            .w = area.w,
+            .h = std::min<uint16_t>(rows, area.h - y),
+        };
+
+        render(band, get_buffer(), stride, user_data);
+
+        load_image_flush_buffer(band.h * stride);
+    }
+
+    load_image_end();
+}
+
+void IT8951::write_memory_start(uint32_t address, size_t len) {
+    ESP_ERROR_ASSERT(address % 2 == 0 && len % 2 == 0);
+
+    // Only wait for refreshes that show this part of the memory, compared
+    // by the rows the data occupies.
+
+    const IT8951Area memory_area = {.x = 0, .y = 0, .w = _width, .h = uint16_t((len + _width - 1) / _width)};
+
+    write_fills(address, memory_area, false);
+    wait_refreshes(nullptr, address, &memory_area);
+
+    // The bus is held until the data has been copied.
+
+    acquire_bus();
+
+    const auto words = len / 2;
+
+    write_command(IT8951_TCON_MEM_BST_WR,
+                  {(uint16_t)address, (uint16_t)(address >> 16), (uint16_t)words, (uint16_t)(words >> 16)});
+
+    // The data follows in a transaction of its own.
+
+    transaction_start();
+
+    wait_until_idle();
+    write_word(0x0000);
+
+    _swap_payload = true;
+    _last_activity_us = _transport->get_time_us();
+}
+
+void IT8951::write_memory_end() {
+    flush_payload();
+
+    _swap_payload = false;
+
+    write_command(IT8951_TCON_MEM_BST_END);
+
+    release_bus();
+}
+
+void IT8951::write_memory(uint32_t address, const uint8_t* data, size_t len) {
+    write_memory_start(address, len);
+    load_image_write(data, len);
+    write_memory_end();
+}
+
+void IT8951::read_memory_start(uint32_t address, size_t len) {
+    ESP_ERROR_ASSERT(address % 2 == 0 && len % 2 == 0);
+    ESP_ERROR_ASSERT(!_buffers_pending);
+
+    const IT8951Area memory_area = {.x = 0, .y = 0, .w = _width, .h = uint16_t((len + _width - 1) / _width)};
+
+    write_fills(address, memory_area, false);
+
+    // The bus is held until the data has been read.
+
+    acquire_bus();
+
+    const auto words = len / 2;
+
+    write_command(IT8951_TCON_MEM_BST_RD_T,
+                  {(uint16_t)address, (uint16_t)(address >> 16), (uint16_t)words, (uint16_t)(words >> 16)});
+    write_command(IT8951_TCON_MEM_BST_RD_S);
+
+    read_data_start();
+
+    _read_len = len;
+    _read_queued = 0;
+    _read_done = 0;
+    _read_held = false;
+
+    queue_reads();
+}
+
+void IT8951::queue_reads() {
+    // The current buffer is the oldest one being read, or the one the
+    // application is processing. The others are queued behind it.
+
+    while (_read_queued < _read_len && _buffers_pending + _read_held < _buffer_count) {
+        const auto len = std::min(_buffer_len, _read_len - _read_queued);
+
+        _transport->queue_transfer(nullptr, get_buffer(_buffers_pending + _read_held), len);
+        _perf_counters.payload_transfers++;
+        _perf_counters.payload_bytes += len;
+
+        trace(IT8951_TRACE_PAYLOAD_TRANSFER, 1, 0, len);
+
+        _read_queued += len;
+        _buffers_pending++;
+    }
+}
+
+const uint8_t* IT8951::read_memory_next(size_t& len) {
+    // The buffer returned by the previous call is reused for the next read.
+
+    if (_read_held) {
+        _read_held = false;
+        _current_buffer = (_current_buffer + 1) % _buffer_count;
+
+        queue_reads();
+    }
+
+    if (!_buffers_pending) {
+        len = 0;
+        return nullptr;
+    }
+
+    _transport->wait_transfer();
+    _buffers_pending--;
+    _read_held = true;
+
+    len = std::min(_buffer_len, _read_len - _read_done);
+    _read_done += len;
+
+    const auto buffer = get_buffer();
+
+    swap_bytes(buffer, len);
+
+    return buffer;
+}
+
+void IT8951::read_memory_end() {
+    while (_buffers_pending) {
+        _transport->wait_transfer();
+        _buffers_pending--;
+    }
+
+    if (_read_held) {
+        _read_held = false;
+        _current_buffer = (_current_buffer + 1) % _buffer_count;
+    }
+
+    transaction_end();
+
+    write_command(IT8951_TCON_MEM_BST_END);
+
+    release_bus();
+}
+
+void IT8951::read_memory(uint32_t address, uint8_t* data, size_t len) {
+    read_memory_start(address, len);
+
+    size_t read_len;
+
+    while (auto read_data = read_memory_next(read_len)) {
+        memcpy(data, read_data, read_len);
+        data += read_len;
+    }
+
+    read_memory_end();
+}
+
+size_t IT8951::get_row_bytes(uint16_t width, it8951_pixel_format_t pixel_format) {
+    // Excludes the padding to whole words. 1 bpp images are loaded as 8 bpp
+    // images of an eighth of the width.
+
+    switch (pixel_format) {
+        case IT8951_PIXEL_FORMAT_1BPP:
+            return width / 8;
+        case IT8951_PIXEL_FORMAT_2BPP:
+            return (width + 3) / 4;
+        case IT8951_PIXEL_FORMAT_4BPP:
+            return (width + 1) / 2;
+        default:
+            return width;
+    }
+}
+
+size_t IT8951::get_stride(uint16_t width, it8951_pixel_format_t pixel_format) {
+    return (get_row_bytes(width, pixel_format) + 1) & ~size_t(1);
+}
+
+void IT8951::load_image_write(const uint8_t* data, size_t len) {
+    // Data is copied back to back, so a buffer can hold parts of several writes.
+
+    while (len) {
+        const auto copy = std::min(len, _buffer_len - _buffer_used);
+
+        memcpy(get_buffer() + _buffer_used, data, copy);
+
+        _buffer_used += copy;
+        data += copy;
+        len -= copy;
+
+        if (_buffer_used == _buffer_len) {
+            load_image_flush_buffer(_buffer_used);
+        }
+    }
+}
+
+void IT8951::load_image_write_direct(const uint8_t* data, size_t len) {
+    if (_buffer_used) {
+        load_image_flush_buffer(_buffer_used);
+    }
+
+    // The transfers take the places of SPI buffers in the queue, which
+    // completes them in order.
+
+    while (len) {
+        const auto chunk = std::min(len, _buffer_len);
+
+        if (_buffers_pending == _buffer_count) {
+            _transport->wait_transfer();
+            _buffers_pending--;
+        }
+
+        _transport->queue_transfer(data, nullptr, chunk);
+        _frame_stats.payload_transfers++;
+        _perf_counters.payload_transfers++;
+        _perf_counters.payload_bytes += chunk;
+
+        trace(IT8951_TRACE_PAYLOAD_TRANSFER, 0, 0, chunk);
+
+        _buffers_pending++;
+        data += chunk;
+        len -= chunk;
+    }
+
+    // Like after flushing a buffer, the next one can be filled right away.
+
+    if (_buffers_pending == _buffer_count) {
+        _transport->wait_transfer();
+        _buffers_pending--;
+    }
+}
+
+void IT8951::display_area(IT8951Area& area, uint32_t target_memory_address, it8951_pixel_format_t pixel_format,
+                          it8951_display_mode_t mode) {
+    const auto one_bpp = pixel_format == IT8951_PIXEL_FORMAT_1BPP;
+
+    set_one_bpp(one_bpp, (FRONT_GRAY_VALUE << 8) | BACK_GRAY_VALUE);
+
+    // The refresh reads the bytes the image was loaded into, which for
+    // 1 bpp images are an eighth of the width.
+
+    IT8951Area memory_area = area;
+
+    if (one_bpp) {
+        memory_area.x = area.x / 8;
+        memory_area.w = (area.x + area.w + 7) / 8 - memory_area.x;
+    }
+
+    write_fills(target_memory_address ? target_memory_address : _memory_address, memory_area, false);
+
+    start_refresh(area, target_memory_address, mode, memory_area);
+}
+
+static bool area_contains(const IT8951Area& a, const IT8951Area& b) {
+    return b.x >= a.x && b.x + b.w <= a.x + a.w && b.y >= a.y && b.y + b.h <= a.y + a.h;
+}
+
+static void render_fill(const IT8951Area& band, uint8_t* buffer, size_t stride, void* user_data) {
+    memset(buffer, *(const uint8_t*)user_data, band.h * stride);
+}
+
+void IT8951::fill_area(IT8951Area& area, uint8_t gray, it8951_display_mode_t mode, uint32_t target_memory_address) {
+    if (!target_memory_address) {
+        target_memory_address = _memory_address;
+    }
+
+    // In 1 bpp mode every pixel is mapped to one of the two colors of the
+    // color table. When both are the fill color, the contents of the memory
+    // don't matter and no pixels have to be transferred.
+
+    set_one_bpp(true, (gray << 8) | gray);
+
+    start_refresh(area, 0, mode, {});
+
+    // The memory still holds what was there before. It's filled when it's
+    // next used, unless it's overwritten first, like by the next frame or a
+    // later fill of the same area.
+
+    size_t count = 0;
+
+    for (size_t i = 0; i < _pending_fill_count; i++) {
+        const auto& fill = _pending_fills[i];
+
+        if (fill.memory_address != target_memory_address || !area_contains(area, fill.area)) {
+            _pending_fills[count++] = fill;
+        }
+    }
+
+    _pending_fill_count = count;
+
+    if (_pending_fill_count == IT8951_MAX_PENDING_FILLS) {
+        write_pending_fills();
+    }
+
+    _pending_fills[_pending_fill_count++] = {
+        .memory_address = target_memory_address,
+        .area = area,
+        .gray = gray,
+    };
+}
+
+void IT8951::write_pending_fills() {
+    // The fills are taken off the list first, as writing them loads images.
+
+    PendingFill fills[IT8951_MAX_PENDING_FILLS];
+    const auto count = _pending_fill_count;
+
+    std::copy(_pending_fills, _pending_fills + count, fills);
+    _pending_fill_count = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        write_fill(fills[i]);
+    }
+}
+
+void IT8951::write_fills(uint32_t memory_address, const IT8951Area& memory_area, bool overwritten) {
+    // Fills of memory that's about to be overwritten as a whole are dropped.
+    // When the memory is used otherwise, all fills are written in the order
+    // they were made, so later fills of overlapping areas end up on top.
+
+    size_t count = 0;
+    auto overlaps = false;
+
+    for (size_t i = 0; i < _pending_fill_count; i++) {
+        const auto& fill = _pending_fills[i];
+
+        if (overwritten && fill.memory_address == memory_address && area_contains(memory_area, fill.area)) {
+            continue;
+        }
+
+        overlaps |= memory_overlaps(fill.memory_address, fill.area, memory_address, memory_area);
+        _pending_fills[count++] = fill;
+    }
+
+    _pending_fill_count = count;
+
+    if (overlaps) {
+        write_pending_fills();
+    }
+}
+
+void IT8951::write_fill(const PendingFill& fill) {
+    // Gray values that 2 bpp can represent take half the transfer of 4 bpp.
+
+    const auto level = fill.gray >> 4;
+    const auto two_bpp = level % 5 == 0;
+    uint8_t value;
+
+    if (two_bpp) {
+        value = level / 5 * 0x55;
+    } else {
+        value = level << 4 | level;
+    }
+
+    auto area = fill.area;
+
+    load_image_render(area, fill.memory_address, IT8951_ROTATE_0,
+                      two_bpp ? IT8951_PIXEL_FORMAT_2BPP : IT8951_PIXEL_FORMAT_4BPP, render_fill, &value);
+}
+
+void IT8951::set_one_bpp(bool one_bpp, uint16_t colors) {
+    if (one_bpp == _one_bpp && (!one_bpp || colors == _one_bpp_colors)) {
+        return;
+    }
+
+    // The 1 bpp mode and its color table apply to all LUT engines, so they
+    // can only be changed when the controller isn't refreshing the panel.
+
+    wait_display_ready();
+
+    BusLock lock(this);
+
+    // Set Display mode to 1 bpp mode - Set 0x18001138 Bit[18](0x1800113A Bit[2])to 1
+
+    if (one_bpp != _one_bpp) {
+        if (one_bpp) {
+            write_reg(UP1SR + 2, read_reg(UP1SR + 2) | (1 << 2));
+        } else {
+            write_reg(UP1SR + 2, read_reg(UP1SR + 2) & ~(1 << 2));
+        }
+    }
+
+    if (one_bpp) {
+        write_reg(BGVR, colors);
+    }
+
+    _one_bpp = one_bpp;
+    _one_bpp_colors = colors;
+
+    store_retained_state();
+}
+
+void IT8951::start_refresh(IT8951Area& area, uint32_t target_memory_address, it8951_display_mode_t mode,
+                           const IT8951Area& memory_area) {
+    // Only wait for refreshes of the same part of the panel.
+
+    wait_refreshes(&area, 0, nullptr);
+
+    acquire_bus();
+
+    const auto lut_status = read_reg(LUTAFSR);
+    update_refreshes(lut_status);
+
+    if (!target_memory_address) {
+        write_command(USDEF_I80_CMD_DPY_AREA, {area.x, area.y, area.w, area.h, get_mode_value(mode)});
+    } else {
+        write_command(USDEF_I80_CMD_DPY_BUF_AREA,
+                      {area.x, area.y, area.w, area.h, get_mode_value(mode), (uint16_t)target_memory_address,
+                       (uint16_t)(target_memory_address >> 16)});
+    }
+
+    // The LUT engines that became active are the ones refreshing this area.
+
+    const auto lut_mask = read_reg(LUTAFSR) & ~lut_status;
+
+    release_bus();
+
+    if (_refresh_count == IT8951_MAX_REFRESHES) {
+        wait_display_ready();
+    }
+
+    _last_refresh_id++;
+
+    if (!_last_refresh_id) {
+        _last_refresh_id++;
+    }
+
+    _refreshes[_refresh_count++] = {
+        .id = _last_refresh_id,
+        .area = area,
+        .memory_address = target_memory_address ? target_memory_address : _memory_address,
+        .memory_area = memory_area,
+        .lut_mask = (uint16_t)lut_mask,
+        .mode = mode,
+        .start_us = _transport->get_time_us(),
+        .seen_busy_us = _transport->get_time_us(),
+    };
+
+    trace(IT8951_TRACE_REFRESH_START, mode, lut_mask, uint32_t(area.w) * area.h);
+
+    // These remove the artifacts of sleep mode from the whole screen.
+
+    if ((mode == IT8951_DISPLAY_MODE_GC16 || mode == IT8951_DISPLAY_MODE_INIT) && !area.x && !area.y &&
+        area.w == _width && area.h == _height) {
+        _power_stats.full_refreshes++;
+    }
+
+    _last_activity_us = _transport->get_time_us();
+
+    _last_frame_stats = _frame_stats;
+    _frame_stats = {};
+}
+
+void IT8951::set_target_memory_address(uint32_t target_memory_address) {
+    BusLock lock(this);
+
+    uint16_t WordH = (uint16_t)((target_memory_address >> 16) & 0x0000FFFF);
+    uint16_t WordL = (uint16_t)(target_memory_address & 0x0000FFFF);
+
+    write_reg(LISAR + 2, WordH);
+    write_reg(LISAR, WordL);
+}
+
+void IT8951::wait_display_ready() {
+    const uint32_t start = millis();
+    const auto start_us = _transport->get_time_us();
+
+    for (auto waited = false;; waited = true) {
+        const auto lut_status = read_reg(LUTAFSR);
+
+        update_refreshes(lut_status);
+
+        if (!lut_status) {
+            if (waited) {
+                add_lut_wait(start_us);
+            }
+            return;
+        }
+
+        if (millis() - start > this->idle_timeout()) {
+            ESP_LOGE(TAG, "Device not ready for more than 30 seconds; exiting");
+            esp_restart();
+            return;
+        }
+        delay(20);
+    }
+}
+
+void IT8951::update_refreshes(uint16_t lut_status) {
+    // Refreshes for which no LUT engine could be identified are only known
+    // to be complete once all LUT engines are idle.
+
+    const auto now_us = _transport->get_time_us();
+    size_t count = 0;
+
+    for (size_t i = 0; i < _refresh_count; i++) {
+        auto& refresh = _refreshes[i];
+
+        if (lut_status && (!refresh.lut_mask || (refresh.lut_mask & lut_status))) {
+            refresh.seen_busy_us = now_us;
+            _refreshes[count++] = refresh;
+        } else {
+            complete_refresh(refresh, now_us);
+        }
+    }
+
+    _refresh_count = count;
+}
+
+void IT8951::complete_refresh(const Refresh& refresh, int64_t now_us) {
+    auto& times = _perf_counters.modes[refresh.mode];
+
+    times.refreshes++;
+
+    // The refresh completed between the last time it was seen busy and now.
+    // Only refreshes that were polled while they completed, like when the
+    // driver waits for them, are timed; others may have completed long ago.
+
+    if (now_us - refresh.seen_busy_us > IT8951_REFRESH_TIMING_RESOLUTION_US) {
+        trace(IT8951_TRACE_REFRESH_DONE, refresh.mode, refresh.lut_mask, 0);
+        return;
+    }
+
+    const auto duration_us = now_us - refresh.start_us;
+
+    times.timed_refreshes++;
+    times.total_us += duration_us;
+    times.max_us = std::max(times.max_us, duration_us);
+
+    trace(IT8951_TRACE_REFRESH_DONE, refresh.mode, refresh.lut_mask, duration_us);
+}
+
+void IT8951::add_lut_wait(int64_t start_us) {
+    const auto wait_us = _transport->get_time_us() - start_us;
+
+    _perf_counters.lut_waits++;
+    _perf_counters.lut_wait_us += wait_us;
+
+    trace(IT8951_TRACE_LUT_WAIT, 0, 0, wait_us);
+}
+
+static bool areas_overlap(const IT8951Area& a, const IT8951Area& b) {
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+bool IT8951::memory_overlaps(uint32_t a_address, const IT8951Area& a, uint32_t b_address, const IT8951Area& b) {
+    // Refreshes of fills don't read the memory, and have an empty area.
+
+    if (!a.w || !a.h || !b.w || !b.h) {
+        return false;
+    }
+
+    // Images are stored with a pitch of the panel width. Images loaded at
+    // another address are compared by the range of rows they occupy.
+
+    if (a_address == b_address) {
+        return areas_overlap(a, b);
+    }
+
+    const auto a_start = a_address + a.y * _width;
+    const auto a_end = a_address + (a.y + a.h) * _width;
+    const auto b_start = b_address + b.y * _width;
+    const auto b_end = b_address + (b.y + b.h) * _width;
+
+    return a_start < b_end && b_start < a_end;
+}
+
+void IT8951::wait_refreshes(const IT8951Area* area, uint32_t memory_address, const IT8951Area* memory_area) {
+    const uint32_t start = millis();
+    const auto start_us = _transport->get_time_us();
+
+    for (auto waited = false;; waited = true) {
+        auto busy = false;
+
+        for (size_t i = 0; i < _refresh_count && !busy; i++) {
+            const auto& refresh = _refreshes[i];
+
+            busy = (area && areas_overlap(*area, refresh.area)) ||
+                   (memory_area &&
+                    memory_overlaps(refresh.memory_address, refresh.memory_area, memory_address, *memory_area));
+        }
+
+        if (!busy) {
+            if (waited) {
+                add_lut_wait(start_us);
+            }
             return;
         }
 
@@ -626,7 +1646,57 @@ void IT8951::wait_display_ready() {
             esp_restart();
             return;
         }
+
         delay(20);
+
+        update_refreshes(read_reg(LUTAFSR));
+    }
+}
+
+bool IT8951::is_display_blocked(const IT8951Area& area, it8951_pixel_format_t pixel_format) {
+    if (!_refresh_count) {
+        return false;
+    }
+
+    {
+        BusLock lock(this);
+
+        update_refreshes(read_reg(LUTAFSR));
+    }
+
+    if (!_refresh_count) {
+        return false;
+    }
+
+    const auto one_bpp = pixel_format == IT8951_PIXEL_FORMAT_1BPP;
+
+    if (one_bpp != _one_bpp || (one_bpp && _one_bpp_colors != ((FRONT_GRAY_VALUE << 8) | BACK_GRAY_VALUE))) {
+        return true;
+    }
+
+    if (_refresh_count == IT8951_MAX_REFRESHES) {
+        return true;
+    }
+
+    for (size_t i = 0; i < _refresh_count; i++) {
+        if (areas_overlap(area, _refreshes[i].area)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool IT8951::is_mode_supported(it8951_display_mode_t mode) {
+    // M641 panels have A2 where the others have GLR16, and lack GLD16 and DU4.
+
+    switch (mode) {
+        case IT8951_DISPLAY_MODE_GLR16:
+        case IT8951_DISPLAY_MODE_GLD16:
+        case IT8951_DISPLAY_MODE_DU4:
+            return _a2_mode != IT8951_MODE_A2_M641;
+        default:
+            return true;
     }
 }
 
@@ -636,6 +1706,16 @@ uint16_t IT8951::get_mode_value(it8951_display_mode_t mode) {
             return IT8951_MODE_INIT;
         case IT8951_DISPLAY_MODE_A2:
             return _a2_mode;
+        case IT8951_DISPLAY_MODE_DU:
+            return IT8951_MODE_DU;
+        case IT8951_DISPLAY_MODE_GL16:
+            return IT8951_MODE_GL16;
+        case IT8951_DISPLAY_MODE_GLR16:
+            return is_mode_supported(mode) ? IT8951_MODE_GLR16 : IT8951_MODE_GL16;
+        case IT8951_DISPLAY_MODE_GLD16:
+            return is_mode_supported(mode) ? IT8951_MODE_GLD16 : IT8951_MODE_GL16;
+        case IT8951_DISPLAY_MODE_DU4:
+            return is_mode_supported(mode) ? IT8951_MODE_DU4 : IT8951_MODE_GC16;
         default:
             return IT8951_MODE_GC16;
     }
@@ -0,0 +1,364 @@
+#include "it8951_async.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "support.h"
+
+static const char* TAG = "IT8951";
+
+// Set when the display task exits.
+#define IT8951_TASK_STOPPED_BIT BIT0
+
+// How often the display task polls the controller while refreshes of its jobs are in progress.
+#define IT8951_REFRESH_POLL_INTERVAL_MS 20
+
+IT8951Async::IT8951Async(IT8951& display) : _display(display) {
+    _queue = xQueueCreate(CONFIG_IT8951_JOB_QUEUE_LENGTH, sizeof(Job));
+    _submit_lock = xSemaphoreCreateMutex();
+    _state_lock = xSemaphoreCreateMutex();
+    _events = xEventGroupCreate();
+
+    ESP_ERROR_ASSERT(_queue && _submit_lock && _state_lock && _events);
+}
+
+IT8951Async::~IT8951Async() {
+    stop();
+
+    vEventGroupDelete(_events);
+    vSemaphoreDelete(_state_lock);
+    vSemaphoreDelete(_submit_lock);
+    vQueueDelete(_queue);
+}
+
+void IT8951Async::start(UBaseType_t priority, int core, uint32_t stack_size) {
+    ESP_ERROR_ASSERT(!_task);
+
+    ESP_LOGI(TAG, "Starting display task on core %d", core);
+
+    xEventGroupClearBits(_events, IT8951_TASK_STOPPED_BIT);
+
+    const auto result = xTaskCreatePinnedToCore(task, "it8951", stack_size, this, priority, &_task,
+                                                core < 0 ? tskNO_AFFINITY : core);
+
+    ESP_ERROR_ASSERT(result == pdPASS);
+}
+
+void IT8951Async::stop() {
+    if (!_task) {
+        return;
+    }
+
+    // The stop job is queued after the submitted jobs, so these complete first.
+
+    Job job = {.type = JobType::STOP};
+
+    submit(job);
+
+    xEventGroupWaitBits(_events, IT8951_TASK_STOPPED_BIT, pdFALSE, pdFALSE, portMAX_DELAY);
+
+    _task = nullptr;
+}
+
+it8951_job_t IT8951Async::upload(const IT8951Area& area, uint32_t target_memory_address, it8951_rotate_t rotate,
+                                 it8951_pixel_format_t pixel_format, const uint8_t* data, size_t stride,
+                                 it8951_job_cb_t callback, void* user_data) {
+    Job job = {
+        .type = JobType::UPLOAD,
+        .area = area,
+        .memory_address = target_memory_address,
+        .rotate = rotate,
+        .pixel_format = pixel_format,
+        .data = data,
+        .stride = stride,
+        .callback = callback,
+        .user_data = user_data,
+    };
+
+    return submit(job);
+}
+
+it8951_job_t IT8951Async::upload_render(const IT8951Area& area, uint32_t target_memory_address,
+                                        it8951_rotate_t rotate, it8951_pixel_format_t pixel_format,
+                                        it8951_render_cb_t render, void* render_data, it8951_job_cb_t callback,
+                                        void* user_data) {
+    Job job = {
+        .type = JobType::UPLOAD_RENDER,
+        .area = area,
+        .memory_address = target_memory_address,
+        .rotate = rotate,
+        .pixel_format = pixel_format,
+        .render = render,
+        .render_data = render_data,
+        .callback = callback,
+        .user_data = user_data,
+    };
+
+    return submit(job);
+}
+
+it8951_job_t IT8951Async::display(const IT8951Area& area, uint32_t target_memory_address,
+                                  it8951_pixel_format_t pixel_format, it8951_display_mode_t mode,
+                                  it8951_job_cb_t callback, void* user_data) {
+    Job job = {
+        .type = JobType::DISPLAY,
+        .area = area,
+        .memory_address = target_memory_address,
+        .pixel_format = pixel_format,
+        .mode = mode,
+        .callback = callback,
+        .user_data = user_data,
+    };
+
+    return submit(job);
+}
+
+it8951_job_t IT8951Async::fill(const IT8951Area& area, uint8_t gray, it8951_display_mode_t mode,
+                               it8951_job_cb_t callback, void* user_data) {
+    Job job = {
+        .type = JobType::FILL,
+        .area = area,
+        .mode = mode,
+        .gray = gray,
+        .callback = callback,
+        .user_data = user_data,
+    };
+
+    return submit(job);
+}
+
+it8951_job_t IT8951Async::clear(it8951_job_cb_t callback, void* user_data) {
+    Job job = {.type = JobType::CLEAR, .callback = callback, .user_data = user_data};
+
+    return submit(job);
+}
+
+it8951_job_t IT8951Async::sleep(it8951_job_cb_t callback, void* user_data) {
+    Job job = {.type = JobType::SLEEP, .callback = callback, .user_data = user_data};
+
+    return submit(job);
+}
+
+it8951_job_t IT8951Async::wake(it8951_job_cb_t callback, void* user_data) {
+    Job job = {.type = JobType::WAKE, .callback = callback, .user_data = user_data};
+
+    return submit(job);
+}
+
+bool IT8951Async::wait(it8951_job_t job, TickType_t timeout) {
+    // Each waiter blocks on a semaphore of its own, so waiters don't take
+    // wake ups from each other. The job is checked under the lock the display
+    // task completes jobs under, so the completion can't be missed.
+
+    StaticSemaphore_t done_buffer;
+    Waiter waiter = {
+        .job = job,
+        .done = xSemaphoreCreateBinaryStatic(&done_buffer),
+    };
+
+    xSemaphoreTake(_state_lock, portMAX_DELAY);
+
+    const auto done = is_done(job);
+
+    if (!done) {
+        waiter.next = _waiters;
+        _waiters = &waiter;
+    }
+
+    xSemaphoreGive(_state_lock);
+
+    if (!done && xSemaphoreTake(waiter.done, timeout) != pdTRUE) {
+        remove_waiter(&waiter);
+    }
+
+    vSemaphoreDelete(waiter.done);
+
+    return is_done(job);
+}
+
+bool IT8951Async::get_times(it8951_job_t job, IT8951JobTimes& times) {
+    xSemaphoreTake(_state_lock, portMAX_DELAY);
+
+    const auto known = job && _submitted - job < IT8951_JOB_HISTORY;
+
+    if (known) {
+        times = _times[job % IT8951_JOB_HISTORY];
+    }
+
+    xSemaphoreGive(_state_lock);
+
+    return known;
+}
+
+it8951_job_t IT8951Async::submit(Job& job) {
+    // Handles are handed out in queue order, so jobs complete in the order
+    // of their handles.
+
+    xSemaphoreTake(_submit_lock, portMAX_DELAY);
+    xSemaphoreTake(_state_lock, portMAX_DELAY);
+
+    job.id = ++_submitted;
+
+    if (!job.id) {
+        job.id = ++_submitted;
+    }
+
+    _times[job.id % IT8951_JOB_HISTORY] = {
+        .submitted_us = esp_timer_get_time(),
+    };
+
+    xSemaphoreGive(_state_lock);
+
+    // The state lock isn't held while the queue is full, as the display task
+    // needs it to complete the job it's working on.
+
+    xQueueSend(_queue, &job, portMAX_DELAY);
+
+    xSemaphoreGive(_submit_lock);
+
+    return job.id;
+}
+
+void IT8951Async::complete(it8951_job_t job) {
+    xSemaphoreTake(_state_lock, portMAX_DELAY);
+
+    _times[job % IT8951_JOB_HISTORY].done_us = esp_timer_get_time();
+    _completed.store(job);
+
+    for (auto link = &_waiters; *link;) {
+        const auto waiter = *link;
+
+        if (is_done(waiter->job)) {
+            *link = waiter->next;
+            xSemaphoreGive(waiter->done);
+        } else {
+            link = &waiter->next;
+        }
+    }
+
+    xSemaphoreGive(_state_lock);
+}
+
+void IT8951Async::update_refreshed() {
+    if (!_pending_refresh_count) {
+        return;
+    }
+
+    const auto now = esp_timer_get_time();
+    size_t count = 0;
+
+    xSemaphoreTake(_state_lock, portMAX_DELAY);
+
+    for (size_t i = 0; i < _pending_refresh_count; i++) {
+        const auto& refresh = _pending_refreshes[i];
+
+        if (!_display.is_refresh_done(refresh.refresh_id)) {
+            _pending_refreshes[count++] = refresh;
+        } else if (_submitted - refresh.job < IT8951_JOB_HISTORY) {
+            _times[refresh.job % IT8951_JOB_HISTORY].refreshed_us = now;
+        }
+    }
+
+    _pending_refresh_count = count;
+
+    xSemaphoreGive(_state_lock);
+}
+
+void IT8951Async::remove_waiter(Waiter* waiter) {
+    xSemaphoreTake(_state_lock, portMAX_DELAY);
+
+    for (auto link = &_waiters; *link; link = &(*link)->next) {
+        if (*link == waiter) {
+            *link = waiter->next;
+            break;
+        }
+    }
+
+    xSemaphoreGive(_state_lock);
+}
+
+void IT8951Async::task(void* arg) {
+    ((IT8951Async*)arg)->run();
+
+    vTaskDelete(nullptr);
+}
+
+void IT8951Async::run() {
+    Job job;
+
+    while (true) {
+        const auto timeout = _pending_refresh_count ? pdMS_TO_TICKS(IT8951_REFRESH_POLL_INTERVAL_MS) : portMAX_DELAY;
+
+        if (xQueueReceive(_queue, &job, timeout) != pdTRUE) {
+            // Reading the controller status completes the refreshes that are done.
+            _display.is_refreshing();
+            update_refreshed();
+            continue;
+        }
+
+        xSemaphoreTake(_state_lock, portMAX_DELAY);
+        _times[job.id % IT8951_JOB_HISTORY].started_us = esp_timer_get_time();
+        xSemaphoreGive(_state_lock);
+
+        const auto last_refresh_id = _display.get_last_refresh_id();
+
+        if (job.type != JobType::STOP) {
+            execute(job);
+        }
+
+        // The driver may have seen refreshes complete while it ran the job.
+        // It tracks at most IT8951_MAX_REFRESHES refreshes, including the
+        // one this job started, so there is always room for it.
+
+        update_refreshed();
+
+        if (_display.get_last_refresh_id() != last_refresh_id) {
+            ESP_ERROR_ASSERT(_pending_refresh_count < IT8951_MAX_REFRESHES);
+
+            _pending_refreshes[_pending_refresh_count++] = {
+                .job = job.id,
+                .refresh_id = _display.get_last_refresh_id(),
+            };
+        }
+
+        complete(job.id);
+
+        if (job.callback) {
+            job.callback(job.id, job.user_data);
+        }
+
+        if (job.type == JobType::STOP) {
+            break;
+        }
+    }
+
+    xEventGroupSetBits(_events, IT8951_TASK_STOPPED_BIT);
+}
+
+void IT8951Async::execute(Job& job) {
+    switch (job.type) {
+        case JobType::UPLOAD:
+            _display.load_image(job.area, job.memory_address, job.rotate, job.pixel_format, job.data, job.stride);
+            break;
+        case JobType::UPLOAD_RENDER:
+            _display.load_image_render(job.area, job.memory_address, job.rotate, job.pixel_format, job.render,
+                                       job.render_data);
+            break;
+        case JobType::DISPLAY:
+            _display.display_area(job.area, job.memory_address, job.pixel_format, job.mode);
+            break;
+        case JobType::FILL:
+            _display.fill_area(job.area, job.gray, job.mode);
+            break;
+        case JobType::CLEAR:
+            _display.clear_screen();
+            break;
+        case JobType::SLEEP:
+            _display.set_sleep();
+            break;
+        case JobType::WAKE:
+            _display.set_system_run();
+            break;
+        default:
+            break;
+    }
+}
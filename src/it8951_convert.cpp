@@ -0,0 +1,259 @@
+#include "it8951_convert.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "support.h"
+
+// The kernels below pack four pixels held in a 32 bit word at a time. The
+// first pixel is in the least significant byte of the word, like it is in
+// memory on the ESP32. They are used on the ESP32-S3 too; see the README for
+// why there is no PIE vector path.
+
+template <bool Curve>
+static inline uint32_t load_word(const uint8_t* curve, const uint8_t* src) {
+    if (Curve) {
+        return curve[src[0]] | curve[src[1]] << 8 | curve[src[2]] << 16 | uint32_t(curve[src[3]]) << 24;
+    }
+
+    uint32_t word;
+    memcpy(&word, src, sizeof(word));
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap32(word);
+#endif
+
+    return word;
+}
+
+template <bool Curve>
+static inline uint8_t load_byte(const uint8_t* curve, const uint8_t* src) {
+    return Curve ? curve[*src] : *src;
+}
+
+static inline void store_word(uint8_t* dst, uint32_t word) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    word = __builtin_bswap32(word);
+#endif
+
+    memcpy(dst, &word, sizeof(word));
+}
+
+// Gathers the top bit of each byte into a nibble, first pixel in the most
+// significant bit. The partial products don't overlap, so there are no carries.
+static inline uint32_t pack_1bpp(uint32_t word) { return ((word >> 7) & 0x01010101) * 0x08040201 >> 24; }
+
+// Gathers the top two bits of each byte into a byte.
+static inline uint32_t pack_2bpp(uint32_t word) { return ((word >> 6) & 0x03030303) * 0x40100401 >> 24; }
+
+// Moves the top nibbles of bytes 1 and 3 next to the ones of bytes 0 and 2.
+static inline uint32_t pack_4bpp(uint32_t word) {
+    word &= 0xF0F0F0F0;
+    return word | word >> 12;
+}
+
+template <bool Curve>
+static size_t convert_1bpp(const uint8_t* curve, const uint8_t* src, uint8_t* dst, size_t pixels) {
+    size_t i = 0;
+    auto out = dst;
+
+    for (; i + 32 <= pixels; i += 32) {
+        uint32_t packed = 0;
+
+        for (int j = 0; j < 4; j++) {
+            const auto high = pack_1bpp(load_word<Curve>(curve, src + i + j * 8));
+            const auto low = pack_1bpp(load_word<Curve>(curve, src + i + j * 8 + 4));
+
+            packed |= (high << 4 | low) << (j * 8);
+        }
+
+        store_word(out, packed);
+        out += 4;
+    }
+
+    // Missing pixels of the last byte are white.
+
+    for (; i < pixels; i += 8) {
+        uint8_t value = 0xff;
+
+        for (size_t j = 0; j < 8 && i + j < pixels; j++) {
+            if (!(load_byte<Curve>(curve, src + i + j) & 0x80)) {
+                value &= ~(0x80 >> j);
+            }
+        }
+
+        *out++ = value;
+    }
+
+    return out - dst;
+}
+
+template <bool Curve>
+static size_t convert_2bpp(const uint8_t* curve, const uint8_t* src, uint8_t* dst, size_t pixels) {
+    size_t i = 0;
+    auto out = dst;
+
+    for (; i + 16 <= pixels; i += 16) {
+        store_word(out, pack_2bpp(load_word<Curve>(curve, src + i)) | pack_2bpp(load_word<Curve>(curve, src + i + 4)) << 8 |
+                            pack_2bpp(load_word<Curve>(curve, src + i + 8)) << 16 |
+                            pack_2bpp(load_word<Curve>(curve, src + i + 12)) << 24);
+        out += 4;
+    }
+
+    for (; i < pixels; i += 4) {
+        uint8_t value = 0xff;
+
+        for (size_t j = 0; j < 4 && i + j < pixels; j++) {
+            const auto shift = 6 - j * 2;
+            value = (value & ~(0x03 << shift)) | (load_byte<Curve>(curve, src + i + j) >> 6) << shift;
+        }
+
+        *out++ = value;
+    }
+
+    return out - dst;
+}
+
+template <bool Curve>
+static size_t convert_4bpp(const uint8_t* curve, const uint8_t* src, uint8_t* dst, size_t pixels) {
+    size_t i = 0;
+    auto out = dst;
+
+    for (; i + 8 <= pixels; i += 8) {
+        const auto low = pack_4bpp(load_word<Curve>(curve, src + i));
+        const auto high = pack_4bpp(load_word<Curve>(curve, src + i + 4));
+
+        store_word(out, (low & 0xff) | (low >> 8 & 0xff00) | (high & 0xff) << 16 | (high & 0xff0000) << 8);
+        out += 4;
+    }
+
+    for (; i < pixels; i += 2) {
+        const auto first = load_byte<Curve>(curve, src + i) & 0xf0;
+        const auto second = i + 1 < pixels ? load_byte<Curve>(curve, src + i + 1) >> 4 : 0x0f;
+
+        *out++ = first | second;
+    }
+
+    return out - dst;
+}
+
+template <bool Curve>
+static size_t convert_8bpp(const uint8_t* curve, const uint8_t* src, uint8_t* dst, size_t pixels) {
+    if (!Curve) {
+        memcpy(dst, src, pixels);
+    } else {
+        for (size_t i = 0; i < pixels; i++) {
+            dst[i] = curve[src[i]];
+        }
+    }
+
+    return pixels;
+}
+
+IT8951Converter::IT8951Converter(it8951_pixel_format_t pixel_format) : _pixel_format(pixel_format) {
+    switch (pixel_format) {
+        case IT8951_PIXEL_FORMAT_1BPP:
+            _bpp = 1;
+            break;
+        case IT8951_PIXEL_FORMAT_2BPP:
+            _bpp = 2;
+            break;
+        case IT8951_PIXEL_FORMAT_4BPP:
+            _bpp = 4;
+            break;
+        default:
+            _bpp = 8;
+            break;
+    }
+}
+
+void IT8951Converter::set_threshold(uint8_t threshold) {
+    for (int i = 0; i < 256; i++) {
+        _curve[i] = i >= threshold ? 0xff : 0x00;
+    }
+
+    _has_curve = true;
+}
+
+void IT8951Converter::set_gamma(float gamma) {
+    for (int i = 0; i < 256; i++) {
+        _curve[i] = uint8_t(std::lround(255.0f * std::pow(i / 255.0f, gamma)));
+    }
+
+    _has_curve = true;
+}
+
+void IT8951Converter::set_curve(const uint8_t* curve) {
+    memcpy(_curve, curve, sizeof(_curve));
+
+    _has_curve = true;
+}
+
+size_t IT8951Converter::get_row_bytes(size_t pixels) { return (pixels * _bpp + 7) / 8; }
+
+size_t IT8951Converter::convert(const uint8_t* src, uint8_t* dst, size_t pixels) {
+    switch (_bpp) {
+        case 1:
+            return _has_curve ? convert_1bpp<true>(_curve, src, dst, pixels)
+                              : convert_1bpp<false>(_curve, src, dst, pixels);
+        case 2:
+            return _has_curve ? convert_2bpp<true>(_curve, src, dst, pixels)
+                              : convert_2bpp<false>(_curve, src, dst, pixels);
+        case 4:
+            return _has_curve ? convert_4bpp<true>(_curve, src, dst, pixels)
+                              : convert_4bpp<false>(_curve, src, dst, pixels);
+        default:
+            return _has_curve ? convert_8bpp<true>(_curve, src, dst, pixels)
+                              : convert_8bpp<false>(_curve, src, dst, pixels);
+    }
+}
+
+void IT8951Converter::load_image(IT8951& display, IT8951Area& area, uint32_t target_memory_address,
+                                 const uint8_t* src, size_t stride) {
+    // 1 bpp images are loaded as 8 bpp images of an eighth of the width, so
+    // only whole bytes of pixels are sent. Rows are padded to whole words.
+
+    const size_t pixels = _bpp == 1 ? area.w / 8 * 8 : area.w;
+    const size_t pixels_per_byte = 8 / _bpp;
+    const auto row_bytes = get_row_bytes(pixels);
+    const auto buffer_len = display.get_buffer_len();
+
+    display.load_image_start(area, target_memory_address, IT8951_ROTATE_0, _pixel_format);
+
+    auto buffer = display.get_buffer();
+    size_t used = 0;
+
+    for (uint16_t y = 0; y < area.h; y++) {
+        const auto row = src + y * stride;
+
+        for (size_t done = 0; done < pixels;) {
+            const auto count = std::min(pixels - done, (buffer_len - used) * pixels_per_byte);
+
+            used += convert(row + done, buffer + used, count);
+            done += count;
+
+            if (used == buffer_len) {
+                display.load_image_flush_buffer(used);
+                buffer = display.get_buffer();
+                used = 0;
+            }
+        }
+
+        if (row_bytes % 2) {
+            buffer[used++] = 0xff;
+
+            if (used == buffer_len) {
+                display.load_image_flush_buffer(used);
+                buffer = display.get_buffer();
+                used = 0;
+            }
+        }
+    }
+
+    if (used) {
+        display.load_image_flush_buffer(used);
+    }
+
+    display.load_image_end();
+}
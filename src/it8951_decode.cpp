@@ -0,0 +1,681 @@
+#include "it8951_decode.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "esp_log.h"
+#include "support.h"
+
+static const char* TAG = "IT8951";
+
+// Number of pixels of 16 bit PGM files and PBM files read at a time.
+#define IT8951_DECODE_CHUNK 64
+
+static const uint8_t PNG_SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+#define PNG_CHUNK(a, b, c, d) (uint32_t(a) << 24 | uint32_t(b) << 16 | uint32_t(c) << 8 | uint32_t(d))
+
+static uint32_t get_be32(const uint8_t* data) {
+    return uint32_t(data[0]) << 24 | uint32_t(data[1]) << 16 | uint32_t(data[2]) << 8 | data[3];
+}
+
+static inline uint8_t get_luma(int r, int g, int b) { return (r * 77 + g * 150 + b * 29 + 128) >> 8; }
+
+static inline uint8_t blend_on_white(int gray, int alpha) { return 255 - ((255 - gray) * alpha + 127) / 255; }
+
+struct RenderState {
+    IT8951ImageDecoder* decoder;
+    IT8951Converter* converter;
+    bool intact;
+};
+
+bool IT8951ImageDecoder::load_image(IT8951& display, IT8951Converter& converter, IT8951Area& area,
+                                    uint32_t target_memory_address) {
+    ESP_ERROR_ASSERT(area.w <= _width && area.h <= _height - _row);
+
+    RenderState state = {
+        .decoder = this,
+        .converter = &converter,
+        .intact = true,
+    };
+
+    display.load_image_render(area, target_memory_address, IT8951_ROTATE_0, converter.get_pixel_format(),
+                              render_rows, &state);
+
+    return state.intact;
+}
+
+bool IT8951ImageDecoder::load_image(IT8951& display, IT8951Ditherer& ditherer, IT8951Area& area,
+                                    uint32_t target_memory_address) {
+    ESP_ERROR_ASSERT(area.w <= _width && area.h <= _height - _row);
+
+    auto intact = true;
+
+    ditherer.reset();
+    display.load_image_start(area, target_memory_address, IT8951_ROTATE_0, ditherer.get_pixel_format());
+
+    for (uint16_t y = 0; y < area.h; y++) {
+        auto row = read_row();
+
+        if (!row) {
+            memset(_gray.get(), 0xff, _width);
+            row = _gray.get();
+            intact = false;
+        }
+
+        ditherer.load_image_row(display, row);
+    }
+
+    display.load_image_end();
+
+    return intact;
+}
+
+void IT8951ImageDecoder::render_rows(const IT8951Area& band, uint8_t* buffer, size_t stride, void* user_data) {
+    // 1 bpp images are loaded as 8 bpp images of an eighth of the width, so
+    // only whole bytes of pixels are sent. The rest of a row is white.
+
+    auto& state = *(RenderState*)user_data;
+    auto& converter = *state.converter;
+    const size_t pixels = converter.get_pixel_format() == IT8951_PIXEL_FORMAT_1BPP ? band.w / 8 * 8 : band.w;
+
+    for (uint16_t y = 0; y < band.h; y++) {
+        const auto row = state.decoder->read_row();
+        const auto dst = buffer + y * stride;
+        size_t len = 0;
+
+        if (row) {
+            len = converter.convert(row, dst, pixels);
+        } else {
+            state.intact = false;
+        }
+
+        memset(dst + len, 0xff, stride - len);
+    }
+}
+
+bool IT8951ImageDecoder::set_size(uint32_t width, uint32_t height) {
+    if (!width || !height || width > UINT16_MAX || height > UINT16_MAX) {
+        fail("unsupported size");
+        return false;
+    }
+
+    _width = width;
+    _height = height;
+    _row = 0;
+    _gray.reset(new uint8_t[width]);
+
+    return true;
+}
+
+void IT8951ImageDecoder::fail(const char* reason) {
+    if (!_error) {
+        ESP_LOGE(TAG, "Failed to decode image: %s", reason);
+    }
+
+    _error = true;
+}
+
+int IT8951ImageDecoder::read_byte() {
+    if (_input_pos == _input_len) {
+        _input_len = _read(_input, sizeof(_input), _user_data);
+        _input_pos = 0;
+
+        if (!_input_len) {
+            return -1;
+        }
+    }
+
+    return _input[_input_pos++];
+}
+
+size_t IT8951ImageDecoder::read(uint8_t* data, size_t len) {
+    size_t done = 0;
+
+    while (done < len) {
+        if (_input_pos == _input_len) {
+            // Large reads go straight to the destination.
+
+            if (len - done >= sizeof(_input)) {
+                const auto count = _read(data + done, len - done, _user_data);
+
+                if (!count) {
+                    break;
+                }
+
+                done += count;
+                continue;
+            }
+
+            _input_len = _read(_input, sizeof(_input), _user_data);
+            _input_pos = 0;
+
+            if (!_input_len) {
+                break;
+            }
+        }
+
+        const auto count = std::min(len - done, _input_len - _input_pos);
+
+        memcpy(data + done, _input + _input_pos, count);
+        _input_pos += count;
+        done += count;
+    }
+
+    return done;
+}
+
+bool IT8951ImageDecoder::skip(size_t len) {
+    uint8_t discard[64];
+
+    while (len) {
+        const auto count = std::min(len, sizeof(discard));
+
+        if (read(discard, count) != count) {
+            return false;
+        }
+
+        len -= count;
+    }
+
+    return true;
+}
+
+bool IT8951PnmDecoder::start() {
+    uint32_t width;
+    uint32_t height;
+
+    _error = false;
+
+    if (read_byte() != 'P') {
+        fail("not a PGM or PBM file");
+        return false;
+    }
+
+    _format = read_byte();
+
+    if (_format != '1' && _format != '2' && _format != '4' && _format != '5') {
+        fail("not a PGM or PBM file");
+        return false;
+    }
+
+    const auto bitmap = _format == '1' || _format == '4';
+
+    if (!read_number(width) || !read_number(height) || (!bitmap && !read_number(_max_value))) {
+        fail("truncated header");
+        return false;
+    }
+
+    if (bitmap) {
+        _max_value = 1;
+    } else if (!_max_value || _max_value > UINT16_MAX) {
+        fail("unsupported maximum gray value");
+        return false;
+    }
+
+    // Gray values that aren't in the range of 0 to 255 are scaled.
+
+    for (uint32_t i = 0; i < 256; i++) {
+        _scale[i] = std::min<uint32_t>(i, _max_value) * 255 / _max_value;
+    }
+
+    return set_size(width, height);
+}
+
+const uint8_t* IT8951PnmDecoder::read_row() {
+    if (_error || _row == _height) {
+        return nullptr;
+    }
+
+    if (!(_format == '1' || _format == '2' ? read_plain_row() : read_binary_row())) {
+        fail("truncated image");
+        return nullptr;
+    }
+
+    _row++;
+
+    return _gray.get();
+}
+
+bool IT8951PnmDecoder::read_number(uint32_t& value, bool single_digit) {
+    // Numbers are separated by whitespace, and comments run to the end of a line.
+
+    auto c = read_byte();
+
+    while (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '#') {
+        if (c == '#') {
+            while (c >= 0 && c != '\n') {
+                c = read_byte();
+            }
+        }
+
+        c = read_byte();
+    }
+
+    if (c < '0' || c > '9') {
+        return false;
+    }
+
+    value = c - '0';
+
+    // The pixels of plain PBM files don't have to be separated.
+
+    if (single_digit) {
+        return true;
+    }
+
+    // The character after the number is consumed, which is the single
+    // whitespace character between the header and binary pixels.
+
+    while ((c = read_byte()) >= '0' && c <= '9') {
+        value = value * 10 + (c - '0');
+
+        if (value > UINT16_MAX) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool IT8951PnmDecoder::read_plain_row() {
+    const auto gray = _gray.get();
+
+    for (uint16_t x = 0; x < _width; x++) {
+        uint32_t value;
+
+        if (!read_number(value, _format == '1') || value > _max_value) {
+            return false;
+        }
+
+        if (_format == '1') {
+            gray[x] = value ? 0x00 : 0xff;
+        } else if (_max_value <= 255) {
+            gray[x] = _scale[value];
+        } else {
+            gray[x] = value * 255 / _max_value;
+        }
+    }
+
+    return true;
+}
+
+bool IT8951PnmDecoder::read_binary_row() {
+    const auto gray = _gray.get();
+
+    if (_format == '5' && _max_value <= 255) {
+        if (read(gray, _width) != _width) {
+            return false;
+        }
+
+        if (_max_value != 255) {
+            for (uint16_t x = 0; x < _width; x++) {
+                gray[x] = _scale[gray[x]];
+            }
+        }
+
+        return true;
+    }
+
+    // 16 bit gray values are big endian, and PBM rows are padded to whole bytes.
+
+    uint8_t chunk[IT8951_DECODE_CHUNK * 2];
+
+    if (_format == '4') {
+        for (uint16_t x = 0; x < _width; x += IT8951_DECODE_CHUNK * 8) {
+            const auto pixels = std::min<uint16_t>(IT8951_DECODE_CHUNK * 8, _width - x);
+            const size_t len = (pixels + 7) / 8;
+
+            if (read(chunk, len) != len) {
+                return false;
+            }
+
+            for (uint16_t i = 0; i < pixels; i++) {
+                gray[x + i] = chunk[i / 8] & 0x80 >> i % 8 ? 0x00 : 0xff;
+            }
+        }
+
+        return true;
+    }
+
+    for (uint16_t x = 0; x < _width; x += IT8951_DECODE_CHUNK) {
+        const auto pixels = std::min<uint16_t>(IT8951_DECODE_CHUNK, _width - x);
+
+        if (read(chunk, pixels * 2) != pixels * 2u) {
+            return false;
+        }
+
+        for (uint16_t i = 0; i < pixels; i++) {
+            gray[x + i] = std::min<uint32_t>(chunk[i * 2] << 8 | chunk[i * 2 + 1], _max_value) * 255 / _max_value;
+        }
+    }
+
+    return true;
+}
+
+bool IT8951PngDecoder::start() {
+    uint8_t signature[sizeof(PNG_SIGNATURE)];
+
+    _error = false;
+    _has_palette = false;
+    _color_type = 0xff;
+    memset(_palette, 0, sizeof(_palette));
+
+    if (read(signature, sizeof(signature)) != sizeof(signature) || memcmp(signature, PNG_SIGNATURE, 8)) {
+        fail("not a PNG file");
+        return false;
+    }
+
+    // Reads the chunks up to the first image data chunk. The chunks after
+    // the image data aren't needed.
+
+    while (true) {
+        uint8_t chunk_header[8];
+
+        if (read(chunk_header, sizeof(chunk_header)) != sizeof(chunk_header)) {
+            fail("truncated file");
+            return false;
+        }
+
+        const auto len = get_be32(chunk_header);
+        const auto type = get_be32(chunk_header + 4);
+
+        if (type == PNG_CHUNK('I', 'H', 'D', 'R')) {
+            uint8_t header[13];
+
+            if (len != sizeof(header) || read(header, sizeof(header)) != sizeof(header) || !read_header(header)) {
+                fail("unsupported header");
+                return false;
+            }
+        } else if (type == PNG_CHUNK('P', 'L', 'T', 'E') || type == PNG_CHUNK('t', 'R', 'N', 'S')) {
+            // The palette is kept as gray values, blended with the alpha
+            // values of the transparency chunk.
+
+            const auto palette = type == PNG_CHUNK('P', 'L', 'T', 'E');
+            const auto entry_len = palette ? 3 : 1;
+            uint32_t index = 0;
+
+            for (; index < len / entry_len; index++) {
+                uint8_t entry[3];
+
+                if (read(entry, entry_len) != size_t(entry_len)) {
+                    fail("truncated file");
+                    return false;
+                }
+
+                if (index >= 256 || _color_type != 3) {
+                    continue;
+                } else if (palette) {
+                    _palette[index] = get_luma(entry[0], entry[1], entry[2]);
+                } else {
+                    _palette[index] = blend_on_white(_palette[index], entry[0]);
+                }
+            }
+
+            if (palette && _color_type == 3) {
+                _has_palette = true;
+            }
+
+            if (!skip(len - index * entry_len)) {
+                fail("truncated file");
+                return false;
+            }
+        } else if (type == PNG_CHUNK('I', 'D', 'A', 'T')) {
+            if (_color_type == 0xff || (_color_type == 3 && !_has_palette)) {
+                fail("missing header or palette");
+                return false;
+            }
+
+            _data_left = len;
+            _data_end = false;
+            _inflater.start(read_image_data, this, true);
+
+            return true;
+        } else if (type == PNG_CHUNK('I', 'E', 'N', 'D')) {
+            fail("no image data");
+            return false;
+        } else if (!skip(len)) {
+            fail("truncated file");
+            return false;
+        }
+
+        // Skip the CRC.
+
+        if (!skip(4)) {
+            fail("truncated file");
+            return false;
+        }
+    }
+}
+
+bool IT8951PngDecoder::read_header(const uint8_t* header) {
+    const auto width = get_be32(header);
+    const auto height = get_be32(header + 4);
+    const auto depth = header[8];
+    const auto color_type = header[9];
+    const auto interlace = header[12];
+    int channels;
+
+    switch (color_type) {
+        case 0:
+            channels = 1;
+            break;
+        case 2:
+            channels = 3;
+            break;
+        case 3:
+            channels = 1;
+            break;
+        case 4:
+            channels = 2;
+            break;
+        case 6:
+            channels = 4;
+            break;
+        default:
+            return false;
+    }
+
+    // Palettes have up to 8 bits, and only gray values have less than 8 bits.
+
+    const auto valid_depth = depth == 8 || (depth == 16 && color_type != 3) ||
+                             ((depth == 1 || depth == 2 || depth == 4) && (color_type == 0 || color_type == 3));
+
+    if (!valid_depth || header[10] || header[11]) {
+        return false;
+    }
+
+    // Interlaced images are stored in seven passes, so they can't be decoded a row at a time.
+
+    if (interlace) {
+        ESP_LOGE(TAG, "Interlaced PNG files aren't supported");
+        return false;
+    }
+
+    if (!set_size(width, height)) {
+        return false;
+    }
+
+    _color_type = color_type;
+    _depth = depth;
+    _row_len = (size_t(width) * depth * channels + 7) / 8;
+    _pixel_len = std::max(1, depth * channels / 8);
+
+    // Each row starts with its filter type. The previous row of the first
+    // row is all zeros.
+
+    _rows.reset(new uint8_t[(_row_len + 1) * 2]());
+    _current = _rows.get();
+    _previous = _rows.get() + _row_len + 1;
+
+    // Gray values of less than 8 bits are looked up like palette entries.
+
+    if (color_type == 0 && depth < 8) {
+        const auto max_value = (1 << depth) - 1;
+
+        for (int i = 0; i <= max_value; i++) {
+            _palette[i] = i * 255 / max_value;
+        }
+    }
+
+    return true;
+}
+
+const uint8_t* IT8951PngDecoder::read_row() {
+    if (_error || _row == _height) {
+        return nullptr;
+    }
+
+    std::swap(_current, _previous);
+
+    if (_inflater.read(_current, _row_len + 1) != _row_len + 1) {
+        fail("truncated image data");
+        return nullptr;
+    }
+
+    if (_current[0] > 4) {
+        fail("unknown filter");
+        return nullptr;
+    }
+
+    unfilter(_current + 1, _previous + 1);
+    convert_row(_current + 1);
+
+    _row++;
+
+    return _gray.get();
+}
+
+size_t IT8951PngDecoder::read_image_data(uint8_t* data, size_t len, void* user_data) {
+    // The image data may be split into several chunks.
+
+    auto& decoder = *(IT8951PngDecoder*)user_data;
+
+    while (!decoder._data_left) {
+        uint8_t chunk_header[12];
+
+        if (decoder._data_end) {
+            return 0;
+        }
+
+        // The CRC of the previous chunk and the header of the next one.
+
+        if (decoder.read(chunk_header, sizeof(chunk_header)) != sizeof(chunk_header) ||
+            get_be32(chunk_header + 8) != PNG_CHUNK('I', 'D', 'A', 'T')) {
+            decoder._data_end = true;
+            return 0;
+        }
+
+        decoder._data_left = get_be32(chunk_header + 4);
+    }
+
+    const auto count = decoder.read(data, std::min<size_t>(len, decoder._data_left));
+
+    decoder._data_left -= count;
+    decoder._data_end = !count;
+
+    return count;
+}
+
+void IT8951PngDecoder::unfilter(uint8_t* row, const uint8_t* previous) {
+    const auto len = _row_len;
+    const auto bpp = _pixel_len;
+
+    switch (_current[0]) {
+        case 1:
+            for (size_t i = bpp; i < len; i++) {
+                row[i] += row[i - bpp];
+            }
+            break;
+        case 2:
+            for (size_t i = 0; i < len; i++) {
+                row[i] += previous[i];
+            }
+            break;
+        case 3:
+            for (size_t i = 0; i < bpp; i++) {
+                row[i] += previous[i] / 2;
+            }
+
+            for (size_t i = bpp; i < len; i++) {
+                row[i] += (row[i - bpp] + previous[i]) / 2;
+            }
+            break;
+        case 4:
+            for (size_t i = 0; i < bpp; i++) {
+                row[i] += previous[i];
+            }
+
+            for (size_t i = bpp; i < len; i++) {
+                const int a = row[i - bpp];
+                const int b = previous[i];
+                const int c = previous[i - bpp];
+                const int pa = abs(b - c);
+                const int pb = abs(a - c);
+                const int pc = abs(a + b - 2 * c);
+
+                row[i] += pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+            }
+            break;
+    }
+}
+
+void IT8951PngDecoder::convert_row(const uint8_t* row) {
+    // 16 bit samples are big endian; only their high byte is used.
+
+    const auto gray = _gray.get();
+    const auto width = _width;
+    const auto step = _depth / 8;
+
+    if (_depth < 8) {
+        const auto pixels_per_byte = 8 / _depth;
+        const auto mask = (1 << _depth) - 1;
+
+        for (uint16_t x = 0; x < width; x++) {
+            const auto shift = 8 - _depth * (x % pixels_per_byte + 1);
+
+            gray[x] = _palette[row[x / pixels_per_byte] >> shift & mask];
+        }
+
+        return;
+    }
+
+    switch (_color_type) {
+        case 0:
+            if (step == 1) {
+                memcpy(gray, row, width);
+            } else {
+                for (uint16_t x = 0; x < width; x++) {
+                    gray[x] = row[x * 2];
+                }
+            }
+            break;
+        case 2:
+            for (uint16_t x = 0; x < width; x++) {
+                const auto pixel = row + x * 3 * step;
+
+                gray[x] = get_luma(pixel[0], pixel[step], pixel[2 * step]);
+            }
+            break;
+        case 3:
+            for (uint16_t x = 0; x < width; x++) {
+                gray[x] = _palette[row[x]];
+            }
+            break;
+        case 4:
+            for (uint16_t x = 0; x < width; x++) {
+                const auto pixel = row + x * 2 * step;
+
+                gray[x] = blend_on_white(pixel[0], pixel[step]);
+            }
+            break;
+        case 6:
+            for (uint16_t x = 0; x < width; x++) {
+                const auto pixel = row + x * 4 * step;
+
+                gray[x] = blend_on_white(get_luma(pixel[0], pixel[step], pixel[2 * step]), pixel[3 * step]);
+            }
+            break;
+    }
+}
@@ -0,0 +1,266 @@
+#include "it8951_diff.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_log.h"
+#include "support.h"
+
+static const char* TAG = "IT8951";
+
+static inline uint64_t hash_word(uint64_t hash, uint32_t word) {
+    hash = (hash ^ word) * 0x9E3779B97F4A7C15;
+    return hash ^ (hash >> 32);
+}
+
+IT8951FrameDiff::IT8951FrameDiff(IT8951& display, it8951_pixel_format_t pixel_format, uint16_t tile_size)
+    : _display(display),
+      _pixel_format(pixel_format),
+      _tile_size(tile_size),
+      _width(display.get_width()),
+      _height(display.get_height()) {
+    ESP_ERROR_ASSERT(tile_size > 0 && tile_size % 16 == 0);
+
+    switch (pixel_format) {
+        case IT8951_PIXEL_FORMAT_1BPP:
+            _bpp = 1;
+            // 1 bpp images are loaded as 8 bpp images of an eighth of the width.
+            _width &= ~7;
+            break;
+        case IT8951_PIXEL_FORMAT_2BPP:
+            _bpp = 2;
+            break;
+        case IT8951_PIXEL_FORMAT_4BPP:
+            _bpp = 4;
+            break;
+        default:
+            _bpp = 8;
+            break;
+    }
+
+    _columns = (_width + tile_size - 1) / tile_size;
+    _rows = (_height + tile_size - 1) / tile_size;
+
+    ESP_LOGI(TAG, "Diffing %dx%d tiles of %d pixels", _columns, _rows, tile_size);
+
+    _hashes.reset(new uint64_t[_columns * _rows]);
+    _areas.reset(new IT8951Area[_columns * _rows]);
+    _open.reset(new size_t[_columns * 2]);
+}
+
+float IT8951FrameDiff::analyze(const uint8_t* frame, size_t stride, uint32_t target_memory_address,
+                               const uint8_t* previous_frame) {
+    if (!target_memory_address) {
+        target_memory_address = _display.get_memory_address();
+    }
+
+    _target = &get_target(target_memory_address);
+    _frame = frame;
+    _stride = stride;
+    _area_count = 0;
+
+    uint32_t changed_pixels = 0;
+
+    // Spans of the previous row of tiles that can be extended downwards.
+
+    auto open = _open.get();
+    auto next_open = _open.get() + _columns;
+    size_t open_count = 0;
+
+    for (int row = 0; row < _rows; row++) {
+        const uint16_t y = row * _tile_size;
+        const uint16_t h = std::min<int>(_tile_size, _height - y);
+        size_t next_open_count = 0;
+
+        const auto hashes = _hashes.get() + row * _columns;
+        const auto previous = _target->hashes.get() + row * _columns;
+
+        for (int column = 0; column < _columns; column++) {
+            hashes[column] = hash_tile(frame, stride, column, row);
+        }
+
+        // The hashes are kept up to date even when the previous frame is
+        // passed, so that the next frame can be compared without it.
+
+        const auto unchanged = [&](int column) {
+            if (!_target->valid) {
+                return false;
+            } else if (previous_frame) {
+                return same_tile(frame, previous_frame, stride, column, row);
+            } else {
+                return hashes[column] == previous[column];
+            }
+        };
+
+        for (int column = 0; column < _columns;) {
+            // Find the next span of changed tiles.
+
+            if (unchanged(column)) {
+                column++;
+                continue;
+            }
+
+            const auto start = column;
+
+            while (column < _columns && !unchanged(column)) {
+                column++;
+            }
+
+            const uint16_t x = start * _tile_size;
+            const uint16_t w = std::min<int>(column * _tile_size, _width) - x;
+
+            changed_pixels += w * h;
+
+            // Extend a span of the previous row with the same columns.
+
+            size_t area = _area_count;
+
+            for (size_t i = 0; i < open_count; i++) {
+                if (_areas[open[i]].x == x && _areas[open[i]].w == w) {
+                    area = open[i];
+                    break;
+                }
+            }
+
+            if (area == _area_count) {
+                _areas[_area_count++] = {.x = x, .y = y, .w = w, .h = h};
+            } else {
+                _areas[area].h += h;
+            }
+
+            next_open[next_open_count++] = area;
+        }
+
+        std::swap(open, next_open);
+        open_count = next_open_count;
+    }
+
+    _changed_ratio = float(changed_pixels) / (uint32_t(_width) * _height);
+
+    return _changed_ratio;
+}
+
+size_t IT8951FrameDiff::upload() {
+    ESP_ERROR_ASSERT(_target && _frame);
+
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < _area_count; i++) {
+        auto& area = _areas[i];
+
+        _display.load_image(area, _target->address, IT8951_ROTATE_0, _pixel_format,
+                            _frame + area.y * _stride + area.x * _bpp / 8, _stride);
+
+        bytes += (area.w * _bpp + 7) / 8 * area.h;
+    }
+
+    memcpy(_target->hashes.get(), _hashes.get(), _columns * _rows * sizeof(uint64_t));
+    _target->valid = true;
+
+    _frame = nullptr;
+
+    return bytes;
+}
+
+void IT8951FrameDiff::display(it8951_display_mode_t mode) {
+    ESP_ERROR_ASSERT(_target);
+
+    for (size_t i = 0; i < _area_count; i++) {
+        _display.display_area(_areas[i], _target->address, _pixel_format, mode);
+    }
+}
+
+void IT8951FrameDiff::invalidate(uint32_t target_memory_address) {
+    for (auto& target : _targets) {
+        if (target.address == target_memory_address) {
+            target.valid = false;
+        }
+    }
+}
+
+IT8951FrameDiff::Target& IT8951FrameDiff::get_target(uint32_t address) {
+    for (auto& target : _targets) {
+        if (target.hashes && target.address == address) {
+            return target;
+        }
+    }
+
+    auto& target = _targets[_next_target];
+    _next_target = (_next_target + 1) % IT8951_MAX_DIFF_TARGETS;
+
+    if (!target.hashes) {
+        target.hashes.reset(new uint64_t[_columns * _rows]);
+    }
+
+    target.address = address;
+    target.valid = false;
+
+    return target;
+}
+
+uint64_t IT8951FrameDiff::hash_tile(const uint8_t* frame, size_t stride, int column, int row) {
+    const auto x = column * _tile_size;
+    const auto y = row * _tile_size;
+    const auto w = std::min<int>(_tile_size, _width - x);
+    const auto h = std::min<int>(_tile_size, _height - y);
+
+    // Tiles start at a byte boundary because the tile size is a multiple of
+    // 16 pixels. Rows are hashed a word at a time.
+
+    const size_t offset = x * _bpp / 8;
+    const size_t len = (w * _bpp + 7) / 8;
+    uint64_t hash = 0xCBF29CE484222325;
+
+    for (int i = 0; i < h; i++) {
+        const auto data = frame + (y + i) * stride + offset;
+        size_t j = 0;
+
+        for (; j + 4 <= len; j += 4) {
+            uint32_t word;
+            memcpy(&word, data + j, sizeof(word));
+            hash = hash_word(hash, word);
+        }
+
+        for (; j < len; j++) {
+            hash = hash_word(hash, data[j]);
+        }
+    }
+
+    return hash;
+}
+
+bool IT8951FrameDiff::same_tile(const uint8_t* frame, const uint8_t* previous_frame, size_t stride, int column,
+                                int row) {
+    const auto x = column * _tile_size;
+    const auto y = row * _tile_size;
+    const auto w = std::min<int>(_tile_size, _width - x);
+    const auto h = std::min<int>(_tile_size, _height - y);
+
+    const size_t offset = x * _bpp / 8;
+    const size_t len = (w * _bpp + 7) / 8;
+
+    for (int i = 0; i < h; i++) {
+        const auto data = frame + (y + i) * stride + offset;
+        const auto previous = previous_frame + (y + i) * stride + offset;
+        size_t j = 0;
+
+        for (; j + 4 <= len; j += 4) {
+            uint32_t word;
+            uint32_t previous_word;
+            memcpy(&word, data + j, sizeof(word));
+            memcpy(&previous_word, previous + j, sizeof(previous_word));
+
+            if (word != previous_word) {
+                return false;
+            }
+        }
+
+        for (; j < len; j++) {
+            if (data[j] != previous[j]) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
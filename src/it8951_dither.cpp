@@ -0,0 +1,199 @@
+#include "it8951_dither.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "support.h"
+
+// Thresholds of the 8x8 Bayer matrix, from 0 to 63.
+static const uint8_t BAYER_MATRIX[64] = {
+    0,  32, 8,  40, 2,  34, 10, 42,  //
+    48, 16, 56, 24, 50, 18, 58, 26,  //
+    12, 44, 4,  36, 14, 46, 6,  38,  //
+    60, 28, 52, 20, 62, 30, 54, 22,  //
+    3,  35, 11, 43, 1,  33, 9,  41,  //
+    51, 19, 59, 27, 49, 17, 57, 25,  //
+    15, 47, 7,  39, 13, 45, 5,  37,  //
+    63, 31, 55, 23, 61, 29, 53, 21,  //
+};
+
+// Error rows have two extra entries on both sides, so diffusion doesn't
+// need bounds checks.
+#define IT8951_DITHER_ERROR_PADDING 2
+
+static inline int clamp_gray(int value) { return value < 0 ? 0 : value > 255 ? 255 : value; }
+
+IT8951Ditherer::IT8951Ditherer(it8951_pixel_format_t pixel_format, it8951_dither_t method, uint16_t width)
+    : _pixel_format(pixel_format), _method(method), _width(width), _converter(pixel_format) {
+    switch (pixel_format) {
+        case IT8951_PIXEL_FORMAT_1BPP:
+            _levels = 2;
+            break;
+        case IT8951_PIXEL_FORMAT_2BPP:
+            _levels = 4;
+            break;
+        default:
+            _levels = 16;
+            break;
+    }
+
+    // The levels are spread evenly, so the top bits of the rounded gray
+    // values are the levels in the packed pixel format.
+
+    for (int i = 0; i < 256; i++) {
+        const auto level = (i * (_levels - 1) + 127) / 255;
+        _round[i] = level * 255 / (_levels - 1);
+    }
+
+    _quantized.reset(new uint8_t[width]);
+    _packed.reset(new uint8_t[width + 1]);
+
+    if (method == IT8951_DITHER_FLOYD_STEINBERG || method == IT8951_DITHER_ATKINSON) {
+        const auto len = width + IT8951_DITHER_ERROR_PADDING * 2;
+
+        _errors.reset(new int16_t[len * 2]);
+        _current_errors = _errors.get() + IT8951_DITHER_ERROR_PADDING;
+        _next_errors = _errors.get() + len + IT8951_DITHER_ERROR_PADDING;
+    }
+
+    reset();
+}
+
+void IT8951Ditherer::reset() {
+    _row = 0;
+
+    if (_errors) {
+        memset(_errors.get(), 0, (_width + IT8951_DITHER_ERROR_PADDING * 2) * 2 * sizeof(int16_t));
+    }
+}
+
+size_t IT8951Ditherer::dither_row(const uint8_t* src, uint8_t* dst) {
+    switch (_method) {
+        case IT8951_DITHER_FLOYD_STEINBERG:
+            diffuse_row<IT8951_DITHER_FLOYD_STEINBERG>(src);
+            break;
+        case IT8951_DITHER_ATKINSON:
+            diffuse_row<IT8951_DITHER_ATKINSON>(src);
+            break;
+        case IT8951_DITHER_BAYER:
+            bayer_row(src);
+            break;
+        default:
+            round_row(src);
+            break;
+    }
+
+    _row++;
+
+    return _converter.convert(_quantized.get(), dst, _width);
+}
+
+void IT8951Ditherer::load_image_row(IT8951& display, const uint8_t* src) {
+    // 1 bpp images are loaded as 8 bpp images of an eighth of the width, so
+    // only whole bytes of pixels are sent. Rows are padded to whole words.
+
+    auto len = dither_row(src, _packed.get());
+
+    if (_pixel_format == IT8951_PIXEL_FORMAT_1BPP) {
+        len = _width / 8;
+    }
+
+    if (len % 2) {
+        _packed[len++] = 0xff;
+    }
+
+    display.load_image_write(_packed.get(), len);
+}
+
+void IT8951Ditherer::load_image(IT8951& display, IT8951Area& area, uint32_t target_memory_address,
+                                const uint8_t* src, size_t stride) {
+    ESP_ERROR_ASSERT(area.w == _width);
+
+    reset();
+
+    display.load_image_start(area, target_memory_address, IT8951_ROTATE_0, _pixel_format);
+
+    for (uint16_t y = 0; y < area.h; y++) {
+        load_image_row(display, src + y * stride);
+    }
+
+    display.load_image_end();
+}
+
+template <it8951_dither_t Method>
+void IT8951Ditherer::diffuse_row(const uint8_t* src) {
+    auto current = _current_errors;
+    auto next = _next_errors;
+    auto quantized = _quantized.get();
+
+    for (int x = 0; x < _width; x++) {
+        const auto value = clamp_gray(src[x] + current[x]);
+        const auto output = _round[value];
+        const auto error = value - output;
+
+        quantized[x] = output;
+
+        if (Method == IT8951_DITHER_FLOYD_STEINBERG) {
+            current[x + 1] += (error * 7) >> 4;
+            next[x - 1] += (error * 3) >> 4;
+            next[x] += (error * 5) >> 4;
+            next[x + 1] += error >> 4;
+        } else {
+            // Atkinson diffuses three quarters of the error, in eighths, over
+            // two rows. The error of this pixel has been used, so its entry
+            // is reused for the row after the next one.
+
+            const auto part = error >> 3;
+
+            current[x] = part;
+            current[x + 1] += part;
+            current[x + 2] += part;
+            next[x - 1] += part;
+            next[x] += part;
+            next[x + 1] += part;
+        }
+    }
+
+    // Move to the next row. For Floyd-Steinberg the row after that starts
+    // without errors; for Atkinson it already has them.
+
+    std::swap(_current_errors, _next_errors);
+
+    for (int i = 1; i <= IT8951_DITHER_ERROR_PADDING; i++) {
+        _current_errors[-i] = 0;
+        _next_errors[-i] = 0;
+        _current_errors[_width + i - 1] = 0;
+        _next_errors[_width + i - 1] = 0;
+    }
+
+    if (Method == IT8951_DITHER_FLOYD_STEINBERG) {
+        memset(_next_errors, 0, _width * sizeof(int16_t));
+    }
+}
+
+void IT8951Ditherer::bayer_row(const uint8_t* src) {
+    // The threshold moves the value by up to half the distance between two
+    // levels in both directions before it's rounded.
+
+    const auto levels = _levels - 1;
+    const auto step = 255 / levels;
+    const auto matrix = BAYER_MATRIX + (_row % 8) * 8;
+    auto quantized = _quantized.get();
+
+    int offsets[8];
+    for (int i = 0; i < 8; i++) {
+        offsets[i] = (2 * matrix[i] + 1) * step / 128 - step / 2;
+    }
+
+    for (int x = 0; x < _width; x++) {
+        quantized[x] = _round[clamp_gray(src[x] + offsets[x % 8])];
+    }
+}
+
+void IT8951Ditherer::round_row(const uint8_t* src) {
+    auto quantized = _quantized.get();
+
+    for (int x = 0; x < _width; x++) {
+        quantized[x] = _round[src[x]];
+    }
+}
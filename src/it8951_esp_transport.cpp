@@ -0,0 +1,315 @@
+#include "it8951_esp_transport.h"
+
+#include <cstring>
+
+#include "driver/gpio.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "support.h"
+
+static const char* TAG = "IT8951";
+
+#define _WS_CONCAT3(x, y, z) x##y##z
+#define WS_CONCAT3(x, y, z) _WS_CONCAT3(x, y, z)
+
+#define IT8951_SPI_HOST WS_CONCAT3(SPI, CONFIG_IT8951_SPI_HOST, _HOST)
+
+// Transfers up to this size are sent using polling instead of interrupts.
+// The ISR and context switch cost far exceeds the time these spend on the wire.
+#define IT8951_POLLING_TRANSFER_MAX_LEN 32
+
+// Size of the state of the driver kept in RTC memory.
+#define IT8951_RETAINED_STATE_SIZE 32
+
+// NVS namespace of the settings.
+#define IT8951_NVS_NAMESPACE "it8951"
+
+// RTC memory keeps its contents while the chip is in deep sleep.
+RTC_DATA_ATTR static uint8_t retained_state[IT8951_RETAINED_STATE_SIZE];
+RTC_DATA_ATTR static size_t retained_state_len;
+
+void IT8951EspTransport::setup(int clock_speed_hz, int queue_size) {
+    if (!_spi) {
+        gpio_config_t i_conf = {
+            .pin_bit_mask = 1ull << CONFIG_IT8951_DISPLAY_READY_PIN,
+            .mode = GPIO_MODE_INPUT,
+            .pull_up_en = GPIO_PULLUP_DISABLE,
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_POSEDGE,
+        };
+
+        ESP_ERROR_CHECK(gpio_config(&i_conf));
+
+        // The pin interrupt signals a semaphore instead of notifying the task,
+        // so the notifications of the calling task are left to the application.
+
+        _ready = xSemaphoreCreateBinary();
+        ESP_ERROR_ASSERT(_ready);
+
+        // The ISR service may already have been installed by the application.
+
+        auto err = gpio_install_isr_service(0);
+        if (err != ESP_ERR_INVALID_STATE) {
+            ESP_ERROR_CHECK(err);
+        }
+
+        ESP_ERROR_CHECK(
+            gpio_isr_handler_add((gpio_num_t)CONFIG_IT8951_DISPLAY_READY_PIN, hrdy_isr_handler, this));
+        ESP_ERROR_CHECK(gpio_intr_disable((gpio_num_t)CONFIG_IT8951_DISPLAY_READY_PIN));
+
+        // Keep the controller out of reset while the pins become outputs,
+        // so it keeps its state after a deep sleep. The reset pin may have been
+        // held high during deep sleep.
+
+        gpio_set_level((gpio_num_t)CONFIG_IT8951_RESET_PIN, 1);
+        gpio_set_level((gpio_num_t)CONFIG_IT8951_CS_PIN, 1);
+
+        i_conf = {
+            .pin_bit_mask = 1ull << CONFIG_IT8951_RESET_PIN | 1ull << CONFIG_IT8951_CS_PIN,
+            .mode = GPIO_MODE_OUTPUT,
+            .pull_up_en = GPIO_PULLUP_DISABLE,
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_DISABLE,
+        };
+
+        ESP_ERROR_CHECK(gpio_config(&i_conf));
+        ESP_ERROR_CHECK(gpio_hold_dis((gpio_num_t)CONFIG_IT8951_RESET_PIN));
+
+        spi_bus_config_t bus_config = {
+            .mosi_io_num = CONFIG_IT8951_MOSI_PIN,
+            .miso_io_num = CONFIG_IT8951_MISO_PIN,
+            .sclk_io_num = CONFIG_IT8951_SCLK_PIN,
+            .quadwp_io_num = -1,
+            .quadhd_io_num = -1,
+        };
+
+        ESP_ERROR_CHECK(spi_bus_initialize(IT8951_SPI_HOST, &bus_config, SPI_DMA_CH_AUTO));
+    } else {
+        ESP_ERROR_ASSERT(!_bus_acquired);
+        ESP_ERROR_ASSERT(!_queue_pending);
+
+        spi_bus_remove_device(_spi);
+    }
+
+    if (queue_size != _queue_size) {
+        _queued_transactions = std::make_unique<spi_transaction_t[]>(queue_size);
+        _queue_size = queue_size;
+        _queue_head = 0;
+    }
+
+    spi_device_interface_config_t device_interface_config = {
+        .clock_speed_hz = clock_speed_hz,
+        .spics_io_num = -1,
+        .queue_size = queue_size,
+    };
+
+    ESP_ERROR_CHECK(spi_bus_add_device(IT8951_SPI_HOST, &device_interface_config, &_spi));
+
+    int freq_khz;
+    ESP_ERROR_CHECK(spi_device_get_actual_freq(_spi, &freq_khz));
+    ESP_LOGI(TAG, "SPI device frequency %d KHz", freq_khz);
+    ESP_ERROR_ASSERT(freq_khz * 1000 <= device_interface_config.clock_speed_hz);
+}
+
+size_t IT8951EspTransport::get_max_transfer_len() {
+    size_t bus_max_transfer_sz;
+    ESP_ERROR_CHECK(spi_bus_get_max_transaction_len(IT8951_SPI_HOST, &bus_max_transfer_sz));
+
+    return bus_max_transfer_sz;
+}
+
+uint8_t* IT8951EspTransport::allocate_buffer(size_t len) { return (uint8_t*)heap_caps_malloc(len, MALLOC_CAP_DMA); }
+
+void IT8951EspTransport::set_reset(bool level) { gpio_set_level((gpio_num_t)CONFIG_IT8951_RESET_PIN, level); }
+
+void IT8951EspTransport::set_cs(bool level) { gpio_set_level((gpio_num_t)CONFIG_IT8951_CS_PIN, level); }
+
+bool IT8951EspTransport::wait_ready(uint32_t timeout_ms) {
+    const auto pin = (gpio_num_t)CONFIG_IT8951_DISPLAY_READY_PIN;
+
+    // The controller is usually ready within a few microseconds, so
+    // spin for a while before blocking.
+
+    const auto start = get_time_us();
+    while (!gpio_get_level(pin)) {
+        if (get_time_us() - start >= CONFIG_IT8951_HRDY_SPIN_US) {
+            break;
+        }
+    }
+
+    if (gpio_get_level(pin)) {
+        return true;
+    }
+
+    // Block until the rising edge of HRDY. The level is checked again after
+    // enabling the interrupt in case the edge happened in between.
+
+    xSemaphoreTake(_ready, 0);
+
+    ESP_ERROR_CHECK(gpio_intr_enable(pin));
+
+    if (!gpio_get_level(pin)) {
+        xSemaphoreTake(_ready, pdMS_TO_TICKS(timeout_ms));
+    }
+
+    ESP_ERROR_CHECK(gpio_intr_disable(pin));
+
+    return gpio_get_level(pin);
+}
+
+void IRAM_ATTR IT8951EspTransport::hrdy_isr_handler(void* arg) {
+    auto self = (IT8951EspTransport*)arg;
+
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    xSemaphoreGiveFromISR(self->_ready, &higher_priority_task_woken);
+
+    if (higher_priority_task_woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+void IT8951EspTransport::acquire_bus() {
+    ESP_ERROR_ASSERT(!_bus_acquired);
+
+    ESP_ERROR_CHECK(spi_device_acquire_bus(_spi, portMAX_DELAY));
+    _bus_acquired = true;
+}
+
+void IT8951EspTransport::release_bus() {
+    ESP_ERROR_ASSERT(_bus_acquired);
+
+    spi_device_release_bus(_spi);
+    _bus_acquired = false;
+}
+
+void IT8951EspTransport::transfer(const uint8_t* tx, uint8_t* rx, size_t len) {
+    spi_transaction_t t = {
+        .length = 8 * len,
+        .tx_buffer = tx,
+        .rx_buffer = rx,
+    };
+
+    // Short transfers go through the transaction itself instead of through
+    // separate (DMA) buffers.
+
+    if (len <= sizeof(t.tx_data)) {
+        t.flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
+        memset(t.tx_data, 0, sizeof(t.tx_data));
+        if (tx) {
+            memcpy(t.tx_data, tx, len);
+        }
+    }
+
+    if (len <= IT8951_POLLING_TRANSFER_MAX_LEN) {
+        ESP_ERROR_CHECK(spi_device_polling_transmit(_spi, &t));
+    } else {
+        ESP_ERROR_CHECK(spi_device_transmit(_spi, &t));
+    }
+
+    if (rx && (t.flags & SPI_TRANS_USE_RXDATA)) {
+        memcpy(rx, t.rx_data, len);
+    }
+}
+
+void IT8951EspTransport::queue_transfer(const uint8_t* tx, uint8_t* rx, size_t len) {
+    ESP_ERROR_ASSERT(_queue_pending < _queue_size);
+
+    auto& transaction = _queued_transactions[(_queue_head + _queue_pending) % _queue_size];
+
+    transaction = {
+        .length = 8 * len,
+        .tx_buffer = tx,
+        .rx_buffer = rx,
+    };
+
+    ESP_ERROR_CHECK(spi_device_queue_trans(_spi, &transaction, portMAX_DELAY));
+
+    _queue_pending++;
+}
+
+void IT8951EspTransport::wait_transfer() {
+    const auto completed = complete_transfer(portMAX_DELAY);
+    ESP_ERROR_ASSERT(completed);
+}
+
+bool IT8951EspTransport::poll_transfer() { return complete_transfer(0); }
+
+bool IT8951EspTransport::complete_transfer(TickType_t ticks_to_wait) {
+    ESP_ERROR_ASSERT(_queue_pending > 0);
+
+    spi_transaction_t* result_transaction;
+    auto err = spi_device_get_trans_result(_spi, &result_transaction, ticks_to_wait);
+    if (err == ESP_ERR_TIMEOUT) {
+        return false;
+    }
+    ESP_ERROR_CHECK(err);
+
+    // Transactions complete in the order they were queued.
+
+    ESP_ERROR_ASSERT(result_transaction == &_queued_transactions[_queue_head]);
+
+    _queue_head = (_queue_head + 1) % _queue_size;
+    _queue_pending--;
+
+    return true;
+}
+
+void IT8951EspTransport::delay(int ms) { vTaskDelay(pdMS_TO_TICKS(ms)); }
+
+int64_t IT8951EspTransport::get_time_us() { return esp_timer_get_time(); }
+
+void IT8951EspTransport::store_retained_state(const void* data, size_t len) {
+    ESP_ERROR_ASSERT(len <= IT8951_RETAINED_STATE_SIZE);
+
+    memcpy(retained_state, data, len);
+    retained_state_len = len;
+}
+
+bool IT8951EspTransport::load_retained_state(void* data, size_t len) {
+    if (retained_state_len != len) {
+        return false;
+    }
+
+    memcpy(data, retained_state, len);
+
+    return true;
+}
+
+bool IT8951EspTransport::store_setting(const char* key, int32_t value) {
+    nvs_handle_t handle;
+
+    auto err = nvs_open(IT8951_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_i32(handle, key, value);
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+
+        nvs_close(handle);
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Storing %s failed: %s", key, esp_err_to_name(err));
+        return false;
+    }
+
+    return true;
+}
+
+bool IT8951EspTransport::load_setting(const char* key, int32_t& value) {
+    // Fails when the setting wasn't stored, or when NVS isn't initialized.
+
+    nvs_handle_t handle;
+
+    if (nvs_open(IT8951_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+
+    const auto err = nvs_get_i32(handle, key, &value);
+
+    nvs_close(handle);
+
+    return err == ESP_OK;
+}
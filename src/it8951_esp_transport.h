@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+
+#include "driver/spi_master.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "it8951_transport.h"
+
+/**
+ * @brief Transport using the ESP32 SPI master and the pins configured in `sdkconfig`.
+ */
+class IT8951EspTransport : public IT8951Transport {
+public:
+    void setup(int clock_speed_hz, int queue_size) override;
+    size_t get_max_transfer_len() override;
+    uint8_t* allocate_buffer(size_t len) override;
+    void set_reset(bool level) override;
+    void set_cs(bool level) override;
+    bool wait_ready(uint32_t timeout_ms) override;
+    void acquire_bus() override;
+    void release_bus() override;
+    void transfer(const uint8_t* tx, uint8_t* rx, size_t len) override;
+    void queue_transfer(const uint8_t* tx, uint8_t* rx, size_t len) override;
+    void wait_transfer() override;
+    bool poll_transfer() override;
+    void delay(int ms) override;
+    int64_t get_time_us() override;
+    void store_retained_state(const void* data, size_t len) override;
+    bool load_retained_state(void* data, size_t len) override;
+    bool store_setting(const char* key, int32_t value) override;
+    bool load_setting(const char* key, int32_t& value) override;
+
+private:
+    static void hrdy_isr_handler(void* arg);
+
+    spi_device_handle_t _spi{nullptr};
+    SemaphoreHandle_t _ready{nullptr};
+    bool _bus_acquired{false};
+    bool complete_transfer(TickType_t ticks_to_wait);
+
+    std::unique_ptr<spi_transaction_t[]> _queued_transactions;
+    int _queue_size{0};
+    int _queue_head{0};
+    int _queue_pending{0};
+};
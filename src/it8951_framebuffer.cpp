@@ -0,0 +1,276 @@
+#include "it8951_framebuffer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_log.h"
+#include "support.h"
+
+static const char* TAG = "IT8951";
+
+static bool areas_intersect(const IT8951Area& a, const IT8951Area& b) {
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+static bool area_contains(const IT8951Area& a, const IT8951Area& b) {
+    return b.x >= a.x && b.x + b.w <= a.x + a.w && b.y >= a.y && b.y + b.h <= a.y + a.h;
+}
+
+static IT8951Area area_union(const IT8951Area& a, const IT8951Area& b) {
+    const auto x = std::min(a.x, b.x);
+    const auto y = std::min(a.y, b.y);
+
+    return {
+        .x = x,
+        .y = y,
+        .w = uint16_t(std::max(a.x + a.w, b.x + b.w) - x),
+        .h = uint16_t(std::max(a.y + a.h, b.y + b.h) - y),
+    };
+}
+
+IT8951Framebuffer::IT8951Framebuffer(IT8951& display, it8951_pixel_format_t pixel_format)
+    : _display(display),
+      _pixel_format(pixel_format),
+      _converter(pixel_format),
+      _width(display.get_width()),
+      _height(display.get_height()) {
+    switch (pixel_format) {
+        case IT8951_PIXEL_FORMAT_1BPP:
+            _bpp = 1;
+            break;
+        case IT8951_PIXEL_FORMAT_2BPP:
+            _bpp = 2;
+            break;
+        case IT8951_PIXEL_FORMAT_4BPP:
+            _bpp = 4;
+            break;
+        default:
+            _bpp = 8;
+            break;
+    }
+
+    // Uploads are done in whole words. 1 bpp images are uploaded as 8 bpp
+    // images of an eighth of the width, so there the width must be a
+    // multiple of 8 pixels.
+
+    _pixels_per_word = 16 / _bpp;
+
+    if (_bpp == 1) {
+        _width &= ~7;
+    }
+
+    _scan_line = get_row_bytes(_width);
+
+    ESP_LOGI(TAG, "Allocating %d bytes for the framebuffer", int(_scan_line * _height));
+
+    _buffer.reset(new uint8_t[_scan_line * _height]);
+    ESP_ERROR_ASSERT(_buffer);
+
+    memset(_buffer.get(), 0xff, _scan_line * _height);
+}
+
+void IT8951Framebuffer::set_pixel(uint16_t x, uint16_t y, uint8_t gray) {
+    if (x >= _width || y >= _height) {
+        return;
+    }
+
+    fill_row(y, x, x + 1, get_level(gray));
+
+    mark_dirty({.x = x, .y = y, .w = 1, .h = 1});
+}
+
+void IT8951Framebuffer::fill_rect(const IT8951Area& area, uint8_t gray) {
+    if (area.x >= _width || area.y >= _height) {
+        return;
+    }
+
+    const auto x1 = std::min<int>(area.x + area.w, _width);
+    const auto y1 = std::min<int>(area.y + area.h, _height);
+    const auto level = get_level(gray);
+
+    for (int y = area.y; y < y1; y++) {
+        fill_row(y, area.x, x1, level);
+    }
+
+    mark_dirty({.x = area.x, .y = area.y, .w = uint16_t(x1 - area.x), .h = uint16_t(y1 - area.y)});
+}
+
+void IT8951Framebuffer::draw_gray8(const IT8951Area& area, const uint8_t* data, size_t stride) {
+    if (area.x >= _width || area.y >= _height) {
+        return;
+    }
+
+    const auto x1 = std::min<int>(area.x + area.w, _width);
+    const auto y1 = std::min<int>(area.y + area.h, _height);
+
+    const int pixels_per_byte = 8 / _bpp;
+
+    for (int y = area.y; y < y1; y++) {
+        const auto row = data + (y - area.y) * stride;
+        int x = area.x;
+
+        // Pixels that share a byte with pixels outside the area are set one
+        // by one, whole bytes are converted at once.
+
+        for (; x < x1 && x % pixels_per_byte; x++) {
+            fill_row(y, x, x + 1, get_level(row[x - area.x]));
+        }
+
+        const auto whole = (x1 - x) / pixels_per_byte * pixels_per_byte;
+
+        if (whole > 0) {
+            _converter.convert(row + x - area.x, _buffer.get() + y * _scan_line + x / pixels_per_byte, whole);
+            x += whole;
+        }
+
+        for (; x < x1; x++) {
+            fill_row(y, x, x + 1, get_level(row[x - area.x]));
+        }
+    }
+
+    mark_dirty({.x = area.x, .y = area.y, .w = uint16_t(x1 - area.x), .h = uint16_t(y1 - area.y)});
+}
+
+void IT8951Framebuffer::mark_dirty(const IT8951Area& area) {
+    if (area.x >= _width || area.y >= _height || !area.w || !area.h) {
+        return;
+    }
+
+    const auto aligned = align(area);
+
+    for (size_t i = 0; i < _dirty_count; i++) {
+        if (area_contains(_dirty[i], aligned)) {
+            return;
+        }
+    }
+
+    _dirty[_dirty_count++] = aligned;
+
+    // Keep the number of areas bounded by merging the cheapest pair.
+
+    size_t a, b;
+
+    if (_dirty_count > IT8951_MAX_DIRTY_AREAS && find_merge(a, b, true)) {
+        merge(a, b);
+    }
+}
+
+size_t IT8951Framebuffer::commit(it8951_display_mode_t mode, uint32_t target_memory_address) {
+    if (!target_memory_address) {
+        target_memory_address = _display.get_memory_address();
+    }
+
+    size_t a, b;
+
+    while (find_merge(a, b, false)) {
+        merge(a, b);
+    }
+
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < _dirty_count; i++) {
+        auto& area = _dirty[i];
+
+        _display.load_image(area, target_memory_address, IT8951_ROTATE_0, _pixel_format,
+                            _buffer.get() + area.y * _scan_line + area.x * _bpp / 8, _scan_line);
+
+        _display.display_area(area, target_memory_address, _pixel_format, mode);
+
+        bytes += get_row_bytes(area.w) * area.h;
+    }
+
+    _dirty_count = 0;
+
+    return bytes;
+}
+
+void IT8951Framebuffer::fill_row(uint16_t y, uint16_t x0, uint16_t x1, uint8_t level) {
+    auto row = _buffer.get() + y * _scan_line;
+
+    if (_bpp == 8) {
+        memset(row + x0, level, x1 - x0);
+        return;
+    }
+
+    const int pixels_per_byte = 8 / _bpp;
+    const uint8_t mask = (1 << _bpp) - 1;
+
+    // Partial bytes are updated pixel by pixel, whole bytes at once.
+
+    while (x0 < x1 && (x0 % pixels_per_byte || x1 - x0 < pixels_per_byte)) {
+        const auto shift = 8 - _bpp * (x0 % pixels_per_byte + 1);
+        auto& value = row[x0 / pixels_per_byte];
+
+        value = (value & ~(mask << shift)) | level << shift;
+
+        x0++;
+    }
+
+    if (x0 == x1) {
+        return;
+    }
+
+    uint8_t value = 0;
+    for (int i = 0; i < pixels_per_byte; i++) {
+        value = value << _bpp | level;
+    }
+
+    const auto whole = (x1 - x0) / pixels_per_byte;
+
+    memset(row + x0 / pixels_per_byte, value, whole);
+
+    fill_row(y, x0 + whole * pixels_per_byte, x1, level);
+}
+
+uint8_t IT8951Framebuffer::get_level(uint8_t gray) { return gray >> (8 - _bpp); }
+
+IT8951Area IT8951Framebuffer::align(const IT8951Area& area) {
+    const auto x0 = area.x / _pixels_per_word * _pixels_per_word;
+    const auto x1 = std::min<int>((area.x + area.w + _pixels_per_word - 1) / _pixels_per_word * _pixels_per_word, _width);
+    const auto y1 = std::min<int>(area.y + area.h, _height);
+
+    return {
+        .x = uint16_t(x0),
+        .y = area.y,
+        .w = uint16_t(x1 - x0),
+        .h = uint16_t(y1 - area.y),
+    };
+}
+
+size_t IT8951Framebuffer::get_row_bytes(uint16_t w) { return ((w * _bpp + 7) / 8 + 1) & ~1; }
+
+size_t IT8951Framebuffer::get_cost(const IT8951Area& area) { return _merge_overhead + get_row_bytes(area.w) * area.h; }
+
+void IT8951Framebuffer::merge(size_t a, size_t b) {
+    _dirty[a] = area_union(_dirty[a], _dirty[b]);
+    _dirty[b] = _dirty[--_dirty_count];
+}
+
+bool IT8951Framebuffer::find_merge(size_t& a, size_t& b, bool force) {
+    // Areas that overlap are always merged, because they would be uploaded
+    // twice and their refreshes can't run concurrently. Other areas are
+    // merged when that's cheaper than the overhead of a separate upload.
+
+    auto found = false;
+    ptrdiff_t best = 0;
+
+    for (size_t i = 0; i < _dirty_count; i++) {
+        for (size_t j = i + 1; j < _dirty_count; j++) {
+            const auto merged = area_union(_dirty[i], _dirty[j]);
+            auto delta = ptrdiff_t(get_cost(merged)) - ptrdiff_t(get_cost(_dirty[i])) - ptrdiff_t(get_cost(_dirty[j]));
+
+            if (areas_intersect(_dirty[i], _dirty[j])) {
+                delta = std::min<ptrdiff_t>(delta, 0);
+            }
+
+            if ((force || delta <= 0) && (!found || delta < best)) {
+                found = true;
+                best = delta;
+                a = i;
+                b = j;
+            }
+        }
+    }
+
+    return found;
+}
@@ -0,0 +1,196 @@
+#include "it8951_ghost.h"
+
+#include <algorithm>
+
+#include "support.h"
+
+IT8951GhostTracker::IT8951GhostTracker(IT8951& display, uint32_t target_memory_address,
+                                       it8951_pixel_format_t pixel_format, uint16_t tile_size)
+    : _display(display), _memory_address(target_memory_address), _pixel_format(pixel_format), _tile_size(tile_size) {
+    ESP_ERROR_ASSERT(tile_size > 0 && tile_size % 16 == 0);
+
+    _columns = (display.get_width() + tile_size - 1) / tile_size;
+    _rows = (display.get_height() + tile_size - 1) / tile_size;
+
+    _counts.reset(new uint16_t[_columns * _rows]());
+}
+
+void IT8951GhostTracker::record(const IT8951Area& area, it8951_display_mode_t mode) {
+    const auto first_column = area.x / _tile_size;
+    const auto last_column = (area.x + area.w - 1) / _tile_size;
+    const auto first_row = area.y / _tile_size;
+    const auto last_row = (area.y + area.h - 1) / _tile_size;
+
+    switch (mode) {
+        case IT8951_DISPLAY_MODE_A2:
+        case IT8951_DISPLAY_MODE_DU:
+        case IT8951_DISPLAY_MODE_DU4:
+            for (int row = first_row; row <= last_row; row++) {
+                for (int column = first_column; column <= last_column; column++) {
+                    auto& count = _counts[row * _columns + column];
+
+                    if (count < UINT16_MAX) {
+                        count++;
+                    }
+
+                    if (count >= _budget) {
+                        _pending = true;
+                    }
+                }
+            }
+            break;
+
+        case IT8951_DISPLAY_MODE_INIT:
+        case IT8951_DISPLAY_MODE_GC16:
+        case IT8951_DISPLAY_MODE_GLR16:
+        case IT8951_DISPLAY_MODE_GLD16:
+            // Tiles that are only partly refreshed keep their after image.
+
+            for (int row = first_row; row <= last_row; row++) {
+                for (int column = first_column; column <= last_column; column++) {
+                    auto& count = _counts[row * _columns + column];
+
+                    if (covers(area, column, row)) {
+                        if (count >= _budget) {
+                            _stats.saved_tiles++;
+                        }
+
+                        count = 0;
+                    }
+                }
+            }
+
+            if (_pending) {
+                const auto end = _counts.get() + _columns * _rows;
+
+                _pending = std::any_of(_counts.get(), end, [this](uint16_t count) { return count >= _budget; });
+
+                // The screen flashes anyway, so the remaining cleanups go with it.
+
+                if (_pending && _deferred) {
+                    _stats.piggybacked += cleanup();
+                }
+            }
+            break;
+
+        default:
+            // GL16 doesn't refresh white pixels, so it neither adds nor removes after images.
+            break;
+    }
+
+    if (_pending && !_deferred) {
+        cleanup();
+    }
+}
+
+void IT8951GhostTracker::reset() {
+    std::fill_n(_counts.get(), _columns * _rows, 0);
+
+    _pending = false;
+}
+
+size_t IT8951GhostTracker::cleanup() {
+    // Runs of tiles over budget in a row are joined with the run of the same
+    // tiles in the row above.
+
+    struct TileRange {
+        int first_column;
+        int last_column;
+        int first_row;
+        int last_row;
+    };
+
+    TileRange ranges[IT8951_MAX_CLEANUP_AREAS];
+    size_t range_count = 0;
+
+    for (int row = 0; row < _rows; row++) {
+        for (int column = 0; column < _columns;) {
+            if (_counts[row * _columns + column] < _budget) {
+                column++;
+                continue;
+            }
+
+            const auto first_column = column;
+
+            while (column < _columns && _counts[row * _columns + column] >= _budget) {
+                column++;
+            }
+
+            const auto last_column = column - 1;
+            auto joined = false;
+
+            for (size_t i = 0; i < range_count && !joined; i++) {
+                auto& range = ranges[i];
+
+                if (range.first_column == first_column && range.last_column == last_column &&
+                    range.last_row == row - 1) {
+                    range.last_row = row;
+                    joined = true;
+                }
+            }
+
+            if (joined) {
+                continue;
+            }
+
+            if (range_count == IT8951_MAX_CLEANUP_AREAS) {
+                auto& last = ranges[range_count - 1];
+
+                last.first_column = std::min(last.first_column, first_column);
+                last.last_column = std::max(last.last_column, last_column);
+                last.last_row = row;
+                continue;
+            }
+
+            ranges[range_count++] = {
+                .first_column = first_column,
+                .last_column = last_column,
+                .first_row = row,
+                .last_row = row,
+            };
+        }
+    }
+
+    for (size_t i = 0; i < range_count; i++) {
+        const auto& range = ranges[i];
+        auto area = get_tiles_area(range.first_column, range.last_column, range.first_row, range.last_row);
+
+        if (_cleanup_mode == IT8951_DISPLAY_MODE_INIT) {
+            _display.display_area(area, _memory_address, _pixel_format, IT8951_DISPLAY_MODE_INIT);
+        }
+
+        _display.display_area(area, _memory_address, _pixel_format, IT8951_DISPLAY_MODE_GC16);
+
+        for (int row = range.first_row; row <= range.last_row; row++) {
+            std::fill_n(&_counts[row * _columns + range.first_column], range.last_column - range.first_column + 1, 0);
+        }
+
+        _stats.cleanup_refreshes++;
+        _stats.cleaned_tiles += (range.last_column - range.first_column + 1) * (range.last_row - range.first_row + 1);
+    }
+
+    _pending = false;
+
+    return range_count;
+}
+
+bool IT8951GhostTracker::covers(const IT8951Area& area, int column, int row) {
+    // Tiles at the right and bottom edges of the screen may be smaller.
+
+    const auto tile = get_tiles_area(column, column, row, row);
+
+    return tile.x >= area.x && tile.x + tile.w <= area.x + area.w && tile.y >= area.y &&
+           tile.y + tile.h <= area.y + area.h;
+}
+
+IT8951Area IT8951GhostTracker::get_tiles_area(int first_column, int last_column, int first_row, int last_row) {
+    const auto x = first_column * _tile_size;
+    const auto y = first_row * _tile_size;
+
+    return {
+        .x = uint16_t(x),
+        .y = uint16_t(y),
+        .w = uint16_t(std::min((last_column + 1) * _tile_size, int(_display.get_width())) - x),
+        .h = uint16_t(std::min((last_row + 1) * _tile_size, int(_display.get_height())) - y),
+    };
+}
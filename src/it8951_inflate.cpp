@@ -0,0 +1,445 @@
+#include "it8951_inflate.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_log.h"
+
+static const char* TAG = "IT8951";
+
+#define IT8951_INFLATE_WINDOW_MASK (IT8951_INFLATE_WINDOW - 1)
+
+// Base lengths and extra bits of the length symbols 257 to 285.
+static const uint16_t LENGTH_BASE[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                         31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                         2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+
+// Base distances and extra bits of the distance symbols.
+static const uint16_t DISTANCE_BASE[30] = {1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+                                           33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+                                           1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t DISTANCE_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                           6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Order in which the lengths of the code length codes are stored.
+static const uint8_t CODE_LENGTH_ORDER[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+IT8951Inflater::IT8951Inflater()
+    : _window(new uint8_t[IT8951_INFLATE_WINDOW]), _lengths(new Huffman), _distances(new Huffman) {}
+
+void IT8951Inflater::start(it8951_read_cb_t read, void* user_data, bool zlib) {
+    _read = read;
+    _user_data = user_data;
+    _state = zlib ? State::ZLIB_HEADER : State::HEADER;
+    _last_block = false;
+    _window_pos = 0;
+    _total = 0;
+    _copy_len = 0;
+    _input_pos = 0;
+    _input_len = 0;
+    _input_end = false;
+    _bits = 0;
+    _bit_count = 0;
+    _padding_bits = 0;
+}
+
+size_t IT8951Inflater::read(uint8_t* data, size_t len) {
+    const auto window = _window.get();
+    size_t done = 0;
+
+    while (done < len) {
+        // Finish the match of the previous call first.
+
+        if (_copy_len) {
+            auto count = std::min<size_t>(_copy_len, len - done);
+            auto from = (_window_pos - _copy_distance) & IT8951_INFLATE_WINDOW_MASK;
+
+            _copy_len -= count;
+            _total += count;
+
+            while (count--) {
+                const auto value = window[from];
+
+                from = (from + 1) & IT8951_INFLATE_WINDOW_MASK;
+                window[_window_pos] = value;
+                _window_pos = (_window_pos + 1) & IT8951_INFLATE_WINDOW_MASK;
+                data[done++] = value;
+            }
+
+            continue;
+        }
+
+        switch (_state) {
+            case State::ZLIB_HEADER: {
+                const auto method = get_bits(8);
+                const auto flags = get_bits(8);
+
+                // Deflate with a window of at most 32 KB, and no preset dictionary.
+
+                if ((method & 0x0f) != 8 || method >> 4 > 7 || (method << 8 | flags) % 31 || flags & 0x20) {
+                    fail();
+                } else if (_state != State::ERROR) {
+                    _state = State::HEADER;
+                }
+
+                break;
+            }
+
+            case State::HEADER:
+                if (_last_block) {
+                    _state = State::DONE;
+                } else if (!read_header()) {
+                    fail();
+                }
+
+                break;
+
+            case State::STORED: {
+                const auto count = std::min<size_t>(_stored_len, len - done);
+
+                for (size_t i = 0; i < count && _state != State::ERROR; i++) {
+                    const auto value = uint8_t(get_bits(8));
+
+                    window[_window_pos] = value;
+                    _window_pos = (_window_pos + 1) & IT8951_INFLATE_WINDOW_MASK;
+                    data[done++] = value;
+                }
+
+                _total += count;
+                _stored_len -= count;
+
+                if (!_stored_len && _state != State::ERROR) {
+                    _state = State::HEADER;
+                }
+
+                break;
+            }
+
+            case State::CODES:
+                // Literals are the most common symbols, so they're stored
+                // without leaving the loop.
+
+                while (done < len) {
+                    const auto symbol = decode(*_lengths);
+
+                    if (symbol < 256) {
+                        if (symbol < 0) {
+                            fail();
+                            break;
+                        }
+
+                        window[_window_pos] = symbol;
+                        _window_pos = (_window_pos + 1) & IT8951_INFLATE_WINDOW_MASK;
+                        data[done++] = symbol;
+                        _total++;
+                        continue;
+                    }
+
+                    if (symbol == 256) {
+                        _state = State::HEADER;
+                        break;
+                    }
+
+                    const auto length_symbol = symbol - 257;
+
+                    if (length_symbol >= 29) {
+                        fail();
+                        break;
+                    }
+
+                    _copy_len = LENGTH_BASE[length_symbol] + get_bits(LENGTH_EXTRA[length_symbol]);
+
+                    const auto distance_symbol = decode(*_distances);
+
+                    if (distance_symbol < 0 || distance_symbol >= 30) {
+                        fail();
+                        break;
+                    }
+
+                    _copy_distance = DISTANCE_BASE[distance_symbol] + get_bits(DISTANCE_EXTRA[distance_symbol]);
+
+                    if (_copy_distance > _total) {
+                        fail();
+                    }
+
+                    break;
+                }
+
+                break;
+
+            case State::DONE:
+            case State::ERROR:
+                return done;
+        }
+    }
+
+    return done;
+}
+
+bool IT8951Inflater::read_header() {
+    _last_block = get_bits(1);
+
+    switch (get_bits(2)) {
+        case 0: {
+            // Stored blocks start at a byte boundary.
+
+            get_bits(_bit_count % 8);
+
+            const auto len = get_bits(16);
+            const auto inverted_len = get_bits(16);
+
+            if (len != (~inverted_len & 0xffff)) {
+                return false;
+            }
+
+            _stored_len = len;
+            _state = len ? State::STORED : State::HEADER;
+            break;
+        }
+
+        case 1: {
+            uint8_t lengths[288 + 30];
+
+            memset(lengths, 8, 144);
+            memset(lengths + 144, 9, 256 - 144);
+            memset(lengths + 256, 7, 280 - 256);
+            memset(lengths + 280, 8, 288 - 280);
+            memset(lengths + 288, 5, 30);
+
+            build(*_lengths, lengths, 288);
+            build(*_distances, lengths + 288, 30);
+
+            _state = State::CODES;
+            break;
+        }
+
+        case 2:
+            if (!read_dynamic_tables()) {
+                return false;
+            }
+
+            _state = State::CODES;
+            break;
+
+        default:
+            return false;
+    }
+
+    return _state != State::ERROR;
+}
+
+bool IT8951Inflater::read_dynamic_tables() {
+    const int length_count = get_bits(5) + 257;
+    const int distance_count = get_bits(5) + 1;
+    const int code_length_count = get_bits(4) + 4;
+    uint8_t lengths[288 + 32] = {};
+
+    if (length_count > 286 || distance_count > 30) {
+        return false;
+    }
+
+    // The lengths of the codes are Huffman coded themselves. The distance
+    // table holds that code until the lengths have been read.
+
+    for (int i = 0; i < code_length_count; i++) {
+        lengths[CODE_LENGTH_ORDER[i]] = get_bits(3);
+    }
+
+    if (!build(*_distances, lengths, 19)) {
+        return false;
+    }
+
+    for (int i = 0; i < length_count + distance_count;) {
+        const auto symbol = decode(*_distances);
+        uint8_t value = 0;
+        int repeat;
+
+        if (symbol < 0) {
+            return false;
+        } else if (symbol < 16) {
+            lengths[i++] = symbol;
+            continue;
+        } else if (symbol == 16) {
+            if (!i) {
+                return false;
+            }
+
+            value = lengths[i - 1];
+            repeat = 3 + get_bits(2);
+        } else if (symbol == 17) {
+            repeat = 3 + get_bits(3);
+        } else {
+            repeat = 11 + get_bits(7);
+        }
+
+        if (i + repeat > length_count + distance_count) {
+            return false;
+        }
+
+        memset(lengths + i, value, repeat);
+        i += repeat;
+    }
+
+    // Every block ends with the end of block symbol.
+
+    if (!lengths[256]) {
+        return false;
+    }
+
+    uint8_t distance_lengths[30];
+
+    memcpy(distance_lengths, lengths + length_count, distance_count);
+    memset(lengths + length_count, 0, 288 - length_count);
+
+    return build(*_lengths, lengths, 288) && build(*_distances, distance_lengths, distance_count);
+}
+
+bool IT8951Inflater::build(Huffman& huffman, const uint8_t* lengths, int count) {
+    uint16_t offsets[MAX_BITS + 2];
+    uint16_t next_code[MAX_BITS + 1];
+
+    memset(huffman.count, 0, sizeof(huffman.count));
+    memset(huffman.fast, 0, sizeof(huffman.fast));
+
+    for (int symbol = 0; symbol < count; symbol++) {
+        huffman.count[lengths[symbol]]++;
+    }
+
+    huffman.count[0] = 0;
+
+    // Codes may be incomplete, but not over-subscribed.
+
+    int left = 1;
+
+    for (int len = 1; len <= MAX_BITS; len++) {
+        left = (left << 1) - huffman.count[len];
+
+        if (left < 0) {
+            return false;
+        }
+    }
+
+    offsets[1] = 0;
+    next_code[0] = 0;
+
+    for (int len = 1; len <= MAX_BITS; len++) {
+        offsets[len + 1] = offsets[len] + huffman.count[len];
+        next_code[len] = (next_code[len - 1] + huffman.count[len - 1]) << 1;
+    }
+
+    for (int symbol = 0; symbol < count; symbol++) {
+        const int len = lengths[symbol];
+
+        if (!len) {
+            continue;
+        }
+
+        huffman.symbol[offsets[len]++] = symbol;
+
+        const auto code = next_code[len]++;
+
+        if (len > FAST_BITS) {
+            continue;
+        }
+
+        // Codes are stored starting with their most significant bit, while
+        // bits are read starting with the least significant bit.
+
+        uint32_t reversed = 0;
+
+        for (int i = 0; i < len; i++) {
+            reversed |= (code >> i & 1) << (len - 1 - i);
+        }
+
+        for (auto i = reversed; i < (1u << FAST_BITS); i += 1 << len) {
+            huffman.fast[i] = symbol << 4 | len;
+        }
+    }
+
+    return true;
+}
+
+int IT8951Inflater::decode(const Huffman& huffman) {
+    if (_bit_count < MAX_BITS) {
+        refill();
+    }
+
+    const auto entry = huffman.fast[_bits & ((1 << FAST_BITS) - 1)];
+
+    if (entry) {
+        get_bits(entry & 0x0f);
+        return entry >> 4;
+    }
+
+    // Longer codes are decoded a bit at a time.
+
+    int code = 0;
+    int first = 0;
+    int index = 0;
+
+    for (int len = 1; len <= MAX_BITS; len++) {
+        code |= _bits >> (len - 1) & 1;
+
+        const int count = huffman.count[len];
+
+        if (code < first + count) {
+            get_bits(len);
+            return huffman.symbol[index + code - first];
+        }
+
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+
+    return -1;
+}
+
+void IT8951Inflater::refill() {
+    while (_bit_count <= 56) {
+        if (_input_pos == _input_len && !_input_end) {
+            _input_len = _read(_input, sizeof(_input), _user_data);
+            _input_pos = 0;
+            _input_end = !_input_len;
+        }
+
+        // Past the end of the input, zeros are read, and reading them is
+        // an error once they're consumed.
+
+        if (_input_end) {
+            _bit_count += 8;
+            _padding_bits += 8;
+            continue;
+        }
+
+        _bits |= uint64_t(_input[_input_pos++]) << _bit_count;
+        _bit_count += 8;
+    }
+}
+
+uint32_t IT8951Inflater::get_bits(int count) {
+    if (_bit_count < count) {
+        refill();
+    }
+
+    const auto value = uint32_t(_bits & ((uint64_t(1) << count) - 1));
+
+    _bits >>= count;
+    _bit_count -= count;
+
+    if (_bit_count < _padding_bits) {
+        fail();
+    }
+
+    return value;
+}
+
+void IT8951Inflater::fail() {
+    if (_state != State::ERROR) {
+        ESP_LOGE(TAG, "Compressed data is corrupt");
+    }
+
+    _state = State::ERROR;
+    _copy_len = 0;
+}
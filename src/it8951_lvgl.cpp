@@ -0,0 +1,197 @@
+#include "it8951_lvgl.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "support.h"
+
+static IT8951Area area_union(const IT8951Area& a, const IT8951Area& b) {
+    const auto x = std::min(a.x, b.x);
+    const auto y = std::min(a.y, b.y);
+
+    return {
+        .x = x,
+        .y = y,
+        .w = uint16_t(std::max(a.x + a.w, b.x + b.w) - x),
+        .h = uint16_t(std::max(a.y + a.h, b.y + b.h) - y),
+    };
+}
+
+IT8951Lvgl::IT8951Lvgl(IT8951& display, it8951_pixel_format_t pixel_format, it8951_display_mode_t mode)
+    : _display(display), _pixel_format(pixel_format), _mode(mode), _converter(pixel_format) {
+    // Uploads are done in whole words. 1 bpp images are uploaded as 8 bpp
+    // images of an eighth of the width, so there the width must be a
+    // multiple of 8 pixels.
+
+    switch (pixel_format) {
+        case IT8951_PIXEL_FORMAT_1BPP:
+            _pixels_per_word = 16;
+            break;
+        case IT8951_PIXEL_FORMAT_2BPP:
+            _pixels_per_word = 8;
+            break;
+        case IT8951_PIXEL_FORMAT_4BPP:
+            _pixels_per_word = 4;
+            break;
+        default:
+            _pixels_per_word = 2;
+            break;
+    }
+
+    _width = display.get_width();
+
+    if (pixel_format == IT8951_PIXEL_FORMAT_1BPP) {
+        _width &= ~7;
+    }
+}
+
+IT8951Lvgl::~IT8951Lvgl() {
+    if (_lv_display) {
+        lv_display_delete(_lv_display);
+    }
+}
+
+lv_display_t* IT8951Lvgl::create(uint16_t buffer_rows, lv_color_format_t color_format) {
+    ESP_ERROR_ASSERT(!_lv_display);
+
+    _color_format = color_format;
+    _bytes_per_pixel = lv_color_format_get_size(color_format);
+
+    ESP_ERROR_ASSERT(_bytes_per_pixel >= 1 && _bytes_per_pixel <= 4);
+
+    if (_bytes_per_pixel > 1) {
+        _gray.reset(new uint8_t[_width]);
+    }
+
+    const auto size = lv_draw_buf_width_to_stride(_width, color_format) * buffer_rows;
+
+    _draw_buffer.reset(new uint8_t[size + LV_DRAW_BUF_ALIGN]);
+
+    _lv_display = lv_display_create(_width, _display.get_height());
+
+    lv_display_set_color_format(_lv_display, color_format);
+    lv_display_set_buffers(_lv_display, lv_draw_buf_align(_draw_buffer.get(), color_format), nullptr, size,
+                           LV_DISPLAY_RENDER_MODE_PARTIAL);
+    lv_display_set_user_data(_lv_display, this);
+    lv_display_set_flush_cb(_lv_display, flush_cb);
+    lv_display_add_event_cb(_lv_display, invalidate_area_cb, LV_EVENT_INVALIDATE_AREA, this);
+
+    return _lv_display;
+}
+
+void IT8951Lvgl::flush_cb(lv_display_t* disp, const lv_area_t* area, uint8_t* px_map) {
+    const auto self = (IT8951Lvgl*)lv_display_get_user_data(disp);
+
+    self->flush(area, px_map);
+
+    if (lv_display_flush_is_last(disp)) {
+        self->show_areas();
+    }
+
+    lv_display_flush_ready(disp);
+}
+
+void IT8951Lvgl::invalidate_area_cb(lv_event_t* e) {
+    // Widen invalidated areas to whole words, so they can be uploaded as is.
+
+    const auto self = (IT8951Lvgl*)lv_event_get_user_data(e);
+    const auto area = (lv_area_t*)lv_event_get_param(e);
+    const int32_t pixels_per_word = self->_pixels_per_word;
+
+    area->x1 -= area->x1 % pixels_per_word;
+    area->x2 = std::min<int32_t>((area->x2 / pixels_per_word + 1) * pixels_per_word, self->_width) - 1;
+}
+
+void IT8951Lvgl::flush(const lv_area_t* area, uint8_t* px_map) {
+    IT8951Area image = {
+        .x = uint16_t(area->x1),
+        .y = uint16_t(area->y1),
+        .w = uint16_t(lv_area_get_width(area)),
+        .h = uint16_t(lv_area_get_height(area)),
+    };
+
+    _px_map = px_map;
+    _px_stride = lv_draw_buf_width_to_stride(image.w, _color_format);
+    _px_y = image.y;
+
+    _display.load_image_render(image, _display.get_memory_address(), IT8951_ROTATE_0, _pixel_format, render_band,
+                               this);
+
+    add_area(image);
+}
+
+void IT8951Lvgl::render_band(const IT8951Area& band, uint8_t* buffer, size_t stride, void* user_data) {
+    const auto self = (IT8951Lvgl*)user_data;
+
+    for (uint16_t y = 0; y < band.h; y++) {
+        auto src = self->_px_map + (band.y - self->_px_y + y) * self->_px_stride;
+        const auto row = buffer + y * stride;
+
+        if (self->_bytes_per_pixel > 1) {
+            src = self->get_gray_row(src, band.w);
+        }
+
+        const auto len = self->_converter.convert(src, row, band.w);
+
+        if (len < stride) {
+            row[len] = 0xff;
+        }
+    }
+}
+
+const uint8_t* IT8951Lvgl::get_gray_row(const uint8_t* src, uint16_t width) {
+    // ITU-R BT.601 luma in 8 bit fixed point. The 24 and 32 bit formats are
+    // stored blue first.
+
+    const auto gray = _gray.get();
+
+    if (_bytes_per_pixel == 2) {
+        for (uint16_t x = 0; x < width; x++) {
+            uint16_t color;
+            memcpy(&color, src + x * 2, sizeof(color));
+
+            const auto r = (color >> 11) & 0x1f;
+            const auto g = (color >> 5) & 0x3f;
+            const auto b = color & 0x1f;
+
+            gray[x] = ((r << 3 | r >> 2) * 77 + (g << 2 | g >> 4) * 150 + (b << 3 | b >> 2) * 29) >> 8;
+        }
+    } else {
+        const auto step = _bytes_per_pixel;
+
+        for (uint16_t x = 0; x < width; x++, src += step) {
+            gray[x] = (src[2] * 77 + src[1] * 150 + src[0] * 29) >> 8;
+        }
+    }
+
+    return gray;
+}
+
+void IT8951Lvgl::add_area(const IT8951Area& area) {
+    // Bands of the same invalidated area are joined again, so the area is
+    // refreshed in one go.
+
+    if (_area_count) {
+        auto& last = _areas[_area_count - 1];
+
+        if (last.x == area.x && last.w == area.w && last.y + last.h == area.y) {
+            last.h += area.h;
+            return;
+        }
+    }
+
+    if (_area_count == IT8951_LVGL_MAX_AREAS) {
+        _areas[_area_count - 1] = area_union(_areas[_area_count - 1], area);
+        return;
+    }
+
+    _areas[_area_count++] = area;
+}
+
+void IT8951Lvgl::show_areas() {
+    for (size_t i = 0; i < _area_count; i++) {
+        _display.display_area(_areas[i], _display.get_memory_address(), _pixel_format, _mode);
+    }
+
+    _area_count = 0;
+}
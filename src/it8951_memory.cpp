@@ -0,0 +1,243 @@
+#include "it8951_memory.h"
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "support.h"
+
+static const char* TAG = "IT8951";
+
+// Alignment of image slots in the controller memory.
+#define IT8951_SLOT_ALIGN 4
+
+IT8951MemoryAllocator::IT8951MemoryAllocator(IT8951& display)
+    : IT8951MemoryAllocator(display.get_memory_address() + uint32_t(display.get_width()) * display.get_height(),
+                            CONFIG_IT8951_MEMORY_SIZE, display.get_width()) {}
+
+IT8951MemoryAllocator::IT8951MemoryAllocator(uint32_t start, uint32_t end, uint16_t pitch)
+    : _start((start + IT8951_SLOT_ALIGN - 1) & ~(IT8951_SLOT_ALIGN - 1)), _end(end), _pitch(pitch) {
+    ESP_ERROR_ASSERT(pitch > 0);
+
+    if (_start >= _end) {
+        ESP_LOGW(TAG, "No controller memory available for image slots");
+        _end = _start;
+    }
+}
+
+int IT8951MemoryAllocator::allocate(const IT8951Area& area, it8951_pixel_format_t pixel_format) {
+    ESP_ERROR_ASSERT(area.w > 0 && area.h > 0);
+
+    const uint32_t size = (uint32_t(area.h) * _pitch + IT8951_SLOT_ALIGN - 1) & ~(IT8951_SLOT_ALIGN - 1);
+
+    int free_slot = IT8951_INVALID_SLOT;
+
+    for (int i = 0; i < IT8951_MAX_SLOTS; i++) {
+        if (!_slots[i].used) {
+            free_slot = i;
+            break;
+        }
+    }
+
+    if (free_slot == IT8951_INVALID_SLOT) {
+        return IT8951_INVALID_SLOT;
+    }
+
+    // First fit. Free space starts at the start of the memory or right
+    // after an allocated slot.
+
+    uint32_t start = _start;
+
+    if (!is_free(start, size)) {
+        start = _end;
+
+        for (const auto& slot : _slots) {
+            const auto candidate = slot.start + slot.size;
+
+            if (slot.used && candidate < start && is_free(candidate, size)) {
+                start = candidate;
+            }
+        }
+
+        if (start == _end) {
+            return IT8951_INVALID_SLOT;
+        }
+    }
+
+    _slots[free_slot] = {
+        .used = true,
+        .start = start,
+        .size = size,
+        .area = area,
+        .pixel_format = pixel_format,
+    };
+
+    return free_slot;
+}
+
+void IT8951MemoryAllocator::free(int slot) {
+    ESP_ERROR_ASSERT(slot >= 0 && slot < IT8951_MAX_SLOTS && _slots[slot].used);
+
+    _slots[slot].used = false;
+}
+
+uint32_t IT8951MemoryAllocator::get_address(int slot) {
+    ESP_ERROR_ASSERT(slot >= 0 && slot < IT8951_MAX_SLOTS && _slots[slot].used);
+
+    // The controller addresses the image by its coordinates, so the first
+    // row of the area must end up at the start of the slot.
+
+    return _slots[slot].start - uint32_t(_slots[slot].area.y) * _pitch;
+}
+
+const IT8951Area& IT8951MemoryAllocator::get_area(int slot) {
+    ESP_ERROR_ASSERT(slot >= 0 && slot < IT8951_MAX_SLOTS && _slots[slot].used);
+
+    return _slots[slot].area;
+}
+
+it8951_pixel_format_t IT8951MemoryAllocator::get_pixel_format(int slot) {
+    ESP_ERROR_ASSERT(slot >= 0 && slot < IT8951_MAX_SLOTS && _slots[slot].used);
+
+    return _slots[slot].pixel_format;
+}
+
+size_t IT8951MemoryAllocator::get_free_size() {
+    size_t size = _end - _start;
+
+    for (const auto& slot : _slots) {
+        if (slot.used) {
+            size -= slot.size;
+        }
+    }
+
+    return size;
+}
+
+bool IT8951MemoryAllocator::is_free(uint32_t start, uint32_t size) {
+    if (start < _start || start + size > _end) {
+        return false;
+    }
+
+    for (const auto& slot : _slots) {
+        if (slot.used && start < slot.start + slot.size && slot.start < start + size) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+IT8951FrameCache::IT8951FrameCache(IT8951& display, IT8951MemoryAllocator& allocator)
+    : _display(display), _allocator(allocator) {}
+
+bool IT8951FrameCache::contains(uint32_t id) {
+    const auto entry = find(id);
+
+    return entry && entry != _loading;
+}
+
+bool IT8951FrameCache::load_start(uint32_t id, IT8951Area& area, it8951_rotate_t rotate,
+                                  it8951_pixel_format_t pixel_format) {
+    ESP_ERROR_ASSERT(!_loading);
+
+    remove(id);
+
+    int slot;
+
+    while ((slot = _allocator.allocate(area, pixel_format)) == IT8951_INVALID_SLOT) {
+        if (!evict()) {
+            ESP_LOGW(TAG, "Image of %dx%d doesn't fit in the controller memory", area.w, area.h);
+            return false;
+        }
+    }
+
+    _loading = &_entries[_entry_count++];
+    *_loading = {
+        .id = id,
+        .slot = slot,
+        .last_used = ++_clock,
+    };
+
+    // Loading waits for refreshes that still show an evicted image.
+
+    _display.load_image_start(area, _allocator.get_address(slot), rotate, pixel_format);
+
+    return true;
+}
+
+void IT8951FrameCache::load_end() {
+    ESP_ERROR_ASSERT(_loading);
+
+    _display.load_image_end();
+
+    _loading = nullptr;
+}
+
+bool IT8951FrameCache::show(uint32_t id, it8951_display_mode_t mode) {
+    auto entry = find(id);
+
+    if (!entry || entry == _loading) {
+        return false;
+    }
+
+    entry->last_used = ++_clock;
+
+    auto area = _allocator.get_area(entry->slot);
+
+    _display.display_area(area, _allocator.get_address(entry->slot), _allocator.get_pixel_format(entry->slot), mode);
+
+    return true;
+}
+
+void IT8951FrameCache::remove(uint32_t id) {
+    ESP_ERROR_ASSERT(!_loading);
+
+    auto entry = find(id);
+
+    if (!entry) {
+        return;
+    }
+
+    _allocator.free(entry->slot);
+
+    *entry = _entries[--_entry_count];
+}
+
+void IT8951FrameCache::clear() {
+    ESP_ERROR_ASSERT(!_loading);
+
+    for (size_t i = 0; i < _entry_count; i++) {
+        _allocator.free(_entries[i].slot);
+    }
+
+    _entry_count = 0;
+}
+
+IT8951FrameCache::Entry* IT8951FrameCache::find(uint32_t id) {
+    for (size_t i = 0; i < _entry_count; i++) {
+        if (_entries[i].id == id) {
+            return &_entries[i];
+        }
+    }
+
+    return nullptr;
+}
+
+bool IT8951FrameCache::evict() {
+    Entry* oldest = nullptr;
+
+    for (size_t i = 0; i < _entry_count; i++) {
+        if (!oldest || _entries[i].last_used < oldest->last_used) {
+            oldest = &_entries[i];
+        }
+    }
+
+    if (!oldest) {
+        return false;
+    }
+
+    _allocator.free(oldest->slot);
+
+    *oldest = _entries[--_entry_count];
+
+    return true;
+}
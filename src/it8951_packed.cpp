@@ -0,0 +1,171 @@
+#include "it8951_packed.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_log.h"
+
+static const char* TAG = "IT8951";
+
+// Images are padded to this, so the headers that follow are aligned.
+#define IT8951_PACKED_IMAGE_ALIGN 4
+// Longest run of a PackBits control byte.
+#define IT8951_MAX_RUN 128
+
+size_t IT8951PackedImages::get_count() {
+    size_t count = 0;
+
+    for (auto image = first(); image; image = next(image)) {
+        count++;
+    }
+
+    return count;
+}
+
+const IT8951PackedImageHeader* IT8951PackedImages::next(const IT8951PackedImageHeader* image) {
+    const auto size = sizeof(IT8951PackedImageHeader) + image->data_size;
+    const auto padded_size = (size + IT8951_PACKED_IMAGE_ALIGN - 1) & ~size_t(IT8951_PACKED_IMAGE_ALIGN - 1);
+
+    return get((const uint8_t*)image + padded_size);
+}
+
+const IT8951PackedImageHeader* IT8951PackedImages::find(const char* name) {
+    for (auto image = first(); image; image = next(image)) {
+        if (!strncmp(image->name, name, IT8951_PACKED_IMAGE_NAME_LEN)) {
+            return image;
+        }
+    }
+
+    return nullptr;
+}
+
+IT8951Area IT8951PackedImages::get_area(const IT8951PackedImageHeader* image) {
+    return {
+        .x = image->x,
+        .y = image->y,
+        .w = image->w,
+        .h = image->h,
+    };
+}
+
+const IT8951PackedImageHeader* IT8951PackedImages::get(const uint8_t* data) {
+    // Anything that isn't a complete image ends the images, like the erased
+    // flash after the last one.
+
+    const auto available = _size - std::min(_size, size_t(data - _data));
+
+    if (available < sizeof(IT8951PackedImageHeader)) {
+        return nullptr;
+    }
+
+    const auto image = (const IT8951PackedImageHeader*)data;
+
+    if (image->magic != IT8951_PACKED_IMAGE_MAGIC || image->version != IT8951_PACKED_IMAGE_VERSION ||
+        image->data_size > available - sizeof(IT8951PackedImageHeader) || !image->w || !image->h ||
+        image->pixel_format > IT8951_PIXEL_FORMAT_8BPP ||
+        image->stride != IT8951::get_stride(image->w, get_pixel_format(image))) {
+        return nullptr;
+    }
+
+    if (!(image->flags & IT8951_PACKED_IMAGE_RLE) && image->data_size != image->stride * image->h) {
+        return nullptr;
+    }
+
+    return image;
+}
+
+bool IT8951PackedImages::load(IT8951& display, const IT8951PackedImageHeader* image,
+                              uint32_t target_memory_address) {
+    auto area = get_area(image);
+    auto intact = true;
+
+    _copied_bytes = 0;
+
+    display.load_image_start(area, target_memory_address, IT8951_ROTATE_0, get_pixel_format(image));
+
+    const auto data = (const uint8_t*)(image + 1);
+
+    if (image->flags & IT8951_PACKED_IMAGE_RLE) {
+        intact = load_rle(display, image);
+    } else if (_dma_capable) {
+        display.load_image_write_direct(data, image->data_size);
+    } else {
+        display.load_image_write(data, image->data_size);
+        _copied_bytes = image->data_size;
+    }
+
+    display.load_image_end();
+
+    return intact;
+}
+
+bool IT8951PackedImages::load_rle(IT8951& display, const IT8951PackedImageHeader* image) {
+    // Runs are decoded straight into the SPI buffers. Every row must decode
+    // to exactly a stride; rows that don't are replaced by zeros, so the
+    // controller still gets the whole image.
+
+    auto data = (const uint8_t*)(image + 1);
+    const auto end = data + image->data_size;
+    uint8_t run[IT8951_MAX_RUN];
+    auto intact = true;
+
+    for (uint16_t y = 0; y < image->h; y++) {
+        size_t row_len = 0;
+
+        while (row_len < image->stride && intact) {
+            if (data == end) {
+                intact = false;
+                break;
+            }
+
+            const auto control = *data++;
+            size_t len;
+
+            if (control < 128) {
+                len = control + 1;
+
+                if (size_t(end - data) < len || row_len + len > image->stride) {
+                    intact = false;
+                    break;
+                }
+
+                display.load_image_write(data, len);
+                data += len;
+            } else if (control > 128) {
+                len = 257 - control;
+
+                if (data == end || row_len + len > image->stride) {
+                    intact = false;
+                    break;
+                }
+
+                memset(run, *data++, len);
+                display.load_image_write(run, len);
+            } else {
+                continue;
+            }
+
+            row_len += len;
+            _copied_bytes += len;
+        }
+
+        // Zero the rest of a row that didn't decode, and the rows after it.
+
+        if (row_len < image->stride) {
+            memset(run, 0, sizeof(run));
+
+            for (auto left = image->stride - row_len; left;) {
+                const auto len = std::min(left, sizeof(run));
+
+                display.load_image_write(run, len);
+                left -= len;
+            }
+        }
+    }
+
+    if (!intact) {
+        ESP_LOGE(TAG, "Packed image %.16s is corrupt", image->name);
+    }
+
+    return intact;
+}
@@ -0,0 +1,47 @@
+#include "it8951_partition.h"
+
+#include "esp_log.h"
+#include "esp_memory_utils.h"
+
+static const char* TAG = "IT8951";
+
+bool IT8951PartitionImages::open(const char* label) {
+    close();
+
+    const auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+
+    if (!partition) {
+        ESP_LOGE(TAG, "Partition %s not found", label);
+        return false;
+    }
+
+    const void* data;
+    const auto err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &data, &_handle);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map partition %s: %s", label, esp_err_to_name(err));
+        return false;
+    }
+
+    _data = (const uint8_t*)data;
+    _size = partition->size;
+
+    // Whether the SPI DMA can read mapped flash depends on the chip; where it
+    // can't, images are copied into the transfer buffers instead.
+
+    _dma_capable = esp_ptr_dma_capable(data);
+
+    ESP_LOGI(TAG, "Mapped partition %s, %u bytes, %sDMA capable", label, (unsigned)_size, _dma_capable ? "" : "not ");
+
+    return true;
+}
+
+void IT8951PartitionImages::close() {
+    if (_data) {
+        esp_partition_munmap(_handle);
+    }
+
+    _data = nullptr;
+    _size = 0;
+    _dma_capable = false;
+}
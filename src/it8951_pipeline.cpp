@@ -0,0 +1,205 @@
+#include "it8951_pipeline.h"
+
+#include <algorithm>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "support.h"
+
+static const char* TAG = "IT8951";
+
+IT8951Pipeline::~IT8951Pipeline() { stop(); }
+
+void IT8951Pipeline::start(int core, UBaseType_t priority, uint32_t stack_size) {
+    ESP_ERROR_ASSERT(!_producer);
+
+    ESP_LOGI(TAG, "Starting producer task on core %d", core);
+
+    _stopping = false;
+
+    const auto result = xTaskCreatePinnedToCore(task, "it8951_producer", stack_size, this, priority, &_producer,
+                                                core < 0 ? tskNO_AFFINITY : core);
+
+    ESP_ERROR_ASSERT(result == pdPASS);
+}
+
+void IT8951Pipeline::stop() {
+    if (!_producer) {
+        return;
+    }
+
+    _consumer = xTaskGetCurrentTaskHandle();
+    _stopping.store(true);
+
+    xTaskNotifyGive(_producer);
+
+    while (_stopping.load()) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+
+    _producer = nullptr;
+}
+
+void IT8951Pipeline::upload(IT8951Area& area, uint32_t target_memory_address, it8951_rotate_t rotate,
+                            it8951_pixel_format_t pixel_format, it8951_render_cb_t render, void* user_data) {
+    ESP_ERROR_ASSERT(_producer);
+
+    const auto buffer_count = _display.get_buffer_count();
+    const auto stride = IT8951::get_stride(area.w, pixel_format);
+
+    ESP_ERROR_ASSERT(buffer_count <= IT8951_MAX_PIPELINE_BUFFERS);
+    ESP_ERROR_ASSERT(stride <= _display.get_buffer_len());
+
+    const auto start_us = esp_timer_get_time();
+
+    _display.load_image_start(area, target_memory_address, rotate, pixel_format);
+
+    // The slots follow the driver's ring, so the buffer the producer fills
+    // is the one the driver transfers next.
+
+    for (size_t i = 0; i < buffer_count; i++) {
+        _slots[i] = _display.get_buffer(i);
+    }
+
+    _area = area;
+    _stride = stride;
+    _rows = uint16_t(std::min<size_t>(_display.get_buffer_len() / stride, area.h));
+    _bands = (area.h + _rows - 1) / _rows;
+    _render = render;
+    _user_data = user_data;
+    _consumer = xTaskGetCurrentTaskHandle();
+    _stats = {.bands = _bands};
+
+    _produced.store(0);
+    _released.store(0);
+    _producing.store(true, std::memory_order_release);
+
+    xTaskNotifyGive(_producer);
+
+    consume();
+
+    // The producer may still be publishing the last band.
+
+    while (_producing.load(std::memory_order_acquire)) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    }
+
+    _display.load_image_end();
+
+    _stats.total_us = esp_timer_get_time() - start_us;
+}
+
+void IT8951Pipeline::task(void* arg) {
+    ((IT8951Pipeline*)arg)->run();
+
+    vTaskDelete(nullptr);
+}
+
+void IT8951Pipeline::run() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        if (_stopping.load()) {
+            break;
+        }
+
+        if (_producing.load(std::memory_order_acquire)) {
+            produce();
+        }
+    }
+
+    _stopping.store(false);
+
+    xTaskNotifyGive(_consumer);
+}
+
+void IT8951Pipeline::produce() {
+    const auto buffer_count = _display.get_buffer_count();
+    int64_t render_us = 0;
+    int64_t stall_us = 0;
+
+    for (uint32_t band_index = 0; band_index < _bands; band_index++) {
+        // A slot is free once the consumer has released the buffer that was
+        // rendered into it a full ring ago.
+
+        if (band_index - _released.load(std::memory_order_acquire) >= buffer_count) {
+            const auto stall_start_us = esp_timer_get_time();
+
+            while (band_index - _released.load(std::memory_order_acquire) >= buffer_count) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            }
+
+            stall_us += esp_timer_get_time() - stall_start_us;
+        }
+
+        const auto y = uint16_t(band_index * _rows);
+        const IT8951Area band = {
+            .x = _area.x,
+            .y = uint16_t(_area.y + y),
+            .w = _area.w,
+            .h = std::min<uint16_t>(_rows, _area.h - y),
+        };
+        const auto slot = band_index % buffer_count;
+
+        const auto render_start_us = esp_timer_get_time();
+
+        _render(band, _slots[slot], _stride, _user_data);
+
+        render_us += esp_timer_get_time() - render_start_us;
+
+        _lengths[slot] = band.h * _stride;
+        _produced.store(band_index + 1, std::memory_order_release);
+
+        xTaskNotifyGive(_consumer);
+    }
+
+    // The consumer reads the timings once it sees the producer is done.
+
+    _stats.render_us = render_us;
+    _stats.producer_stall_us = stall_us;
+
+    _producing.store(false, std::memory_order_release);
+
+    xTaskNotifyGive(_consumer);
+}
+
+void IT8951Pipeline::consume() {
+    const auto buffer_count = _display.get_buffer_count();
+    uint32_t queued = 0;
+    uint32_t released = 0;
+    int64_t stall_us = 0;
+
+    while (queued < _bands) {
+        // Transfers are queued first, so the bus stays busy.
+
+        if (queued < _produced.load(std::memory_order_acquire)) {
+            _display.load_image_flush_buffer(_lengths[queued % buffer_count], false);
+            queued++;
+            continue;
+        }
+
+        if (queued == released) {
+            // Nothing's being transferred, so the bus waits for the producer.
+
+            const auto stall_start_us = esp_timer_get_time();
+
+            while (queued == _produced.load(std::memory_order_acquire)) {
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            }
+
+            stall_us += esp_timer_get_time() - stall_start_us;
+            continue;
+        }
+
+        // Wait for the oldest transfer when the producer is still rendering,
+        // and hand its buffer back.
+
+        _display.load_image_release_buffer(true);
+
+        _released.store(++released, std::memory_order_release);
+
+        xTaskNotifyGive(_producer);
+    }
+
+    _stats.consumer_stall_us = stall_us;
+}
@@ -0,0 +1,267 @@
+#include "it8951_power.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+// Activity after a gap of at least this long starts a new update.
+#define IT8951_UPDATE_GAP_US (100 * 1000)
+// Number of intervals between updates that have to match before updates are predicted.
+#define IT8951_STABLE_PERIODS 2
+// Factor by which the idle time before a mode grows at most.
+#define IT8951_MAX_IDLE_FACTOR 16
+
+IT8951PowerManager::IT8951PowerManager(IT8951& display, uint32_t target_memory_address,
+                                       it8951_pixel_format_t pixel_format)
+    : _display(display), _memory_address(target_memory_address), _pixel_format(pixel_format) {
+    _last_stats = display.get_power_stats();
+    _last_activity_us = display.get_last_activity_us();
+    _last_update_us = _last_activity_us;
+    _last_poll_us = display.get_time_us();
+}
+
+void IT8951PowerManager::set_idle_times(uint32_t standby_after_ms, uint32_t sleep_after_ms) {
+    _base_idle_ms[IT8951_POWER_STATE_STANDBY] = _idle_ms[IT8951_POWER_STATE_STANDBY] = standby_after_ms;
+    _base_idle_ms[IT8951_POWER_STATE_SLEEP] = _idle_ms[IT8951_POWER_STATE_SLEEP] = sleep_after_ms;
+}
+
+void IT8951PowerManager::poll() {
+    const auto now = _display.get_time_us();
+
+    _poll_interval_us = now - _last_poll_us;
+    _last_poll_us = now;
+
+    observe();
+    observe_activity();
+
+    const auto power_state = _display.get_power_state();
+
+    if (power_state == IT8951_POWER_STATE_RUN && _repaint_pending) {
+        IT8951Area area = {.x = 0, .y = 0, .w = _display.get_width(), .h = _display.get_height()};
+
+        if (!_display.is_display_blocked(area, _pixel_format)) {
+            _display.display_area(area, _memory_address, _pixel_format, IT8951_DISPLAY_MODE_GC16);
+
+            _repaint_pending = false;
+            _repaints++;
+
+            // The repaint isn't an update of the application.
+
+            _last_activity_us = _display.get_last_activity_us();
+            _repainted = true;
+        }
+        return;
+    }
+
+    // Stay awake until the predicted update arrives, or shortly after it was
+    // expected.
+
+    if (_last_update_us == _predicted_for_us && now < _hold_until_us) {
+        return;
+    }
+
+    // Wake up ahead of a predicted update, so it doesn't wait for the
+    // controller or the repaint. Once per update. The next poll may come too
+    // late, so this looks two polls ahead.
+
+    if (power_state != IT8951_POWER_STATE_RUN && _predicted_for_us != _last_update_us &&
+        is_update_expected(now, get_wake_cost_us(power_state) + 2 * _poll_interval_us)) {
+        _display.set_system_run();
+
+        _predicted_for_us = _last_update_us;
+        _predicted_wakes++;
+        _hold_until_us = _last_update_us + _period_us + _period_us / 8;
+        return;
+    }
+
+    const auto idle_us = now - _last_activity_us;
+
+    for (auto target : {IT8951_POWER_STATE_SLEEP, IT8951_POWER_STATE_STANDBY}) {
+        if (target <= power_state) {
+            break;
+        }
+
+        if (!_base_idle_ms[target] || idle_us < int64_t(_idle_ms[target]) * 1000) {
+            continue;
+        }
+
+        // Don't bother when the next update is expected before the mode pays off.
+
+        if (is_update_expected(now, get_break_even_us(target))) {
+            continue;
+        }
+
+        enter(target);
+        break;
+    }
+}
+
+void IT8951PowerManager::wake_ahead() {
+    if (_display.get_power_state() != IT8951_POWER_STATE_RUN) {
+        _display.set_system_run();
+    }
+}
+
+IT8951PowerReport IT8951PowerManager::get_report() {
+    const auto stats = _display.get_power_stats();
+    IT8951PowerReport report = {
+        .early_wakes = _early_wakes,
+        .predicted_wakes = _predicted_wakes,
+        .repaints = _repaints,
+    };
+
+    for (int i = 0; i < IT8951_POWER_STATE_COUNT; i++) {
+        const auto power_state = (it8951_power_state_t)i;
+
+        report.time_us[i] = stats.time_us[i];
+        report.energy_mj[i] = get_power_mw(power_state) * stats.time_us[i] / 1e6f;
+        report.wake_cost_us[i] = _wake_cost_us[i];
+        report.idle_after_ms[i] = _idle_ms[i];
+        report.wakes[i] = stats.wakes[i];
+    }
+
+    return report;
+}
+
+void IT8951PowerManager::observe() {
+    // The driver wakes the controller when it's used, so wakes are picked up
+    // from its statistics.
+
+    const auto stats = _display.get_power_stats();
+
+    for (auto power_state : {IT8951_POWER_STATE_STANDBY, IT8951_POWER_STATE_SLEEP}) {
+        const auto timed_wakes = stats.timed_wakes[power_state] - _last_stats.timed_wakes[power_state];
+
+        if (timed_wakes) {
+            const auto sample_us = (stats.wake_us[power_state] - _last_stats.wake_us[power_state]) / timed_wakes;
+            auto& cost_us = _wake_cost_us[power_state];
+
+            cost_us = cost_us ? (3 * cost_us + sample_us) / 4 : sample_us;
+        }
+
+        if (stats.wakes[power_state] == _last_stats.wakes[power_state]) {
+            continue;
+        }
+
+        if (_entered == power_state) {
+            // Back off when the mode didn't pay off, and return to the
+            // configured idle time when it did.
+
+            const auto residency_us = stats.time_us[power_state] - _entered_time_us;
+            auto& idle_ms = _idle_ms[power_state];
+
+            if (residency_us < get_break_even_us(power_state)) {
+                idle_ms = std::min(idle_ms * 2, _base_idle_ms[power_state] * IT8951_MAX_IDLE_FACTOR);
+                _early_wakes++;
+            } else {
+                idle_ms = std::max(idle_ms / 2, _base_idle_ms[power_state]);
+            }
+
+            _entered = IT8951_POWER_STATE_RUN;
+        }
+
+        // The controller was asleep at the previous poll, so a full screen
+        // refresh since then is the update that woke it, and it already
+        // removed the artifacts.
+
+        if (power_state == IT8951_POWER_STATE_SLEEP && _repaint_after_sleep &&
+            stats.full_refreshes == _last_stats.full_refreshes) {
+            _repaint_pending = true;
+        }
+    }
+
+    _last_stats = stats;
+}
+
+void IT8951PowerManager::observe_activity() {
+    const auto activity_us = _display.get_last_activity_us();
+
+    if (activity_us == _last_activity_us) {
+        return;
+    }
+
+    // Only the start of an update counts for the interval between updates.
+    // Activity right after a repaint starts one as well.
+
+    if (activity_us - _last_activity_us >= IT8951_UPDATE_GAP_US || _repainted) {
+        const auto interval_us = activity_us - _last_update_us;
+
+        if (_period_us && std::abs(interval_us - _period_us) <= _period_us / 8) {
+            _stable_periods++;
+        } else {
+            _stable_periods = 0;
+        }
+
+        _period_us = interval_us;
+        _last_update_us = activity_us;
+    }
+
+    _last_activity_us = activity_us;
+    _repainted = false;
+}
+
+void IT8951PowerManager::enter(it8951_power_state_t power_state) {
+    // Entering a mode waits for refreshes to complete, which only happens
+    // when the controller is idle.
+
+    if (_display.is_refreshing()) {
+        return;
+    }
+
+    if (power_state == IT8951_POWER_STATE_STANDBY) {
+        _display.set_standby();
+    } else {
+        _display.set_sleep();
+    }
+
+    _entered = power_state;
+    _entered_time_us = _display.get_power_stats().time_us[power_state];
+    _last_stats = _display.get_power_stats();
+}
+
+bool IT8951PowerManager::is_update_expected(int64_t now, int64_t within_us) {
+    // An update that's well overdue isn't expected anymore.
+
+    const auto until_us = _last_update_us + _period_us - now;
+
+    return _stable_periods >= IT8951_STABLE_PERIODS && until_us <= within_us && until_us > -_period_us / 8;
+}
+
+int64_t IT8951PowerManager::get_wake_cost_us(it8951_power_state_t power_state) {
+    // Waking from sleep mode includes the repaint, which takes about as long
+    // as the GC16 refreshes so far.
+
+    auto cost_us = _wake_cost_us[power_state];
+
+    if (power_state == IT8951_POWER_STATE_SLEEP && _repaint_after_sleep) {
+        const auto& gc16 = _display.get_perf_counters().modes[IT8951_DISPLAY_MODE_GC16];
+
+        if (gc16.timed_refreshes) {
+            cost_us += gc16.total_us / gc16.timed_refreshes;
+        }
+    }
+
+    return cost_us;
+}
+
+int64_t IT8951PowerManager::get_break_even_us(it8951_power_state_t power_state) {
+    // The energy saved in the mode has to make up for running while waking up.
+
+    const auto saved_mw = _model.run_mw - get_power_mw(power_state);
+
+    if (saved_mw <= 0) {
+        return INT64_MAX;
+    }
+
+    return int64_t(get_wake_cost_us(power_state) * _model.run_mw / saved_mw);
+}
+
+float IT8951PowerManager::get_power_mw(it8951_power_state_t power_state) {
+    switch (power_state) {
+        case IT8951_POWER_STATE_STANDBY:
+            return _model.standby_mw;
+        case IT8951_POWER_STATE_SLEEP:
+            return _model.sleep_mw;
+        default:
+            return _model.run_mw;
+    }
+}
@@ -0,0 +1,153 @@
+#include "it8951_scheduler.h"
+
+#include <algorithm>
+
+static bool areas_overlap(const IT8951Area& a, const IT8951Area& b) {
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+static IT8951Area area_union(const IT8951Area& a, const IT8951Area& b) {
+    const auto x = std::min(a.x, b.x);
+    const auto y = std::min(a.y, b.y);
+
+    return {
+        .x = x,
+        .y = y,
+        .w = uint16_t(std::max(a.x + a.w, b.x + b.w) - x),
+        .h = uint16_t(std::max(a.y + a.h, b.y + b.h) - y),
+    };
+}
+
+// Orders the display modes by the gray levels they show, so merged updates
+// show the content of all of them correctly.
+static int get_mode_rank(it8951_display_mode_t mode) {
+    switch (mode) {
+        case IT8951_DISPLAY_MODE_A2:
+            return 0;
+        case IT8951_DISPLAY_MODE_DU:
+            return 1;
+        case IT8951_DISPLAY_MODE_DU4:
+            return 2;
+        case IT8951_DISPLAY_MODE_GL16:
+            return 3;
+        case IT8951_DISPLAY_MODE_GLR16:
+        case IT8951_DISPLAY_MODE_GLD16:
+            return 4;
+        case IT8951_DISPLAY_MODE_GC16:
+            return 5;
+        default:
+            return 6;
+    }
+}
+
+void IT8951UpdateScheduler::submit(const IT8951Area& area, uint32_t target_memory_address,
+                                   it8951_pixel_format_t pixel_format, it8951_display_mode_t mode) {
+    // A refresh shows what's in the controller memory when it starts, so a
+    // queued update of the same image shows this update as well. It mustn't
+    // overlap updates queued after it though, as those would then show their
+    // older content over this update.
+
+    for (size_t i = 0; i < _count; i++) {
+        auto& update = _updates[i];
+
+        if (update.memory_address != target_memory_address || update.pixel_format != pixel_format ||
+            !areas_overlap(update.area, area)) {
+            continue;
+        }
+
+        const auto merged = area_union(update.area, area);
+
+        if (is_queued_after(i, merged)) {
+            continue;
+        }
+
+        update.area = merged;
+
+        if (get_mode_rank(mode) > get_mode_rank(update.mode)) {
+            update.mode = mode;
+        }
+
+        _stats.coalesced++;
+        return;
+    }
+
+    if (!is_queued_before(_count, area) && !_display.is_display_blocked(area, pixel_format)) {
+        IT8951Area display_area = area;
+
+        _display.display_area(display_area, target_memory_address, pixel_format, mode);
+
+        _stats.started++;
+        return;
+    }
+
+    if (_count == IT8951_MAX_QUEUED_UPDATES) {
+        start(0);
+        _stats.dequeued++;
+    }
+
+    _updates[_count++] = {
+        .area = area,
+        .memory_address = target_memory_address,
+        .pixel_format = pixel_format,
+        .mode = mode,
+    };
+
+    _stats.queued++;
+}
+
+size_t IT8951UpdateScheduler::poll() {
+    size_t started = 0;
+
+    for (size_t i = 0; i < _count;) {
+        const auto& update = _updates[i];
+
+        if (!is_queued_before(i, update.area) && !_display.is_display_blocked(update.area, update.pixel_format)) {
+            start(i);
+            started++;
+        } else {
+            i++;
+        }
+    }
+
+    _stats.dequeued += started;
+
+    return started;
+}
+
+void IT8951UpdateScheduler::flush() {
+    while (_count) {
+        start(0);
+        _stats.dequeued++;
+    }
+}
+
+bool IT8951UpdateScheduler::is_queued_before(size_t index, const IT8951Area& area) {
+    // Updates of the same part of the screen start in the order they were submitted.
+
+    for (size_t i = 0; i < index; i++) {
+        if (areas_overlap(_updates[i].area, area)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool IT8951UpdateScheduler::is_queued_after(size_t index, const IT8951Area& area) {
+    for (size_t i = index + 1; i < _count; i++) {
+        if (areas_overlap(_updates[i].area, area)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void IT8951UpdateScheduler::start(size_t index) {
+    auto update = _updates[index];
+
+    std::copy(_updates + index + 1, _updates + _count, _updates + index);
+    _count--;
+
+    _display.display_area(update.area, update.memory_address, update.pixel_format, update.mode);
+}
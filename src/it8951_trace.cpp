@@ -0,0 +1,30 @@
+#include "it8951_trace.h"
+
+#include <algorithm>
+
+#include "support.h"
+
+IT8951TraceRing::IT8951TraceRing(size_t capacity) : _capacity(capacity) {
+    ESP_ERROR_ASSERT(capacity > 0);
+
+    _events.reset(new IT8951TraceEvent[capacity]);
+}
+
+size_t IT8951TraceRing::read(IT8951TraceEvent* events, size_t max_count) {
+    const auto count = std::min(max_count, _count);
+
+    for (size_t i = 0; i < count; i++) {
+        events[i] = _events[(_first + i) % _capacity];
+    }
+
+    _first = (_first + count) % _capacity;
+    _count -= count;
+
+    return count;
+}
+
+void IT8951TraceRing::clear() {
+    _first = 0;
+    _count = 0;
+    _dropped = 0;
+}
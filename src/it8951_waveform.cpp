@@ -0,0 +1,179 @@
+#include "it8951_waveform.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "support.h"
+
+// Gray levels of the content each display mode shows correctly.
+#define IT8951_LEVELS_BLACK_AND_WHITE (1 << 0 | 1 << 15)
+#define IT8951_LEVELS_DU4 (1 << 0 | 1 << 5 | 1 << 10 | 1 << 15)
+
+template <int Bpp>
+static inline uint8_t get_level(const uint8_t* row, size_t i) {
+    if (Bpp == 8) {
+        return row[i] >> 4;
+    }
+
+    // Levels are spread evenly over the 16 gray levels of the panel.
+
+    const auto pixels_per_byte = 8 / Bpp;
+    const auto value = row[i / pixels_per_byte] >> (8 - Bpp * (i % pixels_per_byte + 1)) & ((1 << Bpp) - 1);
+
+    return value * (15 / ((1 << Bpp) - 1));
+}
+
+IT8951WaveformSelector::IT8951WaveformSelector(IT8951& display, uint16_t tile_size)
+    : _display(display), _tile_size(tile_size) {
+    ESP_ERROR_ASSERT(tile_size > 0);
+
+    _columns = (display.get_width() + tile_size - 1) / tile_size;
+    _rows = (display.get_height() + tile_size - 1) / tile_size;
+
+    _tile_levels.reset(new uint16_t[_columns * _rows]());
+    _black_and_white.reset(new bool[_columns * _rows]());
+}
+
+void IT8951WaveformSelector::reset() {
+    std::fill_n(_black_and_white.get(), _columns * _rows, true);
+}
+
+void IT8951WaveformSelector::fill(const IT8951Area& area, uint8_t gray) {
+    const auto level = gray >> 4;
+
+    set_tiles(area, level == 0 || level == 15);
+}
+
+void IT8951WaveformSelector::invalidate(const IT8951Area& area) { set_tiles(area, false); }
+
+void IT8951WaveformSelector::scan(const IT8951Area& area, it8951_pixel_format_t pixel_format, const uint8_t* data,
+                                  size_t stride) {
+    ESP_ERROR_ASSERT(area.x + area.w <= _display.get_width() && area.y + area.h <= _display.get_height());
+
+    switch (pixel_format) {
+        case IT8951_PIXEL_FORMAT_1BPP:
+            scan_rows<1>(area, data, stride);
+            break;
+        case IT8951_PIXEL_FORMAT_2BPP:
+            scan_rows<2>(area, data, stride);
+            break;
+        case IT8951_PIXEL_FORMAT_4BPP:
+            scan_rows<4>(area, data, stride);
+            break;
+        default:
+            scan_rows<8>(area, data, stride);
+            break;
+    }
+}
+
+it8951_display_mode_t IT8951WaveformSelector::select(const IT8951Area& area) {
+    uint16_t levels = 0;
+    uint32_t pixels = 0;
+
+    for (int i = 0; i < 16; i++) {
+        if (_histogram[i]) {
+            levels |= 1 << i;
+            pixels += _histogram[i];
+        }
+    }
+
+    // A2 only drives pixels to black or white from black or white. The other
+    // modes drive pixels from any gray level.
+
+    const auto first_column = area.x / _tile_size;
+    const auto last_column = (area.x + area.w - 1) / _tile_size;
+    const auto first_row = area.y / _tile_size;
+    const auto last_row = (area.y + area.h - 1) / _tile_size;
+    auto shown_black_and_white = true;
+
+    for (int row = first_row; row <= last_row; row++) {
+        for (int column = first_column; column <= last_column; column++) {
+            shown_black_and_white &= _black_and_white[row * _columns + column];
+        }
+    }
+
+    it8951_display_mode_t mode;
+
+    if (!(levels & ~IT8951_LEVELS_BLACK_AND_WHITE)) {
+        mode = shown_black_and_white ? IT8951_DISPLAY_MODE_A2 : IT8951_DISPLAY_MODE_DU;
+    } else if (!(levels & ~IT8951_LEVELS_DU4) && _display.is_mode_supported(IT8951_DISPLAY_MODE_DU4)) {
+        mode = IT8951_DISPLAY_MODE_DU4;
+    } else if (_histogram[15] * 2 >= pixels) {
+        mode = IT8951_DISPLAY_MODE_GL16;
+    } else {
+        mode = IT8951_DISPLAY_MODE_GC16;
+    }
+
+    // Record what the tiles show. Tiles that are only partly updated keep
+    // showing gray levels if they did before.
+
+    for (int row = first_row; row <= last_row; row++) {
+        for (int column = first_column; column <= last_column; column++) {
+            const auto index = row * _columns + column;
+            const auto black_and_white = !(_tile_levels[index] & ~IT8951_LEVELS_BLACK_AND_WHITE);
+
+            _black_and_white[index] = black_and_white && (covers(area, column, row) || _black_and_white[index]);
+            _tile_levels[index] = 0;
+        }
+    }
+
+    memset(_histogram, 0, sizeof(_histogram));
+
+    return mode;
+}
+
+it8951_display_mode_t IT8951WaveformSelector::analyze(const IT8951Area& area, it8951_pixel_format_t pixel_format,
+                                                      const uint8_t* data, size_t stride) {
+    scan(area, pixel_format, data, stride);
+
+    return select(area);
+}
+
+template <int Bpp>
+void IT8951WaveformSelector::scan_rows(const IT8951Area& area, const uint8_t* data, size_t stride) {
+    for (uint16_t y = 0; y < area.h; y++) {
+        const auto row = data + y * stride;
+        const auto tile_levels = _tile_levels.get() + (area.y + y) / _tile_size * _columns;
+
+        for (int x = 0; x < area.w;) {
+            const auto column = (area.x + x) / _tile_size;
+            const auto end = std::min<int>(area.w, (column + 1) * _tile_size - area.x);
+            uint16_t levels = 0;
+
+            for (; x < end; x++) {
+                const auto level = get_level<Bpp>(row, x);
+
+                _histogram[level]++;
+                levels |= 1 << level;
+            }
+
+            tile_levels[column] |= levels;
+        }
+    }
+}
+
+void IT8951WaveformSelector::set_tiles(const IT8951Area& area, bool black_and_white) {
+    const auto first_column = area.x / _tile_size;
+    const auto last_column = (area.x + area.w - 1) / _tile_size;
+    const auto first_row = area.y / _tile_size;
+    const auto last_row = (area.y + area.h - 1) / _tile_size;
+
+    for (int row = first_row; row <= last_row; row++) {
+        for (int column = first_column; column <= last_column; column++) {
+            const auto index = row * _columns + column;
+
+            _black_and_white[index] = black_and_white && (covers(area, column, row) || _black_and_white[index]);
+        }
+    }
+}
+
+bool IT8951WaveformSelector::covers(const IT8951Area& area, int column, int row) {
+    // Tiles at the right and bottom edges of the screen may be smaller.
+
+    const auto x = column * _tile_size;
+    const auto y = row * _tile_size;
+    const auto right = std::min(x + _tile_size, int(_display.get_width()));
+    const auto bottom = std::min(y + _tile_size, int(_display.get_height()));
+
+    return x >= area.x && right <= area.x + area.w && y >= area.y && bottom <= area.y + area.h;
+}
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+#include "esp_compiler.h"
+
 #ifdef NDEBUG
 #define ESP_ERROR_ASSERT(x) \
     do {                    \